@@ -0,0 +1,6 @@
+#!/bin/bash
+# Build the replayer with optimizations and run a replay file at full speed
+DEV_FLAGS="-O2" ./cxx.sh src/space_replay.cc
+
+# Run (arguments are passed to space_replay)
+bin/space_replay "$@"
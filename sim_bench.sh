@@ -0,0 +1,6 @@
+#!/bin/bash
+# Build the headless simulation benchmark with optimizations and run it
+DEV_FLAGS="-DHEADLESS -O2" ./cxx.sh src/sim_bench.cc
+
+# Run (arguments are passed to sim_bench)
+bin/sim_bench "$@"
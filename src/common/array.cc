@@ -7,16 +7,17 @@
 //    k<type> - The storage for the type.
 //    kUsed<type> - The in-use count of the given type.
 // Methods:
-//    Use<type>() - Function to request use of a instance of type.
+//    Use<type>() - Function to request use of a instance of type. The
+//    instance is a copy of kZero<type>, padding included.
 //    Compress<type>(int idx) - Compresses the array starting at idx by moving
 //    all elements that occur after idx down one element in the array.
 #define DECLARE_ARRAY(type, max_count)             \
   constexpr uint64_t kMax##type = max_count;       \
                                                    \
-  static type k##type[max_count];                  \
+  static WORLD_LOCAL type k##type[max_count];      \
   static type kZero##type;                         \
                                                    \
-  static uint64_t kUsed##type;                     \
+  static WORLD_LOCAL uint64_t kUsed##type;         \
                                                    \
   type* Use##type()                                \
   {                                                \
@@ -24,7 +25,7 @@
     if (kUsed##type >= kMax##type) return nullptr; \
     type* t = &k##type[kUsed##type];               \
     kUsed##type += 1;                              \
-    *t = {};                                       \
+    *t = kZero##type;                              \
     return t;                                      \
   }                                                \
                                                    \
@@ -40,7 +41,7 @@
 
 #define DECLARE_ID_ARRAY(type, max_count)                                 \
   DECLARE_ARRAY(type, max_count)                                          \
-  static uint32_t kAutoIncrementId##type = 1;                             \
+  static WORLD_LOCAL uint32_t kAutoIncrementId##type = 1;                 \
                                                                           \
   type* UseId##type()                                                     \
   {                                                                       \
@@ -62,10 +63,10 @@
 #define DECLARE_2D_ARRAY(type, n, max_count)            \
   constexpr uint64_t kMax##type = max_count;            \
   constexpr uint64_t kDim##type = n;                    \
-  static type k##type[n][max_count];                    \
+  static WORLD_LOCAL type k##type[n][max_count];        \
   static type kZero##type;                              \
                                                         \
-  static uint64_t kUsed##type[n];                       \
+  static WORLD_LOCAL uint64_t kUsed##type[n];           \
                                                         \
   type* Use##type(uint64_t dim)                         \
   {                                                     \
@@ -74,7 +75,7 @@
     if (kUsed##type[dim] >= kMax##type) return nullptr; \
     type* t = &k##type[dim][kUsed##type[dim]];          \
     kUsed##type[dim] += 1;                              \
-    *t = {};                                            \
+    *t = kZero##type;                                   \
     return t;                                           \
   }                                                     \
                                                         \
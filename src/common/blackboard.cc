@@ -4,50 +4,90 @@
 #include <cstdint>
 #include <cstring>
 
-static constexpr int kMaxBlackboardItems = 16;
+static constexpr int kMaxBlackboardItems = 64;
 static constexpr int kMaxBlackboardValueSize = 64;
 
 static uint8_t kEmptyValue[kMaxBlackboardValueSize];
 
+// Value type and packed offset of each blackboard key.
+//
+// Keys are declared in ascending order with BB_ENTRY(idx, type). Each value
+// follows the previous key in Blackboard::value, at the alignment of type.
+template <int idx>
+struct BbEntry;
+
+template <>
+struct BbEntry<-1> {
+  static constexpr uint64_t kEnd = 0;
+};
+
+#define BB_ENTRY(idx, type)                                             \
+  template <>                                                           \
+  struct BbEntry<idx> {                                                 \
+    typedef type Type;                                                  \
+    static_assert(sizeof(type) <= kMaxBlackboardValueSize, "BB_ENTRY"); \
+    static constexpr uint64_t kAlign = alignof(type);                   \
+    static constexpr uint64_t kOffset =                                 \
+        (BbEntry<idx - 1>::kEnd + kAlign - 1) & ~(kAlign - 1);          \
+    static constexpr uint64_t kEnd = kOffset + sizeof(type);            \
+  }
+
+// Keys [0, count) declared with BB_ENTRY
+template <int count>
 struct Blackboard {
+  static_assert(count <= kMaxBlackboardItems, "Blackboard key count");
+
+  // A value of all zero bytes is absent, as is a removed value
+  template <int idx>
   bool
-  Set(uint64_t idx, const uint8_t* bytes, uint64_t size)
+  Set(const typename BbEntry<idx>::Type& val)
   {
-    assert(idx < kMaxBlackboardItems);
-    assert(size < kMaxBlackboardValueSize);
-    memcpy(&value[idx], bytes, size);
+    static_assert(idx < count, "Blackboard key");
+    typedef typename BbEntry<idx>::Type T;
+    if (memcmp(&val, kEmptyValue, sizeof(T)) == 0) {
+      Remove<idx>();
+      return true;
+    }
+    memcpy(&value[BbEntry<idx>::kOffset], &val, sizeof(T));
+    present |= (1ull << idx);
     return true;
   }
 
+  template <int idx>
   bool
-  Get(uint64_t idx, const uint8_t** bytes) const
+  Get(const typename BbEntry<idx>::Type** val) const
   {
-    assert(idx < kMaxBlackboardItems);
+    static_assert(idx < count, "Blackboard key");
     if (!Exists(idx)) return false;
-    *bytes = value[idx];
+    *val = (const typename BbEntry<idx>::Type*)&value[BbEntry<idx>::kOffset];
     return true;
   }
 
   bool
   Exists(uint64_t idx) const
   {
-    assert(idx < kMaxBlackboardItems);
-    return memcmp(&value[idx], &kEmptyValue, kMaxBlackboardValueSize) != 0;
+    assert(idx < count);
+    return present & (1ull << idx);
   }
 
+  // Values are zeroed so the bytes of equal blackboards are equal
+  template <int idx>
   void
-  Remove(uint64_t idx)
+  Remove()
   {
-    assert(idx < kMaxBlackboardItems);
-    memcpy(&value[idx], &kEmptyValue, kMaxBlackboardValueSize);
+    static_assert(idx < count, "Blackboard key");
+    memset(&value[BbEntry<idx>::kOffset], 0,
+           sizeof(typename BbEntry<idx>::Type));
+    present &= ~(1ull << idx);
   }
 
-  uint8_t value[kMaxBlackboardItems][kMaxBlackboardValueSize];
+  // Bit idx is set when key idx holds a value
+  uint64_t present;
+  // Rounded to the size of 'present': no padding bytes
+  ALIGNAS(8) uint8_t value[(BbEntry<count - 1>::kEnd + 7) & ~7ull];
 };
 
-#define BB_SET(bb, idx, val) \
-  bb.Set(idx, reinterpret_cast<const uint8_t*>(&val), sizeof(val))
-#define BB_GET(bb, idx, ptr) \
-  bb.Get(idx, reinterpret_cast<const uint8_t**>(&ptr))
+#define BB_SET(bb, idx, val) bb.Set<idx>(val)
+#define BB_GET(bb, idx, ptr) bb.Get<idx>(&ptr)
 #define BB_EXI(bb, idx) bb.Exists(idx)
-#define BB_REM(bb, idx) bb.Remove(idx)
+#define BB_REM(bb, idx) bb.Remove<idx>()
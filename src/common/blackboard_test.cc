@@ -0,0 +1,64 @@
+#include <cassert>
+#include <cstdio>
+
+#include "macro.h"
+
+#include "blackboard.cc"
+
+struct Position {
+  uint16_t x;
+  uint16_t y;
+  uint16_t z;
+};
+
+enum TestBbEntry {
+  kTestFlag = 0,
+  kTestPosition,
+  kTestId,
+  kTestBbEntryMax,
+};
+
+BB_ENTRY(kTestFlag, uint8_t);
+BB_ENTRY(kTestPosition, Position);
+BB_ENTRY(kTestId, uint32_t);
+
+int
+main()
+{
+  typedef Blackboard<kTestBbEntryMax> TestBlackboard;
+  static_assert(BbEntry<kTestPosition>::kOffset == 2, "aligned after flag");
+  static_assert(BbEntry<kTestId>::kOffset == 8, "aligned after position");
+  printf("sizeof(Blackboard) %lu\n", sizeof(TestBlackboard));
+
+  TestBlackboard bb = {};
+  for (int i = 0; i < kTestBbEntryMax; ++i) {
+    assert(!BB_EXI(bb, i));
+  }
+
+  Position pos = {1, 2, 3};
+  BB_SET(bb, kTestPosition, pos);
+  uint32_t id = 42;
+  BB_SET(bb, kTestId, id);
+  assert(!BB_EXI(bb, kTestFlag));
+
+  const Position* p = nullptr;
+  assert(BB_GET(bb, kTestPosition, p));
+  assert(p->x == 1 && p->y == 2 && p->z == 3);
+  const uint32_t* i = nullptr;
+  assert(BB_GET(bb, kTestId, i));
+  assert(*i == 42);
+
+  // Zero values are absent
+  id = 0;
+  BB_SET(bb, kTestId, id);
+  assert(!BB_GET(bb, kTestId, i));
+
+  // Removal restores the empty bytes
+  BB_REM(bb, kTestPosition);
+  assert(!BB_EXI(bb, kTestPosition));
+  TestBlackboard empty = {};
+  assert(memcmp(&bb, &empty, sizeof(bb)) == 0);
+
+  puts("ok");
+  return 0;
+}
@@ -1,5 +1,5 @@
-
 #include <cstdint>
+#include <cstring>
 
 void
 djb2_hash_more(const uint8_t *bytes, unsigned len, uint64_t *hash)
@@ -8,3 +8,100 @@ djb2_hash_more(const uint8_t *bytes, unsigned len, uint64_t *hash)
     *hash = (*hash << 5) + *hash + bytes[i];
   }
 }
+
+// XXH64: four independent multiply-rotate lanes over 32 byte stripes
+constexpr uint64_t kXxPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kXxPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kXxPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t kXxPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t kXxPrime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t
+xx_rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t
+xx_read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t
+xx_read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t
+xx_round(uint64_t acc, uint64_t input)
+{
+  acc += input * kXxPrime2;
+  acc = xx_rotl(acc, 31);
+  return acc * kXxPrime1;
+}
+
+inline uint64_t
+xx_merge(uint64_t acc, uint64_t lane)
+{
+  acc ^= xx_round(0, lane);
+  return acc * kXxPrime1 + kXxPrime4;
+}
+
+uint64_t
+xxhash64(const uint8_t *bytes, uint64_t len, uint64_t seed)
+{
+  const uint8_t *end = bytes + len;
+  uint64_t hash;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + kXxPrime1 + kXxPrime2;
+    uint64_t v2 = seed + kXxPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kXxPrime1;
+    const uint8_t *limit = end - 32;
+    do {
+      v1 = xx_round(v1, xx_read64(bytes));
+      v2 = xx_round(v2, xx_read64(bytes + 8));
+      v3 = xx_round(v3, xx_read64(bytes + 16));
+      v4 = xx_round(v4, xx_read64(bytes + 24));
+      bytes += 32;
+    } while (bytes <= limit);
+
+    hash = xx_rotl(v1, 1) + xx_rotl(v2, 7) + xx_rotl(v3, 12) +
+           xx_rotl(v4, 18);
+    hash = xx_merge(hash, v1);
+    hash = xx_merge(hash, v2);
+    hash = xx_merge(hash, v3);
+    hash = xx_merge(hash, v4);
+  } else {
+    hash = seed + kXxPrime5;
+  }
+
+  hash += len;
+  for (; bytes + 8 <= end; bytes += 8) {
+    hash ^= xx_round(0, xx_read64(bytes));
+    hash = xx_rotl(hash, 27) * kXxPrime1 + kXxPrime4;
+  }
+  if (bytes + 4 <= end) {
+    hash ^= xx_read32(bytes) * kXxPrime1;
+    hash = xx_rotl(hash, 23) * kXxPrime2 + kXxPrime3;
+    bytes += 4;
+  }
+  for (; bytes < end; ++bytes) {
+    hash ^= *bytes * kXxPrime5;
+    hash = xx_rotl(hash, 11) * kXxPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kXxPrime2;
+  hash ^= hash >> 29;
+  hash *= kXxPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
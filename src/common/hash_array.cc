@@ -2,71 +2,104 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 
+// Slot map of handles to array indices.
+//
+// A handle is (generation << index bits) | entry index. Each entry bumps its
+// generation when reused, so a handle to a released instance never matches
+// the entry again. Lookup is a single entry read: there is no probing.
 struct HashEntry {
+  // Handle of the live instance, kInvalidId when the entry is free
   uint32_t id;
   uint32_t array_idx;
+  // Generation of the last handle issued from this entry
+  uint32_t generation;
 };
 
-#define DECLARE_HASH_ARRAY(type, max_count)                                   \
-  constexpr uint32_t kMax##type = max_count;                                  \
-  constexpr uint32_t kMaxHash##type = (max_count * 2);                        \
-  static_assert(POWEROF2(kMaxHash##type), "kMaxHash must be a power of 2");   \
-                                                                              \
-  static uint32_t kAutoIncrementId##type = 1;                                 \
-  static uint64_t kUsed##type = 0;                                            \
-                                                                              \
-  static type k##type[max_count];                                             \
-  static HashEntry kHashEntry##type[kMaxHash##type];                          \
-  static type kZero##type;                                                    \
-                                                                              \
-  bool IsEmptyEntry##type(HashEntry entry)                                    \
-  {                                                                           \
-    return entry.id == kInvalidId || k##type[entry.array_idx].id != entry.id; \
-  }                                                                           \
-                                                                              \
-  uint32_t Hash##type(uint32_t id)                                            \
-  {                                                                           \
-    return MOD_BUCKET(id, kMaxHash##type);                                    \
-  }                                                                           \
-                                                                              \
-  uint32_t GenerateFreeId##type()                                             \
-  {                                                                           \
-    uint32_t id = kAutoIncrementId##type;                                     \
-    HashEntry* hash_entry = &kHashEntry##type[Hash##type(id)];                \
-    while (!IsEmptyEntry##type(*hash_entry)) {                                \
-      id += 1;                                                                \
-      hash_entry = &kHashEntry##type[Hash##type(id)];                         \
-    }                                                                         \
-    kAutoIncrementId##type = id;                                              \
-    return id;                                                                \
-  }                                                                           \
-                                                                              \
-  type* Use##type()                                                           \
-  {                                                                           \
-    assert(kUsed##type < max_count);                                          \
-    if (kUsed##type >= max_count) return nullptr;                             \
-    type* u = &k##type[kUsed##type++];                                        \
-    *u = {};                                                                  \
-    u->id = GenerateFreeId##type();                                           \
-    uint32_t hash = Hash##type(u->id);                                        \
-    HashEntry* hash_entry = &kHashEntry##type[hash];                          \
-    hash_entry->id = u->id;                                                   \
-    hash_entry->array_idx = kUsed##type - 1;                                  \
-    ++kAutoIncrementId##type;                                                 \
-    return u;                                                                 \
-  }                                                                           \
-                                                                              \
-  type* Find##type(uint32_t id)                                               \
-  {                                                                           \
-    uint32_t hash = Hash##type(id);                                           \
-    HashEntry* entry = &kHashEntry##type[hash];                               \
-    if (entry->id != id) return nullptr;                                      \
-    return &k##type[entry->array_idx];                                        \
-  }                                                                           \
-                                                                              \
-  void FreeHashEntry##type(uint32_t id)                                       \
-  {                                                                           \
-    uint32_t hash = Hash##type(id);                                           \
-    kHashEntry##type[hash] = {0, 0};                                          \
+constexpr uint32_t
+HashIndexBits(uint32_t max_hash)
+{
+  return max_hash <= 1 ? 0 : 1 + HashIndexBits(max_hash / 2);
+}
+
+#define DECLARE_HASH_ARRAY(type, max_count)                                  \
+  constexpr uint32_t kMax##type = max_count;                                 \
+  constexpr uint32_t kMaxHash##type = (max_count * 2);                       \
+  static_assert(POWEROF2(kMaxHash##type), "kMaxHash must be a power of 2");  \
+  constexpr uint32_t kHashBits##type = HashIndexBits(kMaxHash##type);        \
+  constexpr uint32_t kMaxGeneration##type =                                  \
+      (uint32_t)((1ull << (32 - kHashBits##type)) - 1);                      \
+                                                                             \
+  static WORLD_LOCAL uint64_t kUsed##type = 0;                               \
+                                                                             \
+  static WORLD_LOCAL type k##type[max_count];                                \
+  static WORLD_LOCAL HashEntry kHashEntry##type[kMaxHash##type];             \
+  static type kZero##type;                                                   \
+  /* Released entries, reused before the untouched entries */                \
+  static WORLD_LOCAL uint32_t kFreeHash##type[kMaxHash##type];               \
+  static WORLD_LOCAL uint32_t kUsedFreeHash##type = 0;                       \
+  static WORLD_LOCAL uint32_t kUsedHash##type = 0;                           \
+                                                                             \
+  uint32_t Hash##type(uint32_t id)                                           \
+  {                                                                          \
+    return MOD_BUCKET(id, kMaxHash##type);                                   \
+  }                                                                          \
+                                                                             \
+  uint32_t GenerateFreeId##type()                                            \
+  {                                                                          \
+    uint32_t idx;                                                            \
+    if (kUsedFreeHash##type) {                                               \
+      idx = kFreeHash##type[--kUsedFreeHash##type];                          \
+    } else {                                                                 \
+      assert(kUsedHash##type < kMaxHash##type);                              \
+      idx = kUsedHash##type++;                                               \
+    }                                                                        \
+    HashEntry* hash_entry = &kHashEntry##type[idx];                          \
+    /* Generation 0 is skipped: handles are never kInvalidId */              \
+    uint32_t generation = hash_entry->generation + 1;                        \
+    if (generation > kMaxGeneration##type) generation = 1;                   \
+    hash_entry->generation = generation;                                     \
+    return (generation << kHashBits##type) | idx;                            \
+  }                                                                          \
+                                                                             \
+  type* Use##type()                                                          \
+  {                                                                          \
+    assert(kUsed##type < max_count);                                         \
+    if (kUsed##type >= max_count) return nullptr;                            \
+    type* u = &k##type[kUsed##type++];                                       \
+    *u = kZero##type;                                                        \
+    u->id = GenerateFreeId##type();                                          \
+    HashEntry* hash_entry = &kHashEntry##type[Hash##type(u->id)];            \
+    hash_entry->id = u->id;                                                  \
+    hash_entry->array_idx = kUsed##type - 1;                                 \
+    return u;                                                                \
+  }                                                                          \
+                                                                             \
+  type* Find##type(uint32_t id)                                              \
+  {                                                                          \
+    if (id == kInvalidId) return nullptr;                                    \
+    HashEntry* entry = &kHashEntry##type[Hash##type(id)];                    \
+    if (entry->id != id) return nullptr;                                     \
+    return &k##type[entry->array_idx];                                       \
+  }                                                                          \
+                                                                             \
+  /* Stale handles are ignored: the entry may belong to a newer instance */  \
+  void FreeHashEntry##type(uint32_t id)                                      \
+  {                                                                          \
+    if (id == kInvalidId) return;                                            \
+    uint32_t idx = Hash##type(id);                                           \
+    HashEntry* entry = &kHashEntry##type[idx];                               \
+    if (entry->id != id) return;                                             \
+    entry->id = kInvalidId;                                                  \
+    entry->array_idx = 0;                                                    \
+    kFreeHash##type[kUsedFreeHash##type++] = idx;                            \
+  }                                                                          \
+                                                                             \
+  /* Handles issued before the reset may match again */                      \
+  void ResetHash##type()                                                     \
+  {                                                                          \
+    memset(kHashEntry##type, 0, sizeof(kHashEntry##type));                   \
+    kUsedFreeHash##type = 0;                                                 \
+    kUsedHash##type = 0;                                                     \
   }
@@ -9,8 +9,8 @@ struct LogMessage {
 };
 
 DECLARE_QUEUE(LogMessage, 32);
-static char kLogBuffer[MAX_LOGLINE];
-static int kUsedLogBuffer;
+static WORLD_LOCAL char kLogBuffer[MAX_LOGLINE];
+static WORLD_LOCAL int kUsedLogBuffer;
 
 void
 Log(const char* logline, unsigned len)
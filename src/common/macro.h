@@ -34,6 +34,14 @@
 // System memory block
 #define PAGE (4 * 1024)
 
+// Storage of game state. Built with WORLD_THREAD every thread holds a world
+// of its own, see simulation/world.cc.
+#ifdef WORLD_THREAD
+#define WORLD_LOCAL thread_local
+#else
+#define WORLD_LOCAL
+#endif
+
 #define DJB2_CONST 5381
 
 // Compile time check that can be performed in an expression
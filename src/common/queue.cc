@@ -15,9 +15,9 @@
   static_assert(POWEROF2(max_count), "max_count must be a power of 2"); \
   constexpr uint64_t kMax##type = max_count;                            \
                                                                         \
-  static type k##type[max_count];                                       \
-  static uint64_t kRead##type;                                          \
-  static uint64_t kWrite##type;                                         \
+  static WORLD_LOCAL type k##type[max_count];                           \
+  static WORLD_LOCAL uint64_t kRead##type;                              \
+  static WORLD_LOCAL uint64_t kWrite##type;                             \
                                                                         \
   type Pop##type()                                                      \
   {                                                                     \
@@ -82,24 +82,24 @@ RenderCrew(uint64_t ship_index)
 
   // Crew rendering
   FOR_EACH_ENTITY(Unit, unit, {
-    if (unit->ship_index != ship_index) continue;
+    if (EntityShipIndex(unit) != ship_index) continue;
     if (unit->inspace) {
-      rgg::RenderPod(unit->position, v3f(20.f, 20.f, 20.f),
+      rgg::RenderPod(EntityPosition(unit), v3f(20.f, 20.f, 20.f),
                      math::Quatf(-90.f, v3f(1.f, 0.f, 0.f)),
                      v4f(1.f, 1.f, 1.f, 1.f));
 
       continue;
     }
-    if (unit->tile.shroud && !unit->tile.visible) continue;
+    if (EntityTile(unit).shroud && !EntityTile(unit).visible) continue;
     if (unit->notify) {
       const float radius = 50.f - (unit->notify * 1.f);
-      rgg::RenderCircle(unit->position, radius - 10.f, radius, kWhite);
+      rgg::RenderCircle(EntityPosition(unit), radius - 10.f, radius, kWhite);
     }
 
     v4f color;
     switch (unit->kind) {
       case kOperator: {
-        switch (unit->player_index) {
+        switch (EntityPlayerIndex(unit)) {
           case 0:
             color = v4f(0.70f, .33f, .33f, 1.f);
             break;
@@ -121,19 +121,20 @@ RenderCrew(uint64_t ship_index)
         continue;
     }
 
-    if (unit->control & (1 << kPlayerIndex)) {
-      rgg::RenderCircle(unit->position + v3f(0.f, 0.f, 0.08f), 12.f, 14.f,
-                        v4f(0.33f, 0.80f, 0.33f, 1.f));
+    if (EntityControl(unit) & (1 << kPlayerIndex)) {
+      rgg::RenderCircle(EntityPosition(unit) + v3f(0.f, 0.f, 0.08f), 12.f,
+                        14.f, v4f(0.33f, 0.80f, 0.33f, 1.f));
     }
 
     FOR_EACH_ENTITY(Module, mod, {
-      if (v3fDsq(unit->position, mod->position) < kDsqOperate) {
+      if (v3fDsq(EntityPosition(unit), EntityPosition(mod)) < kDsqOperate) {
         // TODO(abrunasso): This should be the graphic when working on
         // something.
         static float r = 0.f;
+        const v3f bounds = EntityBounds(unit);
         rgg::RenderGear(
-            unit->position + v3f(-unit->bounds.x - 6.f, unit->bounds.y + 2.f,
-                                 unit->bounds.z + .1f),
+            EntityPosition(unit) +
+                v3f(-bounds.x - 6.f, bounds.y + 2.f, bounds.z + .1f),
             v3f(8.f, 8.f, 8.f), math::Quatf(r, v3f(0.f, 0.f, 1.f)),
             v4f(0.7f, 0.7f, 0.7f, 1.f));
         r += 0.3f;
@@ -142,12 +143,12 @@ RenderCrew(uint64_t ship_index)
 
     v3f crew_bounds = v3f(10.f, 10.f, 10.f);
     const int* behavior;
-    if (BB_GET(unit->bb, kUnitBehavior, behavior) &&
+    if (BB_GET(UnitBb(unit), kUnitBehavior, behavior) &&
         *behavior == kUnitBehaviorCrewMember) {
       crew_bounds = v3f(8.f, 8.f, 8.f);
       color = v4f(color.x * .8f, color.y * .8f, color.z * .8f, color.w);
     }
-    rgg::RenderCrew(unit->position + v3f(0.f, 0.f, 20.f), crew_bounds,
+    rgg::RenderCrew(EntityPosition(unit) + v3f(0.f, 0.f, 20.f), crew_bounds,
                     math::Quatf(-90, v3f(0.f, 0.f, 1.f)), color);
 
     if (unit->spacesuit) {
@@ -157,7 +158,7 @@ RenderCrew(uint64_t ship_index)
 
     // Render unit health bars.
     static const float kHealthSz = 5.f;
-    v3f hstart = unit->position + v3f(-13.0f, 15.5f, 0.0f);
+    v3f hstart = EntityPosition(unit) + v3f(-13.0f, 15.5f, 0.0f);
     float hratio = unit->health / unit->max_health;
     v4f hcolor = v4f(0.0f, 1.0f, 0.0f, 1.0f);
     if (hratio > 0.35f && hratio < 0.75f) {
@@ -177,12 +178,11 @@ RenderCrew(uint64_t ship_index)
         float hdiff = bar_range * bar - unit->health;
         hcolor.w = math::ScaleRange(hdiff, 0.f, bar_range, 1.f, 0.f);
       }
-      rgg::RenderRectangle(
-          Rectf(hstart.x, hstart.y, kHealthSz, kHealthSz), unit->bounds.z,
-          hcolor);
-      rgg::RenderLineRectangle(
-          Rectf(hstart.x, hstart.y, kHealthSz, kHealthSz), unit->bounds.z,
-          v4f(0.3f, 0.3f, 0.3f, 1.0f));
+      rgg::RenderRectangle(Rectf(hstart.x, hstart.y, kHealthSz, kHealthSz),
+                           EntityBounds(unit).z, hcolor);
+      rgg::RenderLineRectangle(Rectf(hstart.x, hstart.y, kHealthSz, kHealthSz),
+                               EntityBounds(unit).z,
+                               v4f(0.3f, 0.3f, 0.3f, 1.0f));
       hstart.x += kHealthSz;
     }
   });
@@ -194,9 +194,9 @@ RenderCrew(uint64_t ship_index)
 
       // Show the path they are on if they have one.
       const Tile* dest = nullptr;
-      if (!BB_GET(unit->bb, kUnitDestination, dest)) continue;
+      if (!BB_GET(UnitBb(unit), kUnitDestination, dest)) continue;
 
-      auto* path = PathTo(unit->tile, *dest);
+      auto* path = AStarPathTo(EntityTile(unit), *dest);
       if (!path || path->size <= 1) {
         continue;
       }
@@ -219,29 +219,31 @@ RenderShip(uint64_t ship_index)
   FOR_EACH_ENTITY(Module, mod, {
     v3f mcolor = ModuleColor(mod->mkind);
     v4f color(mcolor.x, mcolor.y, mcolor.z, 1.f);
+    const v3f position = EntityPosition(mod);
+    const v3f bounds = EntityBounds(mod);
+    const ColdEntity* cold = &EntityCold(mod);
     if (ModuleBuilt(mod)) {
-      rgg::RenderCube(
-          math::Cubef(mod->position + v3f(0.f, 0.f, 15.f / 2.f), mod->bounds),
-          color);
+      rgg::RenderCube(math::Cubef(position + v3f(0.f, 0.f, 15.f / 2.f), bounds),
+                      color);
     } else {
       rgg::RenderLineCube(
-          math::Cubef(mod->position + v3f(0.f, 0.f, 15.f / 2.f), mod->bounds),
+          math::Cubef(position + v3f(0.f, 0.f, 15.f / 2.f), bounds),
           v4f(color.x, color.y, color.z, 1.f));
       glDisable(GL_DEPTH_TEST);
       rgg::RenderProgressBar(
-          Rectf(mod->position.x - mod->bounds.x / 2.f,
-                      mod->position.y - mod->bounds.y, mod->bounds.y, 5.f),
-          2.f, mod->frames_building, mod->frames_to_build, kGreen, kWhite);
+          Rectf(position.x - bounds.x / 2.f, position.y - bounds.y, bounds.y,
+                5.f),
+          2.f, cold->frames_building, cold->frames_to_build, kGreen, kWhite);
       glEnable(GL_DEPTH_TEST);
     }
 
-    if (mod->frames_training == kTrainIdle) continue;
+    if (cold->frames_training == kTrainIdle) continue;
 
     glDisable(GL_DEPTH_TEST);
     rgg::RenderProgressBar(
-        Rectf(mod->position.x - mod->bounds.x / 2.f,
-                    mod->position.y - mod->bounds.y, mod->bounds.y, 5.f),
-        2.f, mod->frames_training, mod->frames_to_train, kRed, kWhite);
+        Rectf(position.x - bounds.x / 2.f, position.y - bounds.y, bounds.y,
+              5.f),
+        2.f, cold->frames_training, cold->frames_to_train, kRed, kWhite);
     glEnable(GL_DEPTH_TEST);
   });
 
@@ -250,12 +252,12 @@ RenderShip(uint64_t ship_index)
     for (int i = 0; i < kUsedEntity; ++i) {
       Module* mod = i2Module(i);
       if (!mod) continue;
-      if (mod->ship_index != ship_index) continue;
+      if (EntityShipIndex(mod) != ship_index) continue;
       if (mod->mkind != kModEngine) continue;
       if (!ModuleBuilt(mod)) continue;
       v3f mcolor = ModuleColor(mod->mkind);
       v2f hack = {-kTileWidth, kTileHeight};
-      world = mod->position + hack;
+      world = EntityPosition(mod) + hack;
       v4f color(mcolor.x, mcolor.y, mcolor.z, 1.f);
       float engine_scale = kShip[ship_index].engine_animation * .1f;
       rgg::RenderExhaust(world + v3f(-40.f, -20.f, 0.f), v3f(22.f, 22.f, 22.f),
@@ -271,11 +273,14 @@ RenderShip(uint64_t ship_index)
 
   float fft = kShip[ship_index].ftl_frame * (1.f / kFtlFrameTime);
   float ship_alpha = 1.f - fft;
-  uint16_t ship_width = kShip[ship_index].map_width;
   uint16_t ship_height = kShip[ship_index].map_height;
+  const uint64_t(*plane)[kMapMaxHeight] = kGrid[ship_index].plane;
   for (int i = 0; i < ship_height; ++i) {
-    for (int j = 0; j < ship_width; ++j) {
-      const Tile* tile = ShipTile(ship_index, j, i);
+    // Open tiles draw nothing: visit the others alone
+    uint64_t drawn = plane[kPlaneShroud][i] | plane[kPlaneBlocked][i] |
+                     plane[kPlaneNooxygen][i];
+    for (; drawn; drawn = BLSR(drawn)) {
+      const Tile* tile = ShipTile(ship_index, TZCNT(drawn), i);
       v2f world_pos = FromShip(*tile).Center();
 
       v4f color;
@@ -55,15 +55,24 @@ OrientToAabb(const Rectf& rect)
   return r;
 }
 
+// Point of rect at the fractions u and v, in [0, 1], of width and height
 v2f
-RandomPointInRect(const Rectf& rect)
+PointInRect(const Rectf& rect, float u, float v)
 {
   float min_x = rect.x;
   float max_x = rect.x + rect.width;
   float min_y = rect.y;
   float max_y = rect.y + rect.height;
-  return v2f(ScaleRange((float)rand() / RAND_MAX, 0.f, 1.f, min_x, max_x),
-             ScaleRange((float)rand() / RAND_MAX, 0.f, 1.f, min_y, max_y));
+  return v2f(ScaleRange(u, 0.f, 1.f, min_x, max_x),
+             ScaleRange(v, 0.f, 1.f, min_y, max_y));
+}
+
+v2f
+RandomPointInRect(const Rectf& rect, int (*rand_func)() = rand)
+{
+  float u = (float)rand_func() / RAND_MAX;
+  float v = (float)rand_func() / RAND_MAX;
+  return PointInRect(rect, u, v);
 }
 
 // The Anthony-especial algorithm for calculating a random point on exterior
@@ -78,8 +87,10 @@ RandomPointInRect(const Rectf& rect)
 // 7. Project that point to top and right vectors made by rect.
 // 8. Save vector with min projection distance.
 // 9. Return the min of distances from 4, 8 and retranslate to exterior.
+//
+// u holds the four draws in [0, 1] of steps 2 and 6.
 v2f
-RandomPointOnRect(const Rectf& rect)
+RandomPointOnRect(const Rectf& rect, const float* u)
 {
   Rectf r = OrientToAabb(rect);
   v2f t(r.x, r.y);
@@ -87,7 +98,7 @@ RandomPointOnRect(const Rectf& rect)
   r.x -= r.x;
   r.y -= r.y;
   // Random point in rect rooted at origin.
-  v2f pv = RandomPointInRect(r);
+  v2f pv = PointInRect(r, u[0], u[1]);
   // Project to left and bottom exteriors.
   v2f pl = Project(pv, v2f(0.f, r.height));
   v2f pb = Project(pv, v2f(r.width, 0.f));
@@ -96,7 +107,7 @@ RandomPointOnRect(const Rectf& rect)
   // Orient rect s.t. top right is now origin.
   r.x -= r.width;
   r.y -= r.height;
-  v2f nv = RandomPointInRect(r);
+  v2f nv = PointInRect(r, u[2], u[3]);
   // Project to top and right exteriors.
   v2f nt = Project(nv, v2f(-r.width, 0.f));
   v2f nr = Project(nv, v2f(0.f, -r.height));
@@ -111,4 +122,14 @@ RandomPointOnRect(const Rectf& rect)
   return pkeep + t;
 }
 
+v2f
+RandomPointOnRect(const Rectf& rect, int (*rand_func)() = rand)
+{
+  float u[4];
+  for (int i = 0; i < 4; ++i) {
+    u[i] = (float)rand_func() / RAND_MAX;
+  }
+  return RandomPointOnRect(rect, u);
+}
+
 }  // namespace math
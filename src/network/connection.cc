@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "platform/platform.cc"
+
+// Open addressing map of 64-bit keys to table indices: the connections and
+// games of a server shard.
+//
+// Slots probe linearly from the Fibonacci hash of the key. A removed slot
+// becomes a tombstone: lookups probe past it and inserts reuse it. Once live
+// and dead slots reach the load limit the tombstones are purged in place.
+// Keys need not be unique: IndexFind() returns every value stored under a
+// key, the caller compares the entry the value refers to. Storage is
+// provided by the caller, a power of two slots.
+
+#define INDEX_EMPTY UINT32_MAX
+#define INDEX_TOMBSTONE (UINT32_MAX - 1)
+// Marks the slots awaiting placement during IndexPurge(): values are lower
+#define INDEX_PENDING (1u << 31)
+
+struct IndexSlot {
+  uint64_t key;
+  // Table index, INDEX_EMPTY or INDEX_TOMBSTONE
+  uint32_t value;
+};
+
+struct IndexTable {
+  IndexSlot* slot;
+  uint64_t mask;
+  // Leaves log2(capacity) bits of the hash product
+  uint64_t shift;
+  uint64_t live;
+  uint64_t tombstone;
+  // Diagnostics
+  uint64_t purge;
+};
+
+void
+IndexInit(IndexTable* t, IndexSlot* slot, uint64_t capacity)
+{
+  assert(capacity >= 2 && POWEROF2(capacity) && capacity <= INDEX_PENDING);
+  *t = {};
+  t->slot = slot;
+  t->mask = capacity - 1;
+  t->shift = 64;
+  for (uint64_t c = capacity; c > 1; c >>= 1) {
+    t->shift -= 1;
+  }
+  for (uint64_t i = 0; i < capacity; ++i) {
+    slot[i] = {0, INDEX_EMPTY};
+  }
+}
+
+INLINE uint64_t
+IndexHome(const IndexTable* t, uint64_t key)
+{
+  return (key * 0x9E3779B97F4A7C15ull) >> t->shift;
+}
+
+// Live and dead slots at most, three quarters of the table
+INLINE uint64_t
+IndexLimit(const IndexTable* t)
+{
+  const uint64_t capacity = t->mask + 1;
+  return capacity - capacity / 4;
+}
+
+// Drops tombstones without a second table: every live slot is marked
+// pending, then moved to the first slot of its probe sequence that is empty
+// or pending. Placed slots never move again, so the slots before them stay
+// occupied.
+void
+IndexPurge(IndexTable* t)
+{
+  const uint64_t capacity = t->mask + 1;
+  for (uint64_t i = 0; i < capacity; ++i) {
+    IndexSlot* s = &t->slot[i];
+    if (s->value == INDEX_TOMBSTONE) {
+      s->value = INDEX_EMPTY;
+    } else if (s->value != INDEX_EMPTY) {
+      s->value |= INDEX_PENDING;
+    }
+  }
+
+  for (uint64_t i = 0; i < capacity; ++i) {
+    IndexSlot* s = &t->slot[i];
+    while (s->value != INDEX_EMPTY && (s->value & INDEX_PENDING)) {
+      uint64_t j = IndexHome(t, s->key);
+      while (t->slot[j].value != INDEX_EMPTY &&
+             !(t->slot[j].value & INDEX_PENDING)) {
+        j = (j + 1) & t->mask;
+      }
+
+      IndexSlot placed = *s;
+      placed.value &= ~INDEX_PENDING;
+      if (j == i) {
+        *s = placed;
+      } else if (t->slot[j].value == INDEX_EMPTY) {
+        t->slot[j] = placed;
+        s->value = INDEX_EMPTY;
+      } else {
+        // Displaces a pending slot, placed on the next iteration
+        *s = t->slot[j];
+        t->slot[j] = placed;
+      }
+    }
+  }
+
+  t->tombstone = 0;
+  t->purge += 1;
+}
+
+// False when the table is at its load limit
+bool
+IndexInsert(IndexTable* t, uint64_t key, uint32_t value)
+{
+  assert(value < INDEX_PENDING);
+  const uint64_t limit = IndexLimit(t);
+  if (t->live >= limit) return false;
+  if (t->live + t->tombstone >= limit) IndexPurge(t);
+
+  uint64_t i = IndexHome(t, key);
+  while (t->slot[i].value < INDEX_TOMBSTONE) {
+    i = (i + 1) & t->mask;
+  }
+  t->tombstone -= t->slot[i].value == INDEX_TOMBSTONE;
+  t->slot[i] = {key, value};
+  t->live += 1;
+
+  return true;
+}
+
+// Next value stored under key, INDEX_EMPTY when there are no more. The
+// cursor starts at 0.
+uint32_t
+IndexFind(const IndexTable* t, uint64_t key, uint64_t* cursor)
+{
+  const uint64_t home = IndexHome(t, key);
+  for (uint64_t n = *cursor; n <= t->mask; ++n) {
+    const IndexSlot* s = &t->slot[(home + n) & t->mask];
+    if (s->value == INDEX_EMPTY) break;
+    if (s->value == INDEX_TOMBSTONE || s->key != key) continue;
+    *cursor = n + 1;
+    return s->value;
+  }
+
+  *cursor = t->mask + 1;
+  return INDEX_EMPTY;
+}
+
+// False when key does not hold value
+bool
+IndexRemove(IndexTable* t, uint64_t key, uint32_t value)
+{
+  uint64_t i = IndexHome(t, key);
+  for (uint64_t n = 0; n <= t->mask; ++n, i = (i + 1) & t->mask) {
+    IndexSlot* s = &t->slot[i];
+    if (s->value == INDEX_EMPTY) break;
+    if (s->value != value || s->key != key) continue;
+
+    // No probe continues past the end of a run
+    if (t->slot[(i + 1) & t->mask].value == INDEX_EMPTY) {
+      s->value = INDEX_EMPTY;
+    } else {
+      s->value = INDEX_TOMBSTONE;
+      t->tombstone += 1;
+    }
+    t->live -= 1;
+    return true;
+  }
+
+  return false;
+}
+
+// Key of the address of a peer: family, port and address of the sockaddr
+INLINE uint64_t
+ConnectionKey(const Udp4* peer)
+{
+  uint64_t word[2];
+  memcpy(word, peer->socket_address, sizeof(word));
+  uint64_t h = word[0] ^ (word[1] * 0xC2B2AE3D27D4EB4Full);
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  return h;
+}
@@ -0,0 +1,193 @@
+#include <cassert>
+#include <cstdio>
+
+#include "server.cc"
+
+// Peers of a large shard
+constexpr uint64_t kPeerCount = 10000;
+constexpr uint64_t kSlotCount = 16384;
+constexpr uint64_t kLookupCount = 1 << 20;
+
+static PlayerState kPlayer[kPeerCount];
+static Udp4 kPeer[kPeerCount];
+static uint32_t kOrder[kLookupCount];
+static IndexSlot kSlot[kSlotCount];
+static IndexTable kTable;
+
+uint64_t
+NextRandom(uint64_t* state)
+{
+  *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+  return *state >> 33;
+}
+
+// Distinct IPv4 addresses and ports, as received
+Udp4
+MakePeer(uint64_t i)
+{
+  Udp4 peer = {};
+  struct sockaddr_in* in = (struct sockaddr_in*)peer.socket_address;
+  in->sin_family = AF_INET;
+  in->sin_port = htons(1024 + i % 50000);
+  in->sin_addr.s_addr = htonl(0x0a000000 + i * 7919);
+  peer.socket = -1;
+  return peer;
+}
+
+// Every live value is found under its key, once
+void
+CheckTable(const IndexTable* t, const bool* live, uint64_t count)
+{
+  uint64_t found = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t cursor = 0;
+    uint64_t matches = 0;
+    uint32_t v;
+    while ((v = IndexFind(t, ConnectionKey(&kPeer[i]), &cursor)) !=
+           INDEX_EMPTY) {
+      matches += v == i;
+    }
+    assert(matches == live[i]);
+    found += matches;
+  }
+  assert(found == t->live);
+}
+
+void
+TestTable()
+{
+  static bool live[kPeerCount];
+  const uint64_t limit = kSlotCount - kSlotCount / 4;
+  IndexInit(&kTable, kSlot, kSlotCount);
+
+  // Filled to the load limit, then full
+  for (uint64_t i = 0; i < limit; ++i) {
+    assert(IndexInsert(&kTable, ConnectionKey(&kPeer[i % kPeerCount]), i));
+  }
+  assert(!IndexInsert(&kTable, 0, 0));
+  for (uint64_t i = 0; i < limit; ++i) {
+    assert(IndexRemove(&kTable, ConnectionKey(&kPeer[i % kPeerCount]), i));
+  }
+  assert(!kTable.live);
+  assert(!IndexRemove(&kTable, ConnectionKey(&kPeer[0]), 0));
+
+  // Connections come and go: tombstones are reused and purged
+  uint64_t state = 5;
+  for (uint64_t round = 0; round < 200000; ++round) {
+    const uint64_t i = NextRandom(&state) % kPeerCount;
+    const uint64_t key = ConnectionKey(&kPeer[i]);
+    if (live[i]) {
+      assert(IndexRemove(&kTable, key, i));
+    } else {
+      assert(IndexInsert(&kTable, key, i));
+    }
+    live[i] = !live[i];
+    assert(kTable.live + kTable.tombstone <= limit);
+    if (round % 20000 == 0) CheckTable(&kTable, live, kPeerCount);
+  }
+  CheckTable(&kTable, live, kPeerCount);
+
+  // Equal keys hold several values
+  IndexInit(&kTable, kSlot, 8);
+  assert(IndexInsert(&kTable, 42, 1));
+  assert(IndexInsert(&kTable, 42, 2));
+  assert(IndexInsert(&kTable, 7, 3));
+  uint64_t cursor = 0;
+  uint32_t sum = 0;
+  uint32_t v;
+  while ((v = IndexFind(&kTable, 42, &cursor)) != INDEX_EMPTY) sum += v;
+  assert(sum == 3);
+  assert(IndexRemove(&kTable, 42, 1));
+  cursor = 0;
+  assert(IndexFind(&kTable, 42, &cursor) == 2);
+  assert(IndexFind(&kTable, 42, &cursor) == INDEX_EMPTY);
+}
+
+// The scan GetPlayerIndexFromPeer() did over the player table
+int
+LinearLookup(const Udp4* peer)
+{
+  for (int i = 0; i < kPeerCount; ++i) {
+    if (memcmp(peer, &kPlayer[i].peer, sizeof(Udp4)) == 0) return i;
+  }
+
+  return -1;
+}
+
+int
+IndexLookup(const Udp4* peer)
+{
+  uint64_t cursor = 0;
+  uint32_t i;
+  while ((i = IndexFind(&kTable, ConnectionKey(peer), &cursor)) !=
+         INDEX_EMPTY) {
+    if (memcmp(peer->socket_address, kPlayer[i].peer.socket_address,
+               sizeof(peer->socket_address)) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  for (uint64_t i = 0; i < kPeerCount; ++i) {
+    kPeer[i] = MakePeer(i);
+  }
+  TestTable();
+
+  // Lookups of random connected peers, as datagrams arrive
+  IndexInit(&kTable, kSlot, kSlotCount);
+  for (uint64_t i = 0; i < kPeerCount; ++i) {
+    kPlayer[i].peer = kPeer[i];
+    assert(IndexInsert(&kTable, ConnectionKey(&kPeer[i]), i));
+  }
+  uint64_t state = 11;
+  for (uint64_t i = 0; i < kLookupCount; ++i) {
+    kOrder[i] = NextRandom(&state) % kPeerCount;
+  }
+
+  // The scan visits half the table per lookup: fewer lookups suffice
+  const uint64_t linear_count = kLookupCount / 256;
+  uint64_t sum = 0;
+  uint64_t begin = rdtsc();
+  for (uint64_t i = 0; i < linear_count; ++i) {
+    sum += LinearLookup(&kPeer[kOrder[i]]);
+  }
+  const uint64_t linear_tsc = rdtsc() - begin;
+
+  uint64_t index_sum = 0;
+  begin = rdtsc();
+  for (uint64_t i = 0; i < kLookupCount; ++i) {
+    index_sum += IndexLookup(&kPeer[kOrder[i]]);
+  }
+  const uint64_t index_tsc = rdtsc() - begin;
+
+  uint64_t check_sum = 0;
+  for (uint64_t i = 0; i < linear_count; ++i) {
+    check_sum += IndexLookup(&kPeer[kOrder[i]]);
+  }
+  assert(sum == check_sum);
+  assert(IndexLookup(&kPeer[0]) == 0 && LinearLookup(&kPeer[0]) == 0);
+  Udp4 stranger = MakePeer(kPeerCount);
+  assert(IndexLookup(&stranger) == -1 && LinearLookup(&stranger) == -1);
+
+  const double linear_ns =
+      (double)linear_tsc * 1000 / median_tsc_per_usec / linear_count;
+  const double index_ns =
+      (double)index_tsc * 1000 / median_tsc_per_usec / kLookupCount;
+  printf(
+      "[ %lu connections ] "
+      "[ linear %.1f ns/lookup ] "
+      "[ index %.1f ns/lookup ] "
+      "[ %.0fx ] "
+      "[ index_sum %lu ] "
+      "\n",
+      kPeerCount, linear_ns, index_ns, linear_ns / index_ns, index_sum);
+
+  puts("ok");
+  return 0;
+}
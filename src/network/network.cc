@@ -42,10 +42,14 @@ struct NetworkState {
   const char* server_ip = "localhost";
   const char* server_port = "9845";
   uint64_t num_players = 1;
+  // Players of a game of several meet by key, see Handshake
+  uint64_t match_key = ANY_MATCH;
   // Unique id for this game
   uint64_t game_id;
   // Unique cookie for this player
   uint64_t player_cookie;
+  // Server issued id, leading each packet after the handshake
+  uint64_t connection_id;
   // Unique local player id for this game
   uint64_t player_index;
   // Total players in this game
@@ -63,6 +67,12 @@ struct NetworkState {
   const float rsdev_const = 3.0f;
   // Server state
   uint64_t server_jerk;
+  // Latest local checkpoint, sent with each Update
+  uint64_t digest_frame;
+  uint64_t digest_root;
+  // Checkpoint subtree requested by the server, frame 0 when none
+  uint64_t digest_request_frame;
+  uint64_t digest_request_registry;
 };
 
 enum {
@@ -72,7 +82,25 @@ enum {
   kNeExcessLatency,
 };
 
+// Rollback: frames run ahead of the received turns
+#define MAX_ROLLBACK 7
+
+struct RollbackState {
+  // Frames before confirmed_frame ran on the received turns
+  uint64_t confirmed_frame;
+  // Turns each frame from confirmed_frame ran on
+  InputBuffer predicted[MAX_NETQUEUE][MAX_PLAYER];
+  // Diagnostics
+  uint64_t rollback_count;
+  uint64_t mispredict_turns;
+  uint64_t last_depth;
+  uint64_t max_depth;
+  uint64_t last_resim_usec;
+  uint64_t max_resim_usec;
+};
+
 static NetworkState kNetworkState;
+static RollbackState kRollbackState;
 static Stats kNetworkStats;
 EXTERN(uint64_t kNetworkExit);
 
@@ -94,7 +122,8 @@ NetworkSetup()
   if (!udp::Init()) return false;
 
   if (strcmp("localhost", kNetworkState.server_ip) == 0) {
-    if (!CreateNetworkServer("localhost", "9845")) return false;
+    // Fails when another process serves the port: the client joins it
+    CreateNetworkServer("localhost", "9845", 1);
   }
 
   if (!udp::GetAddr4(kNetworkState.server_ip, kNetworkState.server_port,
@@ -112,6 +141,7 @@ NetworkSetup()
   v2f dims = window::GetWindowSize();
   Handshake h;
   h.num_players = kNetworkState.num_players;
+  h.match_key = kNetworkState.num_players > 1 ? kNetworkState.match_key : 0;
   h.player_info.window_width = (uint64_t)dims.x;
   h.player_info.window_height = (uint64_t)dims.y;
   if (ALAN) {
@@ -159,11 +189,13 @@ NetworkSetup()
   kNetworkState.player_index = ns->player_index;
   kNetworkState.player_count = ns->player_count;
   kNetworkState.player_cookie = ns->cookie;
+  kNetworkState.connection_id = ns->connection_id;
   for (int i = 0; i < ns->player_count; ++i) {
     kNetworkState.player_info[i] = ns->player_info[i];
   }
 
   BeginGame bg;
+  bg.connection_id = ns->connection_id;
   bg.cookie = ns->cookie;
   bg.game_id = ns->game_id;
   if (!udp::Send(kNetworkState.socket, &bg, sizeof(bg))) {
@@ -241,6 +273,14 @@ NetworkContiguousSlotReady(uint64_t frame)
   return MAX_NETQUEUE;
 }
 
+// Turns are delta-coded against the last event of the previous turn
+INLINE v2f
+TurnReference(const InputBuffer* previous)
+{
+  if (!previous->used_input_event) return v2f(0.f, 0.f);
+  return previous->input_event[previous->used_input_event - 1].position;
+}
+
 bool
 NetworkAppend(uint64_t player_index, const uint8_t* end_buffer,
               uint8_t** write_ref, uint64_t* seq_ref)
@@ -252,27 +292,26 @@ NetworkAppend(uint64_t player_index, const uint8_t* end_buffer,
     return false;
 
   InputBuffer* ibuf = &kNetworkState.input[slot];
-  Turn* turn = (Turn*)netbuffer;
-  uint8_t* event = netbuffer + sizeof(Turn);
-  uint64_t event_bytes = sizeof(PlatformEvent) * ibuf->used_input_event;
+  const InputBuffer* previous =
+      &kNetworkState.input[NETQUEUE_SLOT(*seq_ref - 1)];
+  uint64_t turn_bytes =
+      TurnEncode(ibuf->input_event, ibuf->used_input_event,
+                 TurnReference(previous), netbuffer, end_buffer);
 
   // Full packet
-  if (end_buffer - netbuffer < event_bytes) return false;
+  if (!turn_bytes) return false;
 
   if (ALAN) {
     printf(
         "Client NetworkAppend "
-        "[ event_bytes %lu ] "
+        "[ turn_bytes %lu ] "
         "[ sequence %lu ] "
         "\n",
-        event_bytes, *seq_ref);
+        turn_bytes, *seq_ref);
   }
 
-  turn->event_bytes = event_bytes;
-  memcpy(event, ibuf->input_event, event_bytes);
-
   // Advance
-  *write_ref += event_bytes + sizeof(Turn);
+  *write_ref += turn_bytes;
   *seq_ref += 1;
 
   return true;
@@ -301,8 +340,11 @@ NetworkEgress()
   uint64_t seq = begin_seq;
   for (int i = 0; i < MAX_UPDATE; ++i) {
     Update* header = (Update*)kNetworkState.netbuffer;
+    header->connection_id = kNetworkState.connection_id;
     header->sequence = seq;
     header->ack_frame = kNetworkState.ack_frame;
+    header->digest_frame = kNetworkState.digest_frame;
+    header->digest_root = kNetworkState.digest_root;
 
     uint8_t* write_buffer = kNetworkState.netbuffer + sizeof(Update);
     const uint8_t* end_buffer =
@@ -367,6 +409,8 @@ NetworkIngress(uint64_t next_simulation_frame)
     if (ack_sequence - kNetworkState.ack_sequence >= MAX_NETQUEUE) continue;
     kNetworkState.ack_sequence = ack_sequence;
     kNetworkState.server_jerk = update->server_jerk;
+    kNetworkState.digest_request_frame = update->digest_frame;
+    kNetworkState.digest_request_registry = update->digest_registry;
 
     const uint8_t* offset = (kNetworkState.netbuffer + sizeof(NotifyUpdate));
     const uint8_t* end_buffer = kNetworkState.netbuffer + bytes_received;
@@ -387,28 +431,25 @@ NetworkIngress(uint64_t next_simulation_frame)
       }
 
       for (int i = 0; i < num_players; ++i) {
-        if (offset + sizeof(Turn) >= end_buffer) {
-          kNetworkExit = kNeCorrupt;
-          return;
-        }
-        Turn* turn = (Turn*)offset;
-        const uint64_t event_bytes = turn->event_bytes;
-        if (offset + event_bytes + sizeof(Turn) > end_buffer) {
-          kNetworkExit = kNeCorrupt;
-          return;
-        }
-        if (event_bytes > sizeof(PlatformEvent) * MAX_TICK_EVENTS) {
+        const uint64_t turn_bytes = TurnBytes(offset, end_buffer);
+        if (!turn_bytes) {
           kNetworkExit = kNeCorrupt;
           return;
         }
+        // Frames arrive in order: the previous turn is decoded
         if (kNetworkState.network_slot[slot][i] == kSlotInFlight) {
-          const uint8_t* event = offset + sizeof(Turn);
           InputBuffer* ibuf = &kNetworkState.player_input[slot][i];
-          memcpy(ibuf->input_event, event, event_bytes);
-          ibuf->used_input_event = event_bytes / sizeof(PlatformEvent);
+          const InputBuffer* previous =
+              &kNetworkState.player_input[NETQUEUE_SLOT(frame - 1)][i];
+          if (!TurnDecode(offset, turn_bytes, TurnReference(previous),
+                          ibuf->input_event, MAX_TICK_EVENTS,
+                          &ibuf->used_input_event)) {
+            kNetworkExit = kNeCorrupt;
+            return;
+          }
           kNetworkState.network_slot[slot][i] = kSlotReceived;
         }
-        offset += event_bytes + sizeof(Turn);
+        offset += turn_bytes;
       }
     }
   }
@@ -418,6 +459,76 @@ NetworkIngress(uint64_t next_simulation_frame)
   kNetworkState.ack_frame = end_frame - 1;
 }
 
+bool
+InputBufferEqual(const InputBuffer* a, const InputBuffer* b)
+{
+  if (a->used_input_event != b->used_input_event) return false;
+  return memcmp(a->input_event, b->input_event,
+                a->used_input_event * sizeof(PlatformEvent)) == 0;
+}
+
+// Best known turns of frame: received, the local input, or a repeat of the
+// last turn received from the player
+InputBuffer*
+NetworkPredict(uint64_t frame)
+{
+  const uint64_t slot = NETQUEUE_SLOT(frame);
+  InputBuffer* predicted = kRollbackState.predicted[slot];
+  for (int i = 0; i < kNetworkState.player_count; ++i) {
+    if (frame < kRollbackState.confirmed_frame ||
+        kNetworkState.network_slot[slot][i] == kSlotReceived) {
+      predicted[i] = kNetworkState.player_input[slot][i];
+      continue;
+    }
+
+    if (i == kNetworkState.player_index &&
+        frame < kNetworkState.outgoing_sequence) {
+      predicted[i] = kNetworkState.input[slot];
+      continue;
+    }
+
+    predicted[i] = InputBuffer();
+    for (uint64_t f = frame; f-- > 0;) {
+      const uint64_t s = NETQUEUE_SLOT(f);
+      if (f < kRollbackState.confirmed_frame ||
+          kNetworkState.network_slot[s][i] == kSlotReceived) {
+        predicted[i] = kNetworkState.player_input[s][i];
+        break;
+      }
+    }
+  }
+
+  return predicted;
+}
+
+// The frame ran on the turns received for it
+bool
+NetworkPredicted(uint64_t frame)
+{
+  const uint64_t slot = NETQUEUE_SLOT(frame);
+  bool match = true;
+  for (int i = 0; i < kNetworkState.player_count; ++i) {
+    if (InputBufferEqual(&kRollbackState.predicted[slot][i],
+                         &kNetworkState.player_input[slot][i])) {
+      continue;
+    }
+    kRollbackState.mispredict_turns += 1;
+    match = false;
+  }
+
+  return match;
+}
+
+void
+NetworkSendDigest(const DigestTree* tree)
+{
+  DigestTree packet = *tree;
+  packet.connection_id = kNetworkState.connection_id;
+  if (!udp::Send(kNetworkState.socket, &packet, sizeof(DigestTree))) {
+    kNetworkExit = kNeSendFail;
+  }
+}
+
 uint64_t
 NetworkQueueGoal()
 {
@@ -4,10 +4,25 @@
 
 #include "common/constants.h"
 #include "platform/platform.cc"
+#include "turn.cc"
 
 const uint64_t greeting_size = 8;
 #define GREETING "spacehi"
 #define BEGINGAME "spacegame"
+#define DIGEST "digest"
+// Handshake::match_key of the players of a game of several that name no
+// match
+#define ANY_MATCH 1
+
+// Frames between desync checkpoints
+#define DIGEST_INTERVAL 64
+// Checkpoints retained while the server localizes a desync
+#define MAX_DIGEST_CHECKPOINT 4
+#define DIGEST_CHECKPOINT(frame) \
+  (((frame) / DIGEST_INTERVAL) % MAX_DIGEST_CHECKPOINT)
+// Registries (nodes) and slots (leaves) in one DigestTree
+#define MAX_DIGEST_NODE 16
+#define MAX_DIGEST_LEAF 160
 
 struct PlayerInfo {
   uint64_t window_width;
@@ -17,10 +32,15 @@ struct PlayerInfo {
 struct Handshake {
   const char greeting[greeting_size] = {GREETING};
   uint64_t num_players;
+  // Shared by the players of one game, 0 for a solo game. Games with
+  // different keys may be served by different server shards.
+  uint64_t match_key;
   PlayerInfo player_info;
 };
 
 struct NotifyGame {
+  // Leads every later packet of the player, see BeginGame
+  uint64_t connection_id;
   uint64_t game_id;
   uint64_t player_index;
   uint64_t player_count;
@@ -28,39 +48,82 @@ struct NotifyGame {
   PlayerInfo player_info[MAX_PLAYER];
 };
 
+// Packets to the server after the handshake lead with the connection_id
+// of NotifyGame: the server finds the player by address and connection_id
 struct BeginGame {
+  uint64_t connection_id;
   uint64_t cookie;
   uint64_t game_id;
 };
 
-struct Turn {
-  uint64_t event_bytes;
-#ifndef _WIN32
-  PlatformEvent event[];
-#endif
-};
-
 struct Update {
+  uint64_t connection_id;
   uint64_t sequence;
   uint64_t ack_frame;
+  // Root digest of the latest checkpoint, 0 when none
+  uint64_t digest_frame;
+  uint64_t digest_root;
 #ifndef _WIN32
-  // N updates from the local player
-  Turn turn[];
+  // N turns from the local player, see turn.cc
+  uint8_t turn[];
 #endif
 };
 
 struct NotifyFrame {
   uint64_t frame;
 #ifndef _WIN32
-  // N updates, one for each game participant on frame
-  Turn turn[];
+  // N turns, one for each game participant on frame, see turn.cc
+  uint8_t turn[];
 #endif
 };
 
 struct NotifyUpdate {
   uint64_t server_jerk;
   uint64_t ack_sequence;
+  // Checkpoint whose DigestTree is requested, 0 when none
+  uint64_t digest_frame;
+  // Registry whose leaves are requested, kInvalidIndex for nodes only
+  uint64_t digest_registry;
 #ifndef _WIN32
   NotifyFrame turn[];
 #endif
 };
+
+// Subtree of a checkpoint, sent in reply to NotifyUpdate::digest_frame
+struct DigestTree {
+  uint64_t connection_id;
+  char magic[greeting_size] = {DIGEST};
+  uint64_t frame;
+  uint64_t registry;
+  uint64_t node_count;
+  uint64_t node[MAX_DIGEST_NODE];
+  // Leaves of registry, one per used slot
+  uint64_t leaf_count;
+  uint32_t leaf[MAX_DIGEST_LEAF];
+};
+
+// First registry whose digest differs, or kInvalidIndex
+inline uint64_t
+DigestFirstNode(const DigestTree* a, const DigestTree* b)
+{
+  const uint64_t count = MIN(a->node_count, b->node_count);
+  for (uint64_t i = 0; i < count; ++i) {
+    if (a->node[i] != b->node[i]) return i;
+  }
+  if (a->node_count != b->node_count) return count;
+
+  return kInvalidIndex;
+}
+
+// First slot whose leaf differs, or kInvalidIndex
+inline uint64_t
+DigestFirstLeaf(const DigestTree* a, const DigestTree* b)
+{
+  const uint64_t count = MIN(a->leaf_count, b->leaf_count);
+  for (uint64_t i = 0; i < count; ++i) {
+    if (a->leaf[i] != b->leaf[i]) return i;
+  }
+  if (a->leaf_count != b->leaf_count) return count;
+
+  return kInvalidIndex;
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "network.cc"
+
+// Replays of a game: the turns of every player, enough to run it again.
+//
+// A file is a ReplayHeader followed by one record per frame: a ReplayFrame,
+// then the events of each player in player order. Every REPLAY_CHECKPOINT
+// frames the record also carries the simulation hash, which a replay must
+// reproduce.
+//
+// The game thread appends records to a ring buffer that a writer thread
+// drains to the file. A replay is read through a read-only mapping of the
+// file; a partial last record, as left by a crash, is ignored.
+
+#define REPLAY "replay"
+#define REPLAY_VERSION 1
+// Frames between simulation hash checkpoints
+#define REPLAY_CHECKPOINT 60
+// Checkpoints indexed on load (REPLAY_CHECKPOINT frames each)
+#define MAX_REPLAY_INDEX (64 * 1024)
+// Record bytes buffered for the writer, power of 2
+#define MAX_REPLAY_BUFFER (1024 * 1024)
+// Writer sleep while the buffer is empty
+#define REPLAY_WRITE_USEC 10000
+
+struct ReplayHeader {
+  char magic[8] = {REPLAY};
+  uint64_t version = REPLAY_VERSION;
+  // Initialize() argument
+  uint64_t seed;
+  // ScenarioType at Initialize()
+  uint64_t scenario;
+  uint64_t player_count;
+  // Player that recorded the game
+  uint64_t player_index;
+  PlayerInfo player_info[MAX_PLAYER];
+};
+
+struct ReplayFrame {
+  uint32_t frame;
+  uint16_t event_count[MAX_PLAYER];
+  // Simulation hash before the turn on checkpoint frames, otherwise 0
+  uint64_t hash;
+};
+
+// Records and events keep 8 byte alignment in the mapping
+static_assert(sizeof(ReplayHeader) % 8 == 0, "ReplayHeader alignment");
+static_assert(sizeof(ReplayFrame) % 8 == 0, "ReplayFrame alignment");
+static_assert(sizeof(PlatformEvent) % 8 == 0, "PlatformEvent alignment");
+
+struct ReplayRecorder {
+  // Advanced by the game thread
+  ALIGNAS(64) uint64_t write;
+  // Advanced by the writer thread
+  ALIGNAS(64) uint64_t read;
+  uint8_t buffer[MAX_REPLAY_BUFFER];
+  FILE* file;
+  ThreadInfo thread;
+  bool exit;
+  // Next frame to record
+  uint64_t frame;
+  // Diagnostics: game thread waits on a full buffer
+  uint64_t stall_count;
+};
+
+struct Replay {
+  const uint8_t* data;
+  uint64_t bytes;
+  const ReplayHeader* header;
+  // Complete records in the file
+  uint64_t frame_count;
+  // Offset of the record of every REPLAY_CHECKPOINT frame
+  uint64_t index[MAX_REPLAY_INDEX];
+};
+
+static ReplayRecorder kReplayRecorder;
+
+uint64_t
+ReplayWriter(void* arg)
+{
+  ReplayRecorder* r = (ReplayRecorder*)arg;
+  while (1) {
+    const bool exit = __atomic_load_n(&r->exit, __ATOMIC_ACQUIRE);
+    const uint64_t write = __atomic_load_n(&r->write, __ATOMIC_ACQUIRE);
+    const uint64_t read = r->read;
+    if (read == write) {
+      if (exit) break;
+      platform::sleep_usec(REPLAY_WRITE_USEC);
+      continue;
+    }
+
+    // Up to the end of the ring, the rest on the next pass
+    const uint64_t offset = read % MAX_REPLAY_BUFFER;
+    const uint64_t room = MAX_REPLAY_BUFFER - offset;
+    const uint64_t bytes = MIN(write - read, room);
+    fwrite(r->buffer + offset, 1, bytes, r->file);
+    fflush(r->file);
+    __atomic_store_n(&r->read, read + bytes, __ATOMIC_RELEASE);
+  }
+
+  return 0;
+}
+
+bool
+ReplayOpen(const char* path, const ReplayHeader* header)
+{
+  ReplayRecorder* r = &kReplayRecorder;
+  assert(!r->file);
+  r->file = fopen(path, "wb");
+  if (!r->file) return false;
+  if (fwrite(header, sizeof(ReplayHeader), 1, r->file) != 1) {
+    fclose(r->file);
+    r->file = nullptr;
+    return false;
+  }
+
+  r->read = r->write = 0;
+  r->frame = 0;
+  r->exit = false;
+  r->thread = ThreadInfo{0, ReplayWriter, r};
+  return platform::thread_create(&r->thread);
+}
+
+// Copies bytes into the ring, waiting on the writer when it is full
+void
+ReplayAppend(ReplayRecorder* r, const void* data, uint64_t bytes)
+{
+  assert(bytes <= MAX_REPLAY_BUFFER);
+  while (r->write + bytes -
+             __atomic_load_n(&r->read, __ATOMIC_ACQUIRE) >
+         MAX_REPLAY_BUFFER) {
+    r->stall_count += 1;
+    platform::thread_yield();
+  }
+
+  const uint8_t* src = (const uint8_t*)data;
+  uint64_t write = r->write;
+  while (bytes) {
+    const uint64_t offset = write % MAX_REPLAY_BUFFER;
+    const uint64_t room = MAX_REPLAY_BUFFER - offset;
+    const uint64_t n = MIN(bytes, room);
+    memcpy(r->buffer + offset, src, n);
+    src += n;
+    write += n;
+    bytes -= n;
+  }
+  __atomic_store_n(&r->write, write, __ATOMIC_RELEASE);
+}
+
+// Records the turn of each player for the next frame. hash is the
+// simulation hash before the turn.
+void
+ReplayRecord(const InputBuffer* turn, uint64_t player_count, uint64_t hash)
+{
+  ReplayRecorder* r = &kReplayRecorder;
+  if (!r->file) return;
+
+  ReplayFrame f = {};
+  f.frame = r->frame;
+  for (int i = 0; i < player_count; ++i) {
+    f.event_count[i] = turn[i].used_input_event;
+  }
+  if (r->frame % REPLAY_CHECKPOINT == 0) f.hash = hash;
+  ReplayAppend(r, &f, sizeof(f));
+  for (int i = 0; i < player_count; ++i) {
+    ReplayAppend(r, turn[i].input_event,
+                 turn[i].used_input_event * sizeof(PlatformEvent));
+  }
+  r->frame += 1;
+}
+
+// Writes out the buffered records and closes the file
+void
+ReplayClose()
+{
+  ReplayRecorder* r = &kReplayRecorder;
+  if (!r->file) return;
+
+  __atomic_store_n(&r->exit, true, __ATOMIC_RELEASE);
+  platform::thread_join(&r->thread);
+  fclose(r->file);
+  r->file = nullptr;
+}
+
+uint64_t
+ReplayFrameBytes(const ReplayFrame* f)
+{
+  uint64_t events = 0;
+  for (int i = 0; i < MAX_PLAYER; ++i) {
+    events += f->event_count[i];
+  }
+  return sizeof(ReplayFrame) + events * sizeof(PlatformEvent);
+}
+
+// Events of player in the record
+const PlatformEvent*
+ReplayEvents(const ReplayFrame* f, uint64_t player)
+{
+  const PlatformEvent* event = (const PlatformEvent*)(f + 1);
+  for (int i = 0; i < player; ++i) {
+    event += f->event_count[i];
+  }
+  return event;
+}
+
+// Maps the file and indexes its records
+bool
+ReplayLoad(const char* path, Replay* replay)
+{
+  replay->data = filesystem::MapFile(path, &replay->bytes);
+  if (!replay->data) return false;
+
+  replay->header = (const ReplayHeader*)replay->data;
+  if (replay->bytes < sizeof(ReplayHeader) ||
+      strcmp(replay->header->magic, REPLAY) != 0 ||
+      replay->header->version != REPLAY_VERSION ||
+      replay->header->player_count > MAX_PLAYER) {
+    filesystem::UnmapFile(replay->data, replay->bytes);
+    replay->data = nullptr;
+    return false;
+  }
+
+  uint64_t offset = sizeof(ReplayHeader);
+  uint64_t frame = 0;
+  while (offset + sizeof(ReplayFrame) <= replay->bytes) {
+    const ReplayFrame* f = (const ReplayFrame*)(replay->data + offset);
+    if (f->frame != (uint32_t)frame) break;
+    const uint64_t bytes = ReplayFrameBytes(f);
+    if (offset + bytes > replay->bytes) break;
+    if (frame % REPLAY_CHECKPOINT == 0) {
+      if (frame / REPLAY_CHECKPOINT >= MAX_REPLAY_INDEX) break;
+      replay->index[frame / REPLAY_CHECKPOINT] = offset;
+    }
+    offset += bytes;
+    frame += 1;
+  }
+  replay->frame_count = frame;
+
+  return true;
+}
+
+void
+ReplayUnload(Replay* replay)
+{
+  if (!replay->data) return;
+  filesystem::UnmapFile(replay->data, replay->bytes);
+  replay->data = nullptr;
+}
+
+// Record of frame, or nullptr past the end
+const ReplayFrame*
+ReplayFind(const Replay* replay, uint64_t frame)
+{
+  if (frame >= replay->frame_count) return nullptr;
+
+  uint64_t offset = replay->index[frame / REPLAY_CHECKPOINT];
+  for (uint64_t i = frame % REPLAY_CHECKPOINT; i > 0; --i) {
+    offset += ReplayFrameBytes((const ReplayFrame*)(replay->data + offset));
+  }
+  return (const ReplayFrame*)(replay->data + offset);
+}
+
+// Record after f, or nullptr past the end
+const ReplayFrame*
+ReplayNext(const Replay* replay, const ReplayFrame* f)
+{
+  if (f->frame + 1 >= replay->frame_count) return nullptr;
+  return (const ReplayFrame*)((const uint8_t*)f + ReplayFrameBytes(f));
+}
@@ -0,0 +1,98 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "replay.cc"
+
+constexpr uint64_t kFrameCount = 20000;
+constexpr const char* kPath = "replay_test.bin";
+
+static InputBuffer kTurn[MAX_PLAYER];
+static Replay kReplay;
+
+// Events vary in count and content with frame and player
+void
+Turn(uint64_t frame)
+{
+  for (int i = 0; i < MAX_PLAYER; ++i) {
+    InputBuffer* b = &kTurn[i];
+    b->used_input_event = (frame * 7 + i) % 5;
+    for (int j = 0; j < b->used_input_event; ++j) {
+      b->input_event[j].type = MOUSE_POSITION;
+      b->input_event[j].position = v2f(frame, i * 100 + j);
+    }
+  }
+}
+
+uint64_t
+Hash(uint64_t frame)
+{
+  return frame * 0x9E3779B97F4A7C15ull + 1;
+}
+
+void
+Check(uint64_t frame_count)
+{
+  assert(ReplayLoad(kPath, &kReplay));
+  assert(kReplay.header->seed == 1234);
+  assert(kReplay.header->player_count == MAX_PLAYER);
+  assert(kReplay.frame_count == frame_count);
+
+  uint64_t frame = 0;
+  const ReplayFrame* f = ReplayFind(&kReplay, 0);
+  for (; f; f = ReplayNext(&kReplay, f), ++frame) {
+    assert(f->frame == frame);
+    assert(f->hash == (frame % REPLAY_CHECKPOINT ? 0 : Hash(frame)));
+    Turn(frame);
+    for (int i = 0; i < MAX_PLAYER; ++i) {
+      assert(f->event_count[i] == kTurn[i].used_input_event);
+      assert(memcmp(ReplayEvents(f, i), kTurn[i].input_event,
+                    f->event_count[i] * sizeof(PlatformEvent)) == 0);
+    }
+  }
+  assert(frame == frame_count);
+
+  // Seek
+  assert(ReplayFind(&kReplay, frame_count / 3)->frame == frame_count / 3);
+  assert(!ReplayFind(&kReplay, frame_count));
+  ReplayUnload(&kReplay);
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  ReplayHeader header;
+  header.seed = 1234;
+  header.player_count = MAX_PLAYER;
+  assert(ReplayOpen(kPath, &header));
+  uint64_t begin = rdtsc();
+  for (uint64_t frame = 0; frame < kFrameCount; ++frame) {
+    Turn(frame);
+    ReplayRecord(kTurn, MAX_PLAYER, Hash(frame));
+  }
+  const uint64_t record_tsc = rdtsc() - begin;
+  ReplayClose();
+  Check(kFrameCount);
+
+  // A crash leaves a partial last record
+  FILE* f = fopen(kPath, "rb+");
+  fseek(f, 0, SEEK_END);
+  const long bytes = ftell(f);
+  fclose(f);
+  assert(truncate(kPath, bytes - 1) == 0);
+  Check(kFrameCount - 1);
+  remove(kPath);
+
+  printf(
+      "[ %lu bytes ] "
+      "[ record %lu ns/frame ] "
+      "[ stall %lu ] "
+      "\n",
+      bytes, record_tsc * 1000 / median_tsc_per_usec / kFrameCount,
+      kReplayRecorder.stall_count);
+
+  puts("ok");
+  return 0;
+}
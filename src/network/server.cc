@@ -1,28 +1,41 @@
+#include <cstddef>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+#include "connection.cc"
 #include "platform/platform.cc"
 #include "protocol.cc"
 
-static ThreadInfo thread;
-
-struct ServerParam {
-  const char* ip;
-  const char* port;
-};
-static ServerParam thread_param;
-
 #define MAX_GAMEQUEUE 128
 #define GAMEQUEUE_SLOT(sequence) ((sequence) % MAX_GAMEQUEUE)
 #define MAX_GAME 10
 #define MAX_PLAYER 2
+// Player table of a shard, room for a full game in every game slot
+#define MAX_SHARD_PLAYER (MAX_GAME * MAX_PLAYER)
+// Slots of the player and game indices, see connection.cc
+#define MAX_PLAYER_SLOT 64
+#define MAX_GAME_SLOT 16
+#define MAX_SHARD 64
+// Shard that issued a connection_id, named by its first byte
+#define CONNECTION_SHARD(connection_id) ((connection_id) % MAX_SHARD)
+// Datagrams in flight to a shard from the others
+#define MAX_HANDOFF 256
 #define MAX_PACKET_IN 1024
+// Turn records of a game are allocated a slab at a time, each with room for
+// two of the largest turns
+#define TURN_SLAB_RECORD (2 * MAX_PACKET_IN)
+// Slab bytes of one game at most: no more than a window of the largest turns
+#define MAX_GAME_TURN_BYTES (MAX_GAMEQUEUE * MAX_PLAYER * MAX_PACKET_IN)
+#define MAX_GAME_SLAB (MAX_GAME_TURN_BYTES / sizeof(TurnSlab))
 #define MAX_PACKET_OUT (MAX_PLAYER * 1024)
 #define TIMEOUT_USEC (2 * 1000 * 1000)
 // Update packets per frame
 #define MAX_UPDATE 1
 #define GAME_TICK_USEC (16333)
 #define SERVER_TICK_USEC (8333)
+// Period of the memory stats of each shard, see shard_stats()
+#define STATS_USEC (10 * 1000 * 1000)
 
 #ifndef ALAN
 constexpr bool ALAN = false;
@@ -38,7 +51,10 @@ constexpr bool ALAN = false;
 
 struct PlayerState {
   Udp4 peer;
+  // Issued at the handshake, 0 when the entry is unused
+  uint64_t connection_id;
   uint64_t num_players;
+  uint64_t match_key;
   uint64_t game_index = kInvalidIndex;
   uint64_t pending_game_id;
   uint64_t last_active;
@@ -53,7 +69,17 @@ struct PlayerState {
   uint64_t window_height;
 };
 static PlayerState zero_player;
-static PlayerState player[MAX_PLAYER];
+
+// Turns of a game, as received, in arrival order
+struct TurnSlab {
+  TurnSlab* next;
+  // Latest frame with a turn in the slab
+  uint64_t last_frame;
+  uint64_t used;
+  uint8_t record[TURN_SLAB_RECORD];
+};
+static_assert(sizeof(TurnSlab) == 3 * sizeof(uint64_t) + TURN_SLAB_RECORD,
+              "TurnSlab padding");
 
 struct Game {
   // Unique id of a game session or 0 when unused
@@ -64,50 +90,352 @@ struct Game {
   uint64_t last_frame;
   // Simulation frame confirmed by all participants
   uint64_t ack_frame;
-  // Game data (no protocol wrapper)
-  uint8_t slot[MAX_GAMEQUEUE][MAX_PLAYER][MAX_PACKET_IN];
-  // Game byte count
-  uint64_t used_slot[MAX_GAMEQUEUE][MAX_PLAYER];
+  // Encoded turns, as received (see turn.cc), in the slabs of the game
+  const uint8_t* slot[MAX_GAMEQUEUE][MAX_PLAYER];
+  // Turn byte count, 0 until received
+  uint16_t used_slot[MAX_GAMEQUEUE][MAX_PLAYER];
+  // Slabs in allocation order. Any but the last returns to the shard once
+  // every frame it holds is acknowledged, see game_recycle().
+  TurnSlab* slab_head;
+  TurnSlab* slab_tail;
+  // Memory accounting
+  uint64_t slab_count;
+  uint64_t slab_peak;
+  uint64_t turn_count;
+  uint64_t turn_bytes;
   // Game start time
   uint64_t start_usec;
+  // Checkpoint roots reported by each player
+  uint64_t digest_frame[MAX_DIGEST_CHECKPOINT][MAX_PLAYER];
+  uint64_t digest_root[MAX_DIGEST_CHECKPOINT][MAX_PLAYER];
+  // Checkpoint under inspection after a root mismatch, or 0
+  uint64_t desync_frame;
+  // Registry whose leaves are requested, kInvalidIndex for nodes
+  uint64_t desync_registry;
+  DigestTree desync_tree[MAX_PLAYER];
+  // Localization runs once per game
+  bool desync_reported;
 };
-static Game game[MAX_GAME];
 
+// Datagram received by the shard that does not own its peer
+struct Handoff {
+  Udp4 peer;
+  uint16_t bytes;
+  uint8_t packet[MAX_PACKET_IN];
+};
+
+// Written by any shard under the lock, read by the owner
+struct HandoffQueue {
+  ALIGNAS(64) uint32_t lock;
+  uint64_t read;
+  uint64_t write;
+  Handoff datagram[MAX_HANDOFF];
+};
+
+static_assert(MAX_PLAYER_SLOT - MAX_PLAYER_SLOT / 4 >= MAX_SHARD_PLAYER,
+              "MAX_PLAYER_SLOT too small");
+static_assert(MAX_GAME_SLOT - MAX_GAME_SLOT / 4 >= MAX_GAME,
+              "MAX_GAME_SLOT too small");
+static_assert(256 % MAX_SHARD == 0, "CONNECTION_SHARD beyond the first byte");
+
+// The server runs one shard per thread. Shards bind the same port with
+// SO_REUSEPORT, each with its own socket, tick, players and games. The
+// kernel steers datagrams to the shard udp::ReusePortSelect() selects, when
+// it can. A datagram the receiving shard does not own is handed off to its
+// owner: see shard_owner().
+struct Shard {
+  PlayerState player[MAX_SHARD_PLAYER];
+  Game game[MAX_GAME];
+  Udp4 location;
+  TscClock_t clock;
+  uint64_t next_game_id;
+  // Datagrams of one ReceiveMany()
+  Udp4Batch in_batch;
+  uint8_t in_packet[MAX_UDP_BATCH][MAX_PACKET_IN];
+  // Packets of a server tick, sent by one SendMany()
+  Udp4Batch out_batch;
+  uint8_t out_packet[MAX_UDP_BATCH][MAX_PACKET_OUT];
+  HandoffQueue handoff;
+  // Players by ConnectionKey(), games by game_id, each table fits at the
+  // load limit
+  IndexTable player_index;
+  IndexSlot player_slot[MAX_PLAYER_SLOT];
+  IndexTable game_index;
+  IndexSlot game_slot[MAX_GAME_SLOT];
+  // Unused entries of the tables, the lowest index on top
+  uint32_t free_player[MAX_SHARD_PLAYER];
+  uint64_t free_player_count;
+  uint32_t free_game[MAX_GAME];
+  uint64_t free_game_count;
+  // Issues connection_ids, see CONNECTION_SHARD()
+  uint64_t next_connection_id;
+  // Unused slabs of the games, see slab_alloc()
+  TurnSlab* free_slab;
+  uint64_t slab_allocated;
+  uint64_t peak_game_bytes;
+  uint64_t index;
+  ThreadInfo thread;
+  // Diagnostics
+  uint64_t received;
+  uint64_t handed_off;
+  uint64_t handoff_dropped;
+};
+
+static Shard* shard_list;
+static uint64_t shard_count;
+// Read and written by every shard thread: __atomic only
 static bool running = true;
-static uint64_t next_game_id = time(0);
-static TscClock_t server_clock;
+// Kernel steering of datagrams to their shard, off to exercise handoffs
+static bool shard_steer = true;
+static bool shard_steered;
+
+// Shard of the calling thread, with its tables
+static thread_local Shard* shard;
+static thread_local PlayerState* player;
+static thread_local Game* game;
+
+void
+shard_bind(Shard* s)
+{
+  shard = s;
+  player = s ? s->player : nullptr;
+  game = s ? s->game : nullptr;
+}
 
+// Handshakes select a shard by match_key, so that the players of a game
+// meet on one shard, or by address for a solo game. Later packets lead
+// with a connection_id naming the shard that issued it.
+static const ReusePortRule shard_rule = {
+    {GREETING[0], GREETING[1], GREETING[2], GREETING[3]},
+    sizeof(Handshake),
+    offsetof(Handshake, match_key),
+    MAX_SHARD,
+};
+
+uint64_t
+shard_owner(Udp4 peer, const uint8_t* packet, uint16_t bytes)
+{
+  if (shard_count == 1) return 0;
+
+  return udp::ReusePortSelect(&shard_rule, peer, packet, bytes, shard_count);
+}
+
+void
+handoff_lock(HandoffQueue* q)
+{
+  while (__atomic_exchange_n(&q->lock, 1, __ATOMIC_ACQUIRE)) {
+    _mm_pause();
+  }
+}
+
+void
+handoff_unlock(HandoffQueue* q)
+{
+  __atomic_store_n(&q->lock, 0, __ATOMIC_RELEASE);
+}
+
+// False when the queue of the owner is full: the datagram is dropped
+bool
+handoff_push(Shard* owner, Udp4 peer, const uint8_t* packet, uint16_t bytes)
+{
+  HandoffQueue* q = &owner->handoff;
+  handoff_lock(q);
+  bool ok = q->write - q->read < MAX_HANDOFF;
+  if (ok) {
+    Handoff* h = &q->datagram[q->write++ % MAX_HANDOFF];
+    h->peer = peer;
+    h->bytes = bytes;
+    memcpy(h->packet, packet, bytes);
+  }
+  handoff_unlock(q);
+  return ok;
+}
+
+bool
+handoff_pop(Shard* s, Handoff* out)
+{
+  HandoffQueue* q = &s->handoff;
+  if (__atomic_load_n(&q->write, __ATOMIC_ACQUIRE) == q->read) return false;
+
+  handoff_lock(q);
+  bool ok = q->read != q->write;
+  if (ok) {
+    const Handoff* h = &q->datagram[q->read++ % MAX_HANDOFF];
+    out->peer = h->peer;
+    out->bytes = h->bytes;
+    memcpy(out->packet, h->packet, h->bytes);
+  }
+  handoff_unlock(q);
+  return ok;
+}
+
+// Player of the peer, -1 when unknown. A connection_id of 0 matches any:
+// handshakes precede the id.
 int
-GetPlayerIndexFromPeer(Udp4* peer)
+GetPlayerIndexFromPeer(const Udp4* peer, uint64_t connection_id)
 {
-  for (int i = 0; i < MAX_PLAYER; ++i) {
-    if (memcmp(peer, &player[i].peer, sizeof(Udp4)) == 0) return i;
+  const uint64_t key = ConnectionKey(peer);
+  uint64_t cursor = 0;
+  uint32_t i;
+  while ((i = IndexFind(&shard->player_index, key, &cursor)) != INDEX_EMPTY) {
+    if (memcmp(peer->socket_address, player[i].peer.socket_address,
+               sizeof(peer->socket_address)) != 0)
+      continue;
+    if (connection_id && connection_id != player[i].connection_id) return -1;
+    return i;
   }
 
   return -1;
 }
 
+// Unused player entry, indexed by the address of peer
 int
-GetNextPlayerIndex()
+GetNextPlayerIndex(const Udp4* peer)
 {
-  for (int i = 0; i < MAX_PLAYER; ++i) {
-    if (memcmp(&zero_player, &player[i], sizeof(PlayerState)) == 0) return i;
+  if (!shard->free_player_count) return -1;
+  const uint32_t i = shard->free_player[shard->free_player_count - 1];
+  if (!IndexInsert(&shard->player_index, ConnectionKey(peer), i)) return -1;
+
+  shard->free_player_count -= 1;
+  return i;
+}
+
+void
+RemovePlayer(int pidx)
+{
+  if (!player[pidx].connection_id) return;
+  IndexRemove(&shard->player_index, ConnectionKey(&player[pidx].peer), pidx);
+  shard->free_player[shard->free_player_count++] = pidx;
+  player[pidx] = {};
+}
+
+// Slabs are allocated as games need them and kept by the shard for reuse
+TurnSlab*
+slab_alloc()
+{
+  TurnSlab* s = shard->free_slab;
+  if (s) {
+    shard->free_slab = s->next;
+  } else {
+    s = (TurnSlab*)malloc(sizeof(TurnSlab));
+    if (!s) return nullptr;
+    shard->slab_allocated += 1;
   }
+  s->next = nullptr;
+  s->last_frame = 0;
+  s->used = 0;
+  return s;
+}
 
-  return -1;
+void
+slab_free(TurnSlab* s)
+{
+  s->next = shard->free_slab;
+  shard->free_slab = s;
+}
+
+void
+slab_destroy(TurnSlab* s)
+{
+  while (s) {
+    TurnSlab* next = s->next;
+    free(s);
+    s = next;
+  }
+}
+
+// Frees the slabs of the shard, those held by its games included
+void
+slab_release(Shard* s)
+{
+  for (int i = 0; i < MAX_GAME; ++i) {
+    slab_destroy(s->game[i].slab_head);
+  }
+  slab_destroy(s->free_slab);
 }
 
+uint64_t
+game_bytes(const Game* g)
+{
+  return sizeof(Game) + g->slab_count * sizeof(TurnSlab);
+}
+
+// Room for a turn of frame, nullptr when the game holds MAX_GAME_SLAB slabs
+uint8_t*
+game_record(uint64_t game_index, uint64_t frame, uint64_t bytes)
+{
+  Game* g = &game[game_index];
+  TurnSlab* tail = g->slab_tail;
+  // Every turn of the last slab is acknowledged: start over
+  if (tail && tail->last_frame < g->ack_frame) {
+    tail->used = 0;
+  }
+
+  if (!tail || sizeof(tail->record) - tail->used < bytes) {
+    if (g->slab_count >= MAX_GAME_SLAB) return nullptr;
+    TurnSlab* s = slab_alloc();
+    if (!s) return nullptr;
+    if (tail) {
+      tail->next = s;
+    } else {
+      g->slab_head = s;
+    }
+    g->slab_tail = tail = s;
+    g->slab_count += 1;
+    g->slab_peak = MAX(g->slab_peak, g->slab_count);
+    shard->peak_game_bytes = MAX(shard->peak_game_bytes, game_bytes(g));
+  }
+
+  uint8_t* record = tail->record + tail->used;
+  tail->used += bytes;
+  tail->last_frame = MAX(tail->last_frame, frame);
+  g->turn_count += 1;
+  g->turn_bytes += bytes;
+  return record;
+}
+
+// Returns the slabs whose turns are all acknowledged to the shard
+void
+game_recycle(uint64_t game_index)
+{
+  Game* g = &game[game_index];
+  while (g->slab_head != g->slab_tail &&
+         g->slab_head->last_frame < g->ack_frame) {
+    TurnSlab* s = g->slab_head;
+    g->slab_head = s->next;
+    g->slab_count -= 1;
+    slab_free(s);
+  }
+}
+
+// Game of game_id, or an unused game now indexed by game_id
 int
 GetGameIndex(uint64_t game_id)
 {
-  for (int i = 0; i < MAX_GAME; ++i) {
+  uint64_t cursor = 0;
+  uint32_t i;
+  while ((i = IndexFind(&shard->game_index, game_id, &cursor)) != INDEX_EMPTY) {
     if (game[i].game_id == game_id) return i;
   }
-  for (int i = 0; i < MAX_GAME; ++i) {
-    if (game[i].game_id == 0) return i;
-  }
+  if (!shard->free_game_count) return -1;
+  i = shard->free_game[shard->free_game_count - 1];
+  if (!IndexInsert(&shard->game_index, game_id, i)) return -1;
 
-  return -1;
+  shard->free_game_count -= 1;
+  return i;
+}
+
+void
+RemoveGame(int gidx)
+{
+  IndexRemove(&shard->game_index, game[gidx].game_id, gidx);
+  while (game[gidx].slab_head) {
+    TurnSlab* s = game[gidx].slab_head;
+    game[gidx].slab_head = s->next;
+    slab_free(s);
+  }
+  shard->free_game[shard->free_game_count++] = gidx;
+  game[gidx] = {};
 }
 
 uint64_t
@@ -116,12 +444,13 @@ PlayerContiguousSequence(uint64_t pidx)
   uint64_t gidx = player[pidx].game_index;
   assert(gidx != kInvalidIndex);
   Game* g = &game[gidx];
+  const uint64_t pid = player[pidx].player_index;
 
   uint64_t slot = GAMEQUEUE_SLOT(g->last_frame + 1);
   uint64_t end_slot = GAMEQUEUE_SLOT(g->ack_frame);
   uint64_t count = 0;
   while (slot != end_slot) {
-    if (!g->used_slot[slot][pidx]) {
+    if (!g->used_slot[slot][pid]) {
       break;
     }
     slot = GAMEQUEUE_SLOT(slot + 1);
@@ -134,28 +463,28 @@ PlayerContiguousSequence(uint64_t pidx)
 void
 prune_players(uint64_t rt_usec)
 {
-  for (int i = 0; i < MAX_PLAYER; ++i) {
-    if (memcmp(&player[i], &zero_player, sizeof(PlayerState)) == 0) continue;
+  for (int i = 0; i < MAX_SHARD_PLAYER; ++i) {
+    if (!player[i].connection_id) continue;
     if (rt_usec - player[i].last_active > TIMEOUT_USEC) {
       SERVER_LOGFMT(
           "Server dropped packet flow. [ index %d ] [ game_index %lu ] [ "
           "realtime_usec %lu ] [ last_active %lu ]\n",
           i, player[i].game_index, rt_usec, player[i].last_active);
-      player[i] = {};
+      RemovePlayer(i);
     }
     if (player[i].cookie_mismatch > 3) {
       SERVER_LOGFMT("Server closed packet flow: cookie_mismatch. [index %d]\n",
                     i);
-      player[i] = {};
+      RemovePlayer(i);
     }
     if (player[i].latency_excess > 3) {
       SERVER_LOG(
           "Server closed packet flow: ack_frame latency gap is excessive");
-      player[i] = {};
+      RemovePlayer(i);
     }
     if (player[i].corrupted) {
       SERVER_LOG("Server closed packet flow: corrupted");
-      player[i] = {};
+      RemovePlayer(i);
     }
   }
 }
@@ -165,7 +494,7 @@ prune_games()
 {
   bool active_game[MAX_GAME] = {};
 
-  for (int pidx = 0; pidx < MAX_PLAYER; ++pidx) {
+  for (int pidx = 0; pidx < MAX_SHARD_PLAYER; ++pidx) {
     uint64_t game_index = player[pidx].game_index;
     if (game_index == kInvalidIndex) continue;
     active_game[game_index] = 1;
@@ -175,9 +504,19 @@ prune_games()
     if (active_game[gidx]) continue;
     uint64_t game_id = game[gidx].game_id;
     if (!game_id) continue;
-    SERVER_LOGFMT("Server removed game [ game_index %d ] [ game_id %lu ]\n",
-                  gidx, game_id);
-    game[gidx] = {};
+    const Game* g = &game[gidx];
+    // Reported regardless of NSLOG: memory accounting of the game
+    printf(
+        "Server removed game "
+        "[ game_index %d ] "
+        "[ game_id %lu ] "
+        "[ turns %lu ] "
+        "[ turn_bytes %lu ] "
+        "[ peak_bytes %lu ] "
+        "\n",
+        gidx, game_id, g->turn_count, g->turn_bytes,
+        sizeof(Game) + g->slab_peak * sizeof(TurnSlab));
+    RemoveGame(gidx);
   }
 }
 
@@ -192,16 +531,13 @@ AppendFrame(uint64_t frame, uint64_t game_index, const uint8_t* end_buffer,
   nf->frame = frame;
   uint8_t* offset = (*write_ref + sizeof(NotifyFrame));
   for (int j = 0; j < num_players; ++j) {
-    Turn* nt = (Turn*)offset;
-    uint64_t event_bytes = game[game_index].used_slot[sidx][j];
-
-    if (offset + sizeof(Turn) + event_bytes >= end_buffer) return false;
+    // Turns are relayed as received, see turn.cc
+    uint64_t turn_bytes = game[game_index].used_slot[sidx][j];
 
-    uint8_t* event = offset + sizeof(Turn);
-    memcpy(event, game[game_index].slot[sidx][j], event_bytes);
-    nt->event_bytes = event_bytes;
+    if (offset + turn_bytes >= end_buffer) return false;
 
-    offset += sizeof(Turn) + event_bytes;
+    memcpy(offset, game[game_index].slot[sidx][j], turn_bytes);
+    offset += turn_bytes;
   }
 
   *write_ref = offset;
@@ -209,10 +545,100 @@ AppendFrame(uint64_t frame, uint64_t game_index, const uint8_t* end_buffer,
   return true;
 }
 
+// Compares the checkpoint roots of all players, requesting the nodes of the
+// first checkpoint that differs
+void
+game_digest(uint64_t game_index, uint64_t pid, uint64_t frame, uint64_t root)
+{
+  Game* g = &game[game_index];
+  if (!frame || frame % DIGEST_INTERVAL) return;
+
+  const uint64_t c = DIGEST_CHECKPOINT(frame);
+  g->digest_frame[c][pid] = frame;
+  g->digest_root[c][pid] = root;
+  if (g->desync_frame || g->desync_reported) return;
+
+  for (int i = 0; i < g->num_players; ++i) {
+    if (g->digest_frame[c][i] != frame) return;
+  }
+  for (int i = 1; i < g->num_players; ++i) {
+    if (g->digest_root[c][i] == g->digest_root[c][0]) continue;
+    SERVER_LOGFMT("Server desync [ game_id %lu ] [ frame %lu ]\n",
+                  g->game_id, frame);
+    g->desync_frame = frame;
+    g->desync_registry = kInvalidIndex;
+    return;
+  }
+}
+
+// Descends one level of the tree once every player has replied
+void
+game_desync(uint64_t game_index, uint64_t pid, const DigestTree* tree)
+{
+  Game* g = &game[game_index];
+  if (!g->desync_frame || tree->frame != g->desync_frame) return;
+  if (tree->registry != g->desync_registry) return;
+
+  g->desync_tree[pid] = *tree;
+  for (int i = 0; i < g->num_players; ++i) {
+    if (g->desync_tree[i].frame != g->desync_frame) return;
+    if (g->desync_tree[i].registry != g->desync_registry) return;
+  }
+
+  uint64_t registry = kInvalidIndex;
+  uint64_t slot = kInvalidIndex;
+  for (int i = 1; i < g->num_players && registry == kInvalidIndex; ++i) {
+    registry = DigestFirstNode(&g->desync_tree[0], &g->desync_tree[i]);
+    if (g->desync_registry == kInvalidIndex) continue;
+    slot = DigestFirstLeaf(&g->desync_tree[0], &g->desync_tree[i]);
+  }
+
+  // Nodes differ: request the leaves of the first divergent registry
+  if (g->desync_registry == kInvalidIndex && registry != kInvalidIndex) {
+    g->desync_registry = registry;
+    return;
+  }
+
+  // Reported regardless of NSLOG: the game is no longer deterministic
+  printf(
+      "Server desync "
+      "[ game_id %lu ] "
+      "[ frame %lu ] "
+      "[ registry %ld ] "
+      "[ slot %ld ] "
+      "\n",
+      g->game_id, g->desync_frame, registry, slot);
+  g->desync_frame = 0;
+  g->desync_reported = true;
+}
+
+void
+server_flush(Udp4 location)
+{
+  Udp4Batch* out_batch = &shard->out_batch;
+  if (!out_batch->count) return;
+  udp::SendMany(location, out_batch);
+  out_batch->count = 0;
+}
+
+// Queues a copy of the packet, sent by the next server_flush()
+void
+server_send(Udp4 location, Udp4 peer, const uint8_t* buffer, uint16_t len)
+{
+  Udp4Batch* out_batch = &shard->out_batch;
+  assert(len <= MAX_PACKET_OUT);
+  if (out_batch->count == MAX_UDP_BATCH) server_flush(location);
+
+  const uint64_t i = out_batch->count++;
+  memcpy(out_batch->buffer[i], buffer, len);
+  out_batch->bytes[i] = len;
+  out_batch->peer[i] = peer;
+}
+
 void
 game_transmit(Udp4 location, uint64_t game_index)
 {
-  static uint8_t out_buffer[MAX_PACKET_OUT];
+  uint8_t out_buffer[MAX_PACKET_OUT];
   const Game* g = &game[game_index];
   const uint64_t game_id = g->game_id;
   if (!game_id) return;
@@ -222,7 +648,9 @@ game_transmit(Udp4 location, uint64_t game_index)
   uint64_t last_frame = g->last_frame;
   for (int i = 0; i < MAX_UPDATE; ++i) {
     NotifyUpdate* update = (NotifyUpdate*)out_buffer;
-    update->server_jerk = server_clock.jerk;
+    update->server_jerk = shard->clock.jerk;
+    update->digest_frame = g->desync_frame;
+    update->digest_registry = g->desync_registry;
     uint8_t* offset = out_buffer + sizeof(NotifyUpdate);
 
     const uint64_t start_frame = send_frame;
@@ -233,10 +661,10 @@ game_transmit(Udp4 location, uint64_t game_index)
       ++send_frame;
     }
 
-    for (int pidx = 0; pidx < MAX_PLAYER; ++pidx) {
+    for (int pidx = 0; pidx < MAX_SHARD_PLAYER; ++pidx) {
       if (player[pidx].game_index != game_index) continue;
       update->ack_sequence = player[pidx].sequence;
-      udp::SendTo(location, player[pidx].peer, out_buffer, offset - out_buffer);
+      server_send(location, player[pidx].peer, out_buffer, offset - out_buffer);
     }
     if (ALAN) {
       SERVER_LOGFMT("Server transmit [ start_frame %lu ] [ last_frame %lu ]\n",
@@ -274,7 +702,7 @@ game_update(uint64_t realtime_usec, uint64_t game_index)
     if (g->used_slot[sidx][i] == 0) return false;
   }
   uint64_t new_ack_frame = UINT64_MAX;
-  for (int pidx = 0; pidx < MAX_PLAYER; ++pidx) {
+  for (int pidx = 0; pidx < MAX_SHARD_PLAYER; ++pidx) {
     if (player[pidx].game_index != game_index) continue;
 
     new_ack_frame = MIN(new_ack_frame, player[pidx].ack_frame);
@@ -296,7 +724,7 @@ game_update(uint64_t realtime_usec, uint64_t game_index)
         " [ new_ack_frame %lu ] "
         " [ jerk %lu ] "
         "\n",
-        next_frame, g->ack_frame, new_ack_frame, server_clock.jerk);
+        next_frame, g->ack_frame, new_ack_frame, shard->clock.jerk);
   }
 
   g->last_frame = next_frame;
@@ -305,316 +733,527 @@ game_update(uint64_t realtime_usec, uint64_t game_index)
   return true;
 }
 
+struct GameTick {
+  Shard* shard;
+  uint64_t realtime_usec;
+  bool ready[MAX_GAME];
+};
+
+// Games advance independently: one job per range of games. Any thread may
+// run the job, a shard waiting on its own tick included.
+void
+game_update_job(void* arg, uint64_t begin, uint64_t end)
+{
+  GameTick* tick = (GameTick*)arg;
+  Shard* caller = shard;
+  shard_bind(tick->shard);
+  for (uint64_t i = begin; i < end; ++i) {
+    while (game_update(tick->realtime_usec, i)) {
+      tick->ready[i] = true;
+    }
+  }
+  shard_bind(caller);
+}
+
+// Handles one datagram, non-zero when the server must stop
 uint64_t
-server_main(void* void_arg)
+server_receive(Udp4 location, uint64_t realtime_usec, Udp4 peer,
+               uint8_t* in_buffer, uint16_t received_bytes)
 {
-  ServerParam* arg = (ServerParam*)void_arg;
+  // Handshake packet
+  if (received_bytes >= sizeof(Handshake) &&
+      strncmp(GREETING, (char*)in_buffer, greeting_size) == 0) {
+    // Duplicate handshake packet, idx already assigned
+    int pidx = GetPlayerIndexFromPeer(&peer, 0);
+    if (pidx != -1) {
+      player[pidx].last_active = realtime_usec;
+      return 0;
+    }
 
-  // network thread affinity set to anything but core 0
-  if (platform::thread_affinity_count() > 1) {
-    platform::thread_affinity_avoidcore(0);
-    SERVER_LOGFMT("Server thread may run on %d cores\n",
-                  platform::thread_affinity_count());
-  }
+    Handshake* header = (Handshake*)(in_buffer);
+    uint64_t num_players = header->num_players;
+    if (!num_players || num_players > MAX_PLAYER) return 0;
+    // No room for clients on this server
+    int player_index = GetNextPlayerIndex(&peer);
+    if (player_index == -1) return 0;
+
+    SERVER_LOGFMT("Server Accepted Handshake [index %d]\n", player_index);
+    player[player_index].peer = peer;
+    player[player_index].connection_id =
+        shard->next_connection_id++ * MAX_SHARD + shard->index;
+    player[player_index].num_players = num_players;
+    player[player_index].match_key = header->match_key;
+    player[player_index].game_index = kInvalidIndex;
+    player[player_index].pending_game_id = 0;
+    player[player_index].last_active = realtime_usec;
+    player[player_index].sequence = 0;
+    player[player_index].window_width = header->player_info.window_width;
+    player[player_index].window_height = header->player_info.window_height;
+
+    // Players waiting for a game of the same size and key, in table order
+    int ready[MAX_PLAYER];
+    uint64_t ready_players = 0;
+    for (int i = 0; i < MAX_SHARD_PLAYER && ready_players < num_players;
+         ++i) {
+      if (player[i].pending_game_id) continue;
+      if (player[i].num_players != num_players) continue;
+      if (player[i].match_key != header->match_key) continue;
+      ready[ready_players++] = i;
+    }
 
-  uint8_t in_buffer[MAX_PACKET_IN];
-  if (!udp::Init()) {
-    SERVER_LOG("server: fail init");
-    return 1;
-  }
+    if (ready_players >= num_players) {
+      NotifyGame* response = (NotifyGame*)(in_buffer);
+      uint64_t& next_game_id = shard->next_game_id;
 
-  Udp4 location;
-  if (!udp::GetAddr4(arg->ip, arg->port, &location)) {
-    SERVER_LOG("server: fail GetAddr4");
-    SERVER_LOG(arg->ip);
-    SERVER_LOG(arg->port);
-    return 2;
-  }
+      for (int player_index = 0; player_index < num_players; ++player_index) {
+        const int i = ready[player_index];
+        unsigned long long player_cookie;
+        if (!RDRND(&player_cookie)) {
+          SERVER_LOG("Server crypto rng failure");
+          return 4;
+        }
 
-  SERVER_LOGFMT("Server binding %s:%s\n", arg->ip, arg->port);
-  if (!udp::Bind(location)) {
-    SERVER_LOG("server: fail Bind");
-    return 3;
+        SERVER_LOGFMT(
+            "Server Greeting [index %d] [player_index %d] [player_count %d] "
+            "[next_game_id %d] [cookie 0x%llx]\n",
+            i, player_index, num_players, next_game_id, player_cookie);
+        response->connection_id = player[i].connection_id;
+        response->player_index = player_index;
+        response->player_count = num_players;
+        response->game_id = next_game_id;
+        response->cookie = player_cookie;
+        for (int j = 0; j < response->player_count; ++j) {
+          response->player_info[j].window_width = player[ready[j]].window_width;
+          response->player_info[j].window_height =
+              player[ready[j]].window_height;
+        }
+        udp::SendTo(location, player[i].peer, in_buffer, sizeof(NotifyGame));
+        player[i].pending_game_id = next_game_id;
+        player[i].player_index = player_index;
+        player[i].cookie = player_cookie;
+      }
+      next_game_id += 1 + (next_game_id == 0);
+    }
+
+    return 0;
   }
 
-  uint64_t realtime_usec = 0;
-  clock_init(SERVER_TICK_USEC, &server_clock);
-  while (running) {
-    uint16_t received_bytes;
-    Udp4 peer;
+  // Filter Identified clients
+  uint64_t connection_id;
+  if (received_bytes < sizeof(connection_id)) return 0;
+  memcpy(&connection_id, in_buffer, sizeof(connection_id));
+  if (!connection_id) return 0;
+  int pidx = GetPlayerIndexFromPeer(&peer, connection_id);
+  if (pidx == -1) {
+    return 0;
+  }
 
-    uint64_t sleep_usec;
-    if (clock_sync(&server_clock, &sleep_usec)) {
-      realtime_usec += SERVER_TICK_USEC;
+  // Mark player connection active
+  player[pidx].last_active = realtime_usec;
 
-      prune_players(realtime_usec);
-      prune_games();
-
-      bool ready[MAX_GAME] = {};
-      for (int i = 0; i < MAX_GAME; ++i) {
-        while (game_update(realtime_usec, i)) {
-          ready[i] = true;
-        }
+  // Handle pending games
+  uint64_t gidx = player[pidx].game_index;
+  if (gidx == kInvalidIndex) {
+    if (received_bytes == sizeof(BeginGame)) {
+      BeginGame* bgPacket = (BeginGame*)(in_buffer);
+      if (player[pidx].cookie != bgPacket->cookie) {
+        player[pidx].cookie_mismatch += 1;
+        SERVER_LOG("cookie mismatch");
+        return 0;
       }
-      for (int i = 0; i < MAX_GAME; ++i) {
-        if (!ready[i]) continue;
-        game_transmit(location, i);
+      // two-way interest is agreed, copy pending_game_id to game_id
+      uint64_t game_id = player[pidx].pending_game_id;
+      gidx = GetGameIndex(game_id);
+      if (gidx == -1) {
+        SERVER_LOG("Server is out of space for Space");
+        return 0;
       }
-    } else {
-#ifndef WIN32
-      udp::PollUsec(location, sleep_usec);
-#endif
+      player[pidx].game_index = gidx;
+      game[gidx].game_id = game_id;
+      game[gidx].num_players = player[pidx].num_players;
+      game[gidx].last_frame = 0;
+      game[gidx].ack_frame = 0;
+      game[gidx].start_usec = realtime_usec;
+      SERVER_LOGFMT("Server created Game [ game_index %lu ]\n", gidx);
+      return 0;
     }
 
-    if (!udp::ReceiveAny(location, MAX_PACKET_IN, in_buffer, &received_bytes,
-                         &peer)) {
-      if (udp_errno) running = false;
-      if (udp_errno) SERVER_LOGFMT("Server udp_errno %d\n", udp_errno);
-      continue;
+    if (ALAN) {
+      SERVER_LOG("Unknown message during pending state");
     }
+    return 0;
+  }
 
-    int pidx = GetPlayerIndexFromPeer(&peer);
-
-    // Handshake packet
-    if (received_bytes >= sizeof(Handshake) &&
-        strncmp(GREETING, (char*)in_buffer, greeting_size) == 0) {
-      // No room for clients on this server
-      int player_index = GetNextPlayerIndex();
-      if (player_index == -1) continue;
-      // Duplicate handshake packet, idx already assigned
-      if (pidx != -1) continue;
-
-      Handshake* header = (Handshake*)(in_buffer);
-      uint64_t num_players = header->num_players;
-      SERVER_LOGFMT("Server Accepted Handshake [index %d]\n", player_index);
-      player[player_index].peer = peer;
-      player[player_index].num_players = num_players;
-      player[player_index].game_index = kInvalidIndex;
-      player[player_index].pending_game_id = 0;
-      player[player_index].last_active = realtime_usec;
-      player[player_index].sequence = 0;
-      player[player_index].window_width = header->player_info.window_width;
-      player[player_index].window_height = header->player_info.window_height;
-
-      int ready_players = 0;
-      for (int i = 0; i < MAX_PLAYER; ++i) {
-        if (player[i].pending_game_id) continue;
-        if (player[i].num_players != num_players) continue;
-        ++ready_players;
-      }
+  // Require address stability
+  if (memcmp(&player[pidx].peer, &peer, sizeof(Udp4)) != 0) {
+    SERVER_LOG("unhandled: player address changed");
+    return 0;
+  }
 
-      if (ready_players >= num_players) {
-        NotifyGame* response = (NotifyGame*)(in_buffer);
-
-        uint64_t player_index = 0;
-        for (int i = 0; i < MAX_PLAYER; ++i) {
-          if (player[i].pending_game_id) continue;
-          if (player[i].num_players != num_players) continue;
-          unsigned long long player_cookie;
-          if (!RDRND(&player_cookie)) {
-            SERVER_LOG("Server crypto rng failure");
-            return 4;
-          }
-
-          SERVER_LOGFMT(
-              "Server Greeting [index %d] [player_index %d] [player_count %d] "
-              "[next_game_id %d] [cookie 0x%llx]\n",
-              i, player_index, num_players, next_game_id, player_cookie);
-          response->player_index = player_index;
-          response->player_count = num_players;
-          response->game_id = next_game_id;
-          response->cookie = player_cookie;
-          for (int i = 0; i < response->player_count; ++i) {
-            response->player_info[i].window_width = player[i].window_width;
-            response->player_info[i].window_height = player[i].window_height;
-          }
-          udp::SendTo(location, player[i].peer, in_buffer, sizeof(NotifyGame));
-          player[i].pending_game_id = next_game_id;
-          player[i].player_index = player_index;
-          player[i].cookie = player_cookie;
-          ++player_index;
-        }
-        next_game_id += 1 + (next_game_id == 0);
-      }
-    }
+  uint64_t pid = player[pidx].player_index;
+  if (received_bytes == sizeof(DigestTree) &&
+      strncmp(DIGEST, ((DigestTree*)in_buffer)->magic, greeting_size) == 0) {
+    game_desync(gidx, pid, (const DigestTree*)in_buffer);
+    return 0;
+  }
 
-    // Filter Identified clients
-    if (pidx == -1) {
-      continue;
-    }
+  if (received_bytes < sizeof(Update)) return 0;
+  const Update* packet = (Update*)in_buffer;
+  if (ALAN) {
+    SERVER_LOGFMT(
+        "SvrRcv Precheck "
+        "[ %lu received_bytes ] "
+        "[ %lu packet_sequence ] "
+        "[ %lu packet_ack_frame ] "
+        "\n",
+        received_bytes, packet->sequence, packet->ack_frame);
+  }
 
-    // Mark player connection active
-    player[pidx].last_active = realtime_usec;
-
-    // Handle pending games
-    uint64_t gidx = player[pidx].game_index;
-    if (gidx == kInvalidIndex) {
-      if (received_bytes == sizeof(BeginGame)) {
-        BeginGame* bgPacket = (BeginGame*)(in_buffer);
-        if (player[pidx].cookie != bgPacket->cookie) {
-          player[pidx].cookie_mismatch += 1;
-          SERVER_LOG("cookie mismatch");
-          continue;
-        }
-        // two-way interest is agreed, copy pending_game_id to game_id
-        uint64_t game_id = player[pidx].pending_game_id;
-        gidx = GetGameIndex(game_id);
-        if (gidx == -1) {
-          SERVER_LOG("Server is out of space for Space");
-          continue;
-        }
-        player[pidx].game_index = gidx;
-        game[gidx].game_id = game_id;
-        game[gidx].num_players = player[pidx].num_players;
-        game[gidx].last_frame = 0;
-        game[gidx].ack_frame = 0;
-        game[gidx].start_usec = realtime_usec;
-        SERVER_LOGFMT("Server created Game [ game_index %lu ]\n", gidx);
-        continue;
-      }
+  // Require stream integrity
+  int64_t player_delta = packet->sequence - player[pidx].sequence;
+  if (player_delta >= MAX_GAMEQUEUE) {
+    // SERVER_LOG("packet sequence not relevant to player");
+    return 0;
+  }
 
-      if (ALAN) {
-        SERVER_LOG("Unknown message during pending state");
-      }
-      continue;
-    }
+  // Verify relevance to game state
+  int64_t game_delta = packet->sequence - game[gidx].last_frame;
+  if (game_delta >= MAX_GAMEQUEUE) {
+    // SERVER_LOG("packet seqeuence not relevant to game");
+    return 0;
+  }
 
-    // Require address stability
-    if (memcmp(&player[pidx].peer, &peer, sizeof(Udp4)) != 0) {
-      SERVER_LOG("unhandled: player address changed");
-      continue;
+  // Packet OK - Check game synchronization
+  uint64_t game_id = game[gidx].game_id;
+  int64_t sync_delta = packet->sequence - game[gidx].ack_frame;
+  if (sync_delta < 1) {
+    SERVER_LOGFMT(
+        "Latency Excess [ %lu player_index ] [ %lu packet_sequence ] [ %lu "
+        "ack_frame ] [ %lu clock_jerk ]\n",
+        pidx, packet->sequence, game[gidx].ack_frame, shard->clock.jerk);
+    player[pidx].latency_excess += 1;
+    return 0;
+  }
+
+  // Handle storage of new packet in game
+  player[pidx].ack_frame = MAX(player[pidx].ack_frame, packet->ack_frame);
+  game_digest(gidx, pid, packet->digest_frame, packet->digest_root);
+  const uint8_t* read_offset = in_buffer + sizeof(Update);
+  const uint8_t* end_buffer = in_buffer + received_bytes;
+  uint64_t sequence = packet->sequence;
+  uint64_t ack_sidx = GAMEQUEUE_SLOT(game[gidx].ack_frame);
+
+  if (ALAN) {
+    SERVER_LOGFMT(
+        "Server processing "
+        "[ %ld bytes ] "
+        "[ %p read ] "
+        "[ %p end ] "
+        "\n",
+        received_bytes, read_offset, end_buffer);
+  }
+
+  while (read_offset < end_buffer) {
+    uint64_t sidx = GAMEQUEUE_SLOT(sequence);
+
+    // Prevent clobber of unprocessed turns
+    if (sidx == ack_sidx) {
+      break;
     }
 
-    const Update* packet = (Update*)in_buffer;
+    // Never empty: an empty turn takes one byte
+    uint64_t turn_bytes = TurnBytes(read_offset, end_buffer);
+    if (!turn_bytes || turn_bytes > MAX_PACKET_IN) break;
+
     if (ALAN) {
       SERVER_LOGFMT(
-          "SvrRcv Precheck "
-          "[ %lu received_bytes ] "
-          "[ %lu packet_sequence ] "
-          "[ %lu packet_ack_frame ] "
+          "Server Apply "
+          "[ sequence %lu ] "
+          "[ turn_bytes %lu ] "
           "\n",
-          received_bytes, packet->sequence, packet->ack_frame);
+          sequence, turn_bytes);
     }
 
-    // Require stream integrity
-    int64_t player_delta = packet->sequence - player[pidx].sequence;
-    if (player_delta >= MAX_GAMEQUEUE) {
-      // SERVER_LOG("packet sequence not relevant to player");
-      continue;
+    if (!game[gidx].used_slot[sidx][pid]) {
+      // Apply turn data, or leave it to a retransmission when out of slabs
+      uint8_t* record = game_record(gidx, sequence, turn_bytes);
+      if (record) {
+        memcpy(record, read_offset, turn_bytes);
+        game[gidx].slot[sidx][pid] = record;
+        game[gidx].used_slot[sidx][pid] = turn_bytes;
+      }
     }
 
-    // Verify relevance to game state
-    int64_t game_delta = packet->sequence - game[gidx].last_frame;
-    if (game_delta >= MAX_GAMEQUEUE) {
-      // SERVER_LOG("packet seqeuence not relevant to game");
-      continue;
-    }
+    // Advance
+    read_offset += turn_bytes;
+    sequence += 1;
+  }
 
-    // Packet OK - Check game synchronization
-    uint64_t game_id = game[gidx].game_id;
-    uint64_t pid = player[pidx].player_index;
-    int64_t sync_delta = packet->sequence - game[gidx].ack_frame;
-    if (sync_delta < 1) {
-      SERVER_LOGFMT(
-          "Latency Excess [ %lu player_index ] [ %lu packet_sequence ] [ %lu "
-          "ack_frame ] [ %lu clock_jerk ]\n",
-          pidx, packet->sequence, game[gidx].ack_frame, server_clock.jerk);
-      player[pidx].latency_excess += 1;
-      continue;
-    }
+  if (read_offset == end_buffer) {
+    // Player sequence can be determined after storage
+    player[pidx].sequence =
+        game[gidx].last_frame + PlayerContiguousSequence(pidx);
+  } else {
+    // Do not advance
+    player[pidx].corrupted = 1;
+  }
 
-    // Handle storage of new packet in game
-    player[pidx].ack_frame = MAX(player[pidx].ack_frame, packet->ack_frame);
-    const uint8_t* read_offset = in_buffer + sizeof(Update);
-    const uint8_t* end_buffer = in_buffer + received_bytes;
-    uint64_t sequence = packet->sequence;
-    uint64_t ack_sidx = GAMEQUEUE_SLOT(game[gidx].ack_frame);
+  if (ALAN) {
+    SERVER_LOGFMT(
+        "SvrRcv "
+        "[ %d player_index ] "
+        "[ %d bytes ] "
+        "[ %lu packet_sequence ] "
+        "[ %lu player_sequence ] "
+        "[ %lu game_id ] "
+        "\n",
+        pidx, received_bytes, packet->sequence, player[pidx].sequence,
+        game_id);
+  }
 
-    if (ALAN) {
-      SERVER_LOGFMT(
-          "Server processing "
-          "[ %ld bytes ] "
-          "[ %p read ] "
-          "[ %p end ] "
-          "\n",
-          received_bytes, read_offset, end_buffer);
-    }
+  return 0;
+}
 
-    while (read_offset < end_buffer) {
-      uint64_t sidx = GAMEQUEUE_SLOT(sequence);
+// Memory of the games of the shard, reported regardless of NSLOG
+void
+shard_stats(const Shard* s)
+{
+  uint64_t game_count = 0;
+  uint64_t turn_bytes = 0;
+  uint64_t slab_count = 0;
+  for (int i = 0; i < MAX_GAME; ++i) {
+    const Game* g = &s->game[i];
+    if (!g->game_id) continue;
+    game_count += 1;
+    turn_bytes += g->turn_bytes;
+    slab_count += g->slab_count;
+  }
+  printf(
+      "Server shard "
+      "[ index %lu ] "
+      "[ received %lu ] "
+      "[ handed_off %lu ] "
+      "[ handoff_dropped %lu ] "
+      "[ games %lu ] "
+      "[ turn_bytes %lu ] "
+      "[ game_slab_bytes %lu ] "
+      "[ game_bytes %lu ] "
+      "[ peak_game_bytes %lu ] "
+      "[ slab_bytes %lu ] "
+      "\n",
+      s->index, s->received, s->handed_off, s->handoff_dropped, game_count,
+      turn_bytes, slab_count * sizeof(TurnSlab), sizeof(Game),
+      s->peak_game_bytes, s->slab_allocated * sizeof(TurnSlab));
+}
 
-      // Prevent clobber of unprocessed turns
-      if (sidx == ack_sidx) {
-        break;
-      }
+uint64_t
+server_main(void* void_arg)
+{
+  Shard* s = (Shard*)void_arg;
+  shard_bind(s);
+  const Udp4 location = s->location;
+
+  // Shards spread over the cores, avoiding core 0 when there are others
+  if (shard_count > 1) {
+    platform::thread_affinity_pin(s->index);
+  } else if (platform::thread_affinity_count() > 1) {
+    platform::thread_affinity_avoidcore(0);
+  }
+  SERVER_LOGFMT("Server shard %lu may run on %d cores\n", s->index,
+                platform::thread_affinity_count());
 
-      const Turn* turn = (const Turn*)read_offset;
-      const uint8_t* event = read_offset + sizeof(Turn);
-      uint64_t event_bytes = turn->event_bytes;
+  uint64_t realtime_usec = 0;
+  clock_init(SERVER_TICK_USEC, &s->clock);
+  while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+    uint64_t sleep_usec;
+    if (clock_sync(&s->clock, &sleep_usec)) {
+      realtime_usec += SERVER_TICK_USEC;
 
-      if (ALAN) {
-        SERVER_LOGFMT(
-            "Server Apply "
-            "[ sequence %lu ] "
-            "[ event_bytes %lu ] "
-            "\n",
-            sequence, event_bytes);
-      }
+      prune_players(realtime_usec);
+      prune_games();
 
-      if (!game[gidx].used_slot[sidx][pid]) {
-        // Apply turn data
-        memcpy(game[gidx].slot[sidx][pid], event, event_bytes);
-        game[gidx].used_slot[sidx][pid] = event_bytes;
+      GameTick tick = {s, realtime_usec};
+      platform::job_parallel_for(game_update_job, &tick, MAX_GAME, 1);
+      for (int i = 0; i < MAX_GAME; ++i) {
+        game_recycle(i);
+        if (!tick.ready[i]) continue;
+        game_transmit(location, i);
       }
+      server_flush(location);
+      if (realtime_usec % STATS_USEC < SERVER_TICK_USEC) shard_stats(s);
+    } else {
+#ifndef WIN32
+      udp::PollUsec(location, sleep_usec);
+#endif
+    }
 
-      // Advance
-      read_offset += event_bytes + sizeof(Turn);
-      sequence += 1;
+    // Datagrams of this shard received by the others, at the latest one
+    // server tick after their arrival
+    Handoff handoff;
+    while (handoff_pop(s, &handoff)) {
+      uint64_t error = server_receive(location, realtime_usec, handoff.peer,
+                                      handoff.packet, handoff.bytes);
+      if (error) __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+      if (error) return error;
     }
 
-    if (read_offset == end_buffer) {
-      // Player sequence can be determined after storage
-      player[pidx].sequence =
-          game[gidx].last_frame + PlayerContiguousSequence(pidx);
-    } else {
-      // Do not advance
-      player[pidx].corrupted = 1;
+    // Drain the socket a batch at a time
+    Udp4Batch* in_batch = &s->in_batch;
+    if (!udp::ReceiveMany(location, MAX_PACKET_IN, in_batch)) {
+      if (udp_errno) __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+      if (udp_errno) SERVER_LOGFMT("Server udp_errno %d\n", udp_errno);
+      continue;
     }
 
-    if (ALAN) {
-      SERVER_LOGFMT(
-          "SvrRcv "
-          "[ %d player_index ] "
-          "[ %d bytes ] "
-          "[ %lu packet_sequence ] "
-          "[ %lu player_sequence ] "
-          "[ %lu game_id ] "
-          "\n",
-          pidx, received_bytes, packet->sequence, player[pidx].sequence,
-          game_id);
+    s->received += in_batch->count;
+    for (int i = 0; i < in_batch->count; ++i) {
+      const uint64_t owner = shard_owner(
+          in_batch->peer[i], in_batch->buffer[i], in_batch->bytes[i]);
+      if (owner != s->index) {
+        s->handed_off += 1;
+        s->handoff_dropped +=
+            !handoff_push(&shard_list[owner], in_batch->peer[i],
+                          in_batch->buffer[i], in_batch->bytes[i]);
+        continue;
+      }
+
+      uint64_t error = server_receive(location, realtime_usec,
+                                      in_batch->peer[i], in_batch->buffer[i],
+                                      in_batch->bytes[i]);
+      if (error) __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+      if (error) return error;
     }
   }
 
   return 0;
 }
 
+// Empty tables for the shard at index
+void
+shard_clear(Shard* s, uint64_t index)
+{
+  for (int i = 0; i < MAX_SHARD_PLAYER; ++i) {
+    s->player[i] = zero_player;
+    s->free_player[MAX_SHARD_PLAYER - 1 - i] = i;
+  }
+  for (int i = 0; i < MAX_GAME; ++i) {
+    s->free_game[MAX_GAME - 1 - i] = i;
+  }
+  s->free_player_count = MAX_SHARD_PLAYER;
+  s->free_game_count = MAX_GAME;
+  IndexInit(&s->player_index, s->player_slot, MAX_PLAYER_SLOT);
+  IndexInit(&s->game_index, s->game_slot, MAX_GAME_SLOT);
+  s->next_connection_id = 1;
+  for (int i = 0; i < MAX_UDP_BATCH; ++i) {
+    s->in_batch.buffer[i] = s->in_packet[i];
+    s->out_batch.buffer[i] = s->out_packet[i];
+  }
+  s->index = index;
+  s->next_game_id = time(0);
+}
+
 bool
-CreateNetworkServer(const char* ip, const char* port)
+shard_init(Shard* s, uint64_t index, const char* ip, const char* port)
 {
-  if (thread.id) return false;
+  shard_clear(s, index);
+  if (!udp::GetAddr4(ip, port, &s->location)) {
+    SERVER_LOG("server: fail GetAddr4");
+    SERVER_LOG(ip);
+    SERVER_LOG(port);
+    return false;
+  }
+  if (shard_count > 1 && !udp::SetReusePort(s->location)) {
+    SERVER_LOG("server: fail SetReusePort");
+    udp::Close(s->location);
+    return false;
+  }
+  if (!udp::Bind(s->location)) {
+    SERVER_LOG("server: fail Bind");
+    udp::Close(s->location);
+    return false;
+  }
 
-  thread.func = server_main;
-  thread.arg = &thread_param;
-  thread_param.ip = ip;
-  thread_param.port = port;
-  return platform::thread_create(&thread);
+  return true;
+}
+
+// Stops the threads of the shards, then closes the sockets of the first
+// bound_count and releases them all
+void
+shard_release(uint64_t bound_count)
+{
+  __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+  for (uint64_t i = 0; i < shard_count; ++i) {
+    Shard* s = &shard_list[i];
+    if (s->thread.id) platform::thread_join(&s->thread);
+    if (i < bound_count) udp::Close(s->location);
+    slab_release(s);
+  }
+  free(shard_list);
+  shard_list = nullptr;
+  shard_count = 0;
+}
+
+// Starts shards serving ip:port, a thread each
+bool
+CreateNetworkServer(const char* ip, const char* port, uint64_t count)
+{
+  if (shard_list) return false;
+
+  count = CLAMP(count, 1, MAX_SHARD);
+  shard_list = (Shard*)calloc(count, sizeof(Shard));
+  if (!shard_list) return false;
+  shard_count = count;
+  __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+  // Sockets bind in shard order: kernel steering selects them by that order
+  for (uint64_t i = 0; i < count; ++i) {
+    if (shard_init(&shard_list[i], i, ip, port)) continue;
+    shard_release(i);
+    return false;
+  }
+
+  SERVER_LOGFMT("Server binding %s:%s [ shards %lu ]\n", ip, port, count);
+  shard_steered = count > 1 && shard_steer &&
+                  udp::SteerReusePort(shard_list[0].location, count,
+                                      &shard_rule);
+  if (count > 1 && !shard_steered) {
+    SERVER_LOG("Server kernel steering unavailable: shards hand off");
+  }
+
+  // Calibrated once: shards measuring together disturb each other
+  __init_tsc_per_usec();
+  for (uint64_t i = 0; i < count; ++i) {
+    Shard* s = &shard_list[i];
+    s->thread.func = server_main;
+    s->thread.arg = s;
+    if (platform::thread_create(&s->thread)) continue;
+    shard_release(count);
+    return false;
+  }
+
+  return true;
+}
+
+// Asks the shards to return, see WaitForNetworkServer()
+void
+StopNetworkServer()
+{
+  __atomic_store_n(&running, false, __ATOMIC_RELEASE);
 }
 
 uint64_t
 WaitForNetworkServer()
 {
-  if (!thread.id) return 0;
+  uint64_t result = 0;
+  for (uint64_t i = 0; i < shard_count; ++i) {
+    Shard* s = &shard_list[i];
+    if (!s->thread.id) continue;
+
+    platform::thread_join(&s->thread);
+    s->thread.id = 0;
+    if (!result) result = s->thread.return_value;
+    shard_stats(s);
+  }
 
-  platform::thread_join(&thread);
-  return thread.return_value;
+  return result;
 }
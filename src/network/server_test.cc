@@ -0,0 +1,424 @@
+#include <cassert>
+#include <cstdio>
+
+#include "server.cc"
+
+// Shards of the server under test, without kernel steering
+constexpr uint64_t kShardCount = 4;
+constexpr uint64_t kFrameCount = 8;
+
+struct Client {
+  Udp4 socket;
+  uint64_t num_players;
+  uint64_t match_key;
+  NotifyGame game;
+  uint64_t last_frame;
+};
+
+static Udp4 kServer;
+static uint8_t kBuffer[MAX_PACKET_OUT];
+
+// Client bound to the first port from port whose address owner is shard
+Client
+MakeClient(uint64_t* port, uint64_t shard, uint64_t num_players,
+           uint64_t match_key)
+{
+  Client c = {};
+  c.num_players = num_players;
+  c.match_key = match_key;
+  for (;; ++*port) {
+    char service[8];
+    snprintf(service, sizeof(service), "%lu", *port);
+    assert(udp::GetAddr4("127.0.0.1", service, &c.socket));
+    if (udp::ReusePortIndex(c.socket, kShardCount) == shard &&
+        udp::Bind(c.socket))
+      break;
+    udp::Close(c.socket);
+  }
+  *port += 1;
+  return c;
+}
+
+// Next datagram to the client within a second
+bool
+Receive(Client* c, uint16_t* bytes)
+{
+  for (int i = 0; i < 1000; ++i) {
+    Udp4 from;
+    if (udp::ReceiveAny(c->socket, sizeof(kBuffer), kBuffer, bytes, &from)) {
+      return true;
+    }
+    platform::sleep_usec(1000);
+  }
+
+  return false;
+}
+
+Handshake
+MakeHandshake(const Client* c)
+{
+  Handshake h;
+  h.num_players = c->num_players;
+  h.match_key = c->match_key;
+  h.player_info = {640, 480};
+  return h;
+}
+
+// Shard of the game of the client, see shard_owner()
+uint64_t
+HandshakeOwner(const Client* c)
+{
+  Handshake h = MakeHandshake(c);
+  return shard_owner(c->socket, (const uint8_t*)&h, sizeof(h));
+}
+
+void
+SendHandshake(Client* c)
+{
+  Handshake h = MakeHandshake(c);
+  assert(udp::SendTo(c->socket, kServer, &h, sizeof(h)));
+}
+
+// False until the server names the game
+bool
+Joined(Client* c)
+{
+  uint16_t bytes;
+  if (c->game.player_count) return true;
+  if (!Receive(c, &bytes) || bytes != sizeof(NotifyGame)) return false;
+  memcpy(&c->game, kBuffer, sizeof(NotifyGame));
+  return true;
+}
+
+void
+Begin(Client* c)
+{
+  BeginGame bg;
+  bg.connection_id = c->game.connection_id;
+  bg.cookie = c->game.cookie;
+  bg.game_id = c->game.game_id;
+  assert(udp::SendTo(c->socket, kServer, &bg, sizeof(bg)));
+}
+
+// Sends an empty turn for each frame not relayed yet, then reads the
+// frames relayed
+void
+Play(Client* c)
+{
+  uint8_t packet[sizeof(Update) + kFrameCount];
+  Update* update = (Update*)packet;
+  *update = {};
+  update->connection_id = c->game.connection_id;
+  update->sequence = c->last_frame + 1;
+  update->ack_frame = c->last_frame;
+  uint8_t* turn = packet + sizeof(Update);
+  for (uint64_t f = c->last_frame; f < kFrameCount; ++f) {
+    // Zero bytes: an empty turn, see turn.cc
+    *turn++ = 0;
+  }
+  assert(udp::SendTo(c->socket, kServer, packet, turn - packet));
+
+  uint16_t bytes;
+  Udp4 from;
+  while (udp::ReceiveAny(c->socket, sizeof(kBuffer), kBuffer, &bytes,
+                         &from)) {
+    const uint8_t* read = kBuffer + sizeof(NotifyUpdate);
+    const uint8_t* end = kBuffer + bytes;
+    while (read < end) {
+      const NotifyFrame* frame = (const NotifyFrame*)read;
+      read += sizeof(NotifyFrame);
+      // One empty turn from each player
+      for (int i = 0; i < c->game.player_count; ++i) {
+        assert(TurnBytes(read, end) == 1);
+        read += 1;
+      }
+      c->last_frame = MAX(c->last_frame, frame->frame);
+    }
+  }
+}
+
+uint64_t
+FreeSlabCount(const Shard* s)
+{
+  uint64_t count = 0;
+  for (const TurnSlab* slab = s->free_slab; slab; slab = slab->next) {
+    count += 1;
+  }
+
+  return count;
+}
+
+// Turns of a game recorded directly, with ack_frame driven by hand
+void
+TestSlabRecycle(Shard* s)
+{
+  // Four turns a slab
+  const uint64_t turn_bytes = sizeof(TurnSlab::record) / 4;
+  const int gidx = GetGameIndex(1);
+  Game* g = &game[gidx];
+  g->game_id = 1;
+  for (uint64_t frame = 1; frame <= 8; ++frame) {
+    assert(game_record(gidx, frame, turn_bytes));
+  }
+  assert(g->slab_count == 2 && s->slab_allocated == 2);
+  assert(!FreeSlabCount(s));
+
+  // The head holds frames 1 to 4: it is freed once they are acknowledged
+  g->ack_frame = 4;
+  game_recycle(gidx);
+  assert(g->slab_count == 2);
+  g->ack_frame = 5;
+  game_recycle(gidx);
+  assert(g->slab_count == 1 && g->slab_head == g->slab_tail);
+  assert(FreeSlabCount(s) == 1);
+
+  // The tail is kept, and starts over once its turns are acknowledged
+  g->ack_frame = 9;
+  game_recycle(gidx);
+  assert(g->slab_count == 1);
+  assert(game_record(gidx, 9, turn_bytes) == g->slab_tail->record);
+  assert(g->slab_count == 1 && FreeSlabCount(s) == 1);
+
+  // A full tail is followed by a free slab before any allocation
+  for (uint64_t frame = 10; frame <= 13; ++frame) {
+    assert(game_record(gidx, frame, turn_bytes));
+  }
+  assert(g->slab_count == 2 && s->slab_allocated == 2);
+  assert(!FreeSlabCount(s));
+
+  RemoveGame(gidx);
+  assert(FreeSlabCount(s) == 2 && s->free_game_count == MAX_GAME);
+  printf("[ slab_allocated %lu ] [ free_slab %lu ]\n", s->slab_allocated,
+         FreeSlabCount(s));
+}
+
+// The largest turns, never acknowledged, fill a game to its bound
+void
+TestSlabBound(Shard* s)
+{
+  const int gidx = GetGameIndex(3);
+  Game* g = &game[gidx];
+  g->game_id = 3;
+  uint64_t frame = 1;
+  while (game_record(gidx, frame, MAX_PACKET_IN)) {
+    frame += 1;
+  }
+  // Two turns a slab, and no more slab bytes than a window of the largest
+  // turns
+  assert(g->slab_count == MAX_GAME_SLAB);
+  assert(g->turn_count == 2 * MAX_GAME_SLAB);
+  assert(g->slab_count * sizeof(TurnSlab) <=
+         MAX_GAMEQUEUE * MAX_PLAYER * MAX_PACKET_IN);
+  assert(s->peak_game_bytes == game_bytes(g));
+  printf("[ turns %lu ] [ peak_game_bytes %lu ] [ window_bytes %d ]\n",
+         g->turn_count, s->peak_game_bytes,
+         MAX_GAMEQUEUE * MAX_PLAYER * MAX_PACKET_IN);
+
+  RemoveGame(gidx);
+  assert(FreeSlabCount(s) == s->slab_allocated);
+}
+
+// Sends the turn of frame from a player of a solo game
+void
+ReceiveTurn(int pidx, uint64_t frame)
+{
+  // Two turns a slab
+  uint8_t packet[sizeof(Update) + sizeof(TurnSlab::record) * 4 / 9];
+  Update* update = (Update*)packet;
+  *update = {};
+  update->connection_id = player[pidx].connection_id;
+  update->sequence = frame;
+  update->ack_frame = frame - 1;
+  uint8_t* turn = packet + sizeof(Update);
+  const uint8_t* end = packet + sizeof(packet);
+  // A varint byte count, then the bytes
+  assert(VarintWrite(end - turn - 2, &turn, end));
+  assert(turn == packet + sizeof(Update) + 2);
+  assert(!server_receive(Udp4{}, 0, player[pidx].peer, packet,
+                         sizeof(packet)));
+}
+
+// Turns received while slabs are not recycled, up to MAX_GAME_SLAB
+void
+TestSlabLimit(Shard* s)
+{
+  const int gidx = GetGameIndex(2);
+  Game* g = &game[gidx];
+  g->game_id = 2;
+  g->num_players = 1;
+
+  Udp4 peer;
+  assert(udp::GetAddr4("127.0.0.1", "10299", &peer));
+  const int pidx = GetNextPlayerIndex(&peer);
+  player[pidx].peer = peer;
+  player[pidx].connection_id = MAX_SHARD + s->index;
+  player[pidx].num_players = 1;
+  player[pidx].game_index = gidx;
+
+  uint64_t frame = 1;
+  for (; frame <= 2 * MAX_GAME_SLAB; ++frame) {
+    ReceiveTurn(pidx, frame);
+    assert(game_update(UINT64_MAX / 2, gidx));
+  }
+  assert(g->slab_count == MAX_GAME_SLAB);
+  assert(g->last_frame == frame - 1 && g->ack_frame == frame - 2);
+
+  // Out of slabs: the turn is dropped and the game waits for it
+  ReceiveTurn(pidx, frame);
+  assert(!g->used_slot[GAMEQUEUE_SLOT(frame)][0]);
+  assert(!game_update(UINT64_MAX / 2, gidx));
+
+  // Recycling frees every acknowledged slab, and the retransmission is
+  // recorded
+  game_recycle(gidx);
+  assert(g->slab_count == 1);
+  ReceiveTurn(pidx, frame);
+  assert(g->used_slot[GAMEQUEUE_SLOT(frame)][0] && g->slab_count == 2);
+  assert(game_update(UINT64_MAX / 2, gidx) && g->last_frame == frame);
+  printf("[ turns %lu ] [ slab_peak %lu ] ", g->turn_count, g->slab_peak);
+
+  RemovePlayer(pidx);
+  RemoveGame(gidx);
+  assert(FreeSlabCount(s) == s->slab_allocated);
+  assert(s->slab_allocated == MAX_GAME_SLAB);
+  printf("[ slab_allocated %lu ] [ free_slab %lu ]\n", s->slab_allocated,
+         FreeSlabCount(s));
+}
+
+// Plays count clients, in games of adjacent clients, to kFrameCount and
+// stops the server. Returns the datagrams handed off between shards.
+uint64_t
+PlayGames(Client* client, int count)
+{
+  for (int attempt = 0; attempt < 10; ++attempt) {
+    bool joined = true;
+    for (int i = 0; i < count; ++i) {
+      if (!client[i].game.player_count) SendHandshake(&client[i]);
+    }
+    for (int i = 0; i < count; ++i) {
+      joined = Joined(&client[i]) && joined;
+    }
+    if (joined) break;
+  }
+  for (int i = 0; i < count; i += client[i].num_players) {
+    const NotifyGame* first = &client[i].game;
+    uint64_t player_mask = 0;
+    for (int j = 0; j < client[i].num_players; ++j) {
+      const NotifyGame* game = &client[i + j].game;
+      assert(game->player_count == client[i].num_players);
+      player_mask |= 1 << game->player_index;
+      assert(game->game_id == first->game_id);
+      // The game is on the shard its handshakes select
+      assert(CONNECTION_SHARD(game->connection_id) ==
+             CONNECTION_SHARD(first->connection_id));
+      assert(CONNECTION_SHARD(game->connection_id) ==
+             HandshakeOwner(&client[i + j]));
+    }
+    assert(player_mask == (1 << client[i].num_players) - 1);
+  }
+
+  for (int i = 0; i < count; ++i) {
+    Begin(&client[i]);
+  }
+  for (int round = 0; round < 200; ++round) {
+    bool done = true;
+    for (int i = 0; i < count; ++i) {
+      Play(&client[i]);
+      done = done && client[i].last_frame >= kFrameCount;
+    }
+    if (done) break;
+    platform::sleep_usec(10 * 1000);
+  }
+
+  StopNetworkServer();
+  WaitForNetworkServer();
+
+  uint64_t handed_off = 0;
+  for (int i = 0; i < shard_count; ++i) {
+    const Shard* s = &shard_list[i];
+    printf("[ shard %d ] [ received %lu ] [ handed_off %lu ] ", i,
+           s->received, s->handed_off);
+    assert(!s->handoff_dropped);
+    handed_off += s->handed_off;
+  }
+  puts("");
+  for (int i = 0; i < count; ++i) {
+    assert(client[i].last_frame >= kFrameCount);
+    udp::Close(client[i].socket);
+  }
+  printf("[ clients %d ] [ last_frame %lu ]\n", count, kFrameCount);
+
+  return handed_off;
+}
+
+int
+main()
+{
+  assert(udp::Init());
+
+  // One shard, without its socket or thread
+  Shard* s = (Shard*)calloc(1, sizeof(Shard));
+  shard_clear(s, 0);
+  shard_bind(s);
+  TestSlabRecycle(s);
+  TestSlabLimit(s);
+  TestSlabBound(s);
+  shard_bind(nullptr);
+  slab_release(s);
+  free(s);
+
+  assert(udp::GetAddr4("127.0.0.1", "9850", &kServer));
+
+  // The port is taken: nothing is left running or bound
+  Udp4 taken;
+  assert(udp::GetAddr4("127.0.0.1", "9850", &taken));
+  assert(udp::Bind(taken));
+  assert(!CreateNetworkServer("127.0.0.1", "9850", kShardCount));
+  assert(!shard_list && !shard_count);
+  udp::Close(taken);
+
+  // Without steering: players of one match on two shards, their game on
+  // a third, and a solo player on a fourth
+  shard_steer = false;
+  assert(CreateNetworkServer("127.0.0.1", "9850", kShardCount));
+  uint64_t port = 10300;
+  Client client[2 * MAX_GAME + 4];
+  client[0] = MakeClient(&port, 1, 2, ANY_MATCH);
+  client[1] = MakeClient(&port, 2, 2, ANY_MATCH);
+  client[2] = MakeClient(&port, 3, 1, 0);
+  while (HandshakeOwner(&client[0]) != 0) {
+    client[0].match_key += 1;
+  }
+  client[1].match_key = client[0].match_key;
+  assert(HandshakeOwner(&client[2]) == 3);
+  assert(PlayGames(client, 3));
+  shard_release(shard_count);
+
+  // With steering: more 2 player games than one shard holds, spread by
+  // their match_key
+  shard_steer = true;
+  assert(CreateNetworkServer("127.0.0.1", "9850", kShardCount));
+  uint64_t shard_games[kShardCount] = {};
+  for (int i = 0; i < ARRAY_LENGTH(client); i += 2) {
+    const uint64_t match_key = ANY_MATCH + i;
+    client[i] = MakeClient(&port, i % kShardCount, 2, match_key);
+    client[i + 1] = MakeClient(&port, (i + 1) % kShardCount, 2, match_key);
+    shard_games[HandshakeOwner(&client[i])] += 1;
+  }
+  uint64_t shards_used = 0;
+  for (int i = 0; i < kShardCount; ++i) {
+    printf("[ shard %d ] [ games %lu ] ", i, shard_games[i]);
+    assert(shard_games[i] <= MAX_GAME);
+    shards_used += shard_games[i] != 0;
+  }
+  puts("");
+  assert(shards_used > 1);
+  const bool steered = shard_steered;
+  const uint64_t handed_off = PlayGames(client, ARRAY_LENGTH(client));
+  // Datagrams reach the shard of their game directly
+  assert(!steered || !handed_off);
+  shard_release(shard_count);
+
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "platform/platform.cc"
+
+// Compact encoding of the input events of one player for one frame.
+//
+// A turn is a varint byte count followed by that many bytes: the server
+// stores and relays it without decoding. An empty turn has no bytes, one
+// byte on the wire. Otherwise the bytes are the version, a varint event
+// count, then per event:
+//
+//   tag: type (3 bits) | position form (2 bits) | detail form (2 bits)
+//   position: nothing when equal to the reference, a zigzag varint delta of
+//     each axis in 1/TURN_POSITION_SCALE pixels, or the raw floats
+//   detail: nothing when zero, the button, key or wheel delta in one byte,
+//     or the raw 4 bytes
+//
+// The reference is the position of the previous event, starting from the
+// last event of the previous turn of the player. Events decode to the bytes
+// they were encoded from, whatever the values.
+
+#define TURN_VERSION 1
+// Quantization step of positions, in fractions of a pixel
+#define TURN_POSITION_SCALE 4
+// Largest encoded event: tag, raw position and raw detail
+#define MAX_TURN_EVENT_BYTES (1 + sizeof(v2f) + sizeof(uint32_t))
+// Room reserved for the byte count of a turn, 2 varint bytes
+#define MAX_TURN_PAYLOAD ((1 << 14) - 1)
+
+enum TurnPosition {
+  kTurnPositionSame = 0,
+  kTurnPositionDelta,
+  kTurnPositionRaw,
+};
+
+enum TurnDetail {
+  kTurnDetailZero = 0,
+  kTurnDetailByte,
+  kTurnDetailRaw,
+};
+
+#define TURN_TAG(type, position, detail) \
+  ((type) | ((position) << 3) | ((detail) << 5))
+#define TURN_TAG_TYPE(tag) ((tag)&7)
+#define TURN_TAG_POSITION(tag) (((tag) >> 3) & 3)
+#define TURN_TAG_DETAIL(tag) (((tag) >> 5) & 3)
+
+// Appends v, false when it does not fit before end
+INLINE bool
+VarintWrite(uint64_t v, uint8_t** write_ref, const uint8_t* end)
+{
+  uint8_t* write = *write_ref;
+  do {
+    if (write >= end) return false;
+    *write++ = (v & 0x7f) | ((v > 0x7f) << 7);
+    v >>= 7;
+  } while (v);
+  *write_ref = write;
+  return true;
+}
+
+// Reads a varint, false when it runs past end
+INLINE bool
+VarintRead(const uint8_t** read_ref, const uint8_t* end, uint64_t* v)
+{
+  const uint8_t* read = *read_ref;
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (read >= end) return false;
+    const uint8_t byte = *read++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *read_ref = read;
+      *v = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+INLINE uint64_t
+ZigZag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+INLINE int64_t
+UnZigZag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Steps of f, false unless they convert back to the same bytes
+INLINE bool
+TurnQuantize(float f, int32_t* q)
+{
+  const float scaled = f * TURN_POSITION_SCALE;
+  if (!(scaled > -(1 << 24) && scaled < (1 << 24))) return false;
+  *q = (int32_t)scaled;
+  const float back = (float)*q / TURN_POSITION_SCALE;
+  return memcmp(&back, &f, sizeof(f)) == 0;
+}
+
+INLINE TurnDetail
+TurnDetailForm(const PlatformEvent* e, uint8_t* byte)
+{
+  uint32_t detail;
+  memcpy(&detail, &e->wheel_delta, sizeof(detail));
+  if (!detail) return kTurnDetailZero;
+  if (e->type != MOUSE_WHEEL) {
+    *byte = detail;
+    return detail <= 0xff ? kTurnDetailByte : kTurnDetailRaw;
+  }
+
+  const float wheel = e->wheel_delta;
+  if (!(wheel >= -128.f && wheel <= 127.f)) return kTurnDetailRaw;
+  const int8_t step = (int8_t)wheel;
+  *byte = step;
+  return (float)step == wheel ? kTurnDetailByte : kTurnDetailRaw;
+}
+
+INLINE void
+TurnDetailSet(uint8_t byte, PlatformEvent* e)
+{
+  uint32_t detail = byte;
+  if (e->type == MOUSE_WHEEL) {
+    const float wheel = (int8_t)byte;
+    memcpy(&detail, &wheel, sizeof(detail));
+  }
+  memcpy(&e->wheel_delta, &detail, sizeof(detail));
+}
+
+// Bytes of the encoded turn of count events, 0 when it does not fit before
+// end
+uint64_t
+TurnEncode(const PlatformEvent* event, uint64_t count, v2f reference,
+           uint8_t* out, const uint8_t* end)
+{
+  const uint64_t room = end - out;
+  if (room < 2) return 0;
+  uint8_t* payload = out + 2;
+  uint8_t* write = payload;
+  const uint8_t* payload_end = payload + MIN(room - 2, MAX_TURN_PAYLOAD);
+  if (count) {
+    if (write >= payload_end) return 0;
+    *write++ = TURN_VERSION;
+    if (!VarintWrite(count, &write, payload_end)) return 0;
+  }
+
+  for (uint64_t i = 0; i < count; ++i) {
+    const PlatformEvent* e = &event[i];
+    if ((uint32_t)e->type > 7) return 0;
+
+    TurnPosition position = kTurnPositionRaw;
+    int32_t qx, qy, rx, ry;
+    if (memcmp(&e->position, &reference, sizeof(v2f)) == 0) {
+      position = kTurnPositionSame;
+    } else if (TurnQuantize(e->position.x, &qx) &&
+               TurnQuantize(e->position.y, &qy) &&
+               TurnQuantize(reference.x, &rx) &&
+               TurnQuantize(reference.y, &ry)) {
+      position = kTurnPositionDelta;
+    }
+    uint8_t byte = 0;
+    const TurnDetail detail = TurnDetailForm(e, &byte);
+
+    // A delta takes at most 4 varint bytes per axis: no more than raw floats
+    if (payload_end - write < MAX_TURN_EVENT_BYTES) return 0;
+    *write++ = TURN_TAG(e->type, position, detail);
+    if (position == kTurnPositionDelta) {
+      VarintWrite(ZigZag((int64_t)qx - rx), &write, payload_end);
+      VarintWrite(ZigZag((int64_t)qy - ry), &write, payload_end);
+    } else if (position == kTurnPositionRaw) {
+      memcpy(write, &e->position, sizeof(v2f));
+      write += sizeof(v2f);
+    }
+    if (detail == kTurnDetailByte) {
+      *write++ = byte;
+    } else if (detail == kTurnDetailRaw) {
+      memcpy(write, &e->wheel_delta, sizeof(uint32_t));
+      write += sizeof(uint32_t);
+    }
+    reference = e->position;
+  }
+
+  // The byte count takes one varint byte when short
+  const uint64_t payload_bytes = write - payload;
+  uint8_t* turn = out;
+  VarintWrite(payload_bytes, &turn, payload);
+  memmove(turn, payload, payload_bytes);
+  return turn + payload_bytes - out;
+}
+
+// Bytes of the turn at the start of buffer, 0 when it runs past end
+INLINE uint64_t
+TurnBytes(const uint8_t* buffer, const uint8_t* end)
+{
+  const uint8_t* read = buffer;
+  uint64_t payload_bytes;
+  if (!VarintRead(&read, end, &payload_bytes)) return 0;
+  if (end - read < payload_bytes) return 0;
+  return read + payload_bytes - buffer;
+}
+
+// Decodes a turn of TurnBytes() bytes, false when it is malformed or holds
+// more than max_count events
+bool
+TurnDecode(const uint8_t* turn, uint64_t bytes, v2f reference,
+           PlatformEvent* event, uint64_t max_count, uint64_t* count)
+{
+  const uint8_t* read = turn;
+  const uint8_t* end = turn + bytes;
+  uint64_t payload_bytes;
+  if (!VarintRead(&read, end, &payload_bytes)) return false;
+  if (end - read != payload_bytes) return false;
+  *count = 0;
+  if (!payload_bytes) return true;
+
+  uint64_t n;
+  if (*read++ != TURN_VERSION) return false;
+  if (!VarintRead(&read, end, &n)) return false;
+  if (n > max_count) return false;
+
+  for (uint64_t i = 0; i < n; ++i) {
+    if (read >= end) return false;
+    const uint8_t tag = *read++;
+    PlatformEvent* e = &event[i];
+    e->type = (PlatformEventType)TURN_TAG_TYPE(tag);
+
+    switch (TURN_TAG_POSITION(tag)) {
+      case kTurnPositionSame: {
+        e->position = reference;
+      } break;
+      case kTurnPositionDelta: {
+        int32_t rx, ry;
+        uint64_t dx, dy;
+        if (!TurnQuantize(reference.x, &rx)) return false;
+        if (!TurnQuantize(reference.y, &ry)) return false;
+        if (!VarintRead(&read, end, &dx)) return false;
+        if (!VarintRead(&read, end, &dy)) return false;
+        e->position.x = (float)(rx + UnZigZag(dx)) / TURN_POSITION_SCALE;
+        e->position.y = (float)(ry + UnZigZag(dy)) / TURN_POSITION_SCALE;
+      } break;
+      case kTurnPositionRaw: {
+        if (end - read < sizeof(v2f)) return false;
+        memcpy(&e->position, read, sizeof(v2f));
+        read += sizeof(v2f);
+      } break;
+      default:
+        return false;
+    }
+
+    switch (TURN_TAG_DETAIL(tag)) {
+      case kTurnDetailZero: {
+        e->wheel_delta = 0.f;
+      } break;
+      case kTurnDetailByte: {
+        if (read >= end) return false;
+        TurnDetailSet(*read++, e);
+      } break;
+      case kTurnDetailRaw: {
+        if (end - read < sizeof(uint32_t)) return false;
+        memcpy(&e->wheel_delta, read, sizeof(uint32_t));
+        read += sizeof(uint32_t);
+      } break;
+      default:
+        return false;
+    }
+    reference = e->position;
+  }
+
+  *count = n;
+  return read == end;
+}
@@ -0,0 +1,253 @@
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include "turn.cc"
+
+// Turns of a session: events of the local player per frame
+constexpr uint64_t kMaxFrame = 1 << 16;
+constexpr uint64_t kMaxEvent = 32;
+// Unacknowledged turns re-sent by each NetworkEgress()
+constexpr uint64_t kResendDepth = 8;
+
+struct Session {
+  PlatformEvent event[kMaxFrame][kMaxEvent];
+  uint64_t event_count[kMaxFrame];
+  uint64_t frame_count;
+};
+
+static Session kSession;
+static PlatformEvent kDecoded[kMaxEvent];
+static uint8_t kEncoded[kMaxFrame][1024];
+static uint64_t kEncodedBytes[kMaxFrame];
+
+uint64_t
+NextRandom(uint64_t* state)
+{
+  *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+  return *state >> 33;
+}
+
+v2f
+Reference(uint64_t frame)
+{
+  if (!frame || !kSession.event_count[frame - 1]) return v2f(0.f, 0.f);
+  return kSession.event[frame - 1][kSession.event_count[frame - 1] - 1]
+      .position;
+}
+
+// Mouse motion with pauses, clicks and keys, as GatherWindowInput()
+void
+Synthesize(uint64_t frame_count)
+{
+  uint64_t state = 1234;
+  v2f cursor(960.f, 540.f);
+  v2f velocity(0.f, 0.f);
+  for (uint64_t f = 0; f < frame_count; ++f) {
+    PlatformEvent* e = kSession.event[f];
+    uint64_t n = 0;
+    if (NextRandom(&state) % 30 == 0) {
+      velocity = NextRandom(&state) % 3
+                     ? v2f(0.f, 0.f)
+                     : v2f((int)(NextRandom(&state) % 41) - 20,
+                           (int)(NextRandom(&state) % 41) - 20);
+    }
+    cursor.x = fminf(fmaxf(cursor.x + velocity.x, 0.f), 1919.f);
+    cursor.y = fminf(fmaxf(cursor.y + velocity.y, 0.f), 1079.f);
+    if (NextRandom(&state) % 90 == 0) {
+      e[n] = {};
+      e[n].type = MOUSE_DOWN;
+      e[n].position = cursor;
+      e[n].button = (PlatformButton)(1 + NextRandom(&state) % 3);
+      e[n + 1] = e[n];
+      e[n + 1].type = MOUSE_UP;
+      n += 2;
+    }
+    if (NextRandom(&state) % 120 == 0) {
+      e[n] = {};
+      e[n].type = KEY_DOWN;
+      e[n].position = cursor;
+      e[n].key = 'a' + NextRandom(&state) % 26;
+      n += 1;
+    }
+    if (NextRandom(&state) % 200 == 0) {
+      e[n] = {};
+      e[n].type = MOUSE_WHEEL;
+      e[n].position = cursor;
+      e[n].wheel_delta = NextRandom(&state) % 2 ? 1.f : -1.f;
+      n += 1;
+    }
+    e[n] = {};
+    e[n].type = MOUSE_POSITION;
+    e[n].position = cursor;
+    kSession.event_count[f] = n + 1;
+  }
+  kSession.frame_count = frame_count;
+}
+
+// Loopback datagrams written by udp_logger: record sizes, terminated by 0,
+// then the raw events of every record
+bool
+Load(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint16_t size[kMaxFrame];
+  uint64_t count = 0;
+  while (count < kMaxFrame && fread(&size[count], sizeof(uint16_t), 1, f)) {
+    if (!size[count]) break;
+    count += 1;
+  }
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t n = MIN(size[i] / sizeof(PlatformEvent), kMaxEvent);
+    if (fread(kSession.event[i], sizeof(PlatformEvent), n, f) != n) break;
+    kSession.event_count[i] = n;
+    kSession.frame_count = i + 1;
+  }
+  fclose(f);
+  return kSession.frame_count;
+}
+
+// Every event decodes to the bytes it was encoded from
+void
+CheckFrame(uint64_t frame)
+{
+  const uint8_t* turn = kEncoded[frame];
+  const uint64_t bytes = kEncodedBytes[frame];
+  assert(bytes);
+  assert(TurnBytes(turn, turn + bytes) == bytes);
+  uint64_t count;
+  assert(TurnDecode(turn, bytes, Reference(frame), kDecoded, kMaxEvent,
+                    &count));
+  assert(count == kSession.event_count[frame]);
+  assert(memcmp(kDecoded, kSession.event[frame],
+                count * sizeof(PlatformEvent)) == 0);
+
+  // Truncated turns are rejected
+  for (uint64_t i = 0; i < bytes; ++i) {
+    assert(!TurnBytes(turn, turn + i));
+    assert(!TurnDecode(turn, i, Reference(frame), kDecoded, kMaxEvent,
+                       &count));
+  }
+}
+
+uint64_t
+Encode()
+{
+  uint64_t bytes = 0;
+  for (uint64_t f = 0; f < kSession.frame_count; ++f) {
+    kEncodedBytes[f] =
+        TurnEncode(kSession.event[f], kSession.event_count[f], Reference(f),
+                   kEncoded[f], kEncoded[f] + sizeof(kEncoded[f]));
+    bytes += kEncodedBytes[f];
+  }
+  return bytes;
+}
+
+void
+Report(const char* name)
+{
+  // Timed once the pages of kEncoded are resident
+  Encode();
+  uint64_t begin = rdtsc();
+  const uint64_t compact_bytes = Encode();
+  const uint64_t encode_tsc = rdtsc() - begin;
+
+  uint64_t event_count = 0;
+  uint64_t raw_bytes = 0;
+  uint64_t raw_egress = 0;
+  uint64_t compact_egress = 0;
+  begin = rdtsc();
+  for (uint64_t f = 0; f < kSession.frame_count; ++f) {
+    uint64_t count;
+    assert(TurnDecode(kEncoded[f], kEncodedBytes[f], Reference(f), kDecoded,
+                      kMaxEvent, &count));
+    event_count += count;
+  }
+  const uint64_t decode_tsc = rdtsc() - begin;
+
+  for (uint64_t f = 0; f < kSession.frame_count; ++f) {
+    CheckFrame(f);
+    // Previously: a uint64_t byte count and the raw events
+    raw_bytes += sizeof(uint64_t) + kSession.event_count[f] *
+                                        sizeof(PlatformEvent);
+    for (uint64_t d = 0; d < kResendDepth && d <= f; ++d) {
+      raw_egress += sizeof(uint64_t) + kSession.event_count[f - d] *
+                                           sizeof(PlatformEvent);
+      compact_egress += kEncodedBytes[f - d];
+    }
+  }
+
+  const uint64_t frames = kSession.frame_count;
+  printf(
+      "[ %s ] "
+      "[ %lu frames ] "
+      "[ %.2f events/turn ] "
+      "[ raw %.2f bytes/turn ] "
+      "[ compact %.2f bytes/turn ] "
+      "[ egress %lu -> %lu bytes/frame ] "
+      "[ encode %lu ns/turn ] "
+      "[ decode %lu ns/turn ] "
+      "\n",
+      name, frames, (double)event_count / frames, (double)raw_bytes / frames,
+      (double)compact_bytes / frames, raw_egress / frames,
+      compact_egress / frames, encode_tsc * 1000 / median_tsc_per_usec / frames,
+      decode_tsc * 1000 / median_tsc_per_usec / frames);
+}
+
+int
+main(int argc, char** argv)
+{
+  __init_tsc_per_usec();
+
+  // An empty turn is one byte
+  uint8_t buffer[1024];
+  assert(TurnEncode(nullptr, 0, v2f(0.f, 0.f), buffer,
+                    buffer + sizeof(buffer)) == 1);
+  assert(TurnBytes(buffer, buffer + 1) == 1);
+
+  // Any bytes survive: fractions, negative zero, NaN, large values, stale
+  // detail bytes
+  uint64_t state = 99;
+  const float odd[] = {0.5f, -0.f, NAN, 1e30f, 0.1f, -3.25f, 16777216.f};
+  for (uint64_t f = 0; f < 4096; ++f) {
+    uint64_t n = NextRandom(&state) % kMaxEvent;
+    for (uint64_t i = 0; i < n; ++i) {
+      PlatformEvent* e = &kSession.event[f][i];
+      e->type = (PlatformEventType)(NextRandom(&state) % 7);
+      e->position.x = NextRandom(&state) % 4
+                          ? (float)(NextRandom(&state) % 2000)
+                          : odd[NextRandom(&state) % ARRAY_LENGTH(odd)];
+      e->position.y = NextRandom(&state) % 8
+                          ? (float)(NextRandom(&state) % 1200) - 60.f
+                          : odd[NextRandom(&state) % ARRAY_LENGTH(odd)];
+      uint32_t detail = NextRandom(&state) % 3 ? NextRandom(&state) % 300
+                                               : NextRandom(&state);
+      memcpy(&e->wheel_delta, &detail, sizeof(detail));
+      if (e->type == MOUSE_WHEEL && NextRandom(&state) % 2) {
+        e->wheel_delta = (float)((int)(NextRandom(&state) % 9) - 4);
+      }
+    }
+    kSession.event_count[f] = n;
+    kSession.frame_count = f + 1;
+  }
+  Encode();
+  for (uint64_t f = 0; f < kSession.frame_count; ++f) {
+    CheckFrame(f);
+  }
+
+  // Too small a buffer
+  assert(!TurnEncode(kSession.event[0], kMaxEvent, v2f(0.f, 0.f), buffer,
+                     buffer + 8));
+
+  // Byte counts over a recorded session, or a synthetic one
+  if (argc > 1 && Load(argv[1])) {
+    Report(argv[1]);
+  }
+  Synthesize(60 * 60 * 10);
+  Report("synthetic");
+
+  puts("ok");
+  return 0;
+}
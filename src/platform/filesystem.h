@@ -1,6 +1,11 @@
 #pragma once
 
+#include <cstdint>
+
 namespace filesystem
 {
 bool MakeDirectory(const char* name);
+// Read-only view of the whole file, nullptr on failure or when empty
+const uint8_t* MapFile(const char* name, uint64_t* bytes);
+void UnmapFile(const uint8_t* data, uint64_t bytes);
 }
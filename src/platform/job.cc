@@ -0,0 +1,363 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include "thread.h"
+
+// Work-stealing job scheduler.
+//
+// Each worker owns a deque: the owner pushes and pops at the bottom, other
+// workers steal from the top. The thread calling job_start() is worker 0.
+// Any other thread submits through a locked injection queue. A thread that
+// waits on a counter runs jobs until the counter reaches zero.
+//
+// Without job_start(), or when a queue is full, jobs run on the caller.
+
+#define JOB_MAX_WORKER 16
+// Power of 2
+#define JOB_MAX_DEQUE 512
+#define JOB_MAX_INJECT 256
+// Idle spins before a worker yields its core
+#define JOB_IDLE_SPIN 64
+// Idle yields before a worker sleeps between steal attempts
+#define JOB_IDLE_YIELD 4096
+#define JOB_IDLE_SLEEP_USEC 50
+
+struct JobCounter;
+typedef void (*JobFunc)(void* arg, uint64_t begin, uint64_t end);
+
+struct Job {
+  JobFunc func;
+  void* arg;
+  uint64_t begin;
+  uint64_t end;
+  JobCounter* counter;
+};
+
+// Jobs pending on the counter. When it reaches zero, next (if any) is
+// submitted by the thread that finished the last job.
+struct JobCounter {
+  uint64_t pending;
+  Job next;
+};
+
+struct JobDeque {
+  // Stolen by other threads
+  ALIGNAS(64) int64_t top;
+  // Owned by the worker
+  ALIGNAS(64) int64_t bottom;
+  uint64_t executed;
+  uint64_t stolen;
+  Job job[JOB_MAX_DEQUE];
+};
+
+struct JobInject {
+  ALIGNAS(64) uint32_t lock;
+  uint64_t read;
+  uint64_t write;
+  Job job[JOB_MAX_INJECT];
+};
+
+struct JobSystem {
+  ThreadInfo thread[JOB_MAX_WORKER];
+  JobDeque deque[JOB_MAX_WORKER];
+  JobInject inject;
+  uint64_t worker_count;
+  bool exit;
+  bool running;
+};
+
+static JobSystem kJobSystem;
+// Deque owned by this thread, or UINT64_MAX
+static thread_local uint64_t kJobWorker = UINT64_MAX;
+
+namespace platform
+{
+bool
+job_push(JobDeque* d, const Job& job)
+{
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  if (b - t >= JOB_MAX_DEQUE) return false;
+
+  d->job[b & (JOB_MAX_DEQUE - 1)] = job;
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool
+job_pop(JobDeque* d, Job* job)
+{
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+  if (t > b) {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  *job = d->job[b & (JOB_MAX_DEQUE - 1)];
+  if (t != b) return true;
+
+  // Last job: race the thieves for it
+  bool won = __atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  return won;
+}
+
+bool
+job_steal(JobDeque* d, Job* job)
+{
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b) return false;
+
+  // A torn read is discarded when the exchange fails
+  Job stolen = d->job[t & (JOB_MAX_DEQUE - 1)];
+  if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return false;
+  }
+
+  *job = stolen;
+  return true;
+}
+
+void
+job_lock(JobInject* q)
+{
+  while (__atomic_exchange_n(&q->lock, 1, __ATOMIC_ACQUIRE)) {
+    _mm_pause();
+  }
+}
+
+void
+job_unlock(JobInject* q)
+{
+  __atomic_store_n(&q->lock, 0, __ATOMIC_RELEASE);
+}
+
+bool
+job_inject(JobInject* q, const Job& job)
+{
+  job_lock(q);
+  bool ok = q->write - q->read < JOB_MAX_INJECT;
+  if (ok) q->job[q->write++ % JOB_MAX_INJECT] = job;
+  job_unlock(q);
+  return ok;
+}
+
+bool
+job_take(JobInject* q, Job* job)
+{
+  if (__atomic_load_n(&q->read, __ATOMIC_RELAXED) ==
+      __atomic_load_n(&q->write, __ATOMIC_RELAXED)) {
+    return false;
+  }
+
+  job_lock(q);
+  bool ok = q->read != q->write;
+  if (ok) *job = q->job[q->read++ % JOB_MAX_INJECT];
+  job_unlock(q);
+  return ok;
+}
+
+void job_enqueue(const Job& job);
+
+void
+job_execute(const Job& job)
+{
+  job.func(job.arg, job.begin, job.end);
+
+  JobCounter* counter = job.counter;
+  if (!counter) return;
+  // The waiter may release the counter once pending reaches zero
+  Job next = counter->next;
+  if (__atomic_sub_fetch(&counter->pending, 1, __ATOMIC_ACQ_REL)) return;
+  if (next.func) job_enqueue(next);
+}
+
+// Runs one job of this thread, the injection queue or another worker
+bool
+job_run_one()
+{
+  const uint64_t self = kJobWorker;
+  const uint64_t worker_count = kJobSystem.worker_count;
+  Job job;
+  if (self < worker_count && job_pop(&kJobSystem.deque[self], &job)) {
+    kJobSystem.deque[self].executed += 1;
+    job_execute(job);
+    return true;
+  }
+
+  if (job_take(&kJobSystem.inject, &job)) {
+    job_execute(job);
+    return true;
+  }
+
+  for (uint64_t i = 1; i <= worker_count; ++i) {
+    uint64_t victim = (self + i) % worker_count;
+    if (victim == self) continue;
+    if (!job_steal(&kJobSystem.deque[victim], &job)) continue;
+    if (self < worker_count) kJobSystem.deque[self].stolen += 1;
+    job_execute(job);
+    return true;
+  }
+
+  return false;
+}
+
+// Queues a job already counted on its counter
+void
+job_enqueue(const Job& job)
+{
+  const uint64_t self = kJobWorker;
+  if (!kJobSystem.running) {
+    job_execute(job);
+  } else if (self < kJobSystem.worker_count) {
+    if (!job_push(&kJobSystem.deque[self], job)) job_execute(job);
+  } else {
+    if (!job_inject(&kJobSystem.inject, job)) job_execute(job);
+  }
+}
+
+void
+job_submit(const Job& job)
+{
+  if (job.counter) {
+    __atomic_add_fetch(&job.counter->pending, 1, __ATOMIC_RELAXED);
+  }
+  job_enqueue(job);
+}
+
+void
+job_submit(JobFunc func, void* arg, uint64_t begin, uint64_t end,
+           JobCounter* counter)
+{
+  job_submit({func, arg, begin, end, counter});
+}
+
+// Submits the job once every job on dep has run. Set before any job is
+// submitted on dep.
+void
+job_then(JobCounter* dep, JobFunc func, void* arg, uint64_t begin,
+         uint64_t end, JobCounter* counter)
+{
+  assert(dep->pending == 0);
+  if (counter) __atomic_add_fetch(&counter->pending, 1, __ATOMIC_RELAXED);
+  dep->next = {func, arg, begin, end, counter};
+}
+
+// Runs jobs until the counter reaches zero
+void
+job_wait(JobCounter* counter)
+{
+  uint64_t idle = 0;
+  while (__atomic_load_n(&counter->pending, __ATOMIC_ACQUIRE)) {
+    if (job_run_one()) {
+      idle = 0;
+    } else if (++idle < JOB_IDLE_SPIN) {
+      _mm_pause();
+    } else {
+      thread_yield();
+    }
+  }
+}
+
+// Threads that run jobs: 1 until job_start()
+uint64_t
+job_worker_count()
+{
+  return kJobSystem.running ? kJobSystem.worker_count : 1;
+}
+
+// Calls func over [0, count) in ranges of grain, the first on the caller.
+// Without workers, the whole range runs in order on the caller.
+void
+job_parallel_for(JobFunc func, void* arg, uint64_t count, uint64_t grain)
+{
+  if (!count) return;
+  if (!grain) grain = 1;
+  if (!kJobSystem.running || kJobSystem.worker_count < 2) {
+    func(arg, 0, count);
+    return;
+  }
+
+  JobCounter counter = {};
+  for (uint64_t begin = grain; begin < count; begin += grain) {
+    job_submit(func, arg, begin, MIN(begin + grain, count), &counter);
+  }
+  func(arg, 0, MIN(grain, count));
+  job_wait(&counter);
+}
+
+uint64_t
+job_worker(void* arg)
+{
+  const uint64_t index = (uint64_t)arg;
+  kJobWorker = index;
+  thread_affinity_pin(index - 1);
+
+  uint64_t idle = 0;
+  while (!__atomic_load_n(&kJobSystem.exit, __ATOMIC_ACQUIRE)) {
+    if (job_run_one()) {
+      idle = 0;
+    } else if (++idle < JOB_IDLE_SPIN) {
+      _mm_pause();
+    } else if (idle < JOB_IDLE_YIELD) {
+      thread_yield();
+    } else {
+      sleep_usec(JOB_IDLE_SLEEP_USEC);
+    }
+  }
+
+  return 0;
+}
+
+// The caller becomes worker 0 of worker_count. Workers inherit the affinity
+// of the caller: start before the caller pins itself to core 0.
+void
+job_start(uint64_t worker_count)
+{
+  if (kJobSystem.running) return;
+  worker_count = CLAMP(worker_count, 1, JOB_MAX_WORKER);
+
+  kJobSystem.exit = false;
+  kJobSystem.worker_count = worker_count;
+  for (uint64_t i = 0; i < worker_count; ++i) {
+    JobDeque* d = &kJobSystem.deque[i];
+    d->top = d->bottom = 0;
+    d->executed = d->stolen = 0;
+  }
+  kJobSystem.inject.read = kJobSystem.inject.write = 0;
+  kJobWorker = 0;
+  kJobSystem.running = true;
+
+  for (uint64_t i = 1; i < worker_count; ++i) {
+    ThreadInfo* t = &kJobSystem.thread[i];
+    *t = {};
+    t->func = job_worker;
+    t->arg = (void*)i;
+    thread_create(t);
+  }
+}
+
+void
+job_stop()
+{
+  if (!kJobSystem.running) return;
+  while (job_run_one()) continue;
+
+  __atomic_store_n(&kJobSystem.exit, true, __ATOMIC_RELEASE);
+  for (uint64_t i = 1; i < kJobSystem.worker_count; ++i) {
+    thread_join(&kJobSystem.thread[i]);
+  }
+  kJobSystem.running = false;
+  kJobWorker = UINT64_MAX;
+}
+
+}  // namespace platform
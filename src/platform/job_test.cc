@@ -0,0 +1,161 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "platform.cc"
+
+constexpr uint64_t kWorkCount = 1 << 16;
+constexpr uint64_t kWorkGrain = 256;
+constexpr uint64_t kLatencyCount = 1000;
+
+static uint64_t kWork[kWorkCount];
+static uint64_t kOrder[4];
+static uint64_t kUsedOrder;
+
+uint64_t
+Kernel(uint64_t i)
+{
+  uint64_t x = i + 1;
+  for (int j = 0; j < 64; ++j) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+  }
+  return x;
+}
+
+void
+WorkJob(void* arg, uint64_t begin, uint64_t end)
+{
+  for (uint64_t i = begin; i < end; ++i) {
+    kWork[i] = Kernel(i);
+  }
+}
+
+void
+EmptyJob(void* arg, uint64_t begin, uint64_t end)
+{
+}
+
+void
+StampJob(void* arg, uint64_t begin, uint64_t end)
+{
+  *(uint64_t*)arg = rdtsc();
+}
+
+void
+OrderJob(void* arg, uint64_t begin, uint64_t end)
+{
+  kOrder[__atomic_fetch_add(&kUsedOrder, 1, __ATOMIC_ACQ_REL)] = begin;
+}
+
+uint64_t
+Checksum()
+{
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i < kWorkCount; ++i) {
+    sum += kWork[i] * (i + 1);
+  }
+  return sum;
+}
+
+// Submits from a thread that is not a worker
+uint64_t
+ExternalMain(void* arg)
+{
+  JobCounter counter = {};
+  platform::job_submit(WorkJob, nullptr, 0, kWorkCount / 2, &counter);
+  platform::job_submit(WorkJob, nullptr, kWorkCount / 2, kWorkCount,
+                       &counter);
+  platform::job_wait(&counter);
+  return Checksum();
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+  const uint64_t core_count =
+      MIN(platform::thread_affinity_count(), JOB_MAX_WORKER);
+
+  // Reference result without workers
+  platform::job_parallel_for(WorkJob, nullptr, kWorkCount, kWorkGrain);
+  const uint64_t expected = Checksum();
+
+  platform::job_start(MAX(core_count, 2));
+  memset(kWork, 0, sizeof(kWork));
+  platform::job_parallel_for(WorkJob, nullptr, kWorkCount, kWorkGrain);
+  assert(Checksum() == expected);
+
+  // Dependent job runs after every job of its dependency
+  JobCounter first = {};
+  JobCounter second = {};
+  platform::job_then(&first, OrderJob, nullptr, 3, 4, &second);
+  for (uint64_t i = 0; i < 3; ++i) {
+    platform::job_submit(OrderJob, nullptr, i, i + 1, &first);
+  }
+  platform::job_wait(&second);
+  assert(kUsedOrder == 4);
+  assert(kOrder[3] == 3);
+
+  static ThreadInfo external;
+  memset(kWork, 0, sizeof(kWork));
+  external.func = ExternalMain;
+  platform::thread_create(&external);
+  platform::thread_join(&external);
+  assert(external.return_value == expected);
+  platform::job_stop();
+
+  // Spawn: submit and run on the same worker
+  platform::job_start(1);
+  uint64_t begin = rdtsc();
+  for (uint64_t i = 0; i < kLatencyCount; ++i) {
+    JobCounter counter = {};
+    platform::job_submit(EmptyJob, nullptr, 0, 0, &counter);
+    platform::job_wait(&counter);
+  }
+  uint64_t spawn_tsc = (rdtsc() - begin) / kLatencyCount;
+  platform::job_stop();
+
+  // Steal: the submitter does not help
+  platform::job_start(2);
+  uint64_t steal_tsc = 0;
+  for (uint64_t i = 0; i < kLatencyCount; ++i) {
+    JobCounter counter = {};
+    uint64_t stamp = 0;
+    begin = rdtsc();
+    platform::job_submit(StampJob, &stamp, 0, 0, &counter);
+    while (__atomic_load_n(&counter.pending, __ATOMIC_ACQUIRE)) {
+      platform::thread_yield();
+    }
+    steal_tsc += stamp - begin;
+  }
+  steal_tsc /= kLatencyCount;
+  const uint64_t stolen = kJobSystem.deque[1].stolen;
+  platform::job_stop();
+  assert(stolen == kLatencyCount);
+  printf("[ spawn %lu ns ] [ steal %lu ns ]\n",
+         spawn_tsc * 1000 / median_tsc_per_usec,
+         steal_tsc * 1000 / median_tsc_per_usec);
+
+  // Scaling from 1 to every core
+  uint64_t serial_tsc = 0;
+  for (uint64_t n = 1; n <= MAX(core_count, 1); ++n) {
+    platform::job_start(n);
+    begin = rdtsc();
+    for (int j = 0; j < 8; ++j) {
+      platform::job_parallel_for(WorkJob, nullptr, kWorkCount, kWorkGrain);
+    }
+    uint64_t tsc = (rdtsc() - begin) / 8;
+    platform::job_stop();
+    assert(Checksum() == expected);
+
+    if (n == 1) serial_tsc = tsc;
+    printf("[ workers %lu ] [ %lu usec ] [ speedup %.2f ]\n", n,
+           tsc / median_tsc_per_usec, (double)serial_tsc / tsc);
+  }
+
+  puts("ok");
+  return 0;
+}
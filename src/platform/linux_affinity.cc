@@ -37,4 +37,25 @@ thread_affinity_avoidcore(int cpu_index)
 
   return set_ret != -1;
 }
+
+// Pins the thread to the nth allowed core, other than core 0 when possible
+bool
+thread_affinity_pin(unsigned n)
+{
+  cpu_set_t mask;
+  pthread_t pt = pthread_self();
+
+  int ret = pthread_getaffinity_np(pt, sizeof(cpu_set_t), &mask);
+  if (ret != 0) return false;
+  if (CPU_COUNT(&mask) > 1) CPU_CLR(0, &mask);
+
+  n %= CPU_COUNT(&mask);
+  for (int i = 0; i < CPU_SETSIZE; ++i) {
+    if (!CPU_ISSET(i, &mask)) continue;
+    if (n--) continue;
+    return thread_affinity_usecore(i);
+  }
+
+  return false;
+}
 }  // namespace platform
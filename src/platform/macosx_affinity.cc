@@ -17,4 +17,10 @@ thread_affinity_avoidcore(int cpu_index)
 {
   return false;
 }
+
+bool
+thread_affinity_pin(unsigned n)
+{
+  return false;
+}
 }
@@ -31,3 +31,4 @@
 #endif
 
 #include "affinity.cc"
+#include "job.cc"
@@ -3,8 +3,12 @@
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
 #endif
 
+#include <cstdint>
+
 extern "C" {
 extern int udp_errno;
 }
@@ -20,3 +24,33 @@ struct Udp4 {
   char socket_address[16];
 };
 
+// Datagrams per ReceiveMany() or SendMany()
+#define MAX_UDP_BATCH 64
+
+// Datagrams moved by one system call, in buffers provided by the caller
+struct Udp4Batch {
+  uint64_t count;
+  uint8_t* buffer[MAX_UDP_BATCH];
+  uint16_t bytes[MAX_UDP_BATCH];
+  // Source of received datagrams, destination of sent ones
+  Udp4 peer[MAX_UDP_BATCH];
+#ifdef __linux__
+  // Preallocated for recvmmsg() and sendmmsg()
+  struct mmsghdr header[MAX_UDP_BATCH];
+  struct iovec iov[MAX_UDP_BATCH];
+#endif
+};
+
+// Datagram fields selecting one of the sockets sharing a port, in place of
+// the peer address, see udp::SteerReusePort()
+struct ReusePortRule {
+  // Datagrams of tag_bytes at least that lead with tag select by a hash of
+  // the 4 bytes at key_offset, below tag_bytes, unless those are all 0
+  uint8_t tag[4];
+  uint32_t tag_bytes;
+  uint32_t key_offset;
+  // Any other of 8 bytes at least selects the socket its first byte names,
+  // modulo id_modulus, a power of two up to 256, when there is one
+  uint32_t id_modulus;
+};
+
@@ -0,0 +1,153 @@
+#include <cassert>
+#include <cstdio>
+
+#include "platform.cc"
+
+// Rounds of MAX_UDP_BATCH datagrams sent and received over loopback
+constexpr uint64_t kRoundCount = 2000;
+// About a NotifyUpdate of a two player game
+constexpr uint16_t kPacketBytes = 96;
+
+static uint8_t kSend[MAX_UDP_BATCH][kPacketBytes];
+static uint8_t kReceive[MAX_UDP_BATCH][kPacketBytes * 2];
+static Udp4Batch kSendBatch;
+static Udp4Batch kReceiveBatch;
+
+struct Result {
+  uint64_t packets;
+  uint64_t syscalls;
+  uint64_t tsc;
+};
+
+void
+CheckPacket(const uint8_t* buffer, uint16_t bytes, Udp4 peer, Udp4 from,
+            uint64_t sequence)
+{
+  assert(bytes == kPacketBytes);
+  assert(memcmp(buffer, &sequence, sizeof(sequence)) == 0);
+  assert(memcmp(peer.socket_address, from.socket_address,
+                sizeof(from.socket_address)) == 0);
+}
+
+void
+Stamp(uint64_t sequence)
+{
+  memcpy(kSend[sequence % MAX_UDP_BATCH], &sequence, sizeof(sequence));
+}
+
+// One sendto() and one recvfrom() per datagram
+Result
+Single(Udp4 sender, Udp4 receiver)
+{
+  Result r = {};
+  uint64_t sequence = 0;
+  uint64_t begin = rdtsc();
+  for (uint64_t round = 0; round < kRoundCount; ++round) {
+    for (int i = 0; i < MAX_UDP_BATCH; ++i) {
+      Stamp(sequence + i);
+      assert(udp::SendTo(sender, receiver, kSend[i], kPacketBytes));
+      r.syscalls += 1;
+    }
+
+    uint64_t received = 0;
+    while (received < MAX_UDP_BATCH) {
+      uint16_t bytes;
+      Udp4 peer;
+      r.syscalls += 1;
+      if (!udp::ReceiveAny(receiver, sizeof(kReceive[0]), kReceive[0], &bytes,
+                           &peer)) {
+        assert(!udp_errno);
+        continue;
+      }
+      CheckPacket(kReceive[0], bytes, peer, sender, sequence);
+      sequence += 1;
+      received += 1;
+    }
+  }
+  r.tsc = rdtsc() - begin;
+  r.packets = sequence;
+  return r;
+}
+
+// One sendmmsg() and one recvmmsg() per round
+Result
+Batched(Udp4 sender, Udp4 receiver)
+{
+  Result r = {};
+  uint64_t sequence = 0;
+  uint64_t begin = rdtsc();
+  for (uint64_t round = 0; round < kRoundCount; ++round) {
+    for (int i = 0; i < MAX_UDP_BATCH; ++i) {
+      Stamp(sequence + i);
+      kSendBatch.bytes[i] = kPacketBytes;
+      kSendBatch.peer[i] = receiver;
+    }
+    kSendBatch.count = MAX_UDP_BATCH;
+    assert(udp::SendMany(sender, &kSendBatch));
+    r.syscalls += 1;
+
+    uint64_t received = 0;
+    while (received < MAX_UDP_BATCH) {
+      r.syscalls += 1;
+      if (!udp::ReceiveMany(receiver, sizeof(kReceive[0]), &kReceiveBatch)) {
+        assert(!udp_errno);
+        continue;
+      }
+      for (int i = 0; i < kReceiveBatch.count; ++i) {
+        CheckPacket(kReceiveBatch.buffer[i], kReceiveBatch.bytes[i],
+                    kReceiveBatch.peer[i], sender, sequence);
+        sequence += 1;
+      }
+      received += kReceiveBatch.count;
+    }
+  }
+  r.tsc = rdtsc() - begin;
+  r.packets = sequence;
+  return r;
+}
+
+void
+Report(const char* name, Result r)
+{
+  const uint64_t usec = r.tsc / median_tsc_per_usec;
+  printf(
+      "[ %s ] "
+      "[ %lu packets ] "
+      "[ %lu packets/sec ] "
+      "[ %.3f syscalls/packet ] "
+      "\n",
+      name, r.packets, r.packets * 1000 * 1000 / MAX(usec, 1),
+      (double)r.syscalls / r.packets);
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  Udp4 receiver;
+  Udp4 sender;
+  assert(udp::Init());
+  assert(udp::GetAddr4("127.0.0.1", "9846", &receiver));
+  assert(udp::GetAddr4("127.0.0.1", "9847", &sender));
+  assert(udp::Bind(receiver));
+  assert(udp::Bind(sender));
+
+  for (int i = 0; i < MAX_UDP_BATCH; ++i) {
+    kSendBatch.buffer[i] = kSend[i];
+    kReceiveBatch.buffer[i] = kReceive[i];
+  }
+
+  // Nothing pending is not an error
+  assert(!udp::ReceiveMany(receiver, sizeof(kReceive[0]), &kReceiveBatch));
+  assert(!udp_errno && !kReceiveBatch.count);
+
+  Result single = Single(sender, receiver);
+  Result batched = Batched(sender, receiver);
+  assert(single.packets == batched.packets);
+  Report("single", single);
+  Report("batched", batched);
+
+  puts("ok");
+  return 0;
+}
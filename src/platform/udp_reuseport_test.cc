@@ -0,0 +1,79 @@
+#include <cassert>
+#include <cstdio>
+
+#include "platform.cc"
+
+// Sockets sharing one port, as the shards of space_server
+constexpr uint32_t kSocketCount = 4;
+constexpr uint64_t kPeerCount = 64;
+
+static Udp4 kSocket[kSocketCount];
+static Udp4 kPeer[kPeerCount];
+static uint8_t kPacket[MAX_UDP_BATCH][64];
+static Udp4Batch kBatch;
+// Never tagged: datagrams of 8 bytes select by their first byte
+static const ReusePortRule kRule = {{'T', 'E', 'S', 'T'}, 16, 8,
+                                    kSocketCount};
+
+int
+main()
+{
+  assert(udp::Init());
+  for (int i = 0; i < kSocketCount; ++i) {
+    assert(udp::GetAddr4("127.0.0.1", "9848", &kSocket[i]));
+    assert(udp::SetReusePort(kSocket[i]));
+    assert(udp::Bind(kSocket[i]));
+  }
+  const bool steered =
+      udp::SteerReusePort(kSocket[0], kSocketCount, &kRule);
+
+  // Even peers send 8 bytes, odd peers a datagram that selects by address
+  for (uint64_t i = 0; i < kPeerCount; ++i) {
+    char port[8];
+    snprintf(port, sizeof(port), "%lu", 10100 + i);
+    assert(udp::GetAddr4("127.0.0.1", port, &kPeer[i]));
+    assert(udp::Bind(kPeer[i]));
+    const uint16_t bytes = i & 1 ? sizeof(uint32_t) : sizeof(uint64_t);
+    assert(udp::SendTo(kPeer[i], kSocket[0], &i, bytes));
+  }
+
+  for (int i = 0; i < MAX_UDP_BATCH; ++i) {
+    kBatch.buffer[i] = kPacket[i];
+  }
+
+  // Every datagram reaches the socket ReusePortSelect() names, when steered
+  uint64_t received = 0;
+  uint64_t agree = 0;
+  uint64_t count[kSocketCount] = {};
+  for (int i = 0; i < kSocketCount; ++i) {
+    while (udp::ReceiveMany(kSocket[i], sizeof(kPacket[0]), &kBatch)) {
+      for (int j = 0; j < kBatch.count; ++j) {
+        uint64_t peer = 0;
+        const uint16_t bytes = kBatch.bytes[j];
+        assert(bytes == sizeof(uint32_t) || bytes == sizeof(uint64_t));
+        memcpy(&peer, kBatch.buffer[j], bytes);
+        assert(bytes == (peer & 1 ? sizeof(uint32_t) : sizeof(uint64_t)));
+        assert(memcmp(kBatch.peer[j].socket_address,
+                      kPeer[peer].socket_address,
+                      sizeof(kPeer[peer].socket_address)) == 0);
+        agree += udp::ReusePortSelect(&kRule, kBatch.peer[j],
+                                      kBatch.buffer[j], bytes,
+                                      kSocketCount) == i;
+      }
+      received += kBatch.count;
+      count[i] += kBatch.count;
+    }
+    assert(!udp_errno);
+  }
+  assert(received == kPeerCount);
+  if (steered) assert(agree == kPeerCount);
+
+  printf("[ steered %d ] [ agree %lu of %lu ] ", steered, agree, received);
+  for (int i = 0; i < kSocketCount; ++i) {
+    printf("[ socket %d: %lu ] ", i, count[i]);
+  }
+  puts("");
+
+  puts("ok");
+  return 0;
+}
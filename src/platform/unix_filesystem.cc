@@ -1,8 +1,11 @@
 #include "filesystem.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 namespace filesystem
 {
@@ -15,4 +18,29 @@ MakeDirectory(const char* name)
   return true;
 }
 
+const uint8_t*
+MapFile(const char* name, uint64_t* bytes)
+{
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  // The mapping holds its own reference to the file
+  close(fd);
+  if (data == MAP_FAILED) return nullptr;
+
+  *bytes = st.st_size;
+  return (const uint8_t*)data;
+}
+
+void
+UnmapFile(const uint8_t* data, uint64_t bytes)
+{
+  munmap((void*)data, bytes);
+}
+
 }  // namespace filesystem
@@ -1,3 +1,4 @@
+#include <arpa/inet.h>
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/ip.h>
@@ -6,6 +7,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 #include <cassert>
 #include <cstdint>
 #include <cstring>
@@ -38,6 +43,12 @@ Bind(Udp4 location)
   return true;
 }
 
+void
+Close(Udp4 location)
+{
+  close(location.socket);
+}
+
 bool
 BindAddr(Udp4 peer, const char* host, const char* service_or_port)
 {
@@ -143,6 +154,95 @@ ReceiveAny(Udp4 location, uint16_t buffer_len, uint8_t* buffer,
   return true;
 }
 
+// Receives up to MAX_UDP_BATCH datagrams into batch->buffer, each of
+// buffer_len bytes. False when none are pending or on error.
+bool
+ReceiveMany(Udp4 location, uint16_t buffer_len, Udp4Batch* batch)
+{
+#ifdef __linux__
+  for (int i = 0; i < MAX_UDP_BATCH; ++i) {
+    // MUST initialize: msg_namelen is an in/out parameter
+    struct msghdr* msg = &batch->header[i].msg_hdr;
+    batch->iov[i].iov_base = batch->buffer[i];
+    batch->iov[i].iov_len = buffer_len;
+    *msg = {};
+    msg->msg_name = batch->peer[i].socket_address;
+    msg->msg_namelen = sizeof(struct sockaddr_in);
+    msg->msg_iov = &batch->iov[i];
+    msg->msg_iovlen = 1;
+  }
+
+  batch->count = 0;
+  int count = recvmmsg(location.socket, batch->header, MAX_UDP_BATCH,
+                       MSG_DONTWAIT, NULL);
+  if (count < 0) {
+    udp_errno = TERNARY(errno == EAGAIN, 0, errno);
+    return false;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    assert(sizeof(struct sockaddr_in) == batch->header[i].msg_hdr.msg_namelen);
+    batch->peer[i].socket = -1;
+    batch->bytes[i] = batch->header[i].msg_len;
+  }
+  batch->count = count;
+#else
+  batch->count = 0;
+  while (batch->count < MAX_UDP_BATCH) {
+    uint64_t i = batch->count;
+    if (!ReceiveAny(location, buffer_len, batch->buffer[i], &batch->bytes[i],
+                    &batch->peer[i])) {
+      break;
+    }
+    batch->count += 1;
+  }
+#endif
+
+  return batch->count;
+}
+
+// Sends batch->count datagrams, batch->bytes[i] of batch->buffer[i] to
+// batch->peer[i]. False unless all are sent.
+bool
+SendMany(Udp4 location, Udp4Batch* batch)
+{
+  assert(batch->count <= MAX_UDP_BATCH);
+#ifdef __linux__
+  for (int i = 0; i < batch->count; ++i) {
+    struct msghdr* msg = &batch->header[i].msg_hdr;
+    batch->iov[i].iov_base = batch->buffer[i];
+    batch->iov[i].iov_len = batch->bytes[i];
+    *msg = {};
+    msg->msg_name = batch->peer[i].socket_address;
+    msg->msg_namelen = sizeof(struct sockaddr_in);
+    msg->msg_iov = &batch->iov[i];
+    msg->msg_iovlen = 1;
+  }
+
+  // The kernel may stop short of the batch
+  uint64_t sent = 0;
+  while (sent < batch->count) {
+    int count = sendmmsg(location.socket, batch->header + sent,
+                         batch->count - sent, MSG_DONTWAIT);
+    if (count < 0) {
+      udp_errno = TERNARY(errno == EAGAIN, 0, errno);
+      return false;
+    }
+    sent += count;
+  }
+
+  return true;
+#else
+  bool sent = true;
+  for (int i = 0; i < batch->count; ++i) {
+    sent &= SendTo(location, batch->peer[i], batch->buffer[i],
+                   batch->bytes[i]);
+  }
+
+  return sent;
+#endif
+}
+
 void
 PollUsec(Udp4 location, uint64_t usec)
 {
@@ -158,6 +258,113 @@ SetLowDelay(Udp4 location)
                      sizeof(low_delay)) < 0);
 }
 
+// Sockets bound after this one may share its address and port
+bool
+SetReusePort(Udp4 location)
+{
+  int reuse = 1;
+  if (setsockopt(location.socket, SOL_SOCKET, SO_REUSEPORT, &reuse,
+                 sizeof(reuse)) != 0) {
+    udp_errno = errno;
+    return false;
+  }
+
+  return true;
+}
+
+// Socket of count sharing a port that SteerReusePort() selects for peer
+uint32_t
+ReusePortIndex(Udp4 peer, uint32_t count)
+{
+  const struct sockaddr_in* addr =
+      (const struct sockaddr_in*)peer.socket_address;
+  const uint32_t key = ntohl(addr->sin_addr.s_addr) ^ ntohs(addr->sin_port);
+  return ((key * 0x9e3779b1u) >> 16) % count;
+}
+
+// Socket of count sharing a port that SteerReusePort() selects for a
+// datagram of rule from peer
+uint32_t
+ReusePortSelect(const ReusePortRule* rule, Udp4 peer, const uint8_t* packet,
+                uint16_t bytes, uint32_t count)
+{
+  if (bytes >= 8 && bytes >= rule->tag_bytes &&
+      memcmp(packet, rule->tag, sizeof(rule->tag)) == 0) {
+    // Words load in network order
+    uint32_t key;
+    memcpy(&key, packet + rule->key_offset, sizeof(key));
+    key = ntohl(key);
+    if (key) {
+      key ^= key >> 16;
+      key ^= key >> 8;
+      return ((key * 0x9e3779b1u) >> 16) % count;
+    }
+  } else if (bytes >= 8) {
+    const uint32_t index = packet[0] & (rule->id_modulus - 1);
+    if (index < count) return index;
+  }
+
+  return ReusePortIndex(peer, count);
+}
+
+// Replaces the kernel's choice among count sockets sharing the port of
+// location, numbered in the order they were bound, by ReusePortSelect().
+// A datagram then reaches the same socket whatever the number of sockets.
+bool
+SteerReusePort(Udp4 location, uint32_t count, const ReusePortRule* rule)
+{
+#ifdef __linux__
+  const uint32_t tag = (uint32_t)rule->tag[0] << 24 |
+                       (uint32_t)rule->tag[1] << 16 |
+                       (uint32_t)rule->tag[2] << 8 | rule->tag[3];
+  // Words load in network order. The udp header is pulled: offset 0 is the
+  // payload, the source port follows the ip header. Jumps are relative to
+  // the next instruction.
+  struct sock_filter code[] = {
+      {BPF_LD | BPF_W | BPF_LEN, 0, 0, 0},
+      {BPF_JMP | BPF_JGE | BPF_K, 0, 16, 8},  // address
+      {BPF_JMP | BPF_JGE | BPF_K, 0, 11, rule->tag_bytes},  // id
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, 0},
+      {BPF_JMP | BPF_JEQ | BPF_K, 0, 9, tag},  // id
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, rule->key_offset},
+      {BPF_JMP | BPF_JEQ | BPF_K, 11, 0, 0},  // address
+      {BPF_MISC | BPF_TAX, 0, 0, 0},
+      {BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16},
+      {BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0},
+      {BPF_MISC | BPF_TAX, 0, 0, 0},
+      {BPF_ALU | BPF_RSH | BPF_K, 0, 0, 8},
+      {BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0},
+      {BPF_JMP | BPF_JA, 0, 0, 9},  // hash
+      // id
+      {BPF_LD | BPF_B | BPF_ABS, 0, 0, 0},
+      {BPF_ALU | BPF_AND | BPF_K, 0, 0, rule->id_modulus - 1},
+      {BPF_JMP | BPF_JGE | BPF_K, 1, 0, count},  // address
+      {BPF_RET | BPF_A, 0, 0, 0},
+      // address
+      {BPF_LDX | BPF_B | BPF_MSH, 0, 0, (uint32_t)SKF_NET_OFF},
+      {BPF_LD | BPF_H | BPF_IND, 0, 0, (uint32_t)SKF_NET_OFF},
+      {BPF_MISC | BPF_TAX, 0, 0, 0},
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)SKF_NET_OFF + 12},
+      {BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0},
+      // hash
+      {BPF_ALU | BPF_MUL | BPF_K, 0, 0, 0x9e3779b1u},
+      {BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, count},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog program = {.len = ARRAY_LENGTH(code), .filter = code};
+  if (setsockopt(location.socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                 &program, sizeof(program)) != 0) {
+    udp_errno = errno;
+    return false;
+  }
+
+  return true;
+#else
+  return false;
+#endif
+}
+
 bool
 GetAddr4(const char* host, const char* service_or_port, Udp4* out)
 {
@@ -20,4 +20,11 @@ thread_affinity_avoidcore(int cpu_index)
   // TODO
   return false;
 }
+
+bool
+thread_affinity_pin(unsigned n)
+{
+  // TODO
+  return false;
+}
 }
@@ -10,4 +10,34 @@ MakeDirectory(const char* name)
   return CreateDirectoryA(name, nullptr);
 }
 
+const uint8_t*
+MapFile(const char* name, uint64_t* bytes)
+{
+  HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+  LARGE_INTEGER size;
+  HANDLE mapping = nullptr;
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  }
+  CloseHandle(file);
+  if (!mapping) return nullptr;
+
+  // The view holds its own reference to the mapping
+  void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!data) return nullptr;
+
+  *bytes = size.QuadPart;
+  return (const uint8_t*)data;
+}
+
+void
+UnmapFile(const uint8_t* data, uint64_t bytes)
+{
+  UnmapViewOfFile(data);
+}
+
 }  // namespace filesystem
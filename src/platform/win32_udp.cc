@@ -33,6 +33,12 @@ Bind(Udp4 location)
   return true;
 }
 
+void
+Close(Udp4 location)
+{
+  closesocket(location.socket);
+}
+
 bool
 Send(Udp4 peer, const void* buffer, uint16_t len)
 {
@@ -103,6 +109,74 @@ ReceiveAny(Udp4 location, uint16_t buffer_len, uint8_t* buffer,
   return true;
 }
 
+// One datagram per call: recvfrom() blocks on this socket
+bool
+ReceiveMany(Udp4 location, uint16_t buffer_len, Udp4Batch* batch)
+{
+  batch->count = ReceiveAny(location, buffer_len, batch->buffer[0],
+                            &batch->bytes[0], &batch->peer[0]);
+  return batch->count;
+}
+
+bool
+SendMany(Udp4 location, Udp4Batch* batch)
+{
+  bool sent = true;
+  for (int i = 0; i < batch->count; ++i) {
+    sent &= SendTo(location, batch->peer[i], batch->buffer[i],
+                   batch->bytes[i]);
+  }
+
+  return sent;
+}
+
+// No SO_REUSEPORT: one socket per port
+bool
+SetReusePort(Udp4 location)
+{
+  return false;
+}
+
+uint32_t
+ReusePortIndex(Udp4 peer, uint32_t count)
+{
+  const struct sockaddr_in* addr =
+      (const struct sockaddr_in*)peer.socket_address;
+  const uint32_t key = ntohl(addr->sin_addr.s_addr) ^ ntohs(addr->sin_port);
+  return ((key * 0x9e3779b1u) >> 16) % count;
+}
+
+// Socket of count sharing a port that SteerReusePort() selects for a
+// datagram of rule from peer
+uint32_t
+ReusePortSelect(const ReusePortRule* rule, Udp4 peer, const uint8_t* packet,
+                uint16_t bytes, uint32_t count)
+{
+  if (bytes >= 8 && bytes >= rule->tag_bytes &&
+      memcmp(packet, rule->tag, sizeof(rule->tag)) == 0) {
+    // Words load in network order
+    uint32_t key;
+    memcpy(&key, packet + rule->key_offset, sizeof(key));
+    key = ntohl(key);
+    if (key) {
+      key ^= key >> 16;
+      key ^= key >> 8;
+      return ((key * 0x9e3779b1u) >> 16) % count;
+    }
+  } else if (bytes >= 8) {
+    const uint32_t index = packet[0] & (rule->id_modulus - 1);
+    if (index < count) return index;
+  }
+
+  return ReusePortIndex(peer, count);
+}
+
+bool
+SteerReusePort(Udp4 location, uint32_t count, const ReusePortRule* rule)
+{
+  return false;
+}
+
 #define IPTOS_LOWDELAY 0x10
 
 bool
@@ -0,0 +1,221 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "math/math.cc"
+
+#include "gfx/gfx.cc"
+#include "network/network.cc"
+#include "simulation/interaction.cc"
+#include "simulation/scripted_input.cc"
+#include "simulation/simulation.cc"
+
+// Drives the simulation without network or clock pacing, timing each phase
+// of Update() with rdtsc.
+
+#define MAX_BENCH_FRAME (60 * 60 * 10)
+#define MAX_RECORD (1024 * 1024)
+
+enum BenchPhase {
+  kBenchTilemap = simulation::kPhaseTilemap,
+  kBenchDecide = simulation::kPhaseDecide,
+  kBenchProjectile = simulation::kPhaseProjectile,
+  kBenchCompact = simulation::kPhaseCompact,
+  kBenchHash,
+  kBenchPhaseCount,
+};
+
+constexpr const char* kBenchPhaseNames[kBenchPhaseCount] = {
+    "TilemapUpdate", "Decide", "ProjectileSimulation", "RegistryCompact",
+    "Hash",
+};
+
+struct BenchState {
+  uint64_t frame_count = 60 * 60;
+  uint64_t seed = 1234;
+  uint64_t player_count = 2;
+  // Scenario to run, or kMaxScenario for all
+  uint64_t scenario = simulation::kMaxScenario;
+  // Run simulation stages on the job system
+  bool parallel = false;
+  // Recorded input of player 0, as read by playback_test
+  const char* record_file = nullptr;
+};
+
+static BenchState kBenchState;
+static uint64_t kSample[kBenchPhaseCount][MAX_BENCH_FRAME];
+static char kRecord[MAX_RECORD];
+static uint16_t* kRecordStart;
+static uint16_t* kRecordEnd;
+
+bool
+LoadRecord(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint64_t len = fread(kRecord, 1, sizeof(kRecord) - sizeof(uint16_t), f);
+  fclose(f);
+  if (!len) return false;
+
+  kRecordStart = (uint16_t*)kRecord;
+  kRecordEnd = kRecordStart;
+  while (*kRecordEnd != 0) ++kRecordEnd;
+  return true;
+}
+
+// Replays one record per frame, then no input
+void
+RecordedInput(uint16_t** record, char** event)
+{
+  if (*record >= kRecordEnd) return;
+
+  const uint64_t bytes = **record;
+  simulation::ProcessSimulation(0, bytes / sizeof(PlatformEvent),
+                                (const PlatformEvent*)*event);
+  *event += bytes;
+  *record += 1;
+}
+
+int
+CompareTsc(const void* a, const void* b)
+{
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+void
+Report(uint64_t phase, uint64_t count)
+{
+  uint64_t* sample = kSample[phase];
+  uint64_t sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += sample[i];
+  }
+  qsort(sample, count, sizeof(uint64_t), CompareTsc);
+
+  printf(
+      "  %-20s "
+      "[ mean %8lu ] "
+      "[ p50 %8lu ] "
+      "[ p99 %8lu ] "
+      "[ max %8lu ] "
+      "\n",
+      kBenchPhaseNames[phase], sum / count, sample[count / 2],
+      sample[count * 99 / 100], sample[count - 1]);
+}
+
+void
+RunScenario(uint64_t scenario)
+{
+  using namespace simulation;
+  kScenario = (ScenarioType)scenario;
+  RegistryClear();
+  Initialize(kBenchState.seed);
+  kSimulationHash = DJB2_CONST;
+
+  // Event bytes follow the zero terminated record lengths
+  uint16_t* record = kRecordStart;
+  char* event = kRecordStart ? (char*)(kRecordEnd + 1) : nullptr;
+  uint64_t count = 0;
+  uint64_t begin = rdtsc();
+  for (uint64_t frame = 0; frame < kBenchState.frame_count; ++frame) {
+    if (kRecordStart) {
+      RecordedInput(&record, &event);
+    } else {
+      simulation::ScriptedInput(&simulation::kScriptCrew, frame);
+    }
+
+    uint64_t tsc = rdtsc();
+    Hash();
+    kSample[kBenchHash][count] = rdtsc() - tsc;
+
+    memset(kPhaseTsc, 0, sizeof(kPhaseTsc));
+    simulation::Update();
+    for (int i = 0; i < kPhaseCount; ++i) {
+      kSample[i][count] = kPhaseTsc[i];
+    }
+    ++count;
+
+    if (kSimulationOver) break;
+  }
+  uint64_t end = rdtsc();
+
+  printf(
+      "%s "
+      "[ frames %lu ] "
+      "[ entities %lu ] "
+      "[ usec/frame %lu ] "
+      "[ hash 0x%016lx ] "
+      "\n",
+      kScenarioNames[scenario], count, kUsedEntity,
+      (end - begin) / median_tsc_per_usec / MAX(count, 1), kSimulationHash);
+  if (!count) return;
+  for (int i = 0; i < kBenchPhaseCount; ++i) {
+    Report(i, count);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  while (1) {
+    int opt = platform_getopt(argc, argv, "l:s:n:r:x:t");
+    if (opt == -1) break;
+
+    switch (opt) {
+      case 'l':
+        kBenchState.frame_count = strtol(platform_optarg, NULL, 10);
+        break;
+      case 's':
+        kBenchState.scenario = strtol(platform_optarg, NULL, 10);
+        break;
+      case 'n':
+        kBenchState.player_count = strtol(platform_optarg, NULL, 10);
+        break;
+      case 'r':
+        kBenchState.record_file = platform_optarg;
+        break;
+      case 'x':
+        kBenchState.seed = strtol(platform_optarg, NULL, 10);
+        break;
+      case 't':
+        kBenchState.parallel = true;
+        break;
+      default:
+        puts(
+            "Usage: sim_bench -l <frames> -s <scenario> -n <players> "
+            "-r <record_file> -x <seed> -t");
+        return 1;
+    }
+  }
+
+  kBenchState.frame_count = MIN(kBenchState.frame_count, MAX_BENCH_FRAME);
+  kPlayerCount = CLAMP(kBenchState.player_count, 1, MAX_PLAYER);
+  if (kBenchState.record_file && !LoadRecord(kBenchState.record_file)) {
+    printf("Failed to load %s\n", kBenchState.record_file);
+    return 1;
+  }
+
+  if (kBenchState.parallel) {
+    platform::job_start(platform::thread_affinity_count());
+  }
+  if (platform::thread_affinity_count() > 1) {
+    platform::thread_affinity_usecore(0);
+  }
+
+  __init_tsc_per_usec();
+  printf("median_tsc_per_usec %lu (phase times in tsc)\n",
+         median_tsc_per_usec);
+  for (uint64_t i = 0; i < simulation::kMaxScenario; ++i) {
+    if (kBenchState.scenario != simulation::kMaxScenario &&
+        kBenchState.scenario != i) {
+      continue;
+    }
+    RunScenario(i);
+  }
+
+  platform::job_stop();
+
+  return 0;
+}
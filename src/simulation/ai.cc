@@ -13,8 +13,9 @@ AIWander(Unit* unit)
   // Non interrupting behavior.
   if (unit->uaction != kUaNone) return;
 
-  Tile t = TileNeighbor(unit->tile, rand());
-  BB_SET(unit->bb, kUnitDestination, t);
+  Tile t =
+      TileNeighbor(EntityTile(unit), Rand(kRandShip + EntityShipIndex(unit)));
+  BB_SET(UnitBb(unit), kUnitDestination, t);
   unit->uaction = kUaMove;
 }
 
@@ -23,12 +24,10 @@ AIDefend(Unit* unit)
 {
   if (unit->uaction != kUaNone) return;
 
-  Unit* target = GetNearestEnemyUnit(unit);
+  Unit* target = GetNearestEnemyUnitInRange(unit);
   if (!target) return;
 
-  if (!InRange(unit, target)) return;
-
-  BB_SET(unit->bb, kUnitTarget, target->id);
+  BB_SET(UnitBb(unit), kUnitTarget, target->id);
   unit->uaction = kUaAttack;
 }
 
@@ -42,7 +41,7 @@ AISimpleBehavior(Unit* unit)
 
   Unit* nearby_target = FindUnitInRangeToAttack(unit);
   if (nearby_target) {
-    BB_SET(unit->bb, kUnitTarget, nearby_target->id);
+    BB_SET(UnitBb(unit), kUnitTarget, nearby_target->id);
     unit->uaction = kUaAttack;
     return;
   }
@@ -58,7 +57,7 @@ AIAttackInterrupt(Unit* unit)
   // If the AI discovers a nearer target than the one it is attacking it
   // will change targets.
   const uint32_t* current_target;
-  if (!BB_GET(unit->bb, kUnitTarget, current_target)) return;
+  if (!BB_GET(UnitBb(unit), kUnitTarget, current_target)) return;
 
   Unit* nearest_target = GetNearestEnemyUnit(unit);
   if (!nearest_target) return;
@@ -66,7 +65,7 @@ AIAttackInterrupt(Unit* unit)
   // Nearest target remains the one it is attacking.
   if (nearest_target->id == *current_target) return;
   // Otherwise switch to new nearest.
-  BB_SET(unit->bb, kUnitTarget, nearest_target->id);
+  BB_SET(UnitBb(unit), kUnitTarget, nearest_target->id);
 }
 
 void
@@ -77,12 +76,12 @@ AIAttackWhenDiscovered(Unit* unit)
   // Non interrupting behavior.
   if (unit->uaction != kUaNone) return;
 
-  if (unit->tile.shroud && !unit->tile.visible) return;
+  if (EntityTile(unit).shroud && !EntityTile(unit).visible) return;
 
   Unit* target = GetNearestEnemyUnit(unit);
   if (!target) return;
 
-  BB_SET(unit->bb, kUnitTarget, target->id);
+  BB_SET(UnitBb(unit), kUnitTarget, target->id);
   unit->uaction = kUaAttack;
 }
 
@@ -96,13 +95,13 @@ AICrewMember(Unit* unit)
   const int* timer;
   // Timer should perhaps be a global AI construct that gets updated for all
   // units that contain active timers?
-  if (BB_GET(unit->bb, kUnitTimer, timer) && *timer > 0) {
+  if (BB_GET(UnitBb(unit), kUnitTimer, timer) && *timer > 0) {
     // If timer is set the crew member is working on something.
     int new_time = (*timer) - 1;
     if (new_time <= 0) {
-      BB_REM(unit->bb, kUnitTimer);
+      BB_REM(UnitBb(unit), kUnitTimer);
     } else {
-      BB_SET(unit->bb, kUnitTimer, new_time);
+      BB_SET(UnitBb(unit), kUnitTimer, new_time);
     }
     return;
   }
@@ -110,7 +109,7 @@ AICrewMember(Unit* unit)
   // Prioritize building unbuilt modules.
   Module* target_mod = nullptr;
   FOR_EACH_ENTITY(Module, mod, {
-    if (mod->ship_index != unit->ship_index) continue;
+    if (EntityShipIndex(mod) != EntityShipIndex(unit)) continue;
     if (!ModuleBuilt(mod)) {
       target_mod = mod;
       break;
@@ -119,12 +118,12 @@ AICrewMember(Unit* unit)
 
   // Find a random module.
   if (!target_mod) {
-    int rand_val = rand() % kUsedEntity;
+    int rand_val = Rand(kRandShip + EntityShipIndex(unit)) % kUsedEntity;
     for (int i = 0; i < kUsedEntity; ++i) {
       uint64_t idx = (rand_val + i) % kUsedEntity;
       Module* mod = i2Module(idx);
       if (!mod) continue;
-      if (mod->ship_index != unit->ship_index) continue;
+      if (EntityShipIndex(mod) != EntityShipIndex(unit)) continue;
       if (mod->mkind == kModEngine || mod->mkind == kModMine ||
           mod->mkind == kModDoor) {
         target_mod = mod;
@@ -136,10 +135,10 @@ AICrewMember(Unit* unit)
   if (!target_mod) return;
 
   // Go to the mod and stay there for timer.
-  BB_SET(unit->bb, kUnitDestination, target_mod->tile);
+  BB_SET(UnitBb(unit), kUnitDestination, EntityTile(target_mod));
   unit->uaction = kUaMove;
   int init_timer = 200;
-  BB_SET(unit->bb, kUnitTimer, init_timer);
+  BB_SET(UnitBb(unit), kUnitTimer, init_timer);
 }
 
 void
@@ -151,7 +150,7 @@ AIThink(Unit* unit)
   AIDefend(unit);
 
   const int* behavior;
-  if (!BB_GET(unit->bb, kUnitBehavior, behavior)) return;
+  if (!BB_GET(UnitBb(unit), kUnitBehavior, behavior)) return;
   switch (*behavior) {
     case kUnitBehaviorSimple: {
       AISimpleBehavior(unit);
@@ -167,7 +166,7 @@ AIThink(Unit* unit)
   }
 
   // Clear AI knowledge that should be learned per tick.
-  BB_REM(unit->bb, kUnitAttacker);
+  BB_REM(UnitBb(unit), kUnitAttacker);
 }
 
 }  // namespace simulation
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "search.cc"
+#include "ship.cc"
+
+namespace simulation
+{
+// Best-first path search over the tiles of one ship.
+//
+// Nodes are packed tile indices, (cy << kMapDefaultBits) | cx. Node data is
+// only current when its 'seen' mark matches the search generation, so a new
+// search does not clear the arrays.
+//
+// Movement matches the bfs: 8 neighbors, onto unblocked tiles, wrapping at
+// the edge of the map (TileNeighbor).
+//
+// AStarPathTo() charges one per step and finds a path as short as PathTo().
+// JpsPathTo() charges octile costs and jumps over runs of open tiles,
+// expanding far fewer nodes. Its path may take more steps.
+constexpr int kAStarIndexBits = 2 * kMapDefaultBits;
+constexpr uint32_t kAStarIndexMask = (1 << kAStarIndexBits) - 1;
+constexpr int kMaxAStarNode = kMapMaxHeight * kMapMaxWidth;
+// A node is opened at most once per neighbor
+constexpr int kMaxAStarHeap = kMaxAStarNode * kMaxNeighbor;
+// Octile step costs, approximately 1 : sqrt(2)
+constexpr uint32_t kJpsStraightCost = 5;
+constexpr uint32_t kJpsDiagonalCost = 7;
+
+struct AStar {
+  // Generation of the search that last opened or closed the node
+  uint32_t seen[kMaxAStarNode];
+  uint32_t closed[kMaxAStarNode];
+  uint32_t cost[kMaxAStarNode];
+  uint16_t parent[kMaxAStarNode];
+  // kNeighbor index of the step from the parent
+  uint8_t direction[kMaxAStarNode];
+  // Min heap of (estimate << kAStarIndexBits) | node
+  uint32_t heap[kMaxAStarHeap];
+  int heap_size;
+  uint32_t generation;
+  // Blocked plane of the map of the search in progress
+  const uint64_t* blocked;
+  int map_width;
+  int mask;
+  int goal_x;
+  int goal_y;
+  // Nodes removed from the heap by the last search
+  uint64_t expanded;
+  // The resulting path as calculated from the last search
+  Path path;
+};
+
+// Scratch of the calling thread: ships may search at once
+static thread_local AStar kAStar;
+
+INLINE uint32_t
+AStarNode(int x, int y)
+{
+  return (y << kMapDefaultBits) | x;
+}
+
+INLINE int
+AStarX(uint32_t node)
+{
+  return node & (kMapMaxWidth - 1);
+}
+
+INLINE int
+AStarY(uint32_t node)
+{
+  return node >> kMapDefaultBits;
+}
+
+INLINE bool
+AStarBlocked(int x, int y)
+{
+  x &= kAStar.mask;
+  y &= kAStar.mask;
+  return (kAStar.blocked[y] >> x) & 1;
+}
+
+// Steps between a and b along one axis, either way around the map
+INLINE int
+AStarAxisDistance(int a, int b)
+{
+  int d = (a - b) & kAStar.mask;
+  return MIN(d, kAStar.map_width - d);
+}
+
+INLINE void
+AStarHeapPush(uint32_t key)
+{
+  uint32_t* heap = kAStar.heap;
+  int i = kAStar.heap_size++;
+  while (i) {
+    int parent = (i - 1) / 2;
+    if (heap[parent] <= key) break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = key;
+}
+
+INLINE uint32_t
+AStarHeapPop()
+{
+  uint32_t* heap = kAStar.heap;
+  uint32_t top = heap[0];
+  uint32_t key = heap[--kAStar.heap_size];
+  const int size = kAStar.heap_size;
+  int i = 0;
+  while (true) {
+    int child = 2 * i + 1;
+    if (child >= size) break;
+    if (child + 1 < size && heap[child + 1] < heap[child]) child += 1;
+    if (key <= heap[child]) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = key;
+  return top;
+}
+
+int
+AStarDirection(int dx, int dy)
+{
+  for (int i = 0; i < kMaxNeighbor; ++i) {
+    if (kNeighbor[i].x == dx && kNeighbor[i].y == dy) return i;
+  }
+
+  return 0;
+}
+
+// Prepare a search from start to the (cx, cy) of end on the ship of start
+//
+// Returns false when no search is required.
+bool
+AStarStart(Tile start, Tile end)
+{
+  kAStar.heap_size = 0;
+  kAStar.expanded = 0;
+  kAStar.path.size = 0;
+  if (start == end) return false;
+  if (!TileValid(start)) return false;
+
+  const Ship* ship = &kShip[start.ship_index];
+  if (end.cx >= ship->map_width || end.cy >= ship->map_height) return false;
+  if (TilePlaneTest(start.ship_index, kPlaneBlocked, end.cx, end.cy)) {
+    return false;
+  }
+
+  kAStar.generation += 1;
+  if (!kAStar.generation) {
+    memset(kAStar.seen, 0, sizeof(kAStar.seen));
+    memset(kAStar.closed, 0, sizeof(kAStar.closed));
+    kAStar.generation = 1;
+  }
+
+  kAStar.blocked = TilePlaneRow(start.ship_index, kPlaneBlocked);
+  kAStar.map_width = ship->map_width;
+  kAStar.mask = (1 << start.bitrange_xy) - 1;
+  kAStar.goal_x = end.cx;
+  kAStar.goal_y = end.cy;
+  return true;
+}
+
+INLINE void
+AStarOpen(uint32_t node, uint32_t cost, uint32_t estimate, uint32_t parent,
+          int direction)
+{
+  if (kAStar.seen[node] == kAStar.generation) {
+    if (kAStar.closed[node] == kAStar.generation) return;
+    if (kAStar.cost[node] <= cost) return;
+  }
+
+  kAStar.seen[node] = kAStar.generation;
+  kAStar.cost[node] = cost;
+  kAStar.parent[node] = parent;
+  kAStar.direction[node] = direction;
+  AStarHeapPush(((cost + estimate) << kAStarIndexBits) | node);
+}
+
+// Returns the next node to expand, or false when the search is exhausted
+INLINE bool
+AStarNext(uint32_t* node)
+{
+  while (kAStar.heap_size) {
+    uint32_t n = AStarHeapPop() & kAStarIndexMask;
+    if (kAStar.closed[n] == kAStar.generation) continue;
+    kAStar.closed[n] = kAStar.generation;
+    kAStar.expanded += 1;
+    *node = n;
+    return true;
+  }
+
+  return false;
+}
+
+// Walk parents from the goal, filling the tiles skipped by each jump
+Path*
+AStarBuildPath(uint32_t start, uint32_t goal, uint64_t ship_index)
+{
+  auto& path = kAStar.path;
+  auto& psz = kAStar.path.size;
+  uint32_t node = goal;
+  path.tile[psz++] = *ShipTile(ship_index, AStarX(node), AStarY(node));
+  while (node != start) {
+    const uint32_t parent = kAStar.parent[node];
+    const v2i step = kNeighbor[kAStar.direction[node]];
+    int x = AStarX(node);
+    int y = AStarY(node);
+    while (AStarNode(x, y) != parent) {
+      x = (x - step.x) & kAStar.mask;
+      y = (y - step.y) & kAStar.mask;
+      path.tile[psz++] = *ShipTile(ship_index, x, y);
+    }
+    node = parent;
+  }
+  // Reverse it
+  for (int i = 0, last = psz - 1; i < last; ++i, --last) {
+    auto t = path.tile[last];
+    path.tile[last] = path.tile[i];
+    path.tile[i] = t;
+  }
+
+  return &kAStar.path;
+}
+
+// Find a path with the fewest steps from start to end.
+//
+// end is taken as a position on the ship of start.
+// Returns nullptr when there is no path, matching PathTo().
+Path*
+AStarPathTo(Tile start, Tile end)
+{
+  if (!AStarStart(start, end)) return nullptr;
+
+  const uint32_t start_node = AStarNode(start.cx, start.cy);
+  const uint32_t goal_node = AStarNode(end.cx, end.cy);
+  AStarOpen(start_node, 0, 0, start_node, 0);
+
+  uint32_t node;
+  while (AStarNext(&node)) {
+    if (node == goal_node) {
+      return AStarBuildPath(start_node, goal_node, start.ship_index);
+    }
+
+    const int x = AStarX(node);
+    const int y = AStarY(node);
+    const uint32_t cost = kAStar.cost[node] + 1;
+    for (int i = 0; i < kMaxNeighbor; ++i) {
+      const int nx = (x + kNeighbor[i].x) & kAStar.mask;
+      const int ny = (y + kNeighbor[i].y) & kAStar.mask;
+      if (AStarBlocked(nx, ny)) continue;
+      // Chebyshev distance
+      const int hx = AStarAxisDistance(nx, kAStar.goal_x);
+      const int hy = AStarAxisDistance(ny, kAStar.goal_y);
+      AStarOpen(AStarNode(nx, ny), cost, MAX(hx, hy), node, i);
+    }
+  }
+
+  return nullptr;
+}
+
+INLINE uint32_t
+JpsEstimate(int x, int y)
+{
+  const int hx = AStarAxisDistance(x, kAStar.goal_x);
+  const int hy = AStarAxisDistance(y, kAStar.goal_y);
+  const int diagonal = MIN(hx, hy);
+  return diagonal * kJpsDiagonalCost +
+         (MAX(hx, hy) - diagonal) * kJpsStraightCost;
+}
+
+// Step from (x, y) in direction (dx, dy) until reaching a jump point.
+//
+// A jump point is the goal, or a tile with a forced neighbor: an open tile
+// beside a wall that is only reached optimally through this tile.
+// Diagonal steps also stop where a straight jump finds a jump point.
+// Returns false when the step is blocked, or the map was traversed.
+bool
+JpsJump(int x, int y, int dx, int dy, int* out_x, int* out_y)
+{
+  for (int i = 0; i < kAStar.map_width; ++i) {
+    x = (x + dx) & kAStar.mask;
+    y = (y + dy) & kAStar.mask;
+    if (AStarBlocked(x, y)) return false;
+
+    *out_x = x;
+    *out_y = y;
+    if (x == kAStar.goal_x && y == kAStar.goal_y) return true;
+
+    int jx, jy;
+    if (dx && dy) {
+      if (AStarBlocked(x - dx, y) && !AStarBlocked(x - dx, y + dy)) return true;
+      if (AStarBlocked(x, y - dy) && !AStarBlocked(x + dx, y - dy)) return true;
+      if (JpsJump(x, y, dx, 0, &jx, &jy)) return true;
+      if (JpsJump(x, y, 0, dy, &jx, &jy)) return true;
+    } else if (dx) {
+      if (AStarBlocked(x, y + 1) && !AStarBlocked(x + dx, y + 1)) return true;
+      if (AStarBlocked(x, y - 1) && !AStarBlocked(x + dx, y - 1)) return true;
+    } else {
+      if (AStarBlocked(x + 1, y) && !AStarBlocked(x + 1, y + dy)) return true;
+      if (AStarBlocked(x - 1, y) && !AStarBlocked(x - 1, y + dy)) return true;
+    }
+  }
+
+  return false;
+}
+
+// Jump from node in direction (dx, dy), opening the jump point
+INLINE void
+JpsSuccessor(uint32_t node, int dx, int dy)
+{
+  const int x = AStarX(node);
+  const int y = AStarY(node);
+  int jx, jy;
+  if (!JpsJump(x, y, dx, dy, &jx, &jy)) return;
+
+  const int steps = dx ? ((jx - x) * dx) & kAStar.mask
+                       : ((jy - y) * dy) & kAStar.mask;
+  const uint32_t step_cost =
+      (dx && dy) ? kJpsDiagonalCost : kJpsStraightCost;
+  AStarOpen(AStarNode(jx, jy), kAStar.cost[node] + steps * step_cost,
+            JpsEstimate(jx, jy), node, AStarDirection(dx, dy));
+}
+
+// Jump point search: find a path from start to end.
+//
+// end is taken as a position on the ship of start.
+// Returns nullptr when there is no path, matching PathTo().
+Path*
+JpsPathTo(Tile start, Tile end)
+{
+  if (!AStarStart(start, end)) return nullptr;
+
+  const uint32_t start_node = AStarNode(start.cx, start.cy);
+  const uint32_t goal_node = AStarNode(end.cx, end.cy);
+  AStarOpen(start_node, 0, 0, start_node, 0);
+
+  uint32_t node;
+  while (AStarNext(&node)) {
+    if (node == goal_node) {
+      return AStarBuildPath(start_node, goal_node, start.ship_index);
+    }
+
+    if (node == start_node) {
+      for (int i = 0; i < kMaxNeighbor; ++i) {
+        JpsSuccessor(node, kNeighbor[i].x, kNeighbor[i].y);
+      }
+      continue;
+    }
+
+    // Prune neighbors reached at least as well without passing this node
+    const int x = AStarX(node);
+    const int y = AStarY(node);
+    const v2i d = kNeighbor[kAStar.direction[node]];
+    if (d.x && d.y) {
+      JpsSuccessor(node, d.x, 0);
+      JpsSuccessor(node, 0, d.y);
+      JpsSuccessor(node, d.x, d.y);
+      if (AStarBlocked(x - d.x, y)) JpsSuccessor(node, -d.x, d.y);
+      if (AStarBlocked(x, y - d.y)) JpsSuccessor(node, d.x, -d.y);
+    } else if (d.x) {
+      JpsSuccessor(node, d.x, 0);
+      if (AStarBlocked(x, y + 1)) JpsSuccessor(node, d.x, 1);
+      if (AStarBlocked(x, y - 1)) JpsSuccessor(node, d.x, -1);
+    } else {
+      JpsSuccessor(node, 0, d.y);
+      if (AStarBlocked(x + 1, y)) JpsSuccessor(node, 1, d.y);
+      if (AStarBlocked(x - 1, y)) JpsSuccessor(node, -1, d.y);
+    }
+  }
+
+  return nullptr;
+}
+
+}  // namespace simulation
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "network/protocol.cc"
+
+#include "entity.cc"
+
+// Desync localization.
+//
+// Every DIGEST_INTERVAL frames a checkpoint records a tree of the state: a
+// leaf per used slot, a node per registry (its RegistryDigest()) and a root
+// over the nodes. The root goes to the server with each Update. On a
+// mismatch the server walks down the tree, one DigestTree per request, to
+// the first divergent registry and slot.
+
+namespace simulation
+{
+// Leaves of every registry in one checkpoint
+#define MAX_DESYNC_LEAF 1024
+
+struct DesyncCheckpoint {
+  uint64_t frame;
+  uint64_t root;
+  uint64_t node[MAX_DIGEST_NODE];
+  // Leaves of registry i are [leaf_offset[i], leaf_offset[i + 1])
+  uint32_t leaf_offset[MAX_DIGEST_NODE + 1];
+  uint32_t leaf[MAX_DESYNC_LEAF];
+};
+
+static WORLD_LOCAL DesyncCheckpoint kDesyncCheckpoint[MAX_DIGEST_CHECKPOINT];
+
+// Records a checkpoint on frames that are due one. Call after Hash(): node
+// digests are then cached and only the leaves are read.
+bool
+DesyncCapture(uint64_t frame)
+{
+  if (!frame || frame % DIGEST_INTERVAL) return false;
+  assert(kUsedRegistry <= MAX_DIGEST_NODE);
+
+  DesyncCheckpoint* c = &kDesyncCheckpoint[DIGEST_CHECKPOINT(frame)];
+  c->frame = frame;
+  uint32_t leaf_count = 0;
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    Registry* r = &kRegistry[i];
+    c->node[i] = RegistryDigest(r);
+    c->leaf_offset[i] = leaf_count;
+
+    const uint64_t count = *r->memb_count;
+    assert(leaf_count + count <= MAX_DESYNC_LEAF);
+    for (uint64_t j = 0; j < count; ++j) {
+      uint64_t leaf = xxhash64((const uint8_t*)r->ptr + j * r->memb_size,
+                               r->memb_size, j);
+      FOR_EACH_REGISTRY_COLUMN(r, column, {
+        leaf = xxhash64((const uint8_t*)column->ptr + j * column->size,
+                        column->size, leaf);
+      });
+      c->leaf[leaf_count++] = leaf;
+    }
+  }
+  c->leaf_offset[kUsedRegistry] = leaf_count;
+  c->root = xxhash64((const uint8_t*)c->node, kUsedRegistry * sizeof(uint64_t),
+                     frame);
+
+  return true;
+}
+
+const DesyncCheckpoint*
+DesyncFind(uint64_t frame)
+{
+  const DesyncCheckpoint* c = &kDesyncCheckpoint[DIGEST_CHECKPOINT(frame)];
+  if (!frame || c->frame != frame) return nullptr;
+  return c;
+}
+
+// Fills the reply to a server request, false once the checkpoint is gone
+bool
+DesyncFill(uint64_t frame, uint64_t registry, DigestTree* tree)
+{
+  const DesyncCheckpoint* c = DesyncFind(frame);
+  if (!c) return false;
+
+  tree->frame = frame;
+  tree->registry = registry;
+  tree->node_count = kUsedRegistry;
+  memcpy(tree->node, c->node, kUsedRegistry * sizeof(uint64_t));
+  tree->leaf_count = 0;
+  if (registry < kUsedRegistry) {
+    const uint32_t begin = c->leaf_offset[registry];
+    const uint32_t end = c->leaf_offset[registry + 1];
+    tree->leaf_count = MIN(end - begin, MAX_DIGEST_LEAF);
+    memcpy(tree->leaf, c->leaf + begin, tree->leaf_count * sizeof(uint32_t));
+  }
+
+  return true;
+}
+
+}  // namespace simulation
@@ -0,0 +1,115 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "scripted_input.cc"
+#include "simulation.cc"
+
+using namespace simulation;
+
+constexpr uint64_t kFrameCount = 3 * DIGEST_INTERVAL + 1;
+// Checkpoint where one client diverges
+constexpr uint64_t kDesyncFrame = 2 * DIGEST_INTERVAL;
+constexpr uint64_t kDesyncSlot = 3;
+
+static DesyncCheckpoint kReference[MAX_DIGEST_CHECKPOINT];
+static uint64_t kCaptureTsc;
+static uint64_t kCaptureCount;
+
+// One client: the game loop of space.cc without the network
+void
+Run(bool desync)
+{
+  RegistryClear();
+  memset(kDesyncCheckpoint, 0, sizeof(kDesyncCheckpoint));
+  Initialize(1234);
+
+  for (uint64_t frame = 0; frame < kFrameCount; ++frame) {
+    ScriptedInput(&kScriptAttack, frame);
+    if (desync && frame == kDesyncFrame) {
+      assert(kDesyncSlot < kUsedEntity);
+      kEntityPosition[kDesyncSlot].x += 1.f;
+    }
+
+    Hash();
+    uint64_t begin = rdtsc();
+    if (DesyncCapture(frame)) {
+      kCaptureTsc += rdtsc() - begin;
+      kCaptureCount += 1;
+      assert(DesyncFind(frame));
+    }
+    simulation::Update();
+  }
+}
+
+uint64_t
+EntityRegistryIndex()
+{
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    if (kRegistry[i].ptr == kEntity) return i;
+  }
+  return kInvalidIndex;
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+  kPlayerCount = 2;
+  kScenario = kTwoShip;
+
+  Run(false);
+  memcpy(kReference, kDesyncCheckpoint, sizeof(kReference));
+  assert(!DesyncCapture(kDesyncFrame + 1));
+  assert(!DesyncFind(0));
+
+  // The same input reproduces every root
+  Run(false);
+  for (int i = 0; i < MAX_DIGEST_CHECKPOINT; ++i) {
+    assert(kReference[i].root == kDesyncCheckpoint[i].root);
+  }
+
+  Run(true);
+  for (uint64_t frame = DIGEST_INTERVAL; frame < kFrameCount;
+       frame += DIGEST_INTERVAL) {
+    const uint64_t c = DIGEST_CHECKPOINT(frame);
+    assert(kReference[c].frame == frame);
+    assert((kReference[c].root == kDesyncCheckpoint[c].root) ==
+           (frame < kDesyncFrame));
+  }
+
+  // Server requests the nodes, then the leaves of the divergent registry
+  static DigestTree a;
+  static DigestTree b;
+  assert(DesyncFill(kDesyncFrame, kInvalidIndex, &b));
+  assert(b.leaf_count == 0);
+  static DesyncCheckpoint desync[MAX_DIGEST_CHECKPOINT];
+  memcpy(desync, kDesyncCheckpoint, sizeof(desync));
+  memcpy(kDesyncCheckpoint, kReference, sizeof(kReference));
+  assert(DesyncFill(kDesyncFrame, kInvalidIndex, &a));
+  const uint64_t registry = DigestFirstNode(&a, &b);
+  assert(registry == EntityRegistryIndex());
+
+  assert(DesyncFill(kDesyncFrame, registry, &a));
+  memcpy(kDesyncCheckpoint, desync, sizeof(desync));
+  assert(DesyncFill(kDesyncFrame, registry, &b));
+  assert(a.leaf_count == kUsedEntity);
+  assert(DigestFirstLeaf(&a, &b) == kDesyncSlot);
+
+  // Gone once the ring wraps
+  assert(!DesyncFill(kDesyncFrame + MAX_DIGEST_CHECKPOINT * DIGEST_INTERVAL,
+                     kInvalidIndex, &a));
+
+  const uint64_t capture_ns =
+      kCaptureTsc * 1000 / median_tsc_per_usec / kCaptureCount;
+  printf(
+      "[ tree %lu bytes ] "
+      "[ capture %lu ns ] "
+      "[ %lu ns/frame ] "
+      "\n",
+      sizeof(DigestTree), capture_ns, capture_ns / DIGEST_INTERVAL);
+
+  puts("ok");
+  return 0;
+}
@@ -6,49 +6,139 @@
 
 #include "camera.cc"
 #include "entity_registry.cc"
+#include "snapshot.cc"
+
+// Released slots of type, reclaimed by RegistryCompact()
+#define DECLARE_GAME_TOMBSTONE(type, max_count)                        \
+  static WORLD_LOCAL uint64_t kTombstone##type[(max_count + 63) / 64]; \
+  static WORLD_LOCAL uint32_t kDeadSlot##type[max_count];              \
+  static WORLD_LOCAL uint64_t kUsedDeadSlot##type;                     \
+  DECLARE_SNAPSHOT(kTombstone##type)                                   \
+  DECLARE_SNAPSHOT(kDeadSlot##type)                                    \
+  DECLARE_SNAPSHOT(kUsedDeadSlot##type)                                \
+                                                                       \
+  void Tombstone##type(uint64_t slot)                                  \
+  {                                                                    \
+    RegistryTombstone(kTombstone##type, kDeadSlot##type,               \
+                      &kUsedDeadSlot##type, slot);                     \
+  }
+
+// Members of a game type captured by SnapshotCapture()
+#define DECLARE_GAME_SNAPSHOT(type) \
+  DECLARE_SNAPSHOT(k##type)         \
+  DECLARE_SNAPSHOT(kUsed##type)
+
+#define DECLARE_GAME_HASH_SNAPSHOT(type) \
+  DECLARE_GAME_SNAPSHOT(type)            \
+  DECLARE_SNAPSHOT(kHashEntry##type)     \
+  DECLARE_SNAPSHOT(kFreeHash##type)      \
+  DECLARE_SNAPSHOT(kUsedFreeHash##type)  \
+  DECLARE_SNAPSHOT(kUsedHash##type)
+
+#define DECLARE_GAME_REGISTRY(type, max_count)                  \
+  k##type, &kZero##type, &kUsed##type, max_count, sizeof(type), \
+      kTombstone##type, kDeadSlot##type, &kUsedDeadSlot##type
 
 // Data used by game simulation
-#define DECLARE_GAME_TYPE(type, max_count)                               \
-  DECLARE_ARRAY(type, max_count)                                         \
-  static EntityRegistry kInit##type(k##type, &kZero##type, &kUsed##type, \
-                                    max_count, sizeof(type), nullptr,    \
-                                    nullptr);
-
-// kInvalidId is reserved for invalid references
-#define DECLARE_GAME_TYPE_WITH_ID(type, max_count)                             \
-  DECLARE_HASH_ARRAY(type, max_count)                                          \
-  static EntityRegistry kInit##type(k##type, &kZero##type, &kUsed##type,       \
-                                    max_count, sizeof(type), kHashEntry##type, \
-                                    Hash##type);
-
-#define DECLARE_GAME_QUEUE(type, count) DECLARE_QUEUE(type, count)
-
-// Use with DECLARE_GAME_TYPE_WITH_ID(Entity, ...)
-#define DECLARE_GAME_ENTITY(type, tid)           \
-  type* UseEntity##type()                        \
-  {                                              \
-    Entity* e = UseEntity();                     \
-    if (!e) return nullptr;                      \
-    type t = {};                                 \
-    t.id = e->id;                                \
-    memcpy(e, &t, sizeof(t));                    \
-    return (type*)e;                             \
-  }                                              \
-                                                 \
-  type* i2##type(uint64_t idx)                   \
-  {                                              \
-    assert(idx < kUsedEntity);                   \
-    type* t = (type*)(&kEntity[idx]);            \
-    if (t->type_id != tid) return nullptr;       \
-    if (t->id == 0) return nullptr;              \
-    return t;                                    \
-  }                                              \
-                                                 \
-  type* Find##type(uint32_t id)                  \
-  {                                              \
-    type* t = (type*)FindEntity(id);             \
-    if (!t || t->type_id != tid) return nullptr; \
-    return t;                                    \
+// Zero##type() releases an instance, its record and its columns
+#define DECLARE_GAME_TYPE(type, max_count)                                  \
+  DECLARE_ARRAY(type, max_count)                                            \
+  DECLARE_GAME_TOMBSTONE(type, max_count)                                   \
+  DECLARE_GAME_SNAPSHOT(type)                                               \
+  /* Index in kRegistry, the same in every world */                         \
+  static uint64_t kRegistry##type;                                          \
+  void RegistryBind##type()                                                 \
+  {                                                                         \
+    kRegistry##type = kUsedRegistry;                                        \
+    RegistryRegister(DECLARE_GAME_REGISTRY(type, max_count), nullptr,       \
+                     nullptr);                                              \
+  }                                                                         \
+  static WorldRegister kInit##type(RegistryBind##type);                     \
+                                                                            \
+  void Zero##type(type* t)                                                  \
+  {                                                                         \
+    RegistryZeroSlot(&kRegistry[kRegistry##type], t - k##type);             \
+    Tombstone##type(t - k##type);                                           \
+  }
+
+// Ids are generational handles, kInvalidId is reserved for invalid references
+#define DECLARE_GAME_TYPE_WITH_ID(type, max_count)                          \
+  DECLARE_HASH_ARRAY(type, max_count)                                       \
+  DECLARE_GAME_TOMBSTONE(type, max_count)                                   \
+  DECLARE_GAME_HASH_SNAPSHOT(type)                                          \
+  static uint64_t kRegistry##type;                                          \
+  void RegistryBind##type()                                                 \
+  {                                                                         \
+    kRegistry##type = kUsedRegistry;                                        \
+    RegistryRegister(DECLARE_GAME_REGISTRY(type, max_count),                \
+                     kHashEntry##type, Hash##type);                         \
+  }                                                                         \
+  static WorldRegister kInit##type(RegistryBind##type);                     \
+                                                                            \
+  void Zero##type(type* t)                                                  \
+  {                                                                         \
+    FreeHashEntry##type(t->id);                                             \
+    RegistryZeroSlot(&kRegistry[kRegistry##type], t - k##type);             \
+    Tombstone##type(t - k##type);                                           \
+  }
+
+// Member of type stored as a column, a structure of arrays: k##type##column
+// holds the member of the instance in each slot of k##type. Scans of the
+// member read the column alone. type##column(t) accesses the member of t,
+// a pointer into k##type.
+#define DECLARE_GAME_COLUMN(type, member_type, column)                      \
+  static WORLD_LOCAL member_type k##type##column[kMax##type];               \
+  static member_type kZero##type##column;                                   \
+  DECLARE_SNAPSHOT(k##type##column)                                         \
+  void RegistryBind##type##column()                                         \
+  {                                                                         \
+    RegistryAddColumn(k##type, k##type##column, &kZero##type##column,       \
+                      sizeof(member_type));                                 \
+  }                                                                         \
+  static WorldRegister kInit##type##column(RegistryBind##type##column);     \
+                                                                            \
+  template <typename T>                                                     \
+  INLINE member_type& type##column(const T* t)                              \
+  {                                                                         \
+    return k##type##column[(const type*)t - k##type];                       \
+  }
+
+#define DECLARE_GAME_QUEUE(type, count) \
+  DECLARE_QUEUE(type, count)            \
+  DECLARE_SNAPSHOT(k##type)             \
+  DECLARE_SNAPSHOT(kRead##type)         \
+  DECLARE_SNAPSHOT(kWrite##type)
+
+// Use with DECLARE_GAME_TYPE_WITH_ID(Entity, ...) and its columns
+// Padding is hashed: instances are copies of kZero##type, never temporaries
+#define DECLARE_GAME_ENTITY(type, tid)                           \
+  static type kZero##type;                                       \
+                                                                 \
+  type* UseEntity##type()                                        \
+  {                                                              \
+    Entity* e = UseEntity();                                     \
+    if (!e) return nullptr;                                      \
+    const uint32_t id = e->id;                                   \
+    RegistryZeroSlot(&kRegistry[kRegistryEntity], e - kEntity);  \
+    memcpy(e, &kZero##type, sizeof(type));                       \
+    ((type*)e)->id = id;                                         \
+    kEntityTypeId[e - kEntity] = tid;                            \
+    return (type*)e;                                             \
+  }                                                              \
+                                                                 \
+  /* Reads the type column alone when the slot holds no type */  \
+  INLINE type* i2##type(uint64_t idx)                            \
+  {                                                              \
+    assert(idx < kUsedEntity);                                   \
+    if (kEntityTypeId[idx] != tid) return nullptr;               \
+    return (type*)(&kEntity[idx]);                               \
+  }                                                              \
+                                                                 \
+  type* Find##type(uint32_t id)                                  \
+  {                                                              \
+    type* t = (type*)FindEntity(id);                             \
+    if (!t || EntityTypeId(t) != tid) return nullptr;            \
+    return t;                                                    \
   }
 
 #define FOR_EACH_ENTITY(type, vname, body)                          \
@@ -62,8 +152,8 @@
   }
 
 // Global game state that is local information
-static uint64_t kPlayerCount;
-static uint64_t kPlayerIndex;
+static WORLD_LOCAL uint64_t kPlayerCount;
+static WORLD_LOCAL uint64_t kPlayerIndex;
 
 // Common Flags
 enum UnitAction {
@@ -181,10 +271,31 @@ struct Tile {
     };
   };
 };
+// Plane p holds bit p of Tile::flags for every tile, one word per row
+enum TilePlane {
+  kPlaneBlocked,
+  kPlaneNooxygen,
+  kPlaneShroud,
+  kPlaneVisible,
+  kPlaneExterior,
+  kPlaneExplored,
+  kPlaneCount,
+};
 struct Grid {
   Tile tilemap[kMapMaxHeight][kMapMaxWidth];
+  // Bit x of plane[p][y] mirrors the flag p of tile (x, y)
+  uint64_t plane[kPlaneCount][kMapMaxHeight];
 };
 DECLARE_GAME_TYPE(Grid, 2);
+// Tiles are written by tilemap.cc alone, which sets kGridWritten
+static WORLD_LOCAL bool kGridWritten;
+
+void
+GridBind()
+{
+  RegistryTrackWrites(kGrid, &kGridWritten);
+}
+static WorldRegister kGridTracked(GridBind);
 
 enum ShipEnum { kShipBlank, kShipShuttle, kShipCruiser };
 
@@ -193,7 +304,6 @@ struct Ship {
   uint64_t level;
   uint64_t deck = 1;
   uint64_t pod_capacity;
-  Tile* map;
   uint16_t map_width;
   uint16_t map_height;
   ShipEnum type;
@@ -203,6 +313,14 @@ struct Ship {
 };
 DECLARE_GAME_TYPE(Ship, 2);
 
+// Tiles of the ship, map_width per row. Ships hold no pointer: Hash() reads
+// every member and addresses differ between processes.
+INLINE Tile*
+ShipMap(uint64_t ship_index)
+{
+  return &kGrid[ship_index].tilemap[0][0];
+}
+
 struct Projectile {
   v3f start;
   v3f end;
@@ -211,30 +329,24 @@ struct Projectile {
   unsigned frame;
   // Frame duration
   int duration;
+  // Handle of the target unit
   uint32_t target_id;
 };
 DECLARE_GAME_TYPE(Projectile, 128);
 
-#define COMMON_MEMBER_DECL \
-  int id;                  \
-  v3f position;            \
-  v3f scale;               \
-  v3f bounds;              \
-  Tile tile;               \
-  uint64_t control;        \
-  uint64_t ship_index;     \
-  uint64_t player_index;   \
-  int type_id
-
 enum EntityEnum {
   kEeInvalid = kInvalidId,
   kEeUnit,
   kEeModule,
 };
 
+// Records of an entity hold its handle and the members of its type.
+// Members every entity has are columns, declared with the Entity type. So
+// are the cold members: the blackboard and the module counters.
+//
+// RegistryCompact() reads the handle from the first bytes of the record.
 struct Unit {
-  COMMON_MEMBER_DECL = kEeUnit;
-  Blackboard bb;
+  int id;
   // This will teleport unit position to the warp_tile at beginning of frame
   Tile warp_tile;
   UnitKind kind;
@@ -260,38 +372,72 @@ struct Unit {
 constexpr int kTrainIdle = -1;
 
 struct Module {
-  COMMON_MEMBER_DECL = kEeModule;
+  int id;
   ModuleKind mkind;
-  int frames_to_build = 200;
-  int frames_building = 0;
-  int frames_to_train = 1600;
-  int frames_training = kTrainIdle;
   bool enabled = true;
 };
 
 union Entity {
   struct {
-    COMMON_MEMBER_DECL;
+    int id;
   };
   Unit unit;
   Module module;
 
-  Entity() : type_id(kEeInvalid)
+  Entity() : id(kInvalidId)
   {
   }
 };
+
+// Value type of each UnitBbEntry, units are referenced by handle
+BB_ENTRY(kUnitTarget, uint32_t);
+BB_ENTRY(kUnitDestination, Tile);
+BB_ENTRY(kUnitAttackDestination, Tile);
+BB_ENTRY(kUnitBehavior, int);
+BB_ENTRY(kUnitAttacker, uint32_t);
+BB_ENTRY(kUnitTimer, int);
+typedef Blackboard<kUnitBbEntryMax> UnitBlackboard;
+
+// Members rarely read by entity scans
+struct ColdEntity {
+  // Unit only
+  UnitBlackboard bb;
+  // Module only
+  int frames_to_build = 200;
+  int frames_building = 0;
+  int frames_to_train = 1600;
+  int frames_training = kTrainIdle;
+};
+
+#ifndef MAX_ENTITY
 #define MAX_ENTITY 128
+#endif
 DECLARE_GAME_TYPE_WITH_ID(Entity, MAX_ENTITY);
+// kEeInvalid in released slots
+DECLARE_GAME_COLUMN(Entity, int, TypeId);
+DECLARE_GAME_COLUMN(Entity, v3f, Position);
+DECLARE_GAME_COLUMN(Entity, v3f, Scale);
+DECLARE_GAME_COLUMN(Entity, v3f, Bounds);
+DECLARE_GAME_COLUMN(Entity, Tile, Tile);
+DECLARE_GAME_COLUMN(Entity, uint64_t, Control);
+DECLARE_GAME_COLUMN(Entity, uint64_t, ShipIndex);
+DECLARE_GAME_COLUMN(Entity, uint64_t, PlayerIndex);
+DECLARE_GAME_COLUMN(Entity, ColdEntity, Cold);
 DECLARE_GAME_ENTITY(Unit, kEeUnit);
 DECLARE_GAME_ENTITY(Module, kEeModule);
 
-#define ZeroEntity(x)         \
-  FreeHashEntryEntity(x->id); \
-  *(Entity*)x = kZeroEntity;
+INLINE UnitBlackboard&
+UnitBb(const Unit* unit)
+{
+  return EntityCold(unit).bb;
+}
+
+#define ZeroEntity(x) ZeroEntity((Entity*)(x))
 
 struct Command {
   UnitAction type;
   v3f destination;
+  // Handle of the commanded unit, or kInvalidId for every controlled unit
   uint32_t unit_id;
   unsigned control : MAX_PLAYER;
   uint64_t PADDING : 30;
@@ -324,12 +470,13 @@ constexpr int kMaxInvasionCount = 10;
 
 // TODO: Find a better place for this. Controls the max units allowed in an
 // invasion and increments up to kMaxInvasionCount.
-static int kMaxThisInvasion = 2;
+static WORLD_LOCAL int kMaxThisInvasion = 2;
+DECLARE_SNAPSHOT(kMaxThisInvasion)
 
 struct Invasion {
   Transform transform;
   v2f invasion_dir;
-  // Units countained in the invasion.
+  // Handles of the units contained in the invasion.
   uint32_t unit_id[kMaxInvasionCount];
   int unit_count;
 
@@ -337,3 +484,19 @@ struct Invasion {
   Tile docked_tile;
 };
 DECLARE_GAME_TYPE(Invasion, 2);
+
+// Random streams, drawn by random.cc: one per system, one per ship stage
+enum RandSystem {
+  kRandProjectile = 0,
+  kRandInvasion,
+  kRandAdmin,
+  kRandShip,
+};
+
+// PCG32 state
+struct RandStream {
+  uint64_t state;
+  // Odd, selects the stream
+  uint64_t inc;
+};
+DECLARE_GAME_TYPE(RandStream, kRandShip + kMaxShip);
@@ -0,0 +1,118 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "entity.cc"
+
+struct Item {
+  uint32_t id;
+  uint32_t value;
+};
+DECLARE_GAME_TYPE_WITH_ID(Item, 256);
+
+constexpr int kFrameCount = 100000;
+constexpr int kMaxStale = 1024;
+
+// Handles of live items and the value each was given
+static uint32_t kLive[kMaxItem];
+static uint32_t kLiveValue[kMaxItem];
+static uint64_t kUsedLive;
+
+// Handles of released items, never valid again
+static uint32_t kStale[kMaxStale];
+static uint64_t kUsedStale;
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  uint64_t lookups = 0;
+  uint64_t lookup_tsc = 0;
+  uint64_t stale_lookups = 0;
+  uint64_t stale_tsc = 0;
+  uint64_t moved = 0;
+  uint64_t spawned = 0;
+  srand(11);
+  for (int frame = 0; frame < kFrameCount; ++frame) {
+    int spawn = rand() % 16;
+    for (int i = 0; i < spawn && kUsedItem < kMaxItem; ++i) {
+      Item* item = UseItem();
+      assert(item->id != kInvalidId);
+      item->value = rand();
+      kLive[kUsedLive] = item->id;
+      kLiveValue[kUsedLive] = item->value;
+      ++kUsedLive;
+      ++spawned;
+    }
+
+    int release = kUsedLive ? rand() % 16 : 0;
+    for (int i = 0; i < release && kUsedLive; ++i) {
+      uint64_t idx = rand() % kUsedLive;
+      uint32_t handle = kLive[idx];
+      ZeroItem(FindItem(handle));
+      // Releasing twice through a stale handle is harmless
+      FreeHashEntryItem(handle);
+      kStale[kUsedStale++ % kMaxStale] = handle;
+      kLive[idx] = kLive[--kUsedLive];
+      kLiveValue[idx] = kLiveValue[kUsedLive];
+    }
+
+    RegistryCompact();
+    for (int i = 0; i < kUsedRegistry; ++i) {
+      moved += kRegistry[i].moved;
+    }
+    // A released slot may stay until the next compaction
+    assert(kUsedItem >= kUsedLive);
+
+    // Handles follow their item across compaction
+    uint64_t begin = rdtsc();
+    uint64_t found = 0;
+    for (int i = 0; i < kUsedLive; ++i) {
+      found += (FindItem(kLive[i]) != nullptr);
+    }
+    lookup_tsc += rdtsc() - begin;
+    lookups += kUsedLive;
+    assert(found == kUsedLive);
+    for (int i = 0; i < kUsedLive; ++i) {
+      const Item* item = FindItem(kLive[i]);
+      assert(item->id == kLive[i]);
+      assert(item->value == kLiveValue[i]);
+    }
+
+    begin = rdtsc();
+    found = 0;
+    const uint64_t stale_count = MIN(kUsedStale, kMaxStale);
+    for (int i = 0; i < stale_count; ++i) {
+      found += (FindItem(kStale[i]) != nullptr);
+    }
+    stale_tsc += rdtsc() - begin;
+    stale_lookups += stale_count;
+    assert(found == 0);
+  }
+
+  printf("[ %lu spawned ] [ %lu moved ] [ %lu items ]\n", spawned, moved,
+         kUsedItem);
+  const uint64_t ps = 1000 * 1000 / median_tsc_per_usec;
+  printf("[ live %lu ps/lookup ] [ stale %lu ps/lookup ]\n",
+         lookup_tsc * ps / MAX(lookups, 1),
+         stale_tsc * ps / MAX(stale_lookups, 1));
+
+  // Every entry is released: the table reuses released entries first
+  for (int i = 0; i < kUsedLive; ++i) {
+    ZeroItem(FindItem(kLive[i]));
+  }
+  while (RegistryCompact()) continue;
+  assert(kUsedItem == 0);
+  assert(kUsedHashItem <= kMaxHashItem);
+  assert(kUsedFreeHashItem == kUsedHashItem);
+
+  assert(FindItem(kInvalidId) == nullptr);
+  ResetHashItem();
+  Item* item = UseItem();
+  assert(HashItem(item->id) == 0);
+
+  puts("ok");
+  return 0;
+}
@@ -7,65 +7,267 @@
 
 #include "common/common.cc"
 
+#include "world.cc"
+
 struct Registry {
   void* ptr;
   void* zero_ptr;
   uint64_t* memb_count;
   uint32_t memb_max;
   uint32_t memb_size;
+  // Bit per slot released since the last compaction
+  uint64_t* tombstone;
+  // Released slots, unordered
+  uint32_t* dead_slot;
+  uint64_t* dead_count;
   HashEntry* hash_entry;
   uint32_t (*hash_func)(uint32_t id);
+  // Bit per column of kRegistryColumn that holds members of the type
+  uint64_t column_mask;
+  // Live slots moved by the last RegistryCompact()
+  uint64_t moved;
+  // Used slots as of the last RegistryDigest()
+  uint64_t digest;
+  uint64_t digest_count;
+  // Optional flag set by every writer of the registry
+  bool* written;
 };
 
 #define MAX_REGISTRY (PAGE / sizeof(Registry))
 DECLARE_ARRAY(Registry, MAX_REGISTRY);
 
-class EntityRegistry
-{
- public:
-  // Used in global static initialization
-  EntityRegistry(void* buffer, void* zero, uint64_t* count_ptr, uint32_t max,
-                 uint32_t size, HashEntry* hash_entry,
+// Member of a type stored apart from its records, one element per slot
+struct RegistryColumn {
+  void* ptr;
+  void* zero_ptr;
+  uint32_t size;
+};
+
+#define MAX_REGISTRY_COLUMN 64
+DECLARE_ARRAY(RegistryColumn, MAX_REGISTRY_COLUMN);
+
+#define FOR_EACH_REGISTRY_COLUMN(r, vname, body)                         \
+  for (uint64_t ColumnMask = (r)->column_mask; ColumnMask;               \
+       ColumnMask &= ColumnMask - 1) {                                   \
+    RegistryColumn* vname = &kRegistryColumn[TZCNT(ColumnMask)];        \
+    body                                                                 \
+  }
+
+// Called by the bind function of the type, see world.cc
+void
+RegistryRegister(void* buffer, void* zero, uint64_t* count_ptr, uint32_t max,
+                 uint32_t size, uint64_t* tombstone, uint32_t* dead_slot,
+                 uint64_t* dead_count, HashEntry* hash_entry,
                  uint32_t (*hash_func)(uint32_t))
-  {
-    assert(kUsedRegistry < MAX_REGISTRY);
-    kRegistry[kUsedRegistry] = {buffer, zero,       count_ptr, max,
-                                size,   hash_entry, hash_func};
-    kUsedRegistry += 1;
+{
+  assert(kUsedRegistry < MAX_REGISTRY);
+  kRegistry[kUsedRegistry] = {buffer,     zero,      count_ptr, max,
+                              size,       tombstone, dead_slot, dead_count,
+                              hash_entry, hash_func, 0,         0,
+                              0,          0,         nullptr};
+  kUsedRegistry += 1;
+}
+
+Registry*
+RegistryFind(const void* ptr)
+{
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    if (kRegistry[i].ptr == ptr) return &kRegistry[i];
   }
-};
 
+  return nullptr;
+}
+
+// Called by the bind function of the column, after the bind of its type
+void
+RegistryAddColumn(const void* ptr, void* column, void* zero, uint32_t size)
+{
+  Registry* r = RegistryFind(ptr);
+  assert(r);
+  assert(kUsedRegistryColumn < MAX_REGISTRY_COLUMN);
+  r->column_mask |= 1ull << kUsedRegistryColumn;
+  kRegistryColumn[kUsedRegistryColumn] = {column, zero, size};
+  kUsedRegistryColumn += 1;
+}
+
+// Bytes of one slot, record and columns
+uint64_t
+RegistrySlotSize(const Registry* r)
+{
+  uint64_t size = r->memb_size;
+  FOR_EACH_REGISTRY_COLUMN(r, column, { size += column->size; });
+  return size;
+}
+
+// The record and every column of the slot hold their zero instance
+void
+RegistryZeroSlot(Registry* r, uint64_t slot)
+{
+  memcpy((uint8_t*)r->ptr + slot * r->memb_size, r->zero_ptr, r->memb_size);
+  FOR_EACH_REGISTRY_COLUMN(r, column, {
+    memcpy((uint8_t*)column->ptr + slot * column->size, column->zero_ptr,
+           column->size);
+  });
+}
+
+INLINE bool
+RegistryIsTombstone(const uint64_t* tombstone, uint64_t slot)
+{
+  return tombstone[slot / 64] & (1ull << (slot % 64));
+}
+
+// Record a released slot, once
+INLINE void
+RegistryTombstone(uint64_t* tombstone, uint32_t* dead_slot,
+                  uint64_t* dead_count, uint64_t slot)
+{
+  if (RegistryIsTombstone(tombstone, slot)) return;
+  tombstone[slot / 64] |= (1ull << (slot % 64));
+  dead_slot[(*dead_count)++] = slot;
+}
+
+// Release every slot of every registry
+void
+RegistryReset()
+{
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    Registry* r = &kRegistry[i];
+    *r->memb_count = 0;
+    memset(r->tombstone, 0, (r->memb_max + 63) / 64 * sizeof(uint64_t));
+    *r->dead_count = 0;
+    r->moved = 0;
+    if (r->written) *r->written = true;
+  }
+}
+
+// Registries that report writes are digested again only when written
+bool
+RegistryTrackWrites(void* ptr, bool* written)
+{
+  Registry* r = RegistryFind(ptr);
+  if (!r) return false;
+  r->written = written;
+  *written = true;
+  return true;
+}
+
+// Digest of the used slots, records and columns.
+//
+// Released slots are not read: a release shrinks or moves the used range at
+// the next compaction.
+uint64_t
+RegistryDigest(Registry* r)
+{
+  const uint64_t count = *r->memb_count;
+  if (r->written && !*r->written && !r->moved && r->digest_count == count) {
+    return r->digest;
+  }
+
+  uint64_t digest =
+      xxhash64((const uint8_t*)r->ptr, count * r->memb_size, count);
+  FOR_EACH_REGISTRY_COLUMN(r, column, {
+    digest =
+        xxhash64((const uint8_t*)column->ptr, count * column->size, digest);
+  });
+  r->digest = digest;
+  r->digest_count = count;
+  if (r->written) *r->written = false;
+
+  return digest;
+}
+
+// RegistryReset() and every slot holds its zero instance, as at startup.
+// Hash() reads unused slots: a cleared registry hashes the same every run.
+void
+RegistryClear()
+{
+  RegistryReset();
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    Registry* r = &kRegistry[i];
+    for (int j = 0; j < r->memb_max; ++j) {
+      RegistryZeroSlot(r, j);
+    }
+  }
+}
+
+// The last used slot moves into each dead slot, in ascending slot order.
+//
+// Only tombstoned slots are visited. The slot layout matches a scan of every
+// used slot for zeroed members: a dead slot may receive a dead last slot, in
+// which case it remains dead until the next compaction.
 uint64_t
 RegistryCompact()
 {
   uint64_t sum = 0;
   for (int i = 0; i < kUsedRegistry; ++i) {
     Registry* r = &kRegistry[i];
-    int lower = 0;
-    int upper = *r->memb_count - 1;
-    // printf("Check %d [%lu entities]\n", i, *r->memb_count);
+    r->moved = 0;
+    uint32_t* dead_slot = r->dead_slot;
+    const uint64_t dead_count = *r->dead_count;
+    if (!dead_count) continue;
+
+    // insertion sort: few slots are released per frame
+    for (int j = 1; j < dead_count; ++j) {
+      uint32_t v = dead_slot[j];
+      int k = j;
+      for (; k > 0 && dead_slot[k - 1] > v; --k) {
+        dead_slot[k] = dead_slot[k - 1];
+      }
+      dead_slot[k] = v;
+    }
+
     const uint32_t memb_size = r->memb_size;
     const void* zero_ptr = r->zero_ptr;
+    int64_t upper = *r->memb_count - 1;
     uint64_t count = 0;
-    uint64_t idx = 0;
-    for (; lower <= upper; ++lower) {
+    uint64_t still_dead = 0;
+    int j = 0;
+    for (; j < dead_count; ++j) {
+      const int64_t lower = dead_slot[j];
+      if (lower > upper) break;
+
       uint8_t* lower_ent = (uint8_t*)r->ptr + lower * memb_size;
-      bool empty_lower = memcmp(lower_ent, zero_ptr, memb_size) == 0;
-      if (empty_lower) {
-        uint8_t* upper_ent = (uint8_t*)r->ptr + upper * memb_size;
-        memcpy(lower_ent, upper_ent, memb_size);
-        if (r->hash_entry) {
-          // Expectation that id is first 32 bits in entities.
-          uint32_t id = *((uint32_t*)(lower_ent));
-          r->hash_entry[r->hash_func(id)].array_idx = idx;
+      uint8_t* upper_ent = (uint8_t*)r->ptr + upper * memb_size;
+      memcpy(lower_ent, upper_ent, memb_size);
+      if (r->hash_entry) {
+        // Expectation that id is first 32 bits in entities.
+        // A dead last slot has no handle to update.
+        uint32_t id = *((uint32_t*)(lower_ent));
+        if (id != kInvalidId) {
+          r->hash_entry[r->hash_func(id)].array_idx = lower;
+        }
+      }
+      memcpy(upper_ent, zero_ptr, memb_size);
+      // Columns follow the slot, empty slots hold zero columns
+      FOR_EACH_REGISTRY_COLUMN(r, column, {
+        const uint32_t size = column->size;
+        uint8_t* lower_memb = (uint8_t*)column->ptr + lower * size;
+        uint8_t* upper_memb = (uint8_t*)column->ptr + upper * size;
+        memcpy(lower_memb, upper_memb, size);
+        memcpy(upper_memb, column->zero_ptr, size);
+      });
+
+      const bool upper_dead = RegistryIsTombstone(r->tombstone, upper);
+      r->tombstone[upper / 64] &= ~(1ull << (upper % 64));
+      if (lower != upper) {
+        if (upper_dead) {
+          dead_slot[still_dead++] = lower;
+        } else {
+          r->tombstone[lower / 64] &= ~(1ull << (lower % 64));
+          r->moved += 1;
         }
-        memcpy(upper_ent, zero_ptr, memb_size);
-        --upper;
-        ++count;
       }
-      ++idx;
+      --upper;
+      ++count;
+    }
+
+    // Dead slots past the used range are zero and unused
+    for (; j < dead_count; ++j) {
+      const uint32_t slot = dead_slot[j];
+      r->tombstone[slot / 64] &= ~(1ull << (slot % 64));
     }
 
+    *r->dead_count = still_dead;
     *r->memb_count -= count;
     sum += count;
   }
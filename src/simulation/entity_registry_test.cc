@@ -0,0 +1,86 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "entity.cc"
+
+struct Item {
+  uint32_t id;
+  uint32_t value;
+};
+DECLARE_GAME_TYPE(Item, 256);
+DECLARE_GAME_COLUMN(Item, uint64_t, Weight);
+
+static Item kReference[kMaxItem];
+static uint64_t kReferenceWeight[kMaxItem];
+static uint64_t kUsedReference;
+
+// Compaction by scanning every used slot for the zero instance
+void
+ReferenceCompact()
+{
+  int lower = 0;
+  int upper = kUsedReference - 1;
+  uint64_t count = 0;
+  for (; lower <= upper; ++lower) {
+    if (memcmp(&kReference[lower], &kZeroItem, sizeof(Item)) == 0) {
+      kReference[lower] = kReference[upper];
+      kReference[upper] = kZeroItem;
+      kReferenceWeight[lower] = kReferenceWeight[upper];
+      kReferenceWeight[upper] = 0;
+      --upper;
+      ++count;
+    }
+  }
+  kUsedReference -= count;
+}
+
+int
+main()
+{
+  uint32_t next_id = 1;
+  uint64_t moved = 0;
+  srand(7);
+  for (int frame = 0; frame < 10000; ++frame) {
+    int spawn = rand() % 8;
+    for (int i = 0; i < spawn && kUsedItem < kMaxItem; ++i) {
+      Item* item = UseItem();
+      item->id = next_id;
+      item->value = rand();
+      ItemWeight(item) = rand();
+      kReferenceWeight[kUsedReference] = ItemWeight(item);
+      kReference[kUsedReference++] = *item;
+      ++next_id;
+    }
+
+    // Release slots, sometimes twice
+    int release = kUsedItem ? rand() % 8 : 0;
+    for (int i = 0; i < release; ++i) {
+      uint64_t slot = rand() % kUsedItem;
+      ZeroItem(&kItem[slot]);
+      kReference[slot] = kZeroItem;
+      kReferenceWeight[slot] = 0;
+    }
+
+    RegistryCompact();
+    ReferenceCompact();
+    for (int i = 0; i < kUsedRegistry; ++i) {
+      moved += kRegistry[i].moved;
+    }
+
+    assert(kUsedItem == kUsedReference);
+    assert(memcmp(kItem, kReference, sizeof(kItem)) == 0);
+    // The column follows the slot of its record
+    assert(memcmp(kItemWeight, kReferenceWeight, sizeof(kItemWeight)) == 0);
+  }
+
+  printf("[ %lu items ] [ %lu moved ]\n", kUsedItem, moved);
+
+  RegistryReset();
+  assert(kUsedItem == 0);
+  assert(kUsedDeadSlotItem == 0);
+
+  puts("ok");
+  return 0;
+}
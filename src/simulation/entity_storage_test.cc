@@ -0,0 +1,216 @@
+// Bytes touched and time per tick of kEntity storage, at 128, 1024 and 8192
+// entities in one build.
+//
+// The columns are compared with records of every member of an entity, the
+// layout before the columns, filled from the same instances.
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Capacity of the largest run: every tick may spawn
+#define MAX_ENTITY 16384
+#define MAX_SNAPSHOT_PAGE 1024
+
+#include "simulation/simulation.cc"
+
+using namespace simulation;
+
+constexpr int kTickCount = 16;
+constexpr int kRepeatCount = 8;
+constexpr uint64_t kEntityCount[] = {128, 1024, 8192};
+
+// Every member of an entity, as one record
+struct EntityRecord {
+  int type_id;
+  v3f position;
+  v3f scale;
+  v3f bounds;
+  Tile tile;
+  uint64_t control;
+  uint64_t ship_index;
+  uint64_t player_index;
+  Entity entity;
+  ColdEntity cold;
+};
+
+static EntityRecord kRecord[kMaxEntity];
+static uint32_t kDeadRecord[kMaxEntity];
+
+uint64_t
+TscToNs(uint64_t tsc)
+{
+  return tsc * 1000 / median_tsc_per_usec;
+}
+
+Tile
+RandomOpenTile(uint64_t ship_index)
+{
+  const Ship* ship = &kShip[ship_index];
+  while (true) {
+    const uint64_t x = rand() % ship->map_width;
+    Tile* tile = ShipTile(ship_index, x, rand() % ship->map_height);
+    if (!tile->blocked) return *tile;
+  }
+}
+
+void
+FillRecords()
+{
+  for (int i = 0; i < kUsedEntity; ++i) {
+    EntityRecord* r = &kRecord[i];
+    r->type_id = kEntityTypeId[i];
+    r->position = kEntityPosition[i];
+    r->scale = kEntityScale[i];
+    r->bounds = kEntityBounds[i];
+    r->tile = kEntityTile[i];
+    r->control = kEntityControl[i];
+    r->ship_index = kEntityShipIndex[i];
+    r->player_index = kEntityPlayerIndex[i];
+    memcpy(&r->entity, &kEntity[i], sizeof(Entity));
+    memcpy(&r->cold, &kEntityCold[i], sizeof(ColdEntity));
+  }
+}
+
+// Fewest cycles of kRepeatCount runs
+#define MIN_TSC(tsc, ...)                                   \
+  {                                                         \
+    tsc = UINT64_MAX;                                       \
+    for (int Repeat = 0; Repeat < kRepeatCount; ++Repeat) { \
+      uint64_t Begin = rdtsc();                             \
+      __VA_ARGS__;                                          \
+      tsc = MIN(tsc, rdtsc() - Begin);                      \
+    }                                                       \
+  }
+
+void
+Run(uint64_t entity_count)
+{
+  RegistryClear();
+  Initialize(1);
+  while (kUsedEntity < entity_count) {
+    SpawnEnemy(RandomOpenTile(0));
+  }
+  FillRecords();
+
+  const Registry* registry = &kRegistry[kRegistryEntity];
+  const uint64_t slot_size = RegistrySlotSize(registry);
+  const uint64_t used = kUsedEntity;
+  printf("[ %lu entity ] [ column %lu bytes ] [ record %lu bytes ]\n", used,
+         slot_size, sizeof(EntityRecord));
+
+  // Entity scan of a hot member
+  uint64_t unit_count = 0;
+  FOR_EACH_ENTITY(Unit, unit, { unit_count += 1; });
+  float column_sum = 0.f;
+  float record_sum = 0.f;
+  float each_sum = 0.f;
+  uint64_t column_tsc;
+  uint64_t record_tsc;
+  uint64_t each_tsc;
+  MIN_TSC(column_tsc, {
+    for (int i = 0; i < used; ++i) {
+      if (kEntityTypeId[i] != kEeUnit) continue;
+      column_sum += kEntityPosition[i].x;
+    }
+  });
+  MIN_TSC(record_tsc, {
+    for (int i = 0; i < used; ++i) {
+      if (kRecord[i].type_id != kEeUnit) continue;
+      record_sum += kRecord[i].position.x;
+    }
+  });
+  MIN_TSC(each_tsc, {
+    FOR_EACH_ENTITY(Unit, unit, { each_sum += EntityPosition(unit).x; });
+  });
+  assert(column_sum == record_sum && column_sum == each_sum);
+  printf(
+      "  [ scan ] [ column %lu bytes %lu ns ] [ record %lu bytes %lu ns ] "
+      "[ FOR_EACH_ENTITY %lu ns ]\n",
+      used * sizeof(int) + unit_count * sizeof(v3f), TscToNs(column_tsc),
+      used * sizeof(EntityRecord), TscToNs(record_tsc), TscToNs(each_tsc));
+
+  // Registry digest, as in every Hash()
+  uint64_t digest = 0;
+  MIN_TSC(column_tsc,
+          { digest += RegistryDigest(&kRegistry[kRegistryEntity]); });
+  MIN_TSC(record_tsc, {
+    digest +=
+        xxhash64((const uint8_t*)kRecord, used * sizeof(EntityRecord), used);
+  });
+  printf(
+      "  [ digest ] [ column %lu bytes %lu ns ] [ record %lu bytes %lu ns ] "
+      "[ 0x%016lx ]\n",
+      used * slot_size, TscToNs(column_tsc), used * sizeof(EntityRecord),
+      TscToNs(record_tsc), digest);
+
+  uint64_t hash_tsc = 0;
+  uint64_t update_tsc = 0;
+  uint64_t max_tsc = 0;
+  for (int i = 0; i < kTickCount; ++i) {
+    uint64_t begin = rdtsc();
+    Hash();
+    uint64_t hashed = rdtsc();
+    simulation::Update();
+    uint64_t end = rdtsc();
+    hash_tsc += hashed - begin;
+    update_tsc += end - hashed;
+    max_tsc = MAX(max_tsc, end - begin);
+  }
+  printf("  [ tick ] [ %lu ns hash ] [ %lu ns update ] [ %lu ns max ]\n",
+         TscToNs(hash_tsc / kTickCount), TscToNs(update_tsc / kTickCount),
+         TscToNs(max_tsc));
+
+  // Half the slots are released, then compacted: records move whole
+  FillRecords();
+  uint64_t dead_count = 0;
+  for (int i = 0; i < kUsedEntity; i += 2) {
+    Entity* ent = &kEntity[i];
+    if (EntityTypeId(ent) == kEeInvalid) continue;
+    ZeroEntity(ent);
+    kDeadRecord[dead_count++] = i;
+  }
+  uint64_t upper = kUsedEntity - 1;
+  uint64_t begin = rdtsc();
+  for (int i = 0; i < dead_count && kDeadRecord[i] <= upper; ++i, --upper) {
+    memcpy(&kRecord[kDeadRecord[i]], &kRecord[upper], sizeof(EntityRecord));
+    memset(&kRecord[upper], 0, sizeof(EntityRecord));
+  }
+  record_tsc = rdtsc() - begin;
+  begin = rdtsc();
+  uint64_t moved = RegistryCompact();
+  column_tsc = rdtsc() - begin;
+  printf(
+      "  [ compact ] [ %lu moved ] [ column %lu bytes %lu ns ] "
+      "[ record %lu bytes %lu ns ]\n",
+      moved, moved * slot_size, TscToNs(column_tsc),
+      moved * sizeof(EntityRecord), TscToNs(record_tsc));
+
+  // Columns moved with their slot
+  for (int i = 0; i < kUsedEntity; ++i) {
+    const Entity* ent = &kEntity[i];
+    if (EntityTypeId(ent) == kEeInvalid) continue;
+    assert(FindEntity(ent->id) == ent);
+    if (EntityTypeId(ent) != kEeUnit) continue;
+    assert(BB_EXI(UnitBb(&ent->unit), kUnitBehavior));
+  }
+  for (int i = kUsedEntity; i < kMaxEntity; ++i) {
+    assert(kEntityTypeId[i] == kEeInvalid);
+    assert(memcmp(&kEntityCold[i], &kZeroEntityCold, sizeof(ColdEntity)) == 0);
+  }
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  kPlayerCount = 1;
+  kScenario = kSoloMission;
+  for (uint64_t count : kEntityCount) {
+    Run(count);
+  }
+
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "ship.cc"
+
+namespace simulation
+{
+// Bitboard flood fill over the tiles of one ship.
+//
+// The fill is a set of rows, bit x of row y for tile (x, y), as the tile
+// planes. It grows from the start tile by dilation: every pass ORs the
+// neighbors of each row into the row, masked by the open tiles, until no row
+// grows. Movement matches the bfs: 8 neighbors, onto unblocked tiles within
+// the distance of the start, wrapping at the edge of the map.
+//
+// Fills as wide as the map depend only on the start tile and the 'blocked'
+// flags of the ship. Power modules, the exterior and the shroud repeat them,
+// so each ship caches them until its blocked plane changes.
+constexpr int kMaxFloodCache = 8;
+
+struct FloodFill {
+  uint64_t row[kMapMaxHeight];
+  uint16_t cx;
+  uint16_t cy;
+  uint64_t tile_distance;
+  // Least recently used fill is replaced on a miss
+  uint64_t last_use;
+  bool valid;
+};
+
+struct FloodCache {
+  FloodFill fill[kMaxFloodCache];
+  // Blocked plane of the ship when fills were computed
+  uint64_t blocked[kMapMaxHeight];
+  uint16_t bitrange_xy;
+  uint64_t use_count;
+  // Diagnostics
+  uint64_t hit;
+  uint64_t miss;
+  uint64_t invalidate;
+};
+
+static WORLD_LOCAL FloodCache kFloodCache[kMaxShip];
+
+// Left and right neighbors of the row, wrapping at the edge of the map
+INLINE uint64_t
+FloodSpread(uint64_t row, int size, uint64_t width_mask)
+{
+  return (row | row << 1 | row >> 1 | row << (size - 1) | row >> (size - 1)) &
+         width_mask;
+}
+
+// Tiles of each row within tile_distance of start, as TileDsq()
+void
+FloodDisc(Tile start, uint64_t tile_distance, uint64_t* row)
+{
+  const int size = 1 << start.bitrange_xy;
+  const uint64_t dt = (tile_distance * 2) + 2;
+  const uint64_t dsq = dt * dt;
+  for (int y = 0; y < size; ++y) {
+    const uint64_t dy2 = ABS64((int64_t)start.cy - y) * 2 + 1;
+    row[y] = 0;
+    if (dy2 * dy2 >= dsq) continue;
+
+    // Greatest dx with (dx * 2 + 1)^2 <= rem
+    const uint64_t rem = dsq - dy2 * dy2;
+    uint64_t root = sqrt((double)rem);
+    while (root * root > rem) --root;
+    while ((root + 1) * (root + 1) <= rem) ++root;
+    const int64_t dx = (root - 1) / 2;
+
+    const int64_t lo = MAX((int64_t)start.cx - dx, 0);
+    const int64_t hi = MIN((int64_t)start.cx + dx, size - 1);
+    const int64_t bits = hi - lo + 1;
+    row[y] = (bits == 64 ? ~0ull : ((1ull << bits) - 1)) << lo;
+  }
+}
+
+// Unblocked tiles reached from start, a row per map row
+void
+FloodFillCompute(Tile start, uint64_t tile_distance, uint64_t* reached)
+{
+  const int size = 1 << start.bitrange_xy;
+  const int last = size - 1;
+  const uint64_t width_mask = size == 64 ? ~0ull : (1ull << size) - 1;
+  const uint64_t* blocked = TilePlaneRow(start.ship_index, kPlaneBlocked);
+
+  uint64_t open[kMapMaxHeight];
+  FloodDisc(start, tile_distance, open);
+  // Rows outside [first, end) are never reached
+  int first = start.cy;
+  int end = start.cy + 1;
+  for (int y = 0; y < size; ++y) {
+    open[y] &= ~blocked[y];
+    reached[y] = 0;
+    if (!open[y]) continue;
+    first = MIN(first, y);
+    end = MAX(end, y + 1);
+  }
+  // The bfs leaves a blocked start tile as it is, yet walks on from it
+  reached[start.cy] = 1ull << start.cx;
+
+  // Sweep down then up: a pass carries a fill along any monotonic run
+  bool grown = true;
+  while (grown) {
+    grown = false;
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = first; i < end; ++i) {
+        const int y = pass ? first + end - 1 - i : i;
+        const uint64_t near =
+            reached[(y - 1) & last] | reached[y] | reached[(y + 1) & last];
+        uint64_t row = reached[y] | (FloodSpread(near, size, width_mask) &
+                                     open[y]);
+        // Runs of open tiles fill within the row
+        for (uint64_t prev = 0; prev != row;) {
+          prev = row;
+          row |= FloodSpread(row, size, width_mask) & open[y];
+        }
+        if (row == reached[y]) continue;
+        reached[y] = row;
+        grown = true;
+      }
+    }
+  }
+  reached[start.cy] &= ~blocked[start.cy];
+}
+
+// Drop fills of a ship whose blocked flags changed since they were computed
+void
+FloodCacheValidate(uint64_t ship_index, uint16_t bitrange_xy)
+{
+  FloodCache* cache = &kFloodCache[ship_index];
+  const uint64_t* blocked = TilePlaneRow(ship_index, kPlaneBlocked);
+  if (cache->bitrange_xy == bitrange_xy &&
+      memcmp(cache->blocked, blocked, sizeof(cache->blocked)) == 0) {
+    return;
+  }
+
+  for (int i = 0; i < kMaxFloodCache; ++i) {
+    FloodFill* f = &cache->fill[i];
+    if (!f->valid) continue;
+    f->valid = false;
+    cache->invalidate += 1;
+  }
+  memcpy(cache->blocked, blocked, sizeof(cache->blocked));
+  cache->bitrange_xy = bitrange_xy;
+}
+
+// Unblocked tiles reached from start, a row per map row. Fills as wide as
+// the map are cached.
+const uint64_t*
+FloodFillTo(Tile start, uint64_t tile_distance, uint64_t* reached)
+{
+  if (tile_distance < kMapMaxWidth) {
+    FloodFillCompute(start, tile_distance, reached);
+    return reached;
+  }
+
+  FloodCacheValidate(start.ship_index, start.bitrange_xy);
+  FloodCache* cache = &kFloodCache[start.ship_index];
+  cache->use_count += 1;
+
+  FloodFill* replace = &cache->fill[0];
+  for (int i = 0; i < kMaxFloodCache; ++i) {
+    FloodFill* f = &cache->fill[i];
+    if (f->valid && f->cx == start.cx && f->cy == start.cy &&
+        f->tile_distance == tile_distance) {
+      f->last_use = cache->use_count;
+      cache->hit += 1;
+      return f->row;
+    }
+    if (!f->valid) {
+      replace = f;
+    } else if (replace->valid && f->last_use < replace->last_use) {
+      replace = f;
+    }
+  }
+
+  cache->miss += 1;
+  FloodFillCompute(start, tile_distance, replace->row);
+  replace->cx = start.cx;
+  replace->cy = start.cy;
+  replace->tile_distance = tile_distance;
+  replace->last_use = cache->use_count;
+  replace->valid = true;
+  return replace->row;
+}
+
+}  // namespace simulation
@@ -0,0 +1,153 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "simulation.cc"
+
+using namespace simulation;
+
+constexpr int kQueryCount = 2048;
+
+static uint64_t kExpect[kMapMaxHeight];
+
+// The queue bfs replaced by the flood fill
+void
+BfsReached(Tile start, uint64_t tile_distance, uint64_t* reached)
+{
+  auto& queue = kSearch.queue;
+  auto& path_map = kSearch.path_map;
+  int& qsz = kSearch.queue_size;
+
+  memset(reached, 0, kMapMaxHeight * sizeof(uint64_t));
+  BfsIterator iter = BfsStart(start);
+  if (!TileBlocked(*iter.tile)) reached[start.cy] |= 1ull << start.cx;
+
+  while (iter.queue_index != qsz) {
+    Tile from = queue[iter.queue_index];
+    if (BfsStep(from, &iter)) {
+      if (TileBlocked(*iter.tile)) continue;
+
+      if (TileDsq(*iter.tile, start, tile_distance)) {
+        reached[iter.tile->cy] |= 1ull << iter.tile->cx;
+        path_map[iter.tile->cy][iter.tile->cx] = from;
+        queue[qsz++] = *iter.tile;
+      }
+    }
+  }
+}
+
+uint64_t
+NextRandom(uint64_t* state)
+{
+  *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+  return *state >> 33;
+}
+
+Tile
+RandomTile(uint64_t* state)
+{
+  uint64_t ship_index = NextRandom(state) % kUsedShip;
+  const Ship* ship = &kShip[ship_index];
+  uint64_t x = NextRandom(state) % ship->map_width;
+  uint64_t y = NextRandom(state) % ship->map_height;
+  return *ShipTile(ship_index, x, y);
+}
+
+void
+CheckFill(Tile start, uint64_t tile_distance)
+{
+  uint64_t reached[kMapMaxHeight];
+  BfsReached(start, tile_distance, kExpect);
+  const uint64_t* fill = FloodFillTo(start, tile_distance, reached);
+  assert(memcmp(fill, kExpect, kShip[start.ship_index].map_height *
+                                   sizeof(uint64_t)) == 0);
+}
+
+// Nanoseconds per query
+uint64_t
+QueryNs(uint64_t tsc)
+{
+  return tsc * 1000 / median_tsc_per_usec / kQueryCount;
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  kPlayerCount = 2;
+  kScenario = kTwoShip;
+  RegistryClear();
+  SnapshotReset();
+  Initialize(1234);
+  assert(kUsedShip);
+
+  // Fills match the bfs: any start, blocked or not, any distance
+  uint64_t state = 1234;
+  for (int i = 0; i < kQueryCount; ++i) {
+    Tile start = RandomTile(&state);
+    CheckFill(start, NextRandom(&state) % 12);
+    CheckFill(start, kTileVisibleDistance);
+    CheckFill(start, kMapMaxWidth);
+  }
+  const FloodCache* cache = &kFloodCache[0];
+  assert(cache->hit && cache->miss);
+
+  // Cached fills follow the blocked flags
+  Tile* wall = ShipTile(0, kShip[0].map_width / 2, kShip[0].map_height / 2);
+  CheckFill(*wall, kMapMaxWidth);
+  const uint64_t invalidate = cache->invalidate;
+  if (TileBlocked(*wall)) {
+    TileClear(wall, 1 << kPlaneBlocked);
+  } else {
+    TileSet(wall, 1 << kPlaneBlocked);
+  }
+  CheckFill(*wall, kMapMaxWidth);
+  assert(cache->invalidate > invalidate);
+
+  // Throughput
+  Tile start[kQueryCount];
+  for (int i = 0; i < kQueryCount; ++i) {
+    start[i] = RandomTile(&state);
+  }
+  uint64_t check = 0;
+  uint64_t reached[kMapMaxHeight];
+  const uint64_t distance[] = {kTileVisibleDistance, kMapMaxWidth};
+  uint64_t tsc[ARRAY_LENGTH(distance)][3] = {};
+  for (int d = 0; d < ARRAY_LENGTH(distance); ++d) {
+    uint64_t begin = rdtsc();
+    for (int i = 0; i < kQueryCount; ++i) {
+      BfsReached(start[i], distance[d], reached);
+      check += reached[start[i].cy];
+    }
+    tsc[d][0] = rdtsc() - begin;
+
+    begin = rdtsc();
+    for (int i = 0; i < kQueryCount; ++i) {
+      FloodFillCompute(start[i], distance[d], reached);
+      check += reached[start[i].cy];
+    }
+    tsc[d][1] = rdtsc() - begin;
+
+    // A power module fills from the same tile every frame
+    begin = rdtsc();
+    for (int i = 0; i < kQueryCount; ++i) {
+      check += FloodFillTo(start[i % kMaxFloodCache], distance[d],
+                           reached)[start[i % kMaxFloodCache].cy];
+    }
+    tsc[d][2] = rdtsc() - begin;
+
+    printf(
+        "[ distance %2lu ] "
+        "[ bfs %lu ns ] "
+        "[ flood %lu ns ] "
+        "[ repeat %lu ns ] "
+        "\n",
+        distance[d], QueryNs(tsc[d][0]), QueryNs(tsc[d][1]),
+        QueryNs(tsc[d][2]));
+  }
+  printf("[ check %lu ]\n", check);
+
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "search.cc"
+#include "ship.cc"
+
+namespace simulation
+{
+// Cached distance fields for MoveTowards().
+//
+// One field per destination tile: a reverse bfs from the destination records
+// the step count of every reachable tile. Units headed to the same
+// destination share the field. A unit steps to the neighbor nearest the
+// destination, which is the first step of a shortest path.
+//
+// Fields depend only on the 'blocked' flags of the ship. They are dropped
+// when FlowFieldUpdate() observes a change to those flags.
+//
+// Each ship has its own cache: units query fields of their own ship only,
+// so ships may move their units at once.
+constexpr int kMaxFlowField = 64;
+// Distance value of tiles that cannot reach the destination
+constexpr uint16_t kFlowUnreached = 0;
+
+struct FlowField {
+  // Steps to the destination plus one, or kFlowUnreached
+  uint16_t distance[kMapMaxHeight][kMapMaxWidth];
+  Tile destination;
+  // Least recently used field is replaced on a miss
+  uint64_t last_use;
+  bool valid;
+};
+
+struct FlowFieldCache {
+  FlowField field[kMaxFlowField];
+  // Reverse bfs queue
+  Tile queue[kMapMaxHeight * kMapMaxWidth];
+  // Digest of the blocked flags of the ship when fields were computed
+  uint64_t blocked_hash;
+  uint64_t use_count;
+  // Diagnostics
+  uint64_t hit;
+  uint64_t miss;
+  uint64_t invalidate;
+};
+
+static WORLD_LOCAL FlowFieldCache kFlowField[kMaxShip];
+
+void
+FlowFieldInvalidate(uint64_t ship_index)
+{
+  FlowFieldCache* cache = &kFlowField[ship_index];
+  for (int i = 0; i < kMaxFlowField; ++i) {
+    FlowField* f = &cache->field[i];
+    if (!f->valid) continue;
+    f->valid = false;
+    cache->invalidate += 1;
+  }
+}
+
+void
+FlowFieldInvalidateAll()
+{
+  for (int i = 0; i < kMaxShip; ++i) {
+    FlowFieldInvalidate(i);
+    kFlowField[i].blocked_hash = 0;
+  }
+}
+
+uint64_t
+FlowFieldBlockedHash(uint64_t ship_index)
+{
+  const Ship* ship = &kShip[ship_index];
+  uint64_t hash = DJB2_CONST;
+  djb2_hash_more((const uint8_t*)&ship->map_width, sizeof(ship->map_width),
+                 &hash);
+  const uint64_t* row = TilePlaneRow(ship_index, kPlaneBlocked);
+  djb2_hash_more((const uint8_t*)row, ship->map_height * sizeof(uint64_t),
+                 &hash);
+
+  return hash;
+}
+
+// Drop fields of ships whose blocked flags changed since the last call
+void
+FlowFieldUpdate()
+{
+  for (int i = 0; i < kMaxShip; ++i) {
+    uint64_t hash = 0;
+    if (i < kUsedShip && kShip[i].map_width) hash = FlowFieldBlockedHash(i);
+    if (hash == kFlowField[i].blocked_hash) continue;
+    FlowFieldInvalidate(i);
+    kFlowField[i].blocked_hash = hash;
+  }
+}
+
+void
+FlowFieldCompute(FlowFieldCache* cache, FlowField* f, Tile dest)
+{
+  memset(f->distance, 0, sizeof(f->distance));
+  f->destination = dest;
+  f->valid = true;
+
+  // Movement is onto unblocked tiles only
+  if (TileBlocked(dest)) return;
+
+  auto& queue = cache->queue;
+  int qsz = 0;
+  queue[qsz++] = dest;
+  f->distance[dest.cy][dest.cx] = 1;
+  for (int i = 0; i < qsz; ++i) {
+    Tile from = queue[i];
+    uint16_t next_distance = f->distance[from.cy][from.cx] + 1;
+    for (int n = 0; n < kMaxNeighbor; ++n) {
+      Tile neighbor = TileNeighbor(from, n);
+      if (f->distance[neighbor.cy][neighbor.cx] != kFlowUnreached) continue;
+      if (TileBlocked(neighbor)) continue;
+      f->distance[neighbor.cy][neighbor.cx] = next_distance;
+      queue[qsz++] = *ShipTile(neighbor);
+    }
+  }
+}
+
+FlowField*
+FlowFieldTo(Tile dest)
+{
+  FlowFieldCache* cache = &kFlowField[dest.ship_index];
+  cache->use_count += 1;
+
+  FlowField* replace = &cache->field[0];
+  for (int i = 0; i < kMaxFlowField; ++i) {
+    FlowField* f = &cache->field[i];
+    if (f->valid && TileEqualPosition(f->destination, dest)) {
+      f->last_use = cache->use_count;
+      cache->hit += 1;
+      return f;
+    }
+
+    if (!replace->valid) continue;
+    if (!f->valid || f->last_use < replace->last_use) replace = f;
+  }
+
+  cache->miss += 1;
+  FlowFieldCompute(cache, replace, dest);
+  replace->last_use = cache->use_count;
+  return replace;
+}
+
+// Find the next tile on a shortest path from start to dest.
+//
+// Returns false when no path exists, matching PathTo() returning nullptr.
+bool
+FlowFieldNext(Tile start, Tile dest, Tile* next)
+{
+  if (start == dest) return false;
+
+  const FlowField* f = FlowFieldTo(dest);
+  uint16_t best = kFlowUnreached;
+  for (int n = 0; n < kMaxNeighbor; ++n) {
+    Tile neighbor = TileNeighbor(start, n);
+    uint16_t d = f->distance[neighbor.cy][neighbor.cx];
+    if (d == kFlowUnreached) continue;
+    if (best != kFlowUnreached && d >= best) continue;
+    best = d;
+    *next = *ShipTile(neighbor);
+  }
+
+  return best != kFlowUnreached;
+}
+
+}  // namespace simulation
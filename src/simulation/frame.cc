@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include "interaction.cc"
+#include "simulation.cc"
+
+// The logic frame of the client: every frame, lockstep, speculated or
+// resimulated after a rollback, runs through SimulateTurn().
+
+struct State {
+  // Game and render updates per second
+  uint64_t framerate = 60;
+  // Calculated available microseconds per game_update
+  uint64_t frame_target_usec;
+  // Game clock state
+  TscClock_t game_clock;
+  // Time it took to run a frame.
+  uint64_t frame_time_usec = 0;
+  // (optional) limit the simulation frames (UINT64_MAX will loop infinitely)
+  uint64_t limit_frame = UINT64_MAX;
+  // (optional) yield unused cpu time to the system
+  bool sleep_on_loop = true;
+  // (optional) run simulation stages on the job system
+  bool parallel_ship = false;
+  // (optional) run ahead of remote input, rolling back on misprediction
+  bool rollback = false;
+  // (optional) record the game to a replay file
+  const char* replay_file = nullptr;
+  // Number of times the game has been updated.
+  uint64_t game_updates = 0;
+  uint64_t logic_updates = 0;
+  // Most recent frame that was unable to advance due to input loss
+  uint64_t choke_frame = 0;
+  // Simulation hash at the start of each frame in the network queue
+  uint64_t frame_hash[MAX_NETQUEUE];
+  // Moving average of the cost of one logic update, in tsc
+  uint64_t update_tsc = 0;
+  // Catch-up: received frames past the queue goal, frames run last loop
+  uint64_t behind_frames = 0;
+  uint64_t catchup_rate = 0;
+  // Parameters window::Create will be called with.
+  window::CreateInfo window_create_info;
+};
+
+static State kGameState;
+static Stats kGameStats;
+
+// Every unconfirmed frame and the last confirmed frame have a snapshot
+static_assert(MAX_ROLLBACK < MAX_SNAPSHOT, "rollback exceeds snapshot ring");
+
+// TODO (AN): Revisit cameras
+const Camera*
+GetCamera(uint64_t player_index)
+{
+  return &kPlayer[player_index].camera;
+}
+
+// Runs logic frame logic_updates on the turn of every player. Panels issue
+// commands, so they run on every frame. Only the present frame sets the
+// view.
+void
+SimulateTurn(const InputBuffer* game_turn, bool present)
+{
+  const uint64_t begin = rdtsc();
+  const uint64_t frame = kGameState.logic_updates;
+  simulation::Hash();
+  kGameState.frame_hash[NETQUEUE_SLOT(frame)] = simulation::kSimulationHash;
+  simulation::CacheSyncHashes(NETQUEUE_SLOT(frame) == 0, frame);
+  simulation::DesyncCapture(frame);
+
+  // Game Mutation: Apply player commands for turn N
+  for (int i = 0; i < MAX_PLAYER; ++i) {
+    imui::ResetTag(i);
+    const InputBuffer* player_turn = &game_turn[i];
+    simulation::ProcessSimulation(i, player_turn->used_input_event,
+                                  player_turn->input_event);
+  }
+
+  // Game Mutation: continue simulation
+  simulation::Update();
+#ifndef HEADLESS
+  for (int i = 0; i < kNetworkState.num_players; ++i) {
+    // Misc debug/feedback
+    const v2f dims =
+        v2f(kPlayer[i].camera.viewport.x, kPlayer[i].camera.viewport.y);
+    Player* player = &kPlayer[i];
+    simulation::LogPanel(dims, i);
+    simulation::AdminPanel(dims, i, player);
+    simulation::TilePanel(dims, i, player);
+    simulation::GameUI(dims, i, i, player);
+  }
+#endif
+  if (kGameState.rollback) simulation::Snapshot(frame + 1);
+
+  // Give the user an update tick. The engine runs with
+  // a fixed delta so no need to provide a delta time.
+  ++kGameState.logic_updates;
+  const uint64_t tsc = rdtsc() - begin;
+  const uint64_t average = kGameState.update_tsc;
+  kGameState.update_tsc = average ? average - average / 8 + tsc / 8 : tsc;
+
+  if (!present) return;
+
+  // SetView for the local player's camera
+  camera::SetView(GetCamera(kNetworkState.player_index),
+                  &rgg::GetObserver()->view);
+}
+
+// Confirms frames whose turns arrived. When a confirmed frame ran on a
+// mispredicted turn, the game is restored to that frame and runs again up to
+// the present, panels included, without setting the view.
+void
+RollbackConfirm()
+{
+  RollbackState* rb = &kRollbackState;
+  uint64_t rollback_frame = UINT64_MAX;
+  while (rb->confirmed_frame < kGameState.logic_updates) {
+    const uint64_t slot = NETQUEUE_SLOT(rb->confirmed_frame);
+    if (!SlotReady(slot)) break;
+    if (!NetworkPredicted(rb->confirmed_frame)) {
+      rollback_frame = MIN(rollback_frame, rb->confirmed_frame);
+    }
+    GetSlot(slot);
+    rb->confirmed_frame += 1;
+  }
+  if (rollback_frame == UINT64_MAX) return;
+
+  const uint64_t present = kGameState.logic_updates;
+  const uint64_t begin = rdtsc();
+  const bool restored = simulation::Restore(rollback_frame);
+  assert(restored);
+  kGameState.logic_updates = rollback_frame;
+  while (kGameState.logic_updates < present) {
+    SimulateTurn(NetworkPredict(kGameState.logic_updates), false);
+  }
+  const uint64_t usec = (rdtsc() - begin) / median_tsc_per_usec;
+
+  rb->rollback_count += 1;
+  rb->last_depth = present - rollback_frame;
+  rb->max_depth = MAX(rb->max_depth, rb->last_depth);
+  rb->last_resim_usec = usec;
+  rb->max_resim_usec = MAX(rb->max_resim_usec, usec);
+}
+
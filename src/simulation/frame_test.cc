@@ -0,0 +1,231 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "frame.cc"
+
+using namespace simulation;
+
+constexpr uint64_t kFrameCount = 600;
+// Frames the turns of both players take to arrive
+constexpr uint64_t kTurnDelay = 3;
+constexpr uint64_t kSeed = 1234;
+
+static InputBuffer kTurn[kFrameCount][MAX_PLAYER];
+// Lockstep: hash at the start of each frame, checkpoint roots
+static uint64_t kReference[kFrameCount];
+static uint64_t kReferenceRoot[kFrameCount / DIGEST_INTERVAL + 1];
+static uint64_t kReferenceFinal;
+
+void
+Event(InputBuffer* b, PlatformEventType type, v2f position, uint32_t detail)
+{
+  PlatformEvent* e = &b->input_event[b->used_input_event++];
+  *e = {};
+  e->type = type;
+  e->position = position;
+  if (type == KEY_DOWN || type == KEY_UP) {
+    e->key = detail;
+  } else {
+    e->button = (PlatformButton)detail;
+  }
+}
+
+// Turns that differ from frame to frame, so that a repeat of the last turn
+// received mispredicts. Each player, once a cycle, picks a module from the
+// game menu, places it on the ship and drags the game menu out and back;
+// the cursor moves every frame. Frame 0 has no turns.
+constexpr uint64_t kCycle = 60;
+constexpr uint64_t kDragBegin = 20;
+constexpr uint64_t kDragFrames = 6;
+
+v2f
+TurnCursor(uint64_t frame, int player)
+{
+  const uint64_t phase = (frame + player * kCycle / 3) % kCycle;
+  if (phase >= kDragBegin && phase <= kDragBegin + 2 * kDragFrames) {
+    const uint64_t step = phase - kDragBegin;
+    const float out = step <= kDragFrames ? step : 2 * kDragFrames - step;
+    return v2f(60.f + 10.f * out, 130.f);
+  }
+  return v2f(400.f + (frame * 13 + player * 170) % 1100,
+             200.f + (frame * 7 + player * 90) % 700);
+}
+
+void
+Script()
+{
+  for (uint64_t frame = 1; frame < kFrameCount; ++frame) {
+    for (int i = 0; i < MAX_PLAYER; ++i) {
+      InputBuffer* b = &kTurn[frame][i];
+      const uint64_t phase = (frame + i * kCycle / 3) % kCycle;
+      const v2f cursor = TurnCursor(frame, i);
+      const v2f button(17.f, 374.f - 43.f * (frame / kCycle % 5));
+      Event(b, MOUSE_POSITION, cursor, 0);
+      switch (phase) {
+        case 5:
+          Event(b, MOUSE_DOWN, button, BUTTON_LEFT);
+          Event(b, MOUSE_UP, button, BUTTON_LEFT);
+          break;
+        case 10:
+          Event(b, MOUSE_DOWN, cursor, BUTTON_LEFT);
+          Event(b, MOUSE_UP, cursor, BUTTON_LEFT);
+          break;
+        case kDragBegin:
+          Event(b, MOUSE_DOWN, cursor, BUTTON_LEFT);
+          break;
+        case kDragBegin + 2 * kDragFrames:
+          Event(b, MOUSE_UP, cursor, BUTTON_LEFT);
+          break;
+        case 40:
+          Event(b, MOUSE_DOWN, cursor, BUTTON_LEFT);
+          break;
+        case 44:
+          Event(b, MOUSE_UP, cursor, BUTTON_LEFT);
+          break;
+        case 50:
+          Event(b, MOUSE_DOWN, cursor, BUTTON_RIGHT);
+          Event(b, MOUSE_UP, cursor, BUTTON_RIGHT);
+          break;
+        case 55:
+          Event(b, KEY_DOWN, cursor, 'r');
+          Event(b, KEY_UP, cursor, 'r');
+          break;
+      }
+    }
+  }
+}
+
+// Game of two players at frame 0, as space.cc starts it
+void
+Start(bool rollback)
+{
+  RegistryClear();
+  SnapshotReset();
+  kSimulationHash = DJB2_CONST;
+  kInputHash = DJB2_CONST;
+  kDebugInputHash = 0;
+  kDebugSimulationHash = 0;
+  imui::ResetAll();
+  memset(imui::kIMUI.mouse_down, 0, sizeof(imui::kIMUI.mouse_down));
+
+  memset(&kRollbackState, 0, sizeof(kRollbackState));
+  for (int i = 0; i < MAX_NETQUEUE; ++i) {
+    for (int j = 0; j < MAX_PLAYER; ++j) {
+      kNetworkState.network_slot[i][j] = i ? kSlotSimulated : kSlotReceived;
+      kNetworkState.player_input[i][j] = InputBuffer();
+    }
+  }
+  kNetworkState.outgoing_sequence = 1;
+  kGameState.logic_updates = 0;
+  kGameState.rollback = rollback;
+
+  Initialize(kSeed);
+  if (rollback) Snapshot(0);
+}
+
+// The turns of frame arrive from the server
+void
+Receive(uint64_t frame)
+{
+  const uint64_t slot = NETQUEUE_SLOT(frame);
+  for (int i = 0; i < MAX_PLAYER; ++i) {
+    kNetworkState.player_input[slot][i] = kTurn[frame][i];
+    kNetworkState.network_slot[slot][i] = kSlotReceived;
+  }
+}
+
+void
+RunLockstep()
+{
+  Start(false);
+  for (uint64_t frame = 0; frame < kFrameCount; ++frame) {
+    if (frame) Receive(frame);
+    SimulateTurn(GetSlot(NETQUEUE_SLOT(frame)), true);
+    kReference[frame] = kGameState.frame_hash[NETQUEUE_SLOT(frame)];
+    if (frame % DIGEST_INTERVAL == 0 && frame) {
+      kReferenceRoot[frame / DIGEST_INTERVAL] = DesyncFind(frame)->root;
+    }
+  }
+  Hash();
+  kReferenceFinal = kSimulationHash;
+}
+
+// Frames confirmed this loop ran as they did in lockstep
+void
+CheckConfirmed(uint64_t begin, uint64_t end)
+{
+  for (uint64_t frame = begin; frame < end; ++frame) {
+    assert(kGameState.frame_hash[NETQUEUE_SLOT(frame)] == kReference[frame]);
+    if (frame % DIGEST_INTERVAL == 0 && frame) {
+      assert(DesyncFind(frame)->root ==
+             kReferenceRoot[frame / DIGEST_INTERVAL]);
+    }
+  }
+}
+
+// Runs ahead of the turns on the local input of player 0, as the main loop
+// of space.cc does
+void
+RunRollback()
+{
+  Start(true);
+  for (uint64_t loop = 1; kRollbackState.confirmed_frame < kFrameCount;
+       ++loop) {
+    if (loop < kFrameCount) {
+      kNetworkState.input[NETQUEUE_SLOT(loop)] = kTurn[loop][0];
+      kNetworkState.outgoing_sequence = loop + 1;
+    }
+    if (loop > kTurnDelay && loop - kTurnDelay < kFrameCount) {
+      Receive(loop - kTurnDelay);
+    }
+
+    const uint64_t confirmed_frame = kRollbackState.confirmed_frame;
+    RollbackConfirm();
+    CheckConfirmed(confirmed_frame, kRollbackState.confirmed_frame);
+
+    uint64_t advance =
+        MIN(kNetworkState.outgoing_sequence - kGameState.logic_updates, 2);
+    for (; advance > 0; --advance) {
+      const uint64_t logic_frame = kGameState.logic_updates;
+      if (logic_frame >= kNetworkState.outgoing_sequence) break;
+      if (logic_frame - kRollbackState.confirmed_frame >= MAX_ROLLBACK) break;
+      SimulateTurn(NetworkPredict(logic_frame), true);
+    }
+  }
+  Hash();
+  assert(kSimulationHash == kReferenceFinal);
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  kPlayerCount = MAX_PLAYER;
+  kPlayerIndex = 0;
+  kScenario = kTwoShip;
+  kNetworkState.num_players = MAX_PLAYER;
+  kNetworkState.player_count = MAX_PLAYER;
+  kNetworkState.player_index = 0;
+  kNetworkState.game_id = kSeed;
+  for (int i = 0; i < MAX_PLAYER; ++i) {
+    kNetworkState.player_info[i] = {1920, 1080};
+  }
+
+  Script();
+  RunLockstep();
+  RunRollback();
+
+  const RollbackState* rb = &kRollbackState;
+  printf(
+      "[ frames %lu ] [ rollbacks %lu ] [ mispredicted turns %lu ] "
+      "[ max_depth %lu ] [ digest 0x%016lx ]\n",
+      kFrameCount, rb->rollback_count, rb->mispredict_turns, rb->max_depth,
+      kReferenceFinal);
+  assert(rb->rollback_count && rb->mispredict_turns);
+
+  puts("ok");
+  return 0;
+}
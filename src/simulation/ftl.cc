@@ -5,6 +5,7 @@
 #include "platform/platform.cc"
 
 #include "entity.cc"
+#include "stage.cc"
 
 namespace simulation
 {
@@ -15,9 +16,10 @@ uint64_t
 FtlSimulation(const Ship* ship)
 {
   const uint64_t ftl_frame = ship->ftl_frame;
-  if (ftl_frame == kFtlFrameTime) {
+  // Asteroids are shared by every ship
+  if (ftl_frame == kFtlFrameTime && StageShared()) {
     for (int i = 0; i < kUsedAsteroid; ++i) {
-      kAsteroid[i] = kZeroAsteroid;
+      ZeroAsteroid(&kAsteroid[i]);
     }
   }
 
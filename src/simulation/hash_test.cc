@@ -0,0 +1,130 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "scripted_input.cc"
+#include "simulation.cc"
+
+using namespace simulation;
+
+constexpr int kFrameCount = 3000;
+constexpr uint64_t kBufferSize = 1 << 20;
+
+static uint8_t kBuffer[kBufferSize];
+
+// Hash() before registry digests: every byte of every slot, used or not
+uint64_t
+ReferenceHash(uint64_t hash, uint64_t* bytes)
+{
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    uint64_t len = kRegistry[i].memb_size * kRegistry[i].memb_max;
+    djb2_hash_more((const uint8_t*)kRegistry[i].ptr, len, &hash);
+    *bytes += len;
+    FOR_EACH_REGISTRY_COLUMN(&kRegistry[i], column, {
+      uint64_t column_len = column->size * kRegistry[i].memb_max;
+      djb2_hash_more((const uint8_t*)column->ptr, column_len, &hash);
+      *bytes += column_len;
+    });
+  }
+
+  return hash;
+}
+
+// Digest of the used slots, read in full
+uint64_t
+FullDigest(const Registry* r)
+{
+  const uint64_t count = *r->memb_count;
+  uint64_t digest =
+      xxhash64((const uint8_t*)r->ptr, count * r->memb_size, count);
+  FOR_EACH_REGISTRY_COLUMN(r, column, {
+    digest =
+        xxhash64((const uint8_t*)column->ptr, count * column->size, digest);
+  });
+  return digest;
+}
+
+void
+Throughput(const char* name, uint64_t tsc, uint64_t bytes)
+{
+  printf("[ %s %.2f GB/s ] ", name,
+         (double)bytes * median_tsc_per_usec / MAX(tsc, 1) / 1000.0);
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  // Reference values of XXH64
+  assert(xxhash64(nullptr, 0, 0) == 0xEF46DB3751D8E999ull);
+  assert(xxhash64((const uint8_t*)"abc", 3, 0) == 0x44BC2CF5AD770999ull);
+
+  for (int i = 0; i < kBufferSize; ++i) {
+    kBuffer[i] = i * 2654435761u >> 13;
+  }
+  uint64_t djb2 = DJB2_CONST;
+  uint64_t begin = rdtsc();
+  djb2_hash_more(kBuffer, kBufferSize, &djb2);
+  uint64_t djb2_tsc = rdtsc() - begin;
+  begin = rdtsc();
+  uint64_t xx = xxhash64(kBuffer, kBufferSize, 0);
+  uint64_t xx_tsc = rdtsc() - begin;
+  assert(djb2 != xx);
+  Throughput("djb2", djb2_tsc, kBufferSize);
+  Throughput("xxhash64", xx_tsc, kBufferSize);
+  puts("");
+
+  kPlayerCount = 2;
+  kScenario = kTwoShip;
+  RegistryClear();
+  Initialize(1234);
+
+  uint64_t reference = DJB2_CONST;
+  uint64_t reference_tsc = 0;
+  uint64_t reference_bytes = 0;
+  uint64_t hash_tsc = 0;
+  for (int frame = 0; frame < kFrameCount; ++frame) {
+    ScriptedInput(&kScriptAttack, frame);
+
+    begin = rdtsc();
+    reference = ReferenceHash(reference, &reference_bytes);
+    reference_tsc += rdtsc() - begin;
+
+    const uint64_t previous = kSimulationHash;
+    begin = rdtsc();
+    Hash();
+    hash_tsc += rdtsc() - begin;
+    assert(kSimulationHash != previous);
+
+    // Digests kept across ticks match a full read
+    for (int i = 0; i < kUsedRegistry; ++i) {
+      assert(kRegistry[i].digest == FullDigest(&kRegistry[i]));
+    }
+
+    simulation::Update();
+  }
+
+  // A tile write is seen by the next Hash()
+  Registry* grid = nullptr;
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    if (kRegistry[i].ptr == kGrid) grid = &kRegistry[i];
+  }
+  Hash();
+  assert(!kGridWritten);
+  const uint64_t grid_digest = grid->digest;
+  Tile* tile = ShipTile(0, 1, 1);
+  TileSet(tile, ~tile->flags & 0x3f);
+  assert(kGridWritten);
+  Hash();
+  assert(grid->digest != grid_digest);
+  assert(grid->digest == FullDigest(grid));
+
+  printf("[ djb2 %lu ns/frame %lu bytes/frame ] [ digest %lu ns/frame ]\n",
+         reference_tsc * 1000 / median_tsc_per_usec / kFrameCount,
+         reference_bytes / kFrameCount,
+         hash_tsc * 1000 / median_tsc_per_usec / kFrameCount);
+
+  puts("ok");
+  return 0;
+}
@@ -9,11 +9,36 @@ namespace simulation
 {
 #define UIBUFFER_SIZE 64
 static char ui_buffer[UIBUFFER_SIZE];
-static uint64_t kInputHash = DJB2_CONST;
-static uint64_t kDebugInputHash;
-static uint64_t kDebugSimulationHash;
+static WORLD_LOCAL uint64_t kInputHash = DJB2_CONST;
+DECLARE_SNAPSHOT(kInputHash)
+static WORLD_LOCAL uint64_t kDebugInputHash;
+static WORLD_LOCAL uint64_t kDebugSimulationHash;
+DECLARE_SNAPSHOT(kDebugInputHash)
+DECLARE_SNAPSHOT(kDebugSimulationHash)
 static float kCameraSpeed = 4.f;
 
+#ifndef HEADLESS
+// Panels run on every frame, resimulated ones included: the imui state they
+// carry from frame to frame, and the flags they toggle, rewind with the game
+void
+SnapshotBindPanels()
+{
+  SnapshotRegister(imui::kPane, MAX_PLAYER * sizeof(imui::kPane[0]));
+  SnapshotRegister(imui::kUsedPane, MAX_PLAYER * sizeof(imui::kUsedPane[0]));
+  SnapshotRegister(imui::kMousePosition,
+                   MAX_PLAYER * sizeof(imui::kMousePosition[0]));
+  SnapshotRegister(imui::kUsedMousePosition,
+                   MAX_PLAYER * sizeof(imui::kUsedMousePosition[0]));
+  SnapshotRegister(imui::kIMUI.mouse_down,
+                   MAX_PLAYER * sizeof(imui::kIMUI.mouse_down[0]));
+  SnapshotRegister(&gfx::kRenderGrid, sizeof(gfx::kRenderGrid));
+  SnapshotRegister(&gfx::kRenderPath, sizeof(gfx::kRenderPath));
+  SnapshotRegister(&camera::kShowCameraDebugTarget,
+                   sizeof(camera::kShowCameraDebugTarget));
+}
+static WorldRegister kSnapshotPanels(SnapshotBindPanels);
+#endif
+
 void
 CacheSyncHashes(bool update, uint64_t frame)
 {
@@ -34,43 +59,43 @@ RenderBlackboard(const Unit* unit)
     switch (bb_entry) {
       case kUnitDestination: {
         const Tile* t = nullptr;
-        if (!BB_GET(unit->bb, kUnitDestination, t)) continue;
+        if (!BB_GET(UnitBb(unit), kUnitDestination, t)) continue;
         snprintf(ui_buffer, sizeof(ui_buffer), "dest: %u,%u", t->cx, t->cy);
         imui::Text(ui_buffer);
       } break;
       case kUnitAttackDestination: {
         const Tile* t = nullptr;
-        if (!BB_GET(unit->bb, kUnitAttackDestination, t)) continue;
+        if (!BB_GET(UnitBb(unit), kUnitAttackDestination, t)) continue;
         snprintf(ui_buffer, sizeof(ui_buffer), "adest: %u,%u", t->cx, t->cy);
         imui::Text(ui_buffer);
       } break;
       case kUnitTarget: {
         const uint32_t* t = nullptr;
-        if (!BB_GET(unit->bb, kUnitTarget, t)) continue;
+        if (!BB_GET(UnitBb(unit), kUnitTarget, t)) continue;
         snprintf(ui_buffer, sizeof(ui_buffer), "target: %i", *t);
         imui::Text(ui_buffer);
       } break;
       case kUnitBehavior: {
-        const uint32_t* b = nullptr;
-        if (!BB_GET(unit->bb, kUnitBehavior, b)) continue;
+        const int* b = nullptr;
+        if (!BB_GET(UnitBb(unit), kUnitBehavior, b)) continue;
         snprintf(ui_buffer, sizeof(ui_buffer), "behavior: %i", *b);
         imui::Text(ui_buffer);
       } break;
       case kUnitAttacker: {
-        const int* t = nullptr;
-        if (!BB_GET(unit->bb, kUnitAttacker, t)) continue;
-        snprintf(ui_buffer, sizeof(ui_buffer), "attacker: %i", *t);
+        const uint32_t* t = nullptr;
+        if (!BB_GET(UnitBb(unit), kUnitAttacker, t)) continue;
+        snprintf(ui_buffer, sizeof(ui_buffer), "attacker: %u", *t);
         imui::Text(ui_buffer);
       } break;
       case kUnitTimer: {
         const int* t = nullptr;
-        if (!BB_GET(unit->bb, kUnitTimer, t)) continue;
+        if (!BB_GET(UnitBb(unit), kUnitTimer, t)) continue;
         snprintf(ui_buffer, sizeof(ui_buffer), "timer: %i", *t);
         imui::Text(ui_buffer);
       } break;
       default: {
         snprintf(ui_buffer, sizeof(ui_buffer), "set: %i", i);
-        if (BB_EXI(unit->bb, i)) {
+        if (BB_EXI(UnitBb(unit), i)) {
           imui::Text(ui_buffer);
         }
       }
@@ -81,7 +106,8 @@ RenderBlackboard(const Unit* unit)
 void
 ReadOnlyPanel(v2f screen, uint32_t tag, const Stats& stats,
               uint64_t frame_target_usec, uint64_t frame, uint64_t jerk,
-              uint64_t frame_queue)
+              uint64_t frame_queue, uint64_t behind_frames,
+              uint64_t catchup_rate)
 {
   static bool enable_debug = false;
   static v2f read_only_pos(3.f, screen.y);
@@ -114,14 +140,60 @@ ReadOnlyPanel(v2f screen, uint32_t tag, const Stats& stats,
   snprintf(ui_buffer, sizeof(ui_buffer), "Network Queue: %lu [%1.0fx rsdev]",
            NetworkQueueGoal(), kNetworkState.rsdev_const);
   imui::Text(ui_buffer);
+  snprintf(ui_buffer, sizeof(ui_buffer),
+           "Catch-up: [%lu frames behind] [%lu frames/loop]", behind_frames,
+           catchup_rate);
+  imui::Text(ui_buffer);
   snprintf(ui_buffer, sizeof(ui_buffer), "Window Size: %04.0fx%04.0f", screen.x,
            screen.y);
   imui::Text(ui_buffer);
+  snprintf(ui_buffer, sizeof(ui_buffer), "Rollback: [%lu count] [%lu turns]",
+           kRollbackState.rollback_count, kRollbackState.mispredict_turns);
+  imui::Text(ui_buffer);
+  snprintf(ui_buffer, sizeof(ui_buffer),
+           "Rollback depth: [%lu last] [%lu max] [%lu/%d ahead]",
+           kRollbackState.last_depth, kRollbackState.max_depth,
+           frame - kRollbackState.confirmed_frame, MAX_ROLLBACK);
+  imui::Text(ui_buffer);
+  snprintf(ui_buffer, sizeof(ui_buffer), "Rollback resim: [%lu us] [%lu max]",
+           kRollbackState.last_resim_usec, kRollbackState.max_resim_usec);
+  imui::Text(ui_buffer);
   snprintf(ui_buffer, sizeof(ui_buffer), "Input hash: 0x%lx", kDebugInputHash);
   imui::Text(ui_buffer);
   snprintf(ui_buffer, sizeof(ui_buffer), "Sim hash: 0x%lx",
            kDebugSimulationHash);
   imui::Text(ui_buffer);
+  uint64_t flow_hit = 0;
+  uint64_t flow_miss = 0;
+  uint64_t flow_invalidate = 0;
+  for (int i = 0; i < kMaxShip; ++i) {
+    flow_hit += kFlowField[i].hit;
+    flow_miss += kFlowField[i].miss;
+    flow_invalidate += kFlowField[i].invalidate;
+  }
+  snprintf(ui_buffer, sizeof(ui_buffer),
+           "Flow field: [%lu hit] [%lu miss] [%lu invalidate]", flow_hit,
+           flow_miss, flow_invalidate);
+  imui::Text(ui_buffer);
+  uint64_t flood_hit = 0;
+  uint64_t flood_miss = 0;
+  uint64_t flood_invalidate = 0;
+  for (int i = 0; i < kMaxShip; ++i) {
+    flood_hit += kFloodCache[i].hit;
+    flood_miss += kFloodCache[i].miss;
+    flood_invalidate += kFloodCache[i].invalidate;
+  }
+  snprintf(ui_buffer, sizeof(ui_buffer),
+           "Flood fill: [%lu hit] [%lu miss] [%lu invalidate]", flood_hit,
+           flood_miss, flood_invalidate);
+  imui::Text(ui_buffer);
+  // Churn: live slots moved by compaction, per registry
+  int len = snprintf(ui_buffer, sizeof(ui_buffer), "Slots moved:");
+  for (int i = 0; i < kUsedRegistry && len < sizeof(ui_buffer); ++i) {
+    len += snprintf(ui_buffer + len, sizeof(ui_buffer) - len, " %lu",
+                    kRegistry[i].moved);
+  }
+  imui::Text(ui_buffer);
   const char* ui_err = imui::LastErrorString();
   if (ui_err) imui::Text(ui_err);
   imui::End();
@@ -142,14 +214,14 @@ ReadOnlyUnits(v2f screen, uint32_t tag)
   for (int i = 0; i < kUsedEntity; ++i) {
     snprintf(ui_buffer, sizeof(ui_buffer), "Entity %d", kEntity[i].id);
     bool highlighted = imui::Text(ui_buffer, debug_options).highlighted;
-    if (highlighted || kEntity[i].control || unit_debug) {
+    if (highlighted || kEntityControl[i] || unit_debug) {
       imui::Indent(2);
-      if (kEntity[i].type_id == kEeUnit) {
-        snprintf(ui_buffer, sizeof(ui_buffer), "tile %u %u", kEntity[i].tile.cx,
-                 kEntity[i].tile.cy);
+      if (kEntityTypeId[i] == kEeUnit) {
+        snprintf(ui_buffer, sizeof(ui_buffer), "tile %u %u", kEntityTile[i].cx,
+                 kEntityTile[i].cy);
         imui::Text(ui_buffer);
         snprintf(ui_buffer, sizeof(ui_buffer), "position %04.0f %04.0f",
-                 kEntity[i].position.x, kEntity[i].position.y);
+                 kEntityPosition[i].x, kEntityPosition[i].y);
         imui::Text(ui_buffer);
         snprintf(ui_buffer, sizeof(ui_buffer), "action %d",
                  kEntity[i].unit.uaction);
@@ -165,8 +237,8 @@ ReadOnlyUnits(v2f screen, uint32_t tag)
     if (highlighted) {
       gfx::PushDebugCube(
           math::Cubef(
-              kEntity[i].position + v3f(0.f, 0.f, kEntity[i].bounds.z / 2.f),
-              kEntity[i].bounds),
+              kEntityPosition[i] + v3f(0.f, 0.f, kEntityBounds[i].z / 2.f),
+              kEntityBounds[i]),
           gfx::kRed);
     }
   }
@@ -239,12 +311,14 @@ AdminPanel(v2f screen, uint32_t tag, Player* player)
     player->mineral_cheat = !player->mineral_cheat;
   }
   if (imui::Text("Spawn Unit Cheat", text_options).clicked) {
-    v2f pos = math::RandomPointInRect(ShipBounds(player - kPlayer));
+    float u[2];
+    RandFillUnit(kRandAdmin, u, 2);
+    v2f pos = math::PointInRect(ShipBounds(player - kPlayer), u[0], u[1]);
     SpawnCrew(ToShip(player->ship_index, pos), player - kPlayer);
   }
   if (imui::Text("Kill Random Unit Cheat", text_options).clicked) {
     // Kill first unit in entity list.
-    int rand_val = rand() % kUsedEntity;
+    int rand_val = Rand(kRandAdmin) % kUsedEntity;
     for (int i = 0; i < kUsedEntity; ++i) {
       uint64_t idx = (rand_val + i) % kUsedEntity;
       Unit* unit = i2Unit(idx);
@@ -341,13 +415,13 @@ ControlEvent(const PlatformEvent event, uint64_t player_index, Player* player)
               break;
             }
             Module* mod = UseEntityModule();
-            mod->bounds = ModuleBounds(mkind);
+            EntityBounds(mod) = ModuleBounds(mkind);
             mod->mkind = mkind;
-            mod->ship_index = player->ship_index;
-            mod->player_index = player_index;
+            EntityShipIndex(mod) = player->ship_index;
+            EntityPlayerIndex(mod) = player_index;
             // Rase module to have bottom touch 0,0.
-            mod->position = v3f(0.f, 0.f, mod->bounds.z / 2.f) +
-                            FromShip(event_tile).Center();
+            EntityPosition(mod) = v3f(0.f, 0.f, EntityBounds(mod).z / 2.f) +
+                                  FromShip(event_tile).Center();
             player->mineral -= ModuleCost(mkind);
             LOGFMT("Order build [%i] [%i,%i]", mkind, event_tile.cx,
                    event_tile.cy);
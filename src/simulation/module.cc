@@ -8,14 +8,16 @@ bool
 ModuleBuilt(Module* module)
 {
   if (!module) return false;
-  return module->frames_building >= module->frames_to_build;
+  const ColdEntity* cold = &EntityCold(module);
+  return cold->frames_building >= cold->frames_to_build;
 }
 
 void
 ModuleSetBuilt(Module* module)
 {
   if (!module) return;
-  module->frames_building = module->frames_to_build;
+  ColdEntity* cold = &EntityCold(module);
+  cold->frames_building = cold->frames_to_build;
 }
 
 v3f
@@ -130,11 +132,15 @@ ModuleCanBuild(ModuleKind mkind, Player* player)
   return player->mineral >= ModuleCost(mkind);
 }
 
+constexpr float kModuleNearDsq = 50.f * 38.f;
+// sqrtf(kModuleNearDsq) rounded up, for proximity queries
+constexpr float kModuleNearDistance = 44.f;
+
 bool
 ModuleNear(Module* module, v3f loc)
 {
   // TODO: Take into consideration module bounds.
-  if (LengthSquared(loc - module->position) < 50.f * 38.f) return true;
+  if (LengthSquared(loc - EntityPosition(module)) < kModuleNearDsq) return true;
   return false;
 }
 
@@ -142,7 +148,7 @@ bool
 ModuleNearXY(Module* module, v3f loc)
 {
   // TODO: Take into consideration module bounds.
-  if (LengthSquared(loc.xy() - module->position.xy()) < 50.f * 38.f)
+  if (LengthSquared(loc.xy() - EntityPosition(module).xy()) < kModuleNearDsq)
     return true;
   return false;
 }
@@ -150,7 +156,7 @@ ModuleNearXY(Module* module, v3f loc)
 void
 ModulePowerUpdate(Module* module)
 {
-  Tile tile = module->tile;
+  Tile tile = EntityTile(module);
 
   tile.flags = 0;
   tile.visible = 1;
@@ -167,8 +173,8 @@ ModuleMineUpdate(Module* module)
   Asteroid* a = nullptr;
   for (int i = 0; i < kUsedAsteroid; ++i) {
     Asteroid* asteroid = &kAsteroid[i];
-    float nd =
-        math::LengthSquared(asteroid->transform.position - module->position);
+    float nd = math::LengthSquared(asteroid->transform.position -
+                                   EntityPosition(module));
     if (nd < d) {
       d = nd;
       p = asteroid->transform.position;
@@ -177,39 +183,47 @@ ModuleMineUpdate(Module* module)
   }
 
   if (!a) return;
+  if (!StagePlayer(EntityPlayerIndex(module))) return;
 
-  ProjectileCreate(p, module->position, 15.f, 2, kWeaponMiningLaser);
-  kPlayer[module->player_index].mineral += .1f;
+  StageProjectileCreate(p, EntityPosition(module), 15.f, 2, kWeaponMiningLaser,
+                        kInvalidId);
+  kPlayer[EntityPlayerIndex(module)].mineral += .1f;
 }
 
 void
 ModuleBarrackUpdate(Module* module)
 {
-  Player* player = &kPlayer[module->player_index];
+  if (!StagePlayer(EntityPlayerIndex(module))) return;
+  Player* player = &kPlayer[EntityPlayerIndex(module)];
+  ColdEntity* cold = &EntityCold(module);
 
-  if (module->frames_training != kTrainIdle) {
-    ++module->frames_training;
+  if (cold->frames_training != kTrainIdle) {
+    ++cold->frames_training;
   }
 
-  if (module->frames_training >= module->frames_to_train) {
-    SpawnCrew(module->tile, module->player_index);
-    module->frames_training = kTrainIdle;
+  if (cold->frames_training >= cold->frames_to_train) {
+    if (!StageShared()) return;
+    SpawnCrew(EntityTile(module), EntityPlayerIndex(module));
+    cold->frames_training = kTrainIdle;
   }
 
   // Barracks automatically trains a unit if it has enough minerals, it's
   // enabled and it's training state is not idle.
-  if (module->frames_training != kTrainIdle || !module->enabled ||
+  if (cold->frames_training != kTrainIdle || !module->enabled ||
       player->mineral < 50.f)
     return;
 
-  module->frames_training = 0;
+  cold->frames_training = 0;
 }
 
 void
 ModuleWarpUpdate(Module* module)
 {
-  Unit* unit = GetNearestUnit(module->position);
-  if (module->tile != unit->tile) return;
+  Unit* unit = GetNearestUnit(EntityPosition(module));
+  if (!unit) return;
+  if (EntityTile(module) != EntityTile(unit)) return;
+  // The destination is on another ship
+  if (!StageShared()) return;
 
   // Find the nearest warp on a seperate tilemap from this one.
   Module* target_module = nullptr;
@@ -217,9 +231,9 @@ ModuleWarpUpdate(Module* module)
   FOR_EACH_ENTITY(Module, nm, {
     if (nm == module) continue;
     if (!ModuleBuilt(nm)) continue;
-    if (nm->ship_index == module->ship_index) continue;
+    if (EntityShipIndex(nm) == EntityShipIndex(module)) continue;
     if (nm->mkind != kModWarp) continue;
-    float nd = LengthSquared(nm->position - module->position);
+    float nd = LengthSquared(EntityPosition(nm) - EntityPosition(module));
     if (nd < d) {
       target_module = nm;
       d = nd;
@@ -228,21 +242,22 @@ ModuleWarpUpdate(Module* module)
   if (!target_module) return;
 
   LOGFMT("Warping crew to ship %i. control change %d->%d",
-         target_module->ship_index, unit->control, target_module->control);
-  BfsIterator iter = BfsStart(target_module->tile);
+         EntityShipIndex(target_module), EntityControl(unit),
+         EntityControl(target_module));
+  BfsIterator iter = BfsStart(EntityTile(target_module));
   while (BfsNextTile(&iter)) {
     int i = 0;
     for (; i < kUsedEntity; ++i) {
       Unit* unit = i2Unit(i);
       if (!unit) continue;
-      if (unit->ship_index != target_module->ship_index) continue;
-      if (unit->tile == *iter.tile) break;
+      if (EntityShipIndex(unit) != EntityShipIndex(target_module)) continue;
+      if (EntityTile(unit) == *iter.tile) break;
     }
     if (i != kUsedEntity) continue;
     unit->warp_tile = *iter.tile;
-    unit->player_index = target_module->player_index;
+    EntityPlayerIndex(unit) = EntityPlayerIndex(target_module);
     unit->persistent_uaction = unit->uaction = kUaNone;
-    unit->control = 0;
+    EntityControl(unit) = 0;
     break;
   }
 }
@@ -253,16 +268,16 @@ ModuleDoorUpdate(Module* module)
 {
   constexpr float up = 80.f;
   constexpr float down = 15.f;
-  Unit* unit = GetNearestUnit(module->position);
+  Unit* unit = GetNearestUnit(EntityPosition(module));
   if (!unit) return;
-  if (!ModuleNearXY(module, unit->position)) {
-    if (module->position.z > down) {
-      module->position.z -= 1.f;
+  if (!ModuleNearXY(module, EntityPosition(unit))) {
+    if (EntityPosition(module).z > down) {
+      EntityPosition(module).z -= 1.f;
     }
     return;
   }
-  if (module->position.z < up) {
-    module->position.z += 1.f;
+  if (EntityPosition(module).z < up) {
+    EntityPosition(module).z += 1.f;
   }
 }
 
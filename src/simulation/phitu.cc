@@ -1,6 +1,7 @@
 #pragma once
 
 #include "entity.cc"
+#include "stage.cc"
 #include "util.cc"
 
 namespace simulation
@@ -10,11 +11,11 @@ constexpr float kHitDsq = 13.f * 13.f;
 constexpr float kLaserDamage = 0.01f;
 constexpr float kBulletDamage = 0.50f;
 
-void
+Projectile*
 ProjectileCreate(v3f target, v3f source, float proximity, uint32_t duration,
                  WeaponKind kind)
 {
-  float radian = (float)(rand() % 360) * PI / 180.0f;
+  float radian = (float)(Rand(kRandProjectile) % 360) * PI / 180.0f;
   Projectile* p = UseProjectile();
   p->start = source;
   p->end = target;
@@ -34,33 +35,23 @@ ProjectileCreate(v3f target, v3f source, float proximity, uint32_t duration,
       p->duration = duration;
     } break;
   }
+
+  return p;
 }
 
+// Projectile of a ship stage, created once the stage is known to hold
 void
-ProjectileCreate(const Unit* target, const Unit* source, float proximity,
-                 WeaponKind kind)
+StageProjectileCreate(v3f target, v3f source, float proximity,
+                      uint32_t duration, WeaponKind kind, uint32_t target_id)
 {
-  float radian = (float)(rand() % 360) * PI / 180.0f;
-  Projectile* p = UseProjectile();
-  p->start = source->position;
-  p->end = target->position;
-  p->target_id = target->id;
-  p->end += v3f(proximity * cos(radian), proximity * sin(radian), 0.0f);
-  p->wkind = kind;
-  p->frame = 1;
-
-  switch (kind) {
-    case kWeaponBullet: {
-      v3f distance = p->end - p->start;
-      v3f dir = Normalize(distance);
-      p->duration = distance.x / dir.x;
-    } break;
-    case kWeaponCount:
-    case kWeaponMiningLaser:
-    case kWeaponLaser: {
-      p->duration = kLaserDuration;
-    } break;
+  if (StageSpeculated()) {
+    StageDeferProjectile(target, source, proximity, duration, kind,
+                         target_id);
+    return;
   }
+
+  Projectile* p = ProjectileCreate(target, source, proximity, duration, kind);
+  p->target_id = target_id;
 }
 
 void
@@ -83,10 +74,10 @@ ProjectileSimulation()
 
     v3f dir = Normalize(p->end - p->start);
     v3f position = p->start + dir * p->frame;
-    float dsq = v3fDsq(position, target->position);
+    float dsq = v3fDsq(position, EntityPosition(target));
     if (dsq < kHitDsq) {
       target->health -= kBulletDamage;
-      *p = kZeroProjectile;
+      ZeroProjectile(p);
     }
   }
 
@@ -94,7 +85,7 @@ ProjectileSimulation()
     Projectile* p = &kProjectile[i];
     unsigned frame = p->frame + (p->frame > 0);
     if (frame > p->duration) {
-      *p = kZeroProjectile;
+      ZeroProjectile(p);
     } else {
       p->frame = frame;
     }
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include "entity.cc"
+
+namespace simulation
+{
+// Random draws of the simulation.
+//
+// Every stream is a PCG32 generator: a 64-bit LCG whose state is permuted by
+// an xorshift and a random rotation on output. Streams share the seed, the
+// game id, and differ by their increment, so the draws of one stream never
+// depend on the draws of another. Systems draw from their own stream and the
+// stage of a ship draws from the stream of the ship, on any thread.
+//
+// Streams are a game type: snapshots capture them and Hash() reads them.
+
+constexpr uint64_t kRandMultiplier = 6364136223846793005ull;
+// Draws per chunk of RandFillUnit()
+constexpr uint64_t kRandChunk = 64;
+
+INLINE uint32_t
+RandOutput(uint64_t state)
+{
+  const uint32_t xorshifted = ((state >> 18) ^ state) >> 27;
+  const uint32_t rot = state >> 59;
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+INLINE uint32_t
+RandNext(RandStream* s)
+{
+  const uint64_t state = s->state;
+  s->state = state * kRandMultiplier + s->inc;
+  return RandOutput(state);
+}
+
+// pcg32_srandom_r() of the reference implementation
+void
+RandStreamSeed(RandStream* s, uint64_t seed, uint64_t sequence)
+{
+  s->state = 0;
+  s->inc = (sequence << 1) | 1;
+  RandNext(s);
+  s->state += seed;
+  RandNext(s);
+}
+
+// Every stream starts over from seed. Streams are never released.
+void
+RandSeed(uint64_t seed)
+{
+  kUsedRandStream = 0;
+  for (uint64_t i = 0; i < kMaxRandStream; ++i) {
+    RandStreamSeed(UseRandStream(), seed, i);
+  }
+}
+
+// Uniform in [0, 2^32)
+INLINE uint32_t
+Rand(uint64_t stream)
+{
+  assert(stream < kUsedRandStream);
+  return RandNext(&kRandStream[stream]);
+}
+
+// Uniform in [0, 1)
+INLINE float
+RandUnit(uint64_t stream)
+{
+  return (Rand(stream) >> 8) * (1.f / (1 << 24));
+}
+
+// The next count draws of Rand(stream)
+void
+RandFill(uint64_t stream, uint32_t* out, uint64_t count)
+{
+  assert(stream < kUsedRandStream);
+  RandStream s = kRandStream[stream];
+  for (uint64_t i = 0; i < count; ++i) {
+    out[i] = RandNext(&s);
+  }
+  kRandStream[stream] = s;
+}
+
+// The next count draws of RandUnit(stream)
+void
+RandFillUnit(uint64_t stream, float* out, uint64_t count)
+{
+  uint32_t draw[kRandChunk];
+  while (count) {
+    const uint64_t n = MIN(count, kRandChunk);
+    RandFill(stream, draw, n);
+    for (int i = 0; i < n; ++i) {
+      out[i] = (draw[i] >> 8) * (1.f / (1 << 24));
+    }
+    out += n;
+    count -= n;
+  }
+}
+
+}  // namespace simulation
@@ -0,0 +1,119 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "simulation.cc"
+
+using namespace simulation;
+
+constexpr uint64_t kDrawCount = 1 << 24;
+constexpr uint64_t kFillCount = 4096;
+
+static uint32_t kDraw[kFillCount];
+static uint32_t kExpect[kFillCount];
+static float kUnit[kFillCount];
+
+// Picoseconds per draw
+uint64_t
+DrawPs(uint64_t tsc)
+{
+  return tsc * 1000 * 1000 / median_tsc_per_usec / kDrawCount;
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  // pcg32-demo of the reference implementation
+  RandStream s;
+  RandStreamSeed(&s, 42, 54);
+  const uint32_t reference[] = {0xa15c02b7, 0x7b47f409, 0xba1d3330,
+                                0x83d2f293, 0xbfa4784b, 0xcbed606e};
+  for (int i = 0; i < ARRAY_LENGTH(reference); ++i) {
+    assert(RandNext(&s) == reference[i]);
+  }
+
+  // Streams are independent of each other's draws
+  RandSeed(1234);
+  for (int i = 0; i < kFillCount; ++i) {
+    kExpect[i] = Rand(kRandShip + 1);
+  }
+  RandSeed(1234);
+  for (int i = 0; i < kFillCount; ++i) {
+    Rand(kRandShip);
+    Rand(kRandProjectile);
+    assert(Rand(kRandShip + 1) == kExpect[i]);
+  }
+  RandSeed(1235);
+  assert(Rand(kRandShip + 1) != kExpect[0]);
+
+  // Batches are the same draws, in order, for any count
+  for (uint64_t count = 0; count < 64; ++count) {
+    RandSeed(99);
+    for (int i = 0; i < count + 1; ++i) {
+      kExpect[i] = Rand(kRandInvasion);
+    }
+    RandSeed(99);
+    RandFill(kRandInvasion, kDraw, count);
+    kDraw[count] = Rand(kRandInvasion);
+    assert(memcmp(kDraw, kExpect, (count + 1) * sizeof(uint32_t)) == 0);
+  }
+  RandFillUnit(kRandAdmin, kUnit, kFillCount);
+  float sum = 0.f;
+  for (int i = 0; i < kFillCount; ++i) {
+    assert(kUnit[i] >= 0.f && kUnit[i] < 1.f);
+    sum += kUnit[i];
+  }
+  assert(sum > kFillCount * 0.45f && sum < kFillCount * 0.55f);
+
+  // Streams are game state
+  kPlayerCount = 2;
+  kScenario = kTwoShip;
+  RegistryClear();
+  SnapshotReset();
+  Initialize(1234);
+  Snapshot(0);
+  Hash();
+  const uint64_t hash = kSimulationHash;
+  const uint32_t draw = Rand(kRandAdmin);
+  kSimulationHash = DJB2_CONST;
+  Hash();
+  assert(kSimulationHash != hash);
+  assert(Restore(0));
+  assert(Rand(kRandAdmin) == draw);
+
+  // Throughput
+  uint64_t check = 0;
+  srand(1234);
+  uint64_t begin = rdtsc();
+  for (uint64_t i = 0; i < kDrawCount; ++i) {
+    check += rand();
+  }
+  const uint64_t rand_tsc = rdtsc() - begin;
+
+  begin = rdtsc();
+  for (uint64_t i = 0; i < kDrawCount; ++i) {
+    check += Rand(kRandShip);
+  }
+  const uint64_t stream_tsc = rdtsc() - begin;
+
+  begin = rdtsc();
+  for (uint64_t i = 0; i < kDrawCount; i += kFillCount) {
+    RandFill(kRandShip, kDraw, kFillCount);
+    check += kDraw[0];
+  }
+  const uint64_t fill_tsc = rdtsc() - begin;
+
+  printf(
+      "[ rand() %lu ps/draw ] "
+      "[ Rand %lu ps/draw ] "
+      "[ RandFill %lu ps/draw ] "
+      "[ check %lu ] "
+      "\n",
+      DrawPs(rand_tsc), DrawPs(stream_tsc), DrawPs(fill_tsc), check);
+
+  puts("ok");
+  return 0;
+}
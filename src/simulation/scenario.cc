@@ -4,6 +4,7 @@
 #include "network/network.cc"
 
 #include "entity.cc"
+#include "random.cc"
 #include "search.cc"
 #include "tilemap.cc"
 
@@ -17,8 +18,10 @@ enum ScenarioType {
   kMaxScenario,
 };
 
-static ScenarioType kScenario;
-static uint64_t kFrame;
+static WORLD_LOCAL ScenarioType kScenario;
+static WORLD_LOCAL uint64_t kFrame;
+DECLARE_SNAPSHOT(kScenario)
+DECLARE_SNAPSHOT(kFrame)
 
 constexpr const char* kScenarioNames[kMaxScenario] = {
     "TwoShip",
@@ -35,7 +38,7 @@ ScenarioSpawnRandomModule(ModuleKind kind, uint64_t ship_index, int num = 0)
   int made = 0;
   FOR_EACH_ENTITY(Module, module, {
     if (module->mkind != kind) continue;
-    if (module->ship_index != ship_index) continue;
+    if (EntityShipIndex(module) != ship_index) continue;
     if (ModuleBuilt(module)) continue;
     ModuleSetBuilt(module);
     ++made;
@@ -148,17 +151,16 @@ ScenarioInitialize()
 }  // namespace simulation
 
 void
-ScenarioReset()
+ScenarioReset(uint64_t seed)
 {
   kFrame = 0;
   // TODO (AN): GAME_QUEUE not in the registry
   kReadCommand = 0;
   kWriteCommand = 0;
-  kAutoIncrementIdEntity = kInvalidId + 1;
+  ResetHashEntity();
 
-  for (int i = 0; i < kUsedRegistry; ++i) {
-    *kRegistry[i].memb_count = 0;
-  }
+  RegistryReset();
+  RandSeed(seed);
   ScenarioInitialize();
 }
 
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+
+#include "simulation.cc"
+
+namespace simulation
+{
+// Scripted input of the tests and sim_bench: spawns and orders on every
+// ship, as players would, the same for a frame on every run.
+struct ScriptInput {
+  // One order in attack_period is an attack move, the others are moves
+  uint64_t attack_period;
+  // Crew members take the orders of their player
+  bool crew_control;
+  // Frames between crew members stepping onto the warp of a ship, or 0
+  uint64_t warp_period;
+};
+
+// Attack moves of units no player controls
+static const ScriptInput kScriptAttack = {1, false, 0};
+// Moves and attack moves of the crew of each player
+static const ScriptInput kScriptCrew = {3, true, 0};
+
+void
+ScriptedInput(const ScriptInput* script, uint64_t frame)
+{
+  if (!kUsedShip) return;
+
+  if (frame % 97 == 5 && kUsedEntity < kMaxEntity - 4) {
+    uint64_t ship_index = frame % kUsedShip;
+    Rectf b = ShipBounds(ship_index);
+    Tile t = ToShip(ship_index, v3f(b.x + b.width * 0.5f,
+                                    b.y + b.height * 0.4f, 0.f));
+    if (TileValid(t) && !t.blocked) {
+      SpawnEnemy(t);
+      SpawnCrew(t, frame & 1);
+    }
+  }
+
+  if (script->crew_control) {
+    FOR_EACH_ENTITY(Unit, unit, {
+      if (unit->alliance == kCrew && EntityPlayerIndex(unit) < kPlayerCount) {
+        EntityControl(unit) = 1 << EntityPlayerIndex(unit);
+      }
+    });
+  }
+
+  // A crew member steps onto the warp of the ship
+  const uint64_t warp_period = script->warp_period;
+  if (warp_period && frame % warp_period == warp_period / 2) {
+    uint64_t ship_index = (frame / warp_period) % kUsedShip;
+    Module* warp = nullptr;
+    FOR_EACH_ENTITY(Module, module, {
+      if (EntityShipIndex(module) != ship_index) continue;
+      if (module->mkind != kModWarp || !ModuleBuilt(module)) continue;
+      warp = module;
+      break;
+    });
+    FOR_EACH_ENTITY(Unit, unit, {
+      if (!warp || EntityShipIndex(unit) != ship_index) continue;
+      if (unit->alliance != kCrew) continue;
+      unit->warp_tile = EntityTile(warp);
+      break;
+    });
+  }
+
+  if (frame % 61 == 7) {
+    int p = (frame / 61) % kPlayerCount;
+    Rectf b = ShipBounds(p % kUsedShip);
+    v3f d(b.x + b.width * ((frame * 37) % 100) / 100.f,
+          b.y + b.height * ((frame * 53) % 100) / 100.f, 0.f);
+    UnitAction a =
+        (frame / 61) % script->attack_period == 0 ? kUaAttackMove : kUaMove;
+    PushCommand({a, d, kInvalidId, (unsigned)(1 << p)});
+  }
+}
+
+}  // namespace simulation
@@ -2,6 +2,7 @@
 
 #include <cstring>
 
+#include "flood_fill.cc"
 #include "ship.cc"
 
 namespace simulation
@@ -27,7 +28,8 @@ struct BfsIterator {
   Tile* tile = nullptr;
 };
 
-static Search kSearch;
+// Scratch of the calling thread: ships may search at once
+static thread_local Search kSearch;
 
 BfsIterator
 BfsStart(Tile tile)
@@ -79,7 +81,7 @@ BfsNextTile(BfsIterator* iter)
   while (iter->queue_index < qsz) {
     Tile from = queue[iter->queue_index];
     if (BfsStep(from, iter)) {
-      if (iter->tile->blocked) continue;
+      if (TileBlocked(*iter->tile)) continue;
 
       path_map[iter->tile->cy][iter->tile->cx] = from;
       queue[qsz++] = *iter->tile;
@@ -147,32 +149,15 @@ PathTo(Tile start, Tile end)
 
 // set_tile contains the start location (cx, cy)
 // set_tile contains the flags to be enabled during Bfs
-// tile_dsq is tile distance squared
+// tile_distance bounds the Bfs, see TileDsq()
 void
 BfsTileEnable(Tile set_tile, uint64_t tile_distance)
 {
-  auto& queue = kSearch.queue;
-  auto& path_map = kSearch.path_map;
-  int& qsz = kSearch.queue_size;
-
-  BfsIterator iter = BfsStart(set_tile);
-  if (!iter.tile->blocked) {
-    TileSet(iter.tile, set_tile.flags);
-  }
+  if (!TileValid(set_tile)) return;
 
-  while (iter.queue_index != qsz) {
-    Tile from = queue[iter.queue_index];
-    if (BfsStep(from, &iter)) {
-      if (iter.tile->blocked) continue;
-
-      if (TileDsq(*iter.tile, set_tile, tile_distance)) {
-        TileSet(iter.tile, set_tile.flags);
-
-        path_map[iter.tile->cy][iter.tile->cx] = from;
-        queue[qsz++] = *iter.tile;
-      }
-    }
-  }
+  uint64_t reached[kMapMaxHeight];
+  const uint64_t* fill = FloodFillTo(set_tile, tile_distance, reached);
+  TilePlaneSet(set_tile.ship_index, fill, set_tile.flags);
 }
 
 }  // namespace simulation
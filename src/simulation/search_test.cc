@@ -0,0 +1,144 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "platform/platform.cc"
+
+#include "module.cc"
+
+using namespace simulation;
+
+constexpr int kQueryCount = 4096;
+
+struct Query {
+  Tile start;
+  Tile end;
+};
+
+static Query kQuery[kQueryCount];
+static int kPathSize[kQueryCount];
+
+typedef Path* (*PathFunc)(Tile start, Tile end);
+
+uint64_t
+NextRandom(uint64_t* state)
+{
+  *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+  return *state >> 33;
+}
+
+Tile
+RandomOpenTile(uint64_t ship_index, uint64_t* state)
+{
+  const Ship* ship = &kShip[ship_index];
+  while (true) {
+    uint64_t x = NextRandom(state) % ship->map_width;
+    uint64_t y = NextRandom(state) % ship->map_height;
+    Tile* tile = ShipTile(ship_index, x, y);
+    if (!tile->blocked) return *tile;
+  }
+}
+
+// Each step moves to an unblocked neighbor
+bool
+PathValid(const Path* path, Tile start, Tile end)
+{
+  if (path->tile[0] != start) return false;
+  if (path->tile[path->size - 1] != end) return false;
+  for (int i = 1; i < path->size; ++i) {
+    if (ShipTile(path->tile[i])->blocked) return false;
+    bool adjacent = false;
+    for (int n = 0; n < kMaxNeighbor; ++n) {
+      adjacent |= (TileNeighbor(path->tile[i - 1], n) == path->tile[i]);
+    }
+    if (!adjacent) return false;
+  }
+
+  return true;
+}
+
+void
+Benchmark(const char* name, PathFunc path_to, const uint64_t* expanded)
+{
+  uint64_t found = 0;
+  uint64_t nodes = 0;
+  uint64_t steps = 0;
+  uint64_t tsc = 0;
+  for (int i = 0; i < kQueryCount; ++i) {
+    const Query* q = &kQuery[i];
+    uint64_t begin = rdtsc();
+    Path* path = path_to(q->start, q->end);
+    tsc += rdtsc() - begin;
+    nodes += *expanded;
+
+    if (!path) {
+      assert(kPathSize[i] == 0);
+      continue;
+    }
+    assert(kPathSize[i] != 0);
+    assert(PathValid(path, q->start, q->end));
+    found += 1;
+    steps += path->size;
+  }
+
+  const uint64_t ns = tsc * 1000 / median_tsc_per_usec;
+  printf(
+      "[ %4s ] [ %lu found ] [ %lu nodes/query ] [ %lu steps/path ] "
+      "[ %lu ns/query ]\n",
+      name, found, nodes / kQueryCount, steps / MAX(found, 1),
+      ns / kQueryCount);
+}
+
+// Bfs has no per-search counter: nodes expanded are the queue length
+static uint64_t kBfsExpanded;
+
+Path*
+BfsPathTo(Tile start, Tile end)
+{
+  Path* path = PathTo(start, end);
+  kBfsExpanded = kSearch.queue_size;
+  return path;
+}
+
+void
+TestShip(uint64_t ship_index, const char* name)
+{
+  uint64_t state = ship_index + 1;
+  for (int i = 0; i < kQueryCount; ++i) {
+    kQuery[i].start = RandomOpenTile(ship_index, &state);
+    kQuery[i].end = RandomOpenTile(ship_index, &state);
+    Path* path = PathTo(kQuery[i].start, kQuery[i].end);
+    kPathSize[i] = path ? path->size : 0;
+  }
+
+  // A* finds a path exactly as short as the bfs
+  for (int i = 0; i < kQueryCount; ++i) {
+    Path* path = AStarPathTo(kQuery[i].start, kQuery[i].end);
+    assert((path ? path->size : 0) == kPathSize[i]);
+  }
+
+  printf("%s %dx%d\n", name, kShip[ship_index].map_width,
+         kShip[ship_index].map_height);
+  Benchmark("bfs", BfsPathTo, &kBfsExpanded);
+  Benchmark("a*", AStarPathTo, &kAStar.expanded);
+  Benchmark("jps", JpsPathTo, &kAStar.expanded);
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  const ShipEnum ship_type[] = {kShipShuttle, kShipCruiser};
+  const char* ship_name[] = {"kShuttleDesign", "kCruiserDesign"};
+  for (int i = 0; i < kMaxShip; ++i) {
+    Player* player = UsePlayer();
+    Ship* ship = UseShip();
+    ship->type = ship_type[i];
+    player->ship_index = i;
+    TilemapInitialize(i);
+    TestShip(i, ship_name[i]);
+  }
+
+  return 0;
+}
@@ -12,17 +12,17 @@ SelectPlayerUnit(uint64_t player_index, Unit* unit)
   if (!unit) return;
   if (unit->alliance == kEnemy) return;
   if (unit->kind == kAlien) return;
-  if (unit->player_index != player_index) return;
-  if (BB_EXI(unit->bb, kUnitBehavior)) return;
-  unit->control |= (1 << player_index);
+  if (EntityPlayerIndex(unit) != player_index) return;
+  if (BB_EXI(UnitBb(unit), kUnitBehavior)) return;
+  EntityControl(unit) |= (1 << player_index);
 }
 
 void
 SelectPlayerModule(uint64_t player_index, Module* module)
 {
   if (!module) return;
-  if (module->player_index != player_index) return;
-  module->control |= (1 << player_index);
+  if (EntityPlayerIndex(module) != player_index) return;
+  EntityControl(module) |= (1 << player_index);
 }
 
 uint64_t
@@ -31,7 +31,7 @@ CountUnitSelection(uint64_t player_index)
   unsigned player_control = (1 << player_index);
   uint64_t selection_count = 0;
   for (int i = 0; i < kUsedEntity; ++i) {
-    if (0 == (kEntity[i].control & player_control)) continue;
+    if (0 == (kEntityControl[i] & player_control)) continue;
     ++selection_count;
   }
 
@@ -43,7 +43,7 @@ UnselectPlayerAll(uint64_t player_index)
 {
   unsigned player_control = (1 << player_index);
   for (int i = 0; i < kUsedEntity; ++i) {
-    kEntity[i].control = ANDN(player_control, kEntity[i].control);
+    kEntityControl[i] = ANDN(player_control, kEntityControl[i]);
   }
 }
 
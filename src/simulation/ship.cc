@@ -60,7 +60,7 @@ FromShip(Tile tile)
 INLINE Tile*
 ShipTile(uint64_t ship_index, uint16_t x, uint16_t y)
 {
-  return kShip[ship_index].map + (y * kShip[ship_index].map_width) + (x);
+  return ShipMap(ship_index) + (y * kShip[ship_index].map_width) + (x);
 }
 
 INLINE Tile*
@@ -0,0 +1,144 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "simulation/scripted_input.cc"
+#include "simulation/simulation.cc"
+
+using namespace simulation;
+
+constexpr int kFrameCount = 10000;
+constexpr uint64_t kSeed = 1234;
+// Crew orders on both ships, and a warp step every 500 frames
+constexpr ScriptInput kScript = {3, true, 500};
+
+// StateDigest() after the serial run: ships one after another, as Decide()
+// ran them before stages were speculated
+constexpr uint64_t kSerialDigest = 0xc8df4c5cb0396bde;
+
+static uint64_t kFrameHash[kFrameCount];
+
+void
+DigestMore(const void* ptr, uint64_t bytes, uint64_t* digest)
+{
+  *digest = xxhash64((const uint8_t*)ptr, bytes, *digest);
+}
+
+// Hash of what the players see, whatever the layout of the state in memory:
+// ids, positions and health of the live entities, the tile flags of the
+// ships and the random streams
+uint64_t
+StateDigest()
+{
+  uint64_t digest = 0;
+  FOR_EACH_ENTITY(Unit, unit, {
+    const v3f position = EntityPosition(unit);
+    DigestMore(&unit->id, sizeof(unit->id), &digest);
+    DigestMore(&position, sizeof(position), &digest);
+    DigestMore(&unit->health, sizeof(unit->health), &digest);
+  });
+  FOR_EACH_ENTITY(Module, module, {
+    const v3f position = EntityPosition(module);
+    DigestMore(&module->id, sizeof(module->id), &digest);
+    DigestMore(&position, sizeof(position), &digest);
+    DigestMore(&EntityCold(module).frames_building,
+               sizeof(EntityCold(module).frames_building), &digest);
+  });
+  for (int i = 0; i < kUsedShip; ++i) {
+    const Ship* ship = &kShip[i];
+    for (int y = 0; y < ship->map_height; ++y) {
+      for (int x = 0; x < ship->map_width; ++x) {
+        const uint16_t flags = ShipTile(i, x, y)->flags;
+        DigestMore(&flags, sizeof(flags), &digest);
+      }
+    }
+  }
+  DigestMore(kRandStream, kUsedRandStream * sizeof(RandStream), &digest);
+  return digest;
+}
+
+// Built module of the player of the ship, as placed from the hud
+void
+PlaceModule(uint64_t ship_index, ModuleKind mkind, Tile tile)
+{
+  Module* mod = UseEntityModule();
+  EntityBounds(mod) = ModuleBounds(mkind);
+  mod->mkind = mkind;
+  EntityShipIndex(mod) = ship_index;
+  EntityPlayerIndex(mod) = ship_index;
+  EntityPosition(mod) =
+      v3f(0.f, 0.f, EntityBounds(mod).z / 2.f) + FromShip(tile).Center();
+  mod->enabled = 1;
+  ModuleSetBuilt(mod);
+}
+
+uint64_t
+Run(uint64_t* digest)
+{
+  RegistryClear();
+  Initialize(kSeed);
+  kMaxThisInvasion = 2;
+  kSimulationHash = DJB2_CONST;
+  assert(kUsedShip == 2);
+  for (int i = 0; i < kUsedShip; ++i) {
+    ScenarioSpawnRandomModule(kModMine, i, 2);
+    PlaceModule(i, kModWarp, *ShipTile(i, 5, 23));
+    PlaceModule(i, kModBarrack, *ShipTile(i, 15, 15));
+  }
+
+  uint64_t tsc = 0;
+  for (int frame = 0; frame < kFrameCount; ++frame) {
+    ScriptedInput(&kScript, frame);
+    Hash();
+    uint64_t begin = rdtsc();
+    simulation::Update();
+    tsc += rdtsc() - begin;
+    kFrameHash[frame] ^= kSimulationHash;
+  }
+
+  *digest = StateDigest();
+  return tsc;
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  kPlayerCount = 2;
+  kScenario = kTwoShip;
+
+  uint64_t serial;
+  uint64_t serial_tsc = Run(&serial);
+  assert(kShipStageCount.speculated == 0);
+
+  // Hashes of both runs cancel frame by frame
+  uint64_t speculated;
+  platform::job_start(kMaxShip);
+  uint64_t speculated_tsc = Run(&speculated);
+  platform::job_stop();
+
+  for (int i = 0; i < kFrameCount; ++i) {
+    if (kFrameHash[i] == 0) continue;
+    printf("[ first divergent frame %d ]\n", i);
+    fflush(stdout);
+    assert(false);
+  }
+
+  const ShipStageCount* count = &kShipStageCount;
+  printf(
+      "[ %lu speculated ] [ %lu replayed ] [ %lu entity ] "
+      "[ digest 0x%016lx ]\n",
+      count->speculated, count->replayed, kUsedEntity, serial);
+  printf("[ serial %lu ns/update ] [ speculated %lu ns/update ]\n",
+         serial_tsc * 1000 / median_tsc_per_usec / kFrameCount,
+         speculated_tsc * 1000 / median_tsc_per_usec / kFrameCount);
+  assert(serial == kSerialDigest);
+  assert(speculated == serial);
+  // Both outcomes of speculation are exercised
+  assert(count->speculated == kFrameCount);
+  assert(count->replayed > 0 && count->replayed < count->speculated);
+
+  puts("ok");
+  return 0;
+}
@@ -8,7 +8,10 @@
 #include "util.cc"
 
 #include "ai.cc"
+#include "astar.cc"
+#include "desync.cc"
 #include "entity.cc"
+#include "flow_field.cc"
 #include "ftl.cc"
 #include "module.cc"
 #include "phitu.cc"
@@ -16,6 +19,8 @@
 #include "search.cc"
 #include "selection.cc"
 #include "ship.cc"
+#include "spatial.cc"
+#include "stage.cc"
 
 namespace simulation
 {
@@ -24,14 +29,27 @@ constexpr float kDsqOperate = 50.f * 35.f;
 constexpr float kDsqOperatePod = 75.f * 75.f;
 constexpr float kAvoidanceScaling = 0.15f;
 constexpr uint64_t kTileVisibleDistance = 3;
-static uint64_t kSimulationHash = DJB2_CONST;
-static bool kSimulationOver = false;
+static WORLD_LOCAL uint64_t kSimulationHash = DJB2_CONST;
+static WORLD_LOCAL bool kSimulationOver = false;
+DECLARE_SNAPSHOT(kSimulationHash)
+DECLARE_SNAPSHOT(kSimulationOver)
+
+enum UpdatePhase {
+  kPhaseTilemap,
+  kPhaseDecide,
+  kPhaseProjectile,
+  kPhaseCompact,
+  kPhaseCount,
+};
+// Rdtsc duration of each phase of the last Update()
+static WORLD_LOCAL uint64_t kPhaseTsc[kPhaseCount];
 
 void
 Reset(uint64_t seed)
 {
-  srand(seed);
-  ScenarioReset();
+  SpatialInvalidate();
+  FlowFieldInvalidateAll();
+  ScenarioReset(seed);
 }
 
 bool
@@ -41,12 +59,37 @@ Initialize(uint64_t seed)
   return true;
 }
 
+// Captures the game state as of the start of frame
+void
+Snapshot(uint64_t frame)
+{
+  SnapshotCapture(frame);
+}
+
+// Resumes the game from the snapshot of frame. Caches derived from the game
+// state are dropped.
+bool
+Restore(uint64_t frame)
+{
+  if (!SnapshotRestore(frame)) return false;
+
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    if (kRegistry[i].written) *kRegistry[i].written = true;
+  }
+  SpatialInvalidate();
+  FlowFieldInvalidateAll();
+
+  return true;
+}
+
+// Chains the digest of every registry onto the hash of the previous tick
 void
 Hash()
 {
   for (int i = 0; i < kUsedRegistry; ++i) {
-    uint64_t len = kRegistry[i].memb_size * kRegistry[i].memb_max;
-    djb2_hash_more((const uint8_t*)kRegistry[i].ptr, len, &kSimulationHash);
+    uint64_t digest = RegistryDigest(&kRegistry[i]);
+    kSimulationHash =
+        xxhash64((const uint8_t*)&digest, sizeof(digest), kSimulationHash);
 #ifdef DEBUG_SYNC
     printf("[ Type %d ] [ hash %016lx ]\n", i, kSimulationHash);
 #endif
@@ -63,18 +106,22 @@ TilemapUpdate()
   // Abnormal "jumps" in unit position defying the laws of physics
   FOR_EACH_ENTITY(Unit, unit, {
     if (unit->warp_tile != kZeroTile) {
-      unit->position = FromShip(unit->warp_tile).Center();
-      unit->ship_index = unit->warp_tile.ship_index;
+      EntityPosition(unit) = FromShip(unit->warp_tile).Center();
+      EntityShipIndex(unit) = unit->warp_tile.ship_index;
       unit->warp_tile = kZeroTile;
     }
   });
   // Logical isolation for mapping v3f -> tile
   // Copying the tile introduces a frame delay when processing tile properties
   for (int i = 0; i < kUsedEntity; ++i) {
-    Entity* ent = &kEntity[i];
-    if (ent->type_id == kEeInvalid) continue;
-    ent->tile = ToShip(ent->ship_index, ent->position);
+    if (kEntityTypeId[i] == kEeInvalid) continue;
+    kEntityTile[i] = ToShip(kEntityShipIndex[i], kEntityPosition[i]);
   }
+
+  // Proximity queries for the remainder of the tick
+  SpatialUpdate();
+  // Movement fields survive until ship topology changes
+  FlowFieldUpdate();
 }
 
 void
@@ -111,7 +158,7 @@ DecideAsteroid()
     if (asteroid->mineral_source < .5f ||
         asteroid->transform.position.x <= 0.f) {
       LOG("Asteroid imploded.");
-      *asteroid = kZeroAsteroid;
+      ZeroAsteroid(asteroid);
       continue;
     }
 
@@ -136,7 +183,9 @@ DecideInvasion()
     // Spawn the invasion at a random point on the exterior of a rect
     // consuming all the grids pushed out by a vector from the midpoint
     // of the nearest grid to it.
-    v2f rp = math::RandomPointOnRect(r);
+    float u[4];
+    RandFillUnit(kRandInvasion, u, 4);
+    v2f rp = math::RandomPointOnRect(r, u);
     v2f center(r.x + .5 * r.width, r.y + .5 * r.height);
     v2f invasion_dir = math::Normalize(center - rp);
 
@@ -160,7 +209,7 @@ DecideInvasion()
     } else if (v->unit_count == 0) {
       // Spawn the units from the invasion force!
       BfsIterator iter = BfsStart(v->docked_tile);
-      int count = rand() % kMaxThisInvasion + 1;
+      int count = Rand(kRandInvasion) % kMaxThisInvasion + 1;
       while (BfsNext(&iter)) {
         if (iter.tile->exterior || iter.tile->blocked) continue;
         v->unit_id[v->unit_count++] = SpawnEnemy(*iter.tile);
@@ -183,14 +232,14 @@ DecideInvasion()
       }
     }
 
-    if (all_dead) *v = kZeroInvasion;
+    if (all_dead) ZeroInvasion(v);
   }
 }
 
 bool
 MoveTowards(Unit* unit, Tile dest, UnitAction set_on_arrival)
 {
-  if (unit->tile == dest) {
+  if (EntityTile(unit) == dest) {
     unit->uaction = set_on_arrival;
     return true;
   }
@@ -198,24 +247,30 @@ MoveTowards(Unit* unit, Tile dest, UnitAction set_on_arrival)
   Tile incremental_dest = dest;
   v3f avoidance_vec = {};
   if (!unit->inspace) {
-    auto* path = PathTo(unit->tile, dest);
-    if (!path) {
+    bool has_path;
+    if (TileValid(dest) && dest.ship_index == EntityTile(unit).ship_index) {
+      // Shared per-destination field
+      has_path = FlowFieldNext(EntityTile(unit), dest, &incremental_dest);
+    } else {
+      auto* path = AStarPathTo(EntityTile(unit), dest);
+      has_path = (path != nullptr);
+      if (path && path->size > 1) incremental_dest = path->tile[1];
+    }
+
+    if (!has_path) {
       unit->uaction = set_on_arrival;
-      BB_REM(unit->bb, kUnitDestination);
+      BB_REM(UnitBb(unit), kUnitDestination);
       return true;
     }
 
-    if (path->size > 1) {
-      incremental_dest = path->tile[1];
-      avoidance_vec = TileAvoidWalls(unit->tile) * kAvoidanceScaling;
-    }
+    avoidance_vec = TileAvoidWalls(EntityTile(unit)) * kAvoidanceScaling;
   }
 
-  v3f delta(incremental_dest.cx - unit->tile.cx,
-            incremental_dest.cy - unit->tile.cy, 0.f);
+  v3f delta(incremental_dest.cx - EntityTile(unit).cx,
+            incremental_dest.cy - EntityTile(unit).cy, 0.f);
   v3f move_vec = delta * unit->speed;
 
-  unit->position += (move_vec + avoidance_vec);
+  EntityPosition(unit) += (move_vec + avoidance_vec);
 
   return false;
 }
@@ -223,7 +278,7 @@ MoveTowards(Unit* unit, Tile dest, UnitAction set_on_arrival)
 void
 AttackTarget(Unit* unit, Unit* target)
 {
-  BB_SET(target->bb, kUnitAttacker, unit->id);
+  BB_SET(UnitBb(target), kUnitAttacker, unit->id);
 
   if (!ShouldAttack(unit, target)) {
     return;
@@ -234,7 +289,8 @@ AttackTarget(Unit* unit, Unit* target)
     return;
   }
 
-  ProjectileCreate(target, unit, 7.5f, unit->weapon_kind);
+  StageProjectileCreate(EntityPosition(target), EntityPosition(unit), 7.5f,
+                        kLaserDuration, unit->weapon_kind, target->id);
   unit->attack_frame = kFrame;
 }
 
@@ -248,22 +304,22 @@ ApplyCommand(Unit* unit, const Command& c)
 
   switch (ctype) {
     case kUaMove: {
-      Tile t = ToShip(unit->ship_index, c.destination);
-      BB_SET(unit->bb, kUnitDestination, t);
+      Tile t = ToShip(EntityShipIndex(unit), c.destination);
+      BB_SET(UnitBb(unit), kUnitDestination, t);
     } break;
     case kUaAttack: {
       Unit* target = GetUnit(c.destination);
       if (!target) return;
-      BB_SET(unit->bb, kUnitTarget, target->id);
+      BB_SET(UnitBb(unit), kUnitTarget, target->id);
     } break;
     case kUaAttackMove: {
-      Tile t = ToShip(unit->ship_index, c.destination);
-      BB_SET(unit->bb, kUnitAttackDestination, t);
+      Tile t = ToShip(EntityShipIndex(unit), c.destination);
+      BB_SET(UnitBb(unit), kUnitAttackDestination, t);
       persistent_action = c.type;
     } break;
     case kUaBuild: {
-      Tile t = ToShip(unit->ship_index, c.destination);
-      BB_SET(unit->bb, kUnitDestination, t);
+      Tile t = ToShip(EntityShipIndex(unit), c.destination);
+      BB_SET(UnitBb(unit), kUnitDestination, t);
     } break;
   }
 
@@ -274,30 +330,45 @@ void
 UpdateModule(uint64_t ship_index)
 {
   FOR_EACH_ENTITY(Module, module, {
-    if (module->ship_index != ship_index) continue;
+    if (EntityShipIndex(module) != ship_index) continue;
     if (!ModuleBuilt(module)) continue;
     ModuleUpdate(module);
   });
 }
 
+// Only units of the ship are marked dead by its stage
+void
+ReleaseDead(uint64_t ship_index)
+{
+  // Unit death logic happens here
+  FOR_EACH_ENTITY(Unit, unit, {
+    if (EntityShipIndex(unit) != ship_index) continue;
+    if (unit->dead) {
+      uint32_t death_id = unit->id;
+      LOGFMT("Unit died [id %d]", death_id);
+      ZeroEntity(unit);
+    }
+  });
+}
+
 void
 UpdateUnit(uint64_t ship_index)
 {
   FOR_EACH_ENTITY(Unit, unit, {
-    if (unit->ship_index != ship_index) continue;
+    if (EntityShipIndex(unit) != ship_index) continue;
 
     if (unit->health < 0.f) {
       unit->dead = 1;
       continue;
     }
 
-    if (unit->tile == kZeroTile) {
+    if (EntityTile(unit) == kZeroTile) {
       continue;
     }
 
     // Reveal the shroud
     if (unit->alliance != kEnemy) {
-      Tile set_tile = *ShipTile(unit->tile);
+      Tile set_tile = *ShipTile(EntityTile(unit));
       set_tile.flags = 0;
       set_tile.visible = 1;
       set_tile.explored = 1;
@@ -306,12 +377,17 @@ UpdateUnit(uint64_t ship_index)
 
     AIThink(unit);
 
-    FOR_EACH_ENTITY(Module, m, {
+    uint32_t candidate[MAX_ENTITY];
+    uint64_t count =
+        SpatialRange(EntityPosition(unit), kModuleNearDistance, candidate);
+    for (int i = 0; i < count; ++i) {
+      Module* m = i2Module(candidate[i]);
+      if (!m) continue;
       if (ModuleBuilt(m)) continue;
-      if (ModuleNear(m, unit->position)) {
-        m->frames_building++;
+      if (ModuleNear(m, EntityPosition(unit))) {
+        EntityCold(m).frames_building++;
       }
-    });
+    }
 
     // Implementation of uaction should properly reset persistent_uaction
     // when they are completed. Otherwise units will never have their uaction
@@ -321,7 +397,7 @@ UpdateUnit(uint64_t ship_index)
       unit->uaction = unit->persistent_uaction;
     } else if (unit->uaction == kUaMove) {
       const Tile* dest = nullptr;
-      if (!BB_GET(unit->bb, kUnitDestination, dest)) {
+      if (!BB_GET(UnitBb(unit), kUnitDestination, dest)) {
         continue;
       }
 
@@ -330,13 +406,15 @@ UpdateUnit(uint64_t ship_index)
       }
     } else if (unit->uaction == kUaAttack) {
       const uint32_t* target = nullptr;
-      if (!BB_GET(unit->bb, kUnitTarget, target)) {
+      if (!BB_GET(UnitBb(unit), kUnitTarget, target)) {
         continue;
       }
 
       Unit* target_unit = FindUnit(*target);
+      // Units of another ship are read in ship order
+      if (target_unit && !StageOwns(EntityShipIndex(target_unit))) continue;
       if (!target_unit || target_unit->dead) {
-        BB_REM(unit->bb, kUnitTarget);
+        BB_REM(UnitBb(unit), kUnitTarget);
         unit->uaction = kUaNone;
         unit->persistent_uaction = kUaNone;
         continue;
@@ -344,15 +422,15 @@ UpdateUnit(uint64_t ship_index)
 
       if (!InRange(unit->id, *target)) {
         // Go to your target.
-        BB_SET(unit->bb, kUnitDestination, target_unit->tile);
-        MoveTowards(unit, target_unit->tile, kUaAttack);
+        BB_SET(UnitBb(unit), kUnitDestination, EntityTile(target_unit));
+        MoveTowards(unit, EntityTile(target_unit), kUaAttack);
         continue;
       }
 
       AttackTarget(unit, target_unit);
     } else if (unit->uaction == kUaAttackMove) {
       const Tile* dest = nullptr;
-      if (!BB_GET(unit->bb, kUnitAttackDestination, dest)) {
+      if (!BB_GET(UnitBb(unit), kUnitAttackDestination, dest)) {
         continue;
       }
 
@@ -367,7 +445,7 @@ UpdateUnit(uint64_t ship_index)
       AttackTarget(unit, target_unit);
     } else if (unit->uaction == kUaBuild) {
       const Tile* dest = nullptr;
-      if (!BB_GET(unit->bb, kUnitDestination, dest)) {
+      if (!BB_GET(UnitBb(unit), kUnitDestination, dest)) {
         continue;
       }
 
@@ -377,14 +455,33 @@ UpdateUnit(uint64_t ship_index)
     }
   });
 
-  // Unit death logic happens here
-  FOR_EACH_ENTITY(Unit, unit, {
-    if (unit->dead) {
-      uint32_t death_id = unit->id;
-      LOGFMT("Unit died [id %d]", death_id);
-      ZeroEntity(unit);
-    }
-  });
+  // Released once the stage is known to hold
+  if (StageSpeculated()) return;
+  ReleaseDead(ship_index);
+}
+
+// The stage of one ship, see stage.cc
+void
+UpdateShip(uint64_t ship_index)
+{
+  DecideShip(ship_index);
+  UpdateModule(ship_index);
+  UpdateUnit(ship_index);
+}
+
+// The effects of the speculated stage of a ship that reach other ships
+void
+MergeShip(uint64_t ship_index)
+{
+  const ShipStage* stage = &kShipStage[ship_index];
+  for (int i = 0; i < stage->used_projectile; ++i) {
+    const StageProjectile* sp = &stage->projectile[i];
+    Projectile* p = ProjectileCreate(sp->target, sp->source, sp->proximity,
+                                     sp->duration, sp->kind);
+    p->target_id = sp->target_id;
+  }
+
+  ReleaseDead(ship_index);
 }
 
 void
@@ -395,7 +492,7 @@ Decide()
     if (c.unit_id == kInvalidId) {
       if (c.type == kUaBuild) {
         FOR_EACH_ENTITY(Unit, unit, {
-          if (0 == (unit->control & c.control)) continue;
+          if (0 == (EntityControl(unit) & c.control)) continue;
           ApplyCommand(unit, c);
         });
       } else {
@@ -404,7 +501,7 @@ Decide()
           BfsIterator iter = BfsStart(start);
           FOR_EACH_ENTITY(Unit, unit, {
             // The issuer of a command must have a set bit
-            if (0 == (unit->control & c.control)) continue;
+            if (0 == (EntityControl(unit) & c.control)) continue;
             c.destination = FromShip(*iter.tile).Center();
             ApplyCommand(unit, c);
             if (!BfsNextTile(&iter)) break;
@@ -415,7 +512,7 @@ Decide()
       Unit* unit = FindUnit(c.unit_id);
       if (!unit) continue;
       // Unit specific commands must exactly match the original control bits
-      if (unit->control != c.control) continue;
+      if (EntityControl(unit) != c.control) continue;
       // Unit is busy.
       if (unit->uaction != kUaNone) continue;
       ApplyCommand(unit, c);
@@ -425,10 +522,15 @@ Decide()
   DecideAsteroid();
   DecideInvasion();
 
+  if (ShipStageSpeculate(UpdateShip, kUsedShip)) {
+    for (uint64_t i = 0; i < kUsedShip; ++i) {
+      MergeShip(i);
+    }
+    return;
+  }
+
   for (uint64_t i = 0; i < kUsedShip; ++i) {
-    DecideShip(i);
-    UpdateModule(i);
-    UpdateUnit(i);
+    UpdateShip(i);
   }
 }
 
@@ -451,30 +553,40 @@ Update()
 
   if (kSimulationOver) return;
 
+  uint64_t tsc = rdtsc();
   TilemapUpdate();
+  kPhaseTsc[kPhaseTilemap] = rdtsc() - tsc;
 
   // Frame 1 assigns player camera
   if (kFrame == 1) {
     for (int i = 0; i < kUsedPlayer; ++i) {
       FOR_EACH_ENTITY(Unit, unit, {
-        if (unit->player_index == i) {
-          camera::Move(&kPlayer[i].camera, unit->position);
+        if (EntityPlayerIndex(unit) == i) {
+          camera::Move(&kPlayer[i].camera, EntityPosition(unit));
           break;
         }
       });
     }
   }
 
+  tsc = rdtsc();
   Decide();
+  kPhaseTsc[kPhaseDecide] = rdtsc() - tsc;
 
   FOR_EACH_ENTITY(Unit, unit, {
     unit->notify =
         BITRANGE_WRAP(kNotifyAgeBits, unit->notify + (unit->notify > 0));
   });
 
+  tsc = rdtsc();
   ProjectileSimulation();
+  kPhaseTsc[kPhaseProjectile] = rdtsc() - tsc;
 
+  // Compaction moves entities: indices held by kSpatial are stale
+  tsc = rdtsc();
   RegistryCompact();
+  SpatialInvalidate();
+  kPhaseTsc[kPhaseCompact] = rdtsc() - tsc;
 }  // namespace simulation
 
 }  // namespace simulation
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "common/common.cc"
+
+#include "world.cc"
+
+// Snapshots of the global game state.
+//
+// Game state is declared with DECLARE_SNAPSHOT(), which packs each variable
+// into an image at a fixed offset. A snapshot compares the live state to the
+// image of the previous snapshot one page at a time: changed pages are
+// recorded as the XOR of the two and copied into the image. XOR deltas
+// apply in either direction, so the image walks back to any snapshot in the
+// ring.
+//
+// Every world registers its own variables, in the same order: offsets match
+// between worlds.
+
+// Snapshots in the ring
+#define MAX_SNAPSHOT 8
+// Image of every registered variable, raise with MAX_ENTITY
+#ifndef MAX_SNAPSHOT_PAGE
+#define MAX_SNAPSHOT_PAGE 64
+#endif
+#define MAX_SNAPSHOT_BYTES (MAX_SNAPSHOT_PAGE * PAGE)
+
+struct SnapshotRegion {
+  void* ptr;
+  uint64_t bytes;
+  // Offset in the image
+  uint64_t offset;
+};
+
+#define MAX_SNAPSHOT_REGION 128
+DECLARE_ARRAY(SnapshotRegion, MAX_SNAPSHOT_REGION);
+
+struct SnapshotDelta {
+  uint64_t frame;
+  // Pages that differ from the previous snapshot
+  uint64_t dirty[MAX_SNAPSHOT_PAGE / 64];
+  // Previous image XOR this image, dirty pages only
+  ALIGNAS(64) uint8_t page[MAX_SNAPSHOT_PAGE][PAGE];
+};
+
+struct SnapshotRing {
+  // State as of the newest snapshot
+  ALIGNAS(64) uint8_t image[MAX_SNAPSHOT_BYTES];
+  uint64_t image_bytes;
+  SnapshotDelta delta[MAX_SNAPSHOT];
+  // Snapshots [read, write) are held
+  uint64_t read;
+  uint64_t write;
+};
+
+static WORLD_LOCAL SnapshotRing kSnapshotRing;
+
+void
+SnapshotRegister(void* ptr, uint64_t bytes)
+{
+  SnapshotRegion* r = UseSnapshotRegion();
+  r->ptr = ptr;
+  r->bytes = bytes;
+  r->offset = kSnapshotRing.image_bytes;
+  // Regions start on 8 byte boundaries
+  kSnapshotRing.image_bytes = (r->offset + bytes + 7) & ~7ull;
+  assert(kSnapshotRing.image_bytes <= MAX_SNAPSHOT_BYTES);
+}
+
+#define DECLARE_SNAPSHOT(var)            \
+  void SnapshotBind##var()               \
+  {                                      \
+    SnapshotRegister(&var, sizeof(var)); \
+  }                                      \
+  static WorldRegister kSnapshot##var(SnapshotBind##var);
+
+INLINE bool
+SnapshotIsDirty(const SnapshotDelta* d, uint64_t page)
+{
+  return d->dirty[page / 64] & (1ull << (page % 64));
+}
+
+// Records the changes of one page of live bytes at offset
+void
+SnapshotPage(SnapshotDelta* d, const uint8_t* live, uint64_t offset,
+             uint64_t bytes)
+{
+  uint8_t* image = kSnapshotRing.image + offset;
+  if (memcmp(live, image, bytes) == 0) return;
+
+  const uint64_t page = offset / PAGE;
+  uint8_t* delta = d->page[page] + offset % PAGE;
+  if (!SnapshotIsDirty(d, page)) {
+    d->dirty[page / 64] |= (1ull << (page % 64));
+    memset(d->page[page], 0, PAGE);
+  }
+
+  uint64_t i = 0;
+  for (; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+    uint64_t x, y;
+    memcpy(&x, live + i, sizeof(x));
+    memcpy(&y, image + i, sizeof(y));
+    x ^= y;
+    memcpy(delta + i, &x, sizeof(x));
+  }
+  for (; i < bytes; ++i) {
+    delta[i] = live[i] ^ image[i];
+  }
+  memcpy(image, live, bytes);
+}
+
+// Snapshot of the live state, replacing the oldest once the ring is full
+void
+SnapshotCapture(uint64_t frame)
+{
+  SnapshotRing* s = &kSnapshotRing;
+  if (s->write - s->read == MAX_SNAPSHOT) s->read += 1;
+  SnapshotDelta* d = &s->delta[s->write % MAX_SNAPSHOT];
+  s->write += 1;
+  d->frame = frame;
+  memset(d->dirty, 0, sizeof(d->dirty));
+
+  for (int i = 0; i < kUsedSnapshotRegion; ++i) {
+    const SnapshotRegion* r = &kSnapshotRegion[i];
+    const uint8_t* live = (const uint8_t*)r->ptr;
+    uint64_t offset = r->offset;
+    uint64_t bytes = r->bytes;
+    while (bytes) {
+      const uint64_t room = PAGE - offset % PAGE;
+      const uint64_t n = MIN(bytes, room);
+      SnapshotPage(d, live, offset, n);
+      live += n;
+      offset += n;
+      bytes -= n;
+    }
+  }
+}
+
+// Index of the snapshot of frame, or kInvalidIndex
+uint64_t
+SnapshotFind(uint64_t frame)
+{
+  const SnapshotRing* s = &kSnapshotRing;
+  for (uint64_t i = s->write; i > s->read; --i) {
+    if (s->delta[(i - 1) % MAX_SNAPSHOT].frame == frame) return i - 1;
+  }
+
+  return kInvalidIndex;
+}
+
+// Live state becomes the snapshot of frame. Newer snapshots are released.
+bool
+SnapshotRestore(uint64_t frame)
+{
+  SnapshotRing* s = &kSnapshotRing;
+  const uint64_t index = SnapshotFind(frame);
+  if (index == kInvalidIndex) return false;
+
+  for (uint64_t i = s->write - 1; i > index; --i) {
+    const SnapshotDelta* d = &s->delta[i % MAX_SNAPSHOT];
+    for (uint64_t page = 0; page < MAX_SNAPSHOT_PAGE; ++page) {
+      if (!SnapshotIsDirty(d, page)) continue;
+      uint64_t* image = (uint64_t*)(s->image + page * PAGE);
+      const uint64_t* delta = (const uint64_t*)d->page[page];
+      for (int j = 0; j < PAGE / sizeof(uint64_t); ++j) {
+        image[j] ^= delta[j];
+      }
+    }
+  }
+  s->write = index + 1;
+
+  for (int i = 0; i < kUsedSnapshotRegion; ++i) {
+    const SnapshotRegion* r = &kSnapshotRegion[i];
+    memcpy(r->ptr, s->image + r->offset, r->bytes);
+  }
+
+  return true;
+}
+
+// Releases every snapshot
+void
+SnapshotReset()
+{
+  kSnapshotRing.read = kSnapshotRing.write = 0;
+}
+
+// Copies the live state into image[MAX_SNAPSHOT_BYTES], outside the ring
+void
+SnapshotSave(uint8_t* image)
+{
+  for (int i = 0; i < kUsedSnapshotRegion; ++i) {
+    const SnapshotRegion* r = &kSnapshotRegion[i];
+    memcpy(image + r->offset, r->ptr, r->bytes);
+  }
+}
+
+// Live state becomes the image of SnapshotSave()
+void
+SnapshotLoad(const uint8_t* image)
+{
+  for (int i = 0; i < kUsedSnapshotRegion; ++i) {
+    const SnapshotRegion* r = &kSnapshotRegion[i];
+    memcpy(r->ptr, image + r->offset, r->bytes);
+  }
+}
@@ -0,0 +1,101 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "scripted_input.cc"
+#include "simulation.cc"
+
+using namespace simulation;
+
+constexpr uint64_t kFrameCount = 1200;
+// Rollback every kRollbackPeriod frames, by a growing distance
+constexpr uint64_t kRollbackPeriod = 50;
+
+static uint64_t kReference[kFrameCount];
+static uint64_t kCaptureTsc;
+static uint64_t kCaptureMax;
+static uint64_t kCaptureCount;
+static uint64_t kRestoreTsc;
+static uint64_t kRestoreCount;
+
+void
+TimedSnapshot(uint64_t frame)
+{
+  uint64_t begin = rdtsc();
+  Snapshot(frame);
+  uint64_t tsc = rdtsc() - begin;
+  kCaptureTsc += tsc;
+  kCaptureMax = MAX(kCaptureMax, tsc);
+  kCaptureCount += 1;
+}
+
+// Records the hash of each frame, or checks it against the record
+void
+Run(bool rollback)
+{
+  RegistryClear();
+  SnapshotReset();
+  Initialize(1234);
+  kSimulationHash = DJB2_CONST;
+  // Untimed: first touch of the ring pages
+  Snapshot(0);
+
+  uint64_t distance = 1;
+  uint64_t rolled = 0;
+  for (uint64_t frame = 0; frame < kFrameCount; ++frame) {
+    if (rollback && frame > rolled && frame % kRollbackPeriod == 0) {
+      const uint64_t to = frame - distance;
+      rolled = frame;
+      uint64_t begin = rdtsc();
+      bool restored = Restore(to);
+      kRestoreTsc += rdtsc() - begin;
+      kRestoreCount += 1;
+      assert(restored);
+      assert(kFrame == to);
+      distance = distance % (MAX_SNAPSHOT - 1) + 1;
+      frame = to;
+    }
+
+    ScriptedInput(&kScriptAttack, frame);
+    Hash();
+    if (rollback) {
+      assert(kSimulationHash == kReference[frame]);
+    } else {
+      kReference[frame] = kSimulationHash;
+    }
+    simulation::Update();
+    TimedSnapshot(frame + 1);
+  }
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  kPlayerCount = 2;
+  kScenario = kTwoShip;
+  Run(false);
+  Run(true);
+
+  // Only the ring is held
+  assert(Restore(kFrameCount - MAX_SNAPSHOT + 1));
+  assert(!Restore(kFrameCount));
+  assert(!Restore(kFrameCount - MAX_SNAPSHOT));
+
+  printf(
+      "[ regions %lu ] "
+      "[ image %lu bytes ] "
+      "[ capture %lu ns ] "
+      "[ capture_max %lu ns ] "
+      "[ restore %lu ns ] "
+      "\n",
+      kUsedSnapshotRegion, kSnapshotRing.image_bytes,
+      kCaptureTsc * 1000 / median_tsc_per_usec / kCaptureCount,
+      kCaptureMax * 1000 / median_tsc_per_usec,
+      kRestoreTsc * 1000 / median_tsc_per_usec / kRestoreCount);
+
+  puts("ok");
+  return 0;
+}
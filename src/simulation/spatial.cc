@@ -0,0 +1,402 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "entity.cc"
+#include "ship.cc"
+#include "stage.cc"
+
+namespace simulation
+{
+// Uniform bucket index over kEntity, one grid per ship.
+//
+// Cells are square groups of ship tiles. Entities are bucketed by the tile
+// assigned in TilemapUpdate(). Entities without a ship tile are 'loose' and
+// are candidates to every query. Entities created after the rebuild are
+// always candidates as well.
+//
+// Results are entity indices in ascending order: callers that walk results
+// match the order of a FOR_EACH_ENTITY scan.
+//
+// A speculated ship stage reads the entities of its ship alone: queries
+// gather from that ship, and flag a conflict when an entity of another ship
+// could change the result (see stage.cc).
+constexpr int kSpatialCellBits = 2;
+constexpr int kSpatialCellDim = kMapMaxWidth >> kSpatialCellBits;
+constexpr int kMaxSpatialCell = kSpatialCellDim * kSpatialCellDim;
+// Units move at most one tile per tick: widen queries by that distance
+// so positions bucketed at the start of the tick remain conservative.
+constexpr float kSpatialSlack = kTileWidth;
+// Range results above this count are ordered with a bitmap of MAX_ENTITY
+constexpr int kSpatialInsertionSort = 32;
+constexpr int kSpatialBitmapWords = (MAX_ENTITY + 63) / 64;
+// Queries over the entities of every ship
+constexpr uint64_t kSpatialEveryShip = UINT64_MAX;
+
+struct SpatialIndex {
+  // Cell c of ship s spans cell_entity[cell_start[s][c], cell_start[s][c+1])
+  uint32_t cell_start[kMaxShip][kMaxSpatialCell + 1];
+  // Entity indices grouped by ship and cell, ascending within each cell
+  uint32_t cell_entity[MAX_ENTITY];
+  // Entity indices that are not on a ship tile, ascending
+  uint32_t loose_entity[MAX_ENTITY];
+  uint64_t used_loose;
+  // kUsedEntity at rebuild
+  uint64_t indexed_count;
+  // False until rebuilt, and after entity indices are compacted
+  bool valid;
+};
+
+static WORLD_LOCAL SpatialIndex kSpatial;
+
+typedef bool (*SpatialFilter)(uint64_t entity_index, const void* arg);
+
+// Returns the cell for the entity, or -1 when it is loose
+int
+SpatialCell(uint64_t entity_index)
+{
+  const uint64_t ship_index = kEntityShipIndex[entity_index];
+  const Tile tile = kEntityTile[entity_index];
+  if (ship_index >= kUsedShip) return -1;
+  if (!TileValid(tile)) return -1;
+  if (tile.ship_index != ship_index) return -1;
+
+  const int cx = tile.cx >> kSpatialCellBits;
+  const int cy = tile.cy >> kSpatialCellBits;
+  return cy * kSpatialCellDim + cx;
+}
+
+void
+SpatialInvalidate()
+{
+  kSpatial.valid = false;
+}
+
+// Counting sort of kEntity into cells, preserving index order per cell.
+// Reads the type, ship and tile columns alone.
+void
+SpatialUpdate()
+{
+  uint32_t* cell_start = &kSpatial.cell_start[0][0];
+  constexpr uint64_t kCellTotal = kMaxShip * (kMaxSpatialCell + 1);
+  memset(cell_start, 0, sizeof(kSpatial.cell_start));
+  kSpatial.used_loose = 0;
+
+  // Ship-major flattening: offset of cell c on ship s
+#define SPATIAL_SLOT(s, c) ((s) * (kMaxSpatialCell + 1) + (c))
+  for (int i = 0; i < kUsedEntity; ++i) {
+    if (kEntityTypeId[i] == kEeInvalid) continue;
+    int cell = SpatialCell(i);
+    if (cell < 0) {
+      kSpatial.loose_entity[kSpatial.used_loose++] = i;
+      continue;
+    }
+    cell_start[SPATIAL_SLOT(kEntityShipIndex[i], cell) + 1] += 1;
+  }
+
+  uint32_t sum = 0;
+  for (int i = 0; i < kCellTotal; ++i) {
+    sum += cell_start[i];
+    cell_start[i] = sum;
+  }
+
+  uint32_t cursor[kMaxShip][kMaxSpatialCell];
+  for (int s = 0; s < kMaxShip; ++s) {
+    memcpy(cursor[s], kSpatial.cell_start[s], sizeof(cursor[s]));
+  }
+
+  for (int i = 0; i < kUsedEntity; ++i) {
+    if (kEntityTypeId[i] == kEeInvalid) continue;
+    int cell = SpatialCell(i);
+    if (cell < 0) continue;
+    kSpatial.cell_entity[cursor[kEntityShipIndex[i]][cell]++] = i;
+  }
+#undef SPATIAL_SLOT
+
+  kSpatial.indexed_count = kUsedEntity;
+  kSpatial.valid = true;
+}
+
+// True when the entity is a candidate to queries of 'ship_index'. Empty
+// slots are on every ship.
+INLINE bool
+SpatialOnShip(uint64_t entity_index, uint64_t ship_index)
+{
+  if (ship_index == kSpatialEveryShip) return true;
+  return kEntityTypeId[entity_index] == kEeInvalid ||
+         kEntityShipIndex[entity_index] == ship_index;
+}
+
+// True when the square of 'radius' around 'center' covers every ship, or
+// only 'ship_index' unless it is kSpatialEveryShip
+bool
+SpatialCoversFleet(v3f center, float radius, uint64_t ship_index)
+{
+  const float r = radius + kSpatialSlack;
+  for (int i = 0; i < kUsedShip; ++i) {
+    if (ship_index != kSpatialEveryShip && ship_index != i) continue;
+    Rectf b = ShipBounds(i);
+    if (center.x - r > b.x || center.x + r < b.x + b.width) return false;
+    if (center.y - r > b.y || center.y + r < b.y + b.height) return false;
+  }
+
+  return true;
+}
+
+// Cells of ship 's' within 'radius' of center, widened by kSpatialSlack:
+// span is {cx0, cy0, cx1, cy1}, inclusive. False when there are none.
+bool
+SpatialCellSpan(int s, v3f center, float radius, int* span)
+{
+  const float r = radius + kSpatialSlack;
+  Rectf b = ShipBounds(s);
+  float minx = center.x - r - b.x;
+  float maxx = center.x + r - b.x;
+  float miny = center.y - r - b.y;
+  float maxy = center.y + r - b.y;
+  if (maxx < 0.f || maxy < 0.f) return false;
+  if (minx >= b.width || miny >= b.height) return false;
+
+  const int last_x = (kShip[s].map_width - 1) >> kSpatialCellBits;
+  const int last_y = (kShip[s].map_height - 1) >> kSpatialCellBits;
+  span[0] = (int)(fmaxf(minx, 0.f) / kTileWidth) >> kSpatialCellBits;
+  span[1] = (int)(fmaxf(miny, 0.f) / kTileHeight) >> kSpatialCellBits;
+  span[2] = MIN((int)(maxx / kTileWidth) >> kSpatialCellBits, last_x);
+  span[3] = MIN((int)(maxy / kTileHeight) >> kSpatialCellBits, last_y);
+  return true;
+}
+
+// Gather candidate entity indices near 'center' into out[MAX_ENTITY].
+//
+// Every entity within 'radius' (xy plane) of center is a candidate.
+// Candidates may lie further away: callers apply the exact test.
+// Unless 'ship_index' is kSpatialEveryShip, only entities with that
+// ship_index are candidates: no other entity is read. 'other' is set when
+// an entity of another ship is left out.
+// Returns the count of candidates, sorted by entity index.
+uint64_t
+SpatialRangeShip(uint64_t ship_index, v3f center, float radius,
+                 uint32_t* out, bool* other)
+{
+  uint64_t count = 0;
+  if (!kSpatial.valid) {
+    for (int i = 0; i < kUsedEntity; ++i) {
+      if (!SpatialOnShip(i, ship_index)) {
+        *other = true;
+        continue;
+      }
+      out[count++] = i;
+    }
+    return count;
+  }
+
+  for (int s = 0; s < kUsedShip; ++s) {
+    const bool left_out = ship_index != kSpatialEveryShip && ship_index != s;
+    int span[4];
+    if (!SpatialCellSpan(s, center, radius, span)) continue;
+
+    const uint32_t* cell_start = kSpatial.cell_start[s];
+    for (int cy = span[1]; cy <= span[3]; ++cy) {
+      // A row of cells is contiguous in cell_entity
+      uint32_t begin = cell_start[cy * kSpatialCellDim + span[0]];
+      uint32_t end = cell_start[cy * kSpatialCellDim + span[2] + 1];
+      if (left_out) {
+        *other |= (begin != end);
+        continue;
+      }
+      for (uint32_t j = begin; j < end; ++j) {
+        out[count++] = kSpatial.cell_entity[j];
+      }
+    }
+  }
+
+  for (int i = 0; i < kSpatial.used_loose; ++i) {
+    const uint32_t idx = kSpatial.loose_entity[i];
+    if (!SpatialOnShip(idx, ship_index)) {
+      *other = true;
+      continue;
+    }
+    out[count++] = idx;
+  }
+
+  for (int i = kSpatial.indexed_count; i < kUsedEntity; ++i) {
+    if (!SpatialOnShip(i, ship_index)) {
+      *other = true;
+      continue;
+    }
+    out[count++] = i;
+  }
+
+  if (count <= kSpatialInsertionSort) {
+    // insertion sort: cells are individually sorted and counts are small
+    for (int i = 1; i < count; ++i) {
+      uint32_t v = out[i];
+      int j = i;
+      for (; j > 0 && out[j - 1] > v; --j) {
+        out[j] = out[j - 1];
+      }
+      out[j] = v;
+    }
+    return count;
+  }
+
+  // Large ranges: indices are unique, so a bitmap orders them
+  uint64_t bits[kSpatialBitmapWords];
+  memset(bits, 0, sizeof(bits));
+  for (int i = 0; i < count; ++i) {
+    bits[out[i] / 64] |= 1ull << (out[i] % 64);
+  }
+  count = 0;
+  for (int w = 0; w < kSpatialBitmapWords; ++w) {
+    uint64_t word = bits[w];
+    while (word) {
+      out[count++] = w * 64 + TZCNT(word);
+      word = BLSR(word);
+    }
+  }
+
+  return count;
+}
+
+uint64_t
+SpatialRange(v3f center, float radius, uint32_t* out)
+{
+  bool other = false;
+  if (!StageSpeculated()) {
+    return SpatialRangeShip(kSpatialEveryShip, center, radius, out, &other);
+  }
+
+  uint64_t count = SpatialRangeShip(kStageShip, center, radius, out, &other);
+  if (other) StageConflict();
+  return count;
+}
+
+// True when an entity off 'ship_index' that passes 'filter' may lie within
+// distance squared 'dsq' of center, FLT_MAX for any distance. Entities on a
+// ship tile are within the square of their cell, widened by the movement
+// since the rebuild. Filters read only members that stages do not write.
+bool
+SpatialOtherWithin(uint64_t ship_index, v3f center, float dsq,
+                   SpatialFilter filter, const void* arg)
+{
+  if (!kSpatial.valid) return true;
+  for (int i = 0; i < kSpatial.used_loose; ++i) {
+    if (!SpatialOnShip(kSpatial.loose_entity[i], ship_index)) return true;
+  }
+  for (int i = kSpatial.indexed_count; i < kUsedEntity; ++i) {
+    if (!SpatialOnShip(i, ship_index)) return true;
+  }
+
+  constexpr float kCellWidth = kTileWidth * (1 << kSpatialCellBits);
+  constexpr float kCellHeight = kTileHeight * (1 << kSpatialCellBits);
+  for (int s = 0; s < kUsedShip; ++s) {
+    if (s == ship_index) continue;
+    const uint32_t* cell_start = kSpatial.cell_start[s];
+    if (dsq == FLT_MAX) {
+      if (cell_start[0] != cell_start[kMaxSpatialCell]) return true;
+      continue;
+    }
+
+    // Rounding of the root only widens the span
+    int span[4];
+    if (!SpatialCellSpan(s, center, sqrtf(dsq) + 1.f, span)) continue;
+    Rectf b = ShipBounds(s);
+    for (int cy = span[1]; cy <= span[3]; ++cy) {
+      for (int cx = span[0]; cx <= span[2]; ++cx) {
+        const int c = cy * kSpatialCellDim + cx;
+        bool pass = false;
+        for (uint32_t j = cell_start[c]; j < cell_start[c + 1]; ++j) {
+          pass |= filter(kSpatial.cell_entity[j], arg);
+        }
+        if (!pass) continue;
+        const float x0 = b.x + cx * kCellWidth - kSpatialSlack;
+        const float y0 = b.y + cy * kCellHeight - kSpatialSlack;
+        const float x1 = x0 + kCellWidth + 2.f * kSpatialSlack;
+        const float y1 = y0 + kCellHeight + 2.f * kSpatialSlack;
+        float dx = fmaxf(fmaxf(x0 - center.x, 0.f), center.x - x1);
+        float dy = fmaxf(fmaxf(y0 - center.y, 0.f), center.y - y1);
+        if (dx * dx + dy * dy <= dsq) return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Gather up to 'k' entity indices nearest to 'center' that pass 'filter'.
+//
+// Distance is measured with v3f distance squared to the entity position.
+// Results are ordered by (distance, entity index): the first result is
+// identical to a FOR_EACH_ENTITY scan keeping the strictly nearest.
+// Candidates are restricted to 'ship_index' as in SpatialRangeShip().
+// Returns the count of results written to out[k], and their distances to
+// out_dsq[k].
+uint64_t
+SpatialNearestShip(uint64_t ship_index, v3f center, uint64_t k,
+                   SpatialFilter filter, const void* arg, uint32_t* out,
+                   float* out_dsq)
+{
+  uint32_t candidate[MAX_ENTITY];
+  if (!k) return 0;
+
+  float radius = kTileWidth * (1 << kSpatialCellBits);
+  while (true) {
+    const bool complete =
+        !kSpatial.valid || SpatialCoversFleet(center, radius, ship_index);
+    const float rsq = radius * radius;
+    bool other = false;
+    uint64_t count =
+        SpatialRangeShip(ship_index, center, radius, candidate, &other);
+    uint64_t found = 0;
+    for (int i = 0; i < count; ++i) {
+      const uint64_t idx = candidate[i];
+      if (kEntityTypeId[idx] == kEeInvalid) continue;
+      v3f delta = kEntityPosition[idx] - center;
+      float dsq = LengthSquared(delta);
+      if (!complete && dsq > rsq) continue;
+      if (!filter(idx, arg)) continue;
+
+      // candidates ascend by index: equal distances keep index order
+      int j = MIN(found, k);
+      if (j == k && !(dsq < out_dsq[k - 1])) continue;
+      for (; j > 0 && dsq < out_dsq[j - 1]; --j) {
+        if (j < k) {
+          out[j] = out[j - 1];
+          out_dsq[j] = out_dsq[j - 1];
+        }
+      }
+      out[j] = idx;
+      out_dsq[j] = dsq;
+      found += (found < k);
+    }
+
+    if (found == k || complete) return found;
+    radius *= 2.f;
+  }
+
+  return 0;
+}
+
+uint64_t
+SpatialNearest(v3f center, uint64_t k, SpatialFilter filter, const void* arg,
+               uint32_t* out)
+{
+  float out_dsq[MAX_ENTITY];
+  if (!StageSpeculated()) {
+    return SpatialNearestShip(kSpatialEveryShip, center, k, filter, arg, out,
+                              out_dsq);
+  }
+
+  // The nearest of the ship are the nearest of all when no entity of
+  // another ship is as near: ties order by index
+  uint64_t found =
+      SpatialNearestShip(kStageShip, center, k, filter, arg, out, out_dsq);
+  const float dsq = found == k ? out_dsq[k - 1] : FLT_MAX;
+  if (k && SpatialOtherWithin(kStageShip, center, dsq, filter, arg)) {
+    StageConflict();
+  }
+  return found;
+}
+
+}  // namespace simulation
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "platform/platform.cc"
+
+#include "entity.cc"
+#include "snapshot.cc"
+
+namespace simulation
+{
+// Per-ship stage of Decide(): DecideShip, UpdateModule and UpdateUnit.
+//
+// Ships run their stage one after another. On the job system the stages of
+// every ship are first speculated at once. A speculated stage reads and
+// writes its ship, its tiles, its entities and the minerals of one player:
+// any other access is a conflict. Two effects reach further without being
+// read by any stage: projectiles, and the release of dead units. They are
+// recorded in the ShipStage of the ship and applied in ship order.
+//
+// Without a conflict the speculated stages are what the serial order
+// computes. On a conflict the world is put back as it was before the stages
+// and the ships run one after another.
+struct StageProjectile {
+  v3f target;
+  v3f source;
+  float proximity;
+  uint32_t duration;
+  uint32_t target_id;
+  WeaponKind kind;
+};
+
+struct ShipStage {
+  StageProjectile projectile[kMaxProjectile];
+  uint64_t used_projectile;
+  // The speculated stage accessed what it does not own
+  bool conflict;
+};
+
+// Frames with speculated stages, and of those the ones run again in order
+struct ShipStageCount {
+  uint64_t speculated;
+  uint64_t replayed;
+};
+
+// Stages are not speculated with WORLD_THREAD: none of this is per world
+static ShipStage kShipStage[kMaxShip];
+// Ship + 1 of the stage that owns the minerals of each player, or 0
+static uint64_t kStagePlayer[kMaxPlayer];
+// World before the speculated stages
+static uint8_t kStageImage[MAX_SNAPSHOT_BYTES];
+static ShipStageCount kShipStageCount;
+// Ship of the stage the calling thread speculates, or kInvalidIndex
+static thread_local uint64_t kStageShip = kInvalidIndex;
+
+typedef void (*ShipStageFunc)(uint64_t ship_index);
+
+INLINE bool
+StageSpeculated()
+{
+  return kStageShip != kInvalidIndex;
+}
+
+INLINE void
+StageConflict()
+{
+  kShipStage[kStageShip].conflict = true;
+}
+
+// True when the calling thread may access the state of the ship
+INLINE bool
+StageOwns(uint64_t ship_index)
+{
+  if (!StageSpeculated() || ship_index == kStageShip) return true;
+  StageConflict();
+  return false;
+}
+
+// True when the calling thread may change state shared by every ship
+INLINE bool
+StageShared()
+{
+  if (!StageSpeculated()) return true;
+  StageConflict();
+  return false;
+}
+
+// True when the calling thread may access the minerals of the player: the
+// first speculated stage to do so owns them
+INLINE bool
+StagePlayer(uint64_t player_index)
+{
+  if (!StageSpeculated()) return true;
+  const uint64_t ship = kStageShip + 1;
+  uint64_t owner = 0;
+  if (__atomic_compare_exchange_n(&kStagePlayer[player_index], &owner, ship,
+                                  false, __ATOMIC_RELAXED,
+                                  __ATOMIC_RELAXED) ||
+      owner == ship) {
+    return true;
+  }
+  StageConflict();
+  return false;
+}
+
+// Projectile to create when the speculated stage of the ship is merged
+void
+StageDeferProjectile(v3f target, v3f source, float proximity, uint32_t duration,
+                WeaponKind kind, uint32_t target_id)
+{
+  ShipStage* stage = &kShipStage[kStageShip];
+  if (stage->used_projectile >= kMaxProjectile) {
+    StageConflict();
+    return;
+  }
+  stage->projectile[stage->used_projectile++] = {
+      target, source, proximity, duration, target_id, kind};
+}
+
+void
+ShipStageJob(void* arg, uint64_t begin, uint64_t end)
+{
+  ShipStageFunc func = (ShipStageFunc)arg;
+  for (uint64_t i = begin; i < end; ++i) {
+    kStageShip = i;
+    func(i);
+    kStageShip = kInvalidIndex;
+  }
+}
+
+// Speculates func for every ship, one job per ship. False when the stages
+// did not run, or ran into a conflict and were undone: the caller runs the
+// ships in order. Job workers hold worlds of their own with WORLD_THREAD.
+bool
+ShipStageSpeculate(ShipStageFunc func, uint64_t ship_count)
+{
+#ifdef WORLD_THREAD
+  return false;
+#else
+  if (ship_count < 2 || platform::job_worker_count() < 2) return false;
+
+  for (uint64_t i = 0; i < ship_count; ++i) {
+    kShipStage[i].used_projectile = 0;
+    kShipStage[i].conflict = false;
+  }
+  memset(kStagePlayer, 0, sizeof(kStagePlayer));
+  SnapshotSave(kStageImage);
+  kShipStageCount.speculated += 1;
+
+  platform::job_parallel_for(ShipStageJob, (void*)func, ship_count, 1);
+
+  bool conflict = false;
+  for (uint64_t i = 0; i < ship_count; ++i) {
+    conflict |= kShipStage[i].conflict;
+  }
+  if (!conflict) return true;
+
+  SnapshotLoad(kStageImage);
+  for (int i = 0; i < kUsedRegistry; ++i) {
+    if (kRegistry[i].written) *kRegistry[i].written = true;
+  }
+  kShipStageCount.replayed += 1;
+  return false;
+#endif
+}
+
+}  // namespace simulation
@@ -0,0 +1,161 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "simulation.cc"
+
+using namespace simulation;
+
+constexpr uint64_t kFrameCount = 300;
+constexpr uint64_t kRepeatCount = 20000;
+
+// Every plane mirrors the flags of the tiles
+void
+CheckPlanes()
+{
+  for (int i = 0; i < kUsedShip; ++i) {
+    const Ship* ship = &kShip[i];
+    for (int y = 0; y < kMapMaxHeight; ++y) {
+      for (int x = 0; x < kMapMaxWidth; ++x) {
+        bool in_map = x < ship->map_width && y < ship->map_height;
+        uint16_t flags = in_map ? ShipTile(i, x, y)->flags : 0;
+        for (int p = 0; p < kPlaneCount; ++p) {
+          assert(TilePlaneTest(i, (TilePlane)p, x, y) == ((flags >> p) & 1));
+        }
+      }
+    }
+  }
+}
+
+// The loops replaced by the planes
+void
+TileResetVisible()
+{
+  for (int i = 0; i < kUsedShip; ++i) {
+    Ship* ship = &kShip[i];
+    Tile* tile = ShipMap(i);
+    for (int j = 0; j < ship->map_height; ++j) {
+      for (int k = 0; k < ship->map_width; ++k) {
+        tile->visible = false;
+        ++tile;
+      }
+    }
+  }
+}
+
+bool
+TileAnyVisible(uint64_t ship_index)
+{
+  const Ship* ship = &kShip[ship_index];
+  const Tile* tile = ShipMap(ship_index);
+  for (int i = 0; i < ship->map_height * ship->map_width; ++i) {
+    if (tile[i].visible) return true;
+  }
+  return false;
+}
+
+uint64_t
+TileCountBlocked(uint64_t ship_index)
+{
+  const Ship* ship = &kShip[ship_index];
+  const Tile* tile = ShipMap(ship_index);
+  uint64_t count = 0;
+  for (int i = 0; i < ship->map_height * ship->map_width; ++i) {
+    count += tile[i].blocked;
+  }
+  return count;
+}
+
+// Nanoseconds per repeat
+uint64_t
+RepeatNs(uint64_t tsc)
+{
+  return tsc * 1000 / median_tsc_per_usec / kRepeatCount;
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  // Plane p is bit p of the flags
+  Tile t = kZeroTile;
+  t.explored = 1;
+  assert(t.flags == 1 << kPlaneExplored);
+  t.flags = 0;
+  t.blocked = 1;
+  assert(t.flags == 1 << kPlaneBlocked);
+
+  kPlayerCount = 2;
+  kScenario = kTwoShip;
+  RegistryClear();
+  SnapshotReset();
+  Initialize(1234);
+  CheckPlanes();
+  assert(TilePlaneAny(0, kPlaneBlocked));
+  assert(TilePlaneAny(0, kPlaneExterior));
+
+  // Units reveal the tiles around them
+  for (uint64_t frame = 0; frame < kFrameCount; ++frame) {
+    if (frame == kFrameCount / 2) Snapshot(frame);
+    simulation::Update();
+  }
+  CheckPlanes();
+  assert(TilePlaneAny(0, kPlaneVisible));
+  assert(TilePlaneCount(0, kPlaneBlocked) == TileCountBlocked(0));
+
+  TilemapResetVisible();
+  CheckPlanes();
+  assert(!TilePlaneAny(0, kPlaneVisible));
+  assert(TilePlaneAny(0, kPlaneExplored));
+
+  // Snapshots hold the planes with the tiles
+  assert(Restore(kFrameCount / 2));
+  CheckPlanes();
+  assert(TilePlaneAny(0, kPlaneVisible));
+
+  // Throughput, every ship
+  uint64_t check = 0;
+  uint64_t begin = rdtsc();
+  for (int i = 0; i < kRepeatCount; ++i) {
+    TileResetVisible();
+  }
+  const uint64_t tile_reset_tsc = rdtsc() - begin;
+
+  begin = rdtsc();
+  for (int i = 0; i < kRepeatCount; ++i) {
+    TilemapResetVisible();
+  }
+  const uint64_t plane_reset_tsc = rdtsc() - begin;
+
+  begin = rdtsc();
+  for (int i = 0; i < kRepeatCount; ++i) {
+    for (int j = 0; j < kUsedShip; ++j) {
+      check += TileAnyVisible(j) + TileCountBlocked(j);
+    }
+  }
+  const uint64_t tile_query_tsc = rdtsc() - begin;
+
+  begin = rdtsc();
+  for (int i = 0; i < kRepeatCount; ++i) {
+    for (int j = 0; j < kUsedShip; ++j) {
+      check += TilePlaneAny(j, kPlaneVisible) +
+               TilePlaneCount(j, kPlaneBlocked);
+    }
+  }
+  const uint64_t plane_query_tsc = rdtsc() - begin;
+  CheckPlanes();
+
+  printf(
+      "[ reset tiles %lu ns ] "
+      "[ reset planes %lu ns ] "
+      "[ query tiles %lu ns ] "
+      "[ query planes %lu ns ] "
+      "[ check %lu ] "
+      "\n",
+      RepeatNs(tile_reset_tsc), RepeatNs(plane_reset_tsc),
+      RepeatNs(tile_query_tsc), RepeatNs(plane_query_tsc), check);
+
+  puts("ok");
+  return 0;
+}
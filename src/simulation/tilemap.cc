@@ -56,16 +56,106 @@ operator!=(Tile lhs, Tile rhs)
   return !TileEqualPosition(lhs, rhs);
 }
 
+// Ship stages write tiles of their own ship concurrently
+INLINE void
+TileWritten()
+{
+  __atomic_store_n(&kGridWritten, true, __ATOMIC_RELAXED);
+}
+
+// Rows of the plane of the ship: bit x of row y is the flag of tile (x, y)
+INLINE uint64_t*
+TilePlaneRow(uint64_t ship_index, TilePlane plane)
+{
+  return kGrid[ship_index].plane[plane];
+}
+
+INLINE bool
+TilePlaneTest(uint64_t ship_index, TilePlane plane, uint64_t x, uint64_t y)
+{
+  return (kGrid[ship_index].plane[plane][y] >> x) & 1;
+}
+
+INLINE bool
+TileBlocked(Tile t)
+{
+  return TilePlaneTest(t.ship_index, kPlaneBlocked, t.cx, t.cy);
+}
+
+// Planes follow the flags of t that flipped
+INLINE void
+TilePlaneFlip(const Tile* t, uint16_t flipped)
+{
+  uint64_t(*plane)[kMapMaxHeight] = kGrid[t->ship_index].plane;
+  const uint64_t bit = 1ull << t->cx;
+  for (int i = 0; i < kPlaneCount; ++i) {
+    if (flipped & (1 << i)) plane[i][t->cy] ^= bit;
+  }
+}
+
 INLINE void
 TileClear(Tile* t, uint16_t clear)
 {
+  const uint16_t flipped = t->flags & clear;
+  if (!flipped) return;
   t->flags &= ~(clear);
+  TilePlaneFlip(t, flipped);
+  TileWritten();
 }
 
 INLINE void
 TileSet(Tile* t, uint16_t set)
 {
+  const uint16_t flipped = set & ~t->flags;
+  if (!flipped) return;
   t->flags |= set;
+  TilePlaneFlip(t, flipped);
+  TileWritten();
+}
+
+// Sets flags on the tiles of the ship in rows, bit x of row y for (x, y)
+void
+TilePlaneSet(uint64_t ship_index, const uint64_t* rows, uint16_t flags)
+{
+  const Ship* ship = &kShip[ship_index];
+  for (int i = 0; i < kPlaneCount; ++i) {
+    if (!(flags & (1 << i))) continue;
+    uint64_t* plane = TilePlaneRow(ship_index, (TilePlane)i);
+    Tile* tile = ShipMap(ship_index);
+    for (int y = 0; y < ship->map_height; ++y, tile += ship->map_width) {
+      uint64_t flipped = ANDN(plane[y], rows[y]);
+      if (!flipped) continue;
+      plane[y] |= flipped;
+      for (; flipped; flipped = BLSR(flipped)) {
+        tile[TZCNT(flipped)].flags |= 1 << i;
+      }
+      TileWritten();
+    }
+  }
+}
+
+// Any tile of the ship has the flag
+bool
+TilePlaneAny(uint64_t ship_index, TilePlane plane)
+{
+  const uint64_t* row = TilePlaneRow(ship_index, plane);
+  uint64_t any = 0;
+  for (int y = 0; y < kMapMaxHeight; ++y) {
+    any |= row[y];
+  }
+  return any != 0;
+}
+
+// Tiles of the ship with the flag
+uint64_t
+TilePlaneCount(uint64_t ship_index, TilePlane plane)
+{
+  const uint64_t* row = TilePlaneRow(ship_index, plane);
+  uint64_t count = 0;
+  for (int y = 0; y < kMapMaxHeight; ++y) {
+    count += POPCNT(row[y]);
+  }
+  return count;
 }
 
 // Integer math to measure the distance squred to the center of a tile
@@ -124,6 +214,9 @@ TilemapInitialize(uint64_t player_index)
   }
 
   Tile* tile = &kGrid[ship_index].tilemap[0][0];
+  uint64_t* blocked = TilePlaneRow(ship_index, kPlaneBlocked);
+  memset(kGrid[ship_index].plane, 0, sizeof(Grid::plane));
+  TileWritten();
   for (int y = 0; y < (1 << bitrange_xy); ++y) {
     for (int x = 0; x < (1 << bitrange_xy); ++x) {
       uint8_t tile_type = ship_design ? *ship_design : kTileOpen;
@@ -138,6 +231,7 @@ TilemapInitialize(uint64_t player_index)
       switch (tile_type) {
         case kTileBlock: {
           tile->blocked = 1;
+          blocked[y] |= 1ull << x;
         } break;
         case kTilePower:
         case kTileEngine:
@@ -146,11 +240,11 @@ TilemapInitialize(uint64_t player_index)
         case kTileTurret: {
           Module* mod = UseEntityModule();
           mod->mkind = (ModuleKind)(tile_type - kTileModule);
-          mod->bounds = ModuleBounds(mod->mkind);
-          mod->ship_index = ship_index;
-          mod->player_index = player_index;
-          mod->position =
-              v3f(0.f, 0.f, mod->bounds.z / 2.f) + FromShip(*tile).Center();
+          EntityBounds(mod) = ModuleBounds(mod->mkind);
+          EntityShipIndex(mod) = ship_index;
+          EntityPlayerIndex(mod) = player_index;
+          EntityPosition(mod) = v3f(0.f, 0.f, EntityBounds(mod).z / 2.f) +
+                                FromShip(*tile).Center();
         } break;
       };
 
@@ -160,7 +254,6 @@ TilemapInitialize(uint64_t player_index)
   }
 
   Ship* ship = &kShip[ship_index];
-  ship->map = &kGrid[ship_index].tilemap[0][0];
   ship->map_width = (1 << bitrange_xy);
   ship->map_height = (1 << bitrange_xy);
 }
@@ -182,14 +275,16 @@ TileAvoidWalls(Tile start)
 void
 TilemapResetVisible()
 {
+  TileWritten();
   for (int i = 0; i < kUsedShip; ++i) {
     Ship* ship = &kShip[i];
-    Tile* tile = ship->map;
-    for (int j = 0; j < ship->map_height; ++j) {
-      for (int k = 0; k < ship->map_width; ++k) {
-        tile->visible = false;
-        ++tile;
+    uint64_t* visible = TilePlaneRow(i, kPlaneVisible);
+    Tile* tile = ShipMap(i);
+    for (int j = 0; j < ship->map_height; ++j, tile += ship->map_width) {
+      for (uint64_t bits = visible[j]; bits; bits = BLSR(bits)) {
+        tile[TZCNT(bits)].visible = false;
       }
+      visible[j] = 0;
     }
   }
 }
@@ -198,8 +293,7 @@ void
 TilemapResetExterior()
 {
   for (int i = 0; i < kUsedShip; ++i) {
-    Ship* ship = &kShip[i];
-    Tile tile = *ship->map;
+    Tile tile = *ShipMap(i);
     tile.flags = 0;
     tile.exterior = 1;
     BfsTileEnable(tile, kMapMaxWidth);
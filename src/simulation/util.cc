@@ -2,8 +2,11 @@
 
 #include "math/vec.h"
 
+#include "astar.cc"
 #include "entity.cc"
+#include "random.cc"
 #include "search.cc"
+#include "spatial.cc"
 
 #include <cstdint>
 
@@ -14,7 +17,7 @@ constexpr float kDsqSelect = 25.f * 25.f;
 int
 AssignPlayerId()
 {
-  static int id = 0;
+  static WORLD_LOCAL int id = 0;
   return (id++ % kPlayerCount);
 }
 
@@ -28,23 +31,31 @@ v3fDsq(const v3f& dst, const v3f& src)
 Unit*
 GetUnit(v3f world)
 {
-  FOR_EACH_ENTITY(Unit, unit, {
-    if (v3fDsq(unit->position, world) < kDsqSelect) {
+  uint32_t candidate[MAX_ENTITY];
+  uint64_t count = SpatialRange(world, sqrtf(kDsqSelect), candidate);
+  for (int i = 0; i < count; ++i) {
+    Unit* unit = i2Unit(candidate[i]);
+    if (!unit) continue;
+    if (v3fDsq(EntityPosition(unit), world) < kDsqSelect) {
       return unit;
     }
-  });
+  }
   return nullptr;
 }
 
 Unit*
 GetUnitTarget(uint64_t local_player, v3f world)
 {
-  FOR_EACH_ENTITY(Unit, unit, {
-    if (FLAGGED(unit->control, local_player)) continue;
-    if (v3fDsq(unit->position, world) < kDsqSelect) {
+  uint32_t candidate[MAX_ENTITY];
+  uint64_t count = SpatialRange(world, sqrtf(kDsqSelect), candidate);
+  for (int i = 0; i < count; ++i) {
+    Unit* unit = i2Unit(candidate[i]);
+    if (!unit) continue;
+    if (FLAGGED(EntityControl(unit), local_player)) continue;
+    if (v3fDsq(EntityPosition(unit), world) < kDsqSelect) {
       return unit;
     }
-  });
+  }
 
   return nullptr;
 }
@@ -53,7 +64,7 @@ Unit*
 SelectUnit(const Rectf& rect, int idx)
 {
   Unit* unit = &kEntity[idx].unit;
-  if (PointInRect(unit->position.xy(), rect)) {
+  if (PointInRect(EntityPosition(unit).xy(), rect)) {
     return unit;
   }
   return nullptr;
@@ -62,11 +73,11 @@ SelectUnit(const Rectf& rect, int idx)
 Module*
 SelectModule(const Rectf& rect, int idx)
 {
-  if (kEntity[idx].type_id != kEeModule) return nullptr;
+  if (kEntityTypeId[idx] != kEeModule) return nullptr;
 
   Module* mod = &kEntity[idx].module;
   // TODO: Take into consideration module bounds and do a rect/rect intersect.
-  if (PointInRect(mod->position.xy(), rect)) {
+  if (PointInRect(EntityPosition(mod).xy(), rect)) {
     return mod;
   }
   return nullptr;
@@ -75,7 +86,7 @@ SelectModule(const Rectf& rect, int idx)
 bool
 InRange(Unit* source_unit, Unit* target_unit)
 {
-  float dsq = v3fDsq(source_unit->position, target_unit->position);
+  float dsq = v3fDsq(EntityPosition(source_unit), EntityPosition(target_unit));
   float rsq = source_unit->attack_radius * source_unit->attack_radius;
   return dsq < rsq;
 }
@@ -108,42 +119,72 @@ ShouldAttack(uint64_t unit, uint64_t target)
 Unit*
 FindUnitInRangeToAttack(Unit* unit)
 {
-  FOR_EACH_ENTITY(Unit, target, {
+  uint32_t candidate[MAX_ENTITY];
+  uint64_t count =
+      SpatialRange(EntityPosition(unit), unit->attack_radius, candidate);
+  for (int i = 0; i < count; ++i) {
+    Unit* target = i2Unit(candidate[i]);
+    if (!target) continue;
     if (unit == target) continue;
     if (!ShouldAttack(unit, target)) continue;
     if (InRange(unit, target)) return target;
-  });
+  }
   return nullptr;
 }
 
+bool
+SpatialFilterUnit(uint64_t entity_index, const void* arg)
+{
+  return i2Unit(entity_index) != nullptr;
+}
+
+bool
+SpatialFilterEnemy(uint64_t entity_index, const void* arg)
+{
+  Unit* unit = (Unit*)arg;
+  return ShouldAttack(unit, i2Unit(entity_index));
+}
+
 Unit*
 GetNearestEnemyUnit(Unit* unit)
 {
-  float d = FLT_MAX;
-  Unit* target = nullptr;
-  FOR_EACH_ENTITY(Unit, new_target, {
-    float nd = v3fDsq(unit->position, new_target->position);
-    if (nd < d && ShouldAttack(unit, new_target)) {
-      target = new_target;
-      d = nd;
+  uint32_t nearest;
+  if (!SpatialNearest(EntityPosition(unit), 1, SpatialFilterEnemy, unit,
+                      &nearest))
+    return nullptr;
+  return i2Unit(nearest);
+}
+
+// GetNearestEnemyUnit() when InRange(), else nullptr: both measure the same
+// distance squared, so the nearest enemy in range is the one
+Unit*
+GetNearestEnemyUnitInRange(Unit* unit)
+{
+  uint32_t candidate[MAX_ENTITY];
+  uint64_t count =
+      SpatialRange(EntityPosition(unit), unit->attack_radius, candidate);
+  Unit* nearest = nullptr;
+  float nearest_dsq = unit->attack_radius * unit->attack_radius;
+  for (int i = 0; i < count; ++i) {
+    Unit* target = i2Unit(candidate[i]);
+    if (!ShouldAttack(unit, target)) continue;
+    // candidates ascend by index: equal distances keep the first
+    float dsq = v3fDsq(EntityPosition(target), EntityPosition(unit));
+    if (dsq < nearest_dsq) {
+      nearest = target;
+      nearest_dsq = dsq;
     }
-  });
-  return target;
+  }
+  return nearest;
 }
 
 Unit*
 GetNearestUnit(const v3f& pos)
 {
-  float d = FLT_MAX;
-  Unit* target = nullptr;
-  FOR_EACH_ENTITY(Unit, new_target, {
-    float nd = v3fDsq(pos, new_target->position);
-    if (nd < d) {
-      target = new_target;
-      d = nd;
-    }
-  });
-  return target;
+  uint32_t nearest;
+  if (!SpatialNearest(pos, 1, SpatialFilterUnit, nullptr, &nearest))
+    return nullptr;
+  return i2Unit(nearest);
 }
 
 uint32_t
@@ -151,15 +192,15 @@ SpawnEnemy(Tile tile)
 {
   Unit* enemy = UseEntityUnit();
   enemy->warp_tile = tile;
-  enemy->scale = v3f(0.25f, 0.25f, 0.f);
-  enemy->ship_index = tile.ship_index;
-  enemy->player_index = kInvalidIndex;
+  EntityScale(enemy) = v3f(0.25f, 0.25f, 0.f);
+  EntityShipIndex(enemy) = tile.ship_index;
+  EntityPlayerIndex(enemy) = kInvalidIndex;
   enemy->alliance = kEnemy;
   enemy->kind = kAlien;
   enemy->attack_radius = 30.f;
   enemy->speed = 0.5f;
-  enemy->bounds = v3f(15.f, 15.f, 25.f);
-  BB_SET(enemy->bb, kUnitBehavior, kUnitBehaviorAttackWhenDiscovered);
+  EntityBounds(enemy) = v3f(15.f, 15.f, 25.f);
+  BB_SET(UnitBb(enemy), kUnitBehavior, kUnitBehaviorAttackWhenDiscovered);
   return enemy->id;
 }
 
@@ -168,14 +209,14 @@ SpawnAICrew(Tile tile, uint64_t player_index)
 {
   Unit* unit = UseEntityUnit();
   unit->warp_tile = tile;
-  unit->scale = v3f(0.25f, 0.25f, 0.f);
-  unit->ship_index = tile.ship_index;
-  unit->player_index = player_index;
+  EntityScale(unit) = v3f(0.25f, 0.25f, 0.f);
+  EntityShipIndex(unit) = tile.ship_index;
+  EntityPlayerIndex(unit) = player_index;
   unit->kind = kOperator;
   unit->spacesuit = 1;
   unit->notify = 1;
-  unit->bounds = v3f(17.f, 17.f, 25.f);
-  BB_SET(unit->bb, kUnitBehavior, kUnitBehaviorCrewMember);
+  EntityBounds(unit) = v3f(17.f, 17.f, 25.f);
+  BB_SET(UnitBb(unit), kUnitBehavior, kUnitBehaviorCrewMember);
 }
 
 void
@@ -183,21 +224,21 @@ SpawnCrew(Tile tile, uint64_t player_index)
 {
   Unit* unit = UseEntityUnit();
   unit->warp_tile = tile;
-  unit->scale = v3f(0.25f, 0.25f, 0.f);
-  unit->ship_index = tile.ship_index;
-  unit->player_index = player_index;
+  EntityScale(unit) = v3f(0.25f, 0.25f, 0.f);
+  EntityShipIndex(unit) = tile.ship_index;
+  EntityPlayerIndex(unit) = player_index;
   unit->kind = kOperator;
   unit->spacesuit = 1;
   unit->notify = 1;
-  unit->bounds = v3f(17.f, 17.f, 25.f);
+  EntityBounds(unit) = v3f(17.f, 17.f, 25.f);
 }
 
 bool
 CanPathTo(Unit* unit, Unit* target)
 {
   if (!unit || !target) return false;
-  if (unit->ship_index != target->ship_index) return false;
-  return PathTo(unit->tile, target->tile) != nullptr;
+  if (EntityShipIndex(unit) != EntityShipIndex(target)) return false;
+  return JpsPathTo(EntityTile(unit), EntityTile(target)) != nullptr;
 }
 
 }  // namespace simulation
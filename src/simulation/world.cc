@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include "common/common.cc"
+#include "platform/platform.cc"
+
+// A world is one instance of the game simulation.
+//
+// World state is declared WORLD_LOCAL: every registry, snapshot, scratch
+// buffer and random stream. By default the process holds a single world,
+// and ship stages run on job workers. Built with WORLD_THREAD, every thread
+// holds a world of its own: the declared names access the world of the
+// calling thread, and worlds run side by side on separate threads.
+//
+// State that refers to other state, the registry table and the snapshot
+// regions, is built by bind functions. Static initialization binds the
+// world of the main thread; WorldBind() binds the world of any other thread.
+
+typedef void (*WorldBindFunc)();
+typedef void (*WorldFunc)(void* arg);
+
+#define MAX_WORLD_BIND 256
+
+struct World {
+  ThreadInfo thread;
+  WorldFunc func;
+  void* arg;
+};
+
+// Process wide: the same for every world
+static WorldBindFunc kWorldBind[MAX_WORLD_BIND];
+static uint64_t kUsedWorldBind;
+static WORLD_LOCAL bool kWorldBound;
+
+class WorldRegister
+{
+ public:
+  // Used in global static initialization
+  WorldRegister(WorldBindFunc func)
+  {
+    assert(kUsedWorldBind < MAX_WORLD_BIND);
+    kWorldBind[kUsedWorldBind++] = func;
+    kWorldBound = true;
+    func();
+  }
+};
+
+// Binds the world of the calling thread, once
+void
+WorldBind()
+{
+  if (kWorldBound) return;
+  kWorldBound = true;
+  for (int i = 0; i < kUsedWorldBind; ++i) {
+    kWorldBind[i]();
+  }
+}
+
+#ifdef WORLD_THREAD
+uint64_t
+WorldMain(void* arg)
+{
+  World* w = (World*)arg;
+  WorldBind();
+  w->func(w->arg);
+  return 0;
+}
+
+// Runs func(arg) in a new world on a thread of its own
+bool
+WorldStart(World* w, WorldFunc func, void* arg)
+{
+  *w = World{};
+  w->func = func;
+  w->arg = arg;
+  w->thread = ThreadInfo{0, WorldMain, w};
+  return platform::thread_create(&w->thread);
+}
+
+void
+WorldJoin(World* w)
+{
+  platform::thread_join(&w->thread);
+}
+#endif
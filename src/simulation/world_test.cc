@@ -0,0 +1,111 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+// Every thread holds a world of its own
+#define WORLD_THREAD
+
+#include "scripted_input.cc"
+#include "simulation.cc"
+
+using namespace simulation;
+
+constexpr uint64_t kWorldCount = 64;
+constexpr uint64_t kFrameCount = 600;
+constexpr uint64_t kSnapshotPeriod = 100;
+
+struct WorldRun {
+  uint64_t seed;
+  ScenarioType scenario;
+  uint64_t hash;
+  uint64_t entity_count;
+};
+
+static WorldRun kSolo[kWorldCount];
+static WorldRun kParallel[kWorldCount];
+static World kWorld[kWorldCount];
+
+void
+Play(uint64_t frame, uint64_t end)
+{
+  for (; frame < end; ++frame) {
+    if (frame % kSnapshotPeriod == 0) Snapshot(frame);
+    ScriptedInput(&kScriptAttack, frame);
+    Hash();
+    simulation::Update();
+  }
+}
+
+// Runs a game in the world of the calling thread, then runs the last
+// snapshot period again from its snapshot
+void
+Run(void* arg)
+{
+  WorldRun* run = (WorldRun*)arg;
+  kPlayerCount = 2;
+  kScenario = run->scenario;
+  RegistryClear();
+  SnapshotReset();
+  Initialize(run->seed);
+  kSimulationHash = DJB2_CONST;
+
+  Play(0, kFrameCount);
+  run->hash = kSimulationHash;
+  run->entity_count = kUsedEntity;
+
+  const uint64_t from = (kFrameCount - 1) / kSnapshotPeriod * kSnapshotPeriod;
+  assert(Restore(from));
+  Play(from, kFrameCount);
+  assert(kSimulationHash == run->hash);
+}
+
+int
+main()
+{
+  __init_tsc_per_usec();
+
+  for (int i = 0; i < kWorldCount; ++i) {
+    kSolo[i].seed = 1000 + i;
+    kSolo[i].scenario = (ScenarioType)(i % kMaxScenario);
+    kParallel[i] = kSolo[i];
+  }
+
+  uint64_t begin = rdtsc();
+  for (int i = 0; i < kWorldCount; ++i) {
+    Run(&kSolo[i]);
+  }
+  const uint64_t solo_tsc = rdtsc() - begin;
+
+  begin = rdtsc();
+  for (int i = 0; i < kWorldCount; ++i) {
+    assert(WorldStart(&kWorld[i], Run, &kParallel[i]));
+  }
+  for (int i = 0; i < kWorldCount; ++i) {
+    WorldJoin(&kWorld[i]);
+  }
+  const uint64_t parallel_tsc = rdtsc() - begin;
+
+  for (int i = 0; i < kWorldCount; ++i) {
+    assert(kParallel[i].hash == kSolo[i].hash);
+    assert(kParallel[i].entity_count == kSolo[i].entity_count);
+  }
+  // Seeds reach the game
+  assert(kSolo[0].hash != kSolo[kMaxScenario].hash);
+  // The world of the main thread is untouched
+  assert(kSimulationHash == kSolo[kWorldCount - 1].hash);
+
+  const uint64_t solo_usec = solo_tsc / median_tsc_per_usec;
+  const uint64_t parallel_usec = MAX(parallel_tsc / median_tsc_per_usec, 1);
+  printf(
+      "[ worlds %lu ] "
+      "[ frames %lu ] "
+      "[ solo %lu usec ] "
+      "[ parallel %lu usec ] "
+      "[ speedup %.2fx ] "
+      "\n",
+      kWorldCount, kFrameCount, solo_usec, parallel_usec,
+      (double)solo_usec / parallel_usec);
+
+  puts("ok");
+  return 0;
+}
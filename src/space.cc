@@ -5,40 +5,14 @@
 
 #include "gfx/gfx.cc"
 #include "network/network.cc"
-#include "simulation/interaction.cc"
+#include "network/replay.cc"
+#include "simulation/frame.cc"
 #include "simulation/simulation.cc"
 
-struct State {
-  // Game and render updates per second
-  uint64_t framerate = 60;
-  // Calculated available microseconds per game_update
-  uint64_t frame_target_usec;
-  // Game clock state
-  TscClock_t game_clock;
-  // Time it took to run a frame.
-  uint64_t frame_time_usec = 0;
-  // (optional) limit the simulation frames (UINT64_MAX will loop infinitely)
-  uint64_t limit_frame = UINT64_MAX;
-  // (optional) yield unused cpu time to the system
-  bool sleep_on_loop = true;
-  // Number of times the game has been updated.
-  uint64_t game_updates = 0;
-  uint64_t logic_updates = 0;
-  // Most recent frame that was unable to advance due to input loss
-  uint64_t choke_frame = 0;
-  // Parameters window::Create will be called with.
-  window::CreateInfo window_create_info;
-};
-
-static State kGameState;
-static Stats kGameStats;
-
-// TODO (AN): Revisit cameras
-const Camera*
-GetCamera(uint64_t player_index)
-{
-  return &kPlayer[player_index].camera;
-}
+// Catch-up runs more than two logic frames per loop once this far behind
+constexpr uint64_t kCatchupMargin = 4;
+// Share of the frame catch-up updates may use
+constexpr uint64_t kCatchupBudgetPercent = 75;
 
 void
 GatherWindowInput(InputBuffer* input_buffer)
@@ -48,7 +22,8 @@ GatherWindowInput(InputBuffer* input_buffer)
   int i = 0;
   for (; i < MAX_TICK_EVENTS * 2; ++i) {
     if (event_count >= (MAX_TICK_EVENTS - 1)) break;
-    PlatformEvent pevent;
+    // Unused bytes are zero: turns encode them in no space (turn.cc)
+    PlatformEvent pevent = {};
     if (!window::PollEvent(&pevent)) break;
 
     uint64_t type = pevent.type;
@@ -74,6 +49,7 @@ GatherWindowInput(InputBuffer* input_buffer)
 
   // Always append an estimate of the the local mouse cursor
   const v2f cursor = window::GetCursorPosition();
+  input_buffer->input_event[event_count] = {};
   input_buffer->input_event[event_count].type = MOUSE_POSITION;
   input_buffer->input_event[event_count].position = cursor;
   event_count += 1;
@@ -108,11 +84,60 @@ SetProjection()
       math::Perspective(67.f, size.x / size.y, .1f, 2000.f);
 }
 
+// Logic frames to run in lockstep this loop: one on schedule, two while past
+// the queue goal. Further behind, as many as fit in the frame budget at the
+// measured update cost, draining half of the excess so the rate falls off
+// approaching the goal.
+uint64_t
+CatchupAdvance(uint64_t frame_queue, bool recent_starvation)
+{
+  const uint64_t goal = NetworkQueueGoal();
+  const uint64_t advance =
+      (frame_queue > 0) + (!recent_starvation * (frame_queue > goal));
+  kGameState.behind_frames = frame_queue > goal ? frame_queue - goal : 0;
+  if (kGameState.behind_frames <= kCatchupMargin) return advance;
+
+  const uint64_t budget_usec =
+      kGameState.frame_target_usec * kCatchupBudgetPercent / 100;
+  const uint64_t elapsed_usec = clock_delta_usec(&kGameState.game_clock);
+  if (elapsed_usec >= budget_usec) return advance;
+
+  const uint64_t update_tsc = MAX(kGameState.update_tsc, 1);
+  const uint64_t fit =
+      (budget_usec - elapsed_usec) * median_tsc_per_usec / update_tsc;
+  const uint64_t drain = kGameState.behind_frames / 2 + 1;
+  const uint64_t catchup = MIN(fit, drain);
+  return MAX(advance, catchup);
+}
+
+// Sends the root of the latest checkpoint that no turn can change
+void
+PublishDigest(uint64_t confirmed_frame)
+{
+  const uint64_t frame = confirmed_frame / DIGEST_INTERVAL * DIGEST_INTERVAL;
+  const simulation::DesyncCheckpoint* c = simulation::DesyncFind(frame);
+  if (!c) return;
+  kNetworkState.digest_frame = frame;
+  kNetworkState.digest_root = c->root;
+}
+
+// Records the turns of frames that no turn can change
+void
+RecordReplay(uint64_t confirmed_frame)
+{
+  if (!kGameState.replay_file) return;
+  while (kReplayRecorder.frame < confirmed_frame) {
+    const uint64_t slot = NETQUEUE_SLOT(kReplayRecorder.frame);
+    ReplayRecord(kNetworkState.player_input[slot], kNetworkState.player_count,
+                 kGameState.frame_hash[slot]);
+  }
+}
+
 int
 main(int argc, char** argv)
 {
   while (1) {
-    int opt = platform_getopt(argc, argv, "i:p:n:l:s:w:h:x:y:f");
+    int opt = platform_getopt(argc, argv, "i:p:n:m:l:s:w:h:x:y:o:ftr");
     if (opt == -1) break;
 
     switch (opt) {
@@ -125,6 +150,10 @@ main(int argc, char** argv)
       case 'n':
         kNetworkState.num_players = strtol(platform_optarg, NULL, 10);
         break;
+      case 'm':
+        kNetworkState.match_key =
+            MAX(strtoull(platform_optarg, NULL, 10), ANY_MATCH);
+        break;
       case 'l':
         kGameState.limit_frame = strtol(platform_optarg, NULL, 10);
         break;
@@ -148,9 +177,18 @@ main(int argc, char** argv)
         kGameState.window_create_info.window_pos_y =
             strtol(platform_optarg, NULL, 10);
         break;
+      case 'o':
+        kGameState.replay_file = platform_optarg;
+        break;
       case 'f':
         kGameState.window_create_info.fullscreen = true;
         break;
+      case 't':
+        kGameState.parallel_ship = true;
+        break;
+      case 'r':
+        kGameState.rollback = true;
+        break;
     }
   }
   printf("Client will connect to game at %s:%s\n", kNetworkState.server_ip,
@@ -174,6 +212,20 @@ main(int argc, char** argv)
   if (!simulation::Initialize(kNetworkState.game_id)) {
     return 1;
   }
+  if (kGameState.rollback) simulation::Snapshot(0);
+  if (kGameState.replay_file) {
+    ReplayHeader header;
+    header.seed = kNetworkState.game_id;
+    header.scenario = simulation::kScenario;
+    header.player_count = kNetworkState.player_count;
+    header.player_index = kNetworkState.player_index;
+    memcpy(header.player_info, kNetworkState.player_info,
+           sizeof(header.player_info));
+    if (!ReplayOpen(kGameState.replay_file, &header)) {
+      printf("Failed to open replay %s\n", kGameState.replay_file);
+      return 1;
+    }
+  }
   // Init view for local player's camera
   camera::SetView(GetCamera(kNetworkState.player_index),
                   &rgg::GetObserver()->view);
@@ -181,6 +233,11 @@ main(int argc, char** argv)
   // Projection init
   SetProjection();
 
+  // Workers inherit the affinity of the game thread: start them first
+  if (kGameState.parallel_ship) {
+    platform::job_start(platform::thread_affinity_count());
+  }
+
   // main thread affinity set to core 0
   if (platform::thread_affinity_count() > 1) {
     platform::thread_affinity_usecore(0);
@@ -197,9 +254,11 @@ main(int argc, char** argv)
         "[ ptr %p ] "
         "[ memb_size %lu ] "
         "[ memb_max %lu ] "
+        "[ slot_size %lu ] "
         "\n",
-        i, kRegistry[i].ptr, kRegistry[i].memb_size, kRegistry[i].memb_max);
-    bytes += kRegistry[i].memb_max * kRegistry[i].memb_size;
+        i, kRegistry[i].ptr, kRegistry[i].memb_size, kRegistry[i].memb_max,
+        RegistrySlotSize(&kRegistry[i]));
+    bytes += kRegistry[i].memb_max * RegistrySlotSize(&kRegistry[i]);
     max_ptr = MAX((uint64_t)kRegistry[i].ptr, max_ptr);
     min_ptr = MIN((uint64_t)kRegistry[i].ptr, min_ptr);
   }
@@ -239,22 +298,40 @@ main(int argc, char** argv)
 
     GatherInput();
     NetworkEgress();
-    NetworkIngress(kGameState.logic_updates);
+    NetworkIngress(kRollbackState.confirmed_frame);
     if (kNetworkExit) break;
 
-    const int frame_queue =
-        NetworkContiguousSlotReady(kGameState.logic_updates);
+    // Answer the server until it has localized the desync
+    if (kNetworkState.digest_request_frame) {
+      static DigestTree tree;
+      if (simulation::DesyncFill(kNetworkState.digest_request_frame,
+                                 kNetworkState.digest_request_registry,
+                                 &tree)) {
+        NetworkSendDigest(&tree);
+      }
+    }
+
+    const uint64_t received_frame = kRollbackState.confirmed_frame;
+    const int frame_queue = NetworkContiguousSlotReady(received_frame);
     const bool recent_starvation =
         (frame - kGameState.choke_frame) < (kGameState.framerate * 5);
-    int advance = (frame_queue > 0) +
-                  (!recent_starvation * (frame_queue > NetworkQueueGoal()));
-    const bool is_starvation = (frame_queue == 0);
+    int advance = CatchupAdvance(frame_queue, recent_starvation);
+    bool is_starvation = (frame_queue == 0);
+    if (kGameState.rollback) {
+      RollbackConfirm();
+      advance = MIN(kNetworkState.outgoing_sequence - kGameState.logic_updates,
+                    2);
+      const uint64_t ahead =
+          kGameState.logic_updates - kRollbackState.confirmed_frame;
+      is_starvation = ahead >= MAX_ROLLBACK;
+    }
     kGameState.choke_frame =
         MAX(recent_starvation * kGameState.choke_frame, is_starvation * frame);
+    const uint64_t loop_logic_frame = kGameState.logic_updates;
     for (; advance > 0; --advance) {
-      uint64_t slot = NETQUEUE_SLOT(kGameState.logic_updates);
+      const uint64_t logic_frame = kGameState.logic_updates;
+      uint64_t slot = NETQUEUE_SLOT(logic_frame);
       if (ALAN) {
-        assert(SlotReady(slot));
         printf(
             "Simulation "
             "[ frame %lu ] "
@@ -267,53 +344,36 @@ main(int argc, char** argv)
             "[ queue_goal %lu ] "
             "[ ready_count %d ] "
             "\n",
-            kGameState.logic_updates, slot, advance, kGameState.game_clock.jerk,
+            logic_frame, slot, advance, kGameState.game_clock.jerk,
             kNetworkState.server_jerk, kNetworkState.egress_min,
             kNetworkState.egress_max, NetworkQueueGoal(),
-            NetworkContiguousSlotReady(kGameState.logic_updates));
-      }
-
-      simulation::Hash();
-      simulation::CacheSyncHashes(slot == 0, kGameState.logic_updates);
-
-      // Game Mutation: Apply player commands for turn N
-      InputBuffer* game_turn = GetSlot(slot);
-      for (int i = 0; i < MAX_PLAYER; ++i) {
-        imui::ResetTag(i);
-        InputBuffer* player_turn = &game_turn[i];
-        simulation::ProcessSimulation(i, player_turn->used_input_event,
-                                      player_turn->input_event);
+            NetworkContiguousSlotReady(received_frame));
       }
 
-      // Game Mutation: continue simulation
-      simulation::Update();
-#ifndef HEADLESS
-      for (int i = 0; i < kNetworkState.num_players; ++i) {
-        // Misc debug/feedback
-        const v2f dims =
-            v2f(kPlayer[i].camera.viewport.x, kPlayer[i].camera.viewport.y);
-        Player* player = &kPlayer[i];
-        simulation::LogPanel(dims, i);
-        simulation::AdminPanel(dims, i, player);
-        simulation::TilePanel(dims, i, player);
-        simulation::GameUI(dims, i, i, player);
+      // Lockstep: every frame runs on the received turns, the last one
+      // presented
+      if (!kGameState.rollback) {
+        SimulateTurn(GetSlot(slot), advance == 1);
+        kRollbackState.confirmed_frame = kGameState.logic_updates;
+        continue;
       }
-#endif
 
-      // SetView for the local player's camera
-      camera::SetView(GetCamera(kNetworkState.player_index),
-                      &rgg::GetObserver()->view);
-
-      // Give the user an update tick. The engine runs with
-      // a fixed delta so no need to provide a delta time.
-      ++kGameState.logic_updates;
+      // Speculate within the snapshot ring, on local input that exists
+      if (logic_frame >= kNetworkState.outgoing_sequence) break;
+      if (logic_frame - kRollbackState.confirmed_frame >= MAX_ROLLBACK) break;
+      SimulateTurn(NetworkPredict(logic_frame), true);
     }
+    kGameState.catchup_rate = kGameState.logic_updates - loop_logic_frame;
+    PublishDigest(kRollbackState.confirmed_frame);
+    RecordReplay(kRollbackState.confirmed_frame);
 
 #ifndef HEADLESS
     simulation::ReadOnlyPanel(window::GetWindowSize(), imui::kEveryoneTag,
                               kGameStats, kGameState.frame_target_usec,
                               kGameState.logic_updates,
-                              kGameState.game_clock.jerk, frame_queue);
+                              kGameState.game_clock.jerk, frame_queue,
+                              kGameState.behind_frames,
+                              kGameState.catchup_rate);
     simulation::ReadOnlyUnits(window::GetWindowSize(), imui::kEveryoneTag);
 
     gfx::Render(kNetworkState.player_index);
@@ -371,5 +431,8 @@ main(int argc, char** argv)
       "\n",
       frame, kNetworkExit);
 
+  ReplayClose();
+  platform::job_stop();
+
   return 0;
 }
@@ -0,0 +1,249 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "math/math.cc"
+
+#include "gfx/gfx.cc"
+#include "network/network.cc"
+#include "network/replay.cc"
+#include "simulation/interaction.cc"
+#include "simulation/simulation.cc"
+
+// Runs a replay file as fast as possible, without a window or network, and
+// checks every simulation hash checkpoint in the file.
+//
+// Seeking restores the nearest snapshot held at or before the frame, or
+// starts over, then runs forward. Snapshots are taken every
+// REPLAY_SNAPSHOT frames and the newest MAX_SNAPSHOT are held.
+
+// Frames between snapshots
+#define REPLAY_SNAPSHOT 600
+
+struct ReplayerState {
+  // (optional) stop after this many frames
+  uint64_t limit_frame = UINT64_MAX;
+  // (optional) seek back to this frame at the end, then run again
+  uint64_t seek_frame = UINT64_MAX;
+  // Next frame to run
+  uint64_t frame;
+  // Most recent snapshot taken
+  uint64_t snapshot_frame;
+  uint64_t checkpoint_count;
+  // First frame that did not match its checkpoint
+  uint64_t mismatch_frame = UINT64_MAX;
+  uint64_t phase_tsc[simulation::kPhaseCount];
+};
+
+static ReplayerState kReplayerState;
+static Replay kReplay;
+
+constexpr const char* kPhaseNames[simulation::kPhaseCount] = {
+    "TilemapUpdate",
+    "Decide",
+    "ProjectileSimulation",
+    "RegistryCompact",
+};
+
+// Game state of frame 0, as space.cc initializes it
+void
+Start()
+{
+  using namespace simulation;
+  const ReplayHeader* header = kReplay.header;
+  kNetworkState.game_id = header->seed;
+  kNetworkState.player_count = header->player_count;
+  kNetworkState.player_index = header->player_index;
+  memcpy(kNetworkState.player_info, header->player_info,
+         sizeof(kNetworkState.player_info));
+  kPlayerCount = header->player_count;
+  kPlayerIndex = header->player_index;
+  kScenario = (ScenarioType)header->scenario;
+
+  RegistryClear();
+  SnapshotReset();
+  Initialize(header->seed);
+  kSimulationHash = DJB2_CONST;
+  kReplayerState.frame = 0;
+  kReplayerState.snapshot_frame = UINT64_MAX;
+}
+
+// Runs one frame on its recorded turns, as SimulateTurn() in space.cc
+void
+Step(const ReplayFrame* f)
+{
+  using namespace simulation;
+  ReplayerState* s = &kReplayerState;
+  assert(f->frame == (uint32_t)s->frame);
+  if (s->frame % REPLAY_SNAPSHOT == 0 && s->frame != s->snapshot_frame) {
+    Snapshot(s->frame);
+    s->snapshot_frame = s->frame;
+  }
+
+  Hash();
+  if (s->frame % REPLAY_CHECKPOINT == 0) {
+    s->checkpoint_count += 1;
+    if (f->hash != kSimulationHash) {
+      s->mismatch_frame = MIN(s->mismatch_frame, s->frame);
+    }
+  }
+
+  for (int i = 0; i < MAX_PLAYER; ++i) {
+    imui::ResetTag(i);
+    ProcessSimulation(i, f->event_count[i], ReplayEvents(f, i));
+  }
+
+  simulation::Update();
+  for (int i = 0; i < kPhaseCount; ++i) {
+    s->phase_tsc[i] += kPhaseTsc[i];
+  }
+
+#ifndef HEADLESS
+  // Panels take player commands too
+  for (int i = 0; i < kPlayerCount; ++i) {
+    const v2f dims =
+        v2f(kPlayer[i].camera.viewport.x, kPlayer[i].camera.viewport.y);
+    Player* player = &kPlayer[i];
+    LogPanel(dims, i);
+    AdminPanel(dims, i, player);
+    TilePanel(dims, i, player);
+    GameUI(dims, i, i, player);
+  }
+#endif
+
+  s->frame += 1;
+}
+
+// Runs frames up to end
+void
+Play(uint64_t end)
+{
+  const ReplayFrame* f = ReplayFind(&kReplay, kReplayerState.frame);
+  for (; f && kReplayerState.frame < end; f = ReplayNext(&kReplay, f)) {
+    Step(f);
+  }
+}
+
+// Moves the game to the start of frame, returns the frame it ran from
+uint64_t
+Seek(uint64_t frame)
+{
+  ReplayerState* s = &kReplayerState;
+  if (frame < s->frame) {
+    uint64_t from = frame / REPLAY_SNAPSHOT * REPLAY_SNAPSHOT;
+    while (from && SnapshotFind(from) == kInvalidIndex) {
+      from -= REPLAY_SNAPSHOT;
+    }
+    if (simulation::Restore(from)) {
+      s->frame = from;
+      s->snapshot_frame = from;
+    } else {
+      Start();
+    }
+  }
+
+  const uint64_t from = s->frame;
+  Play(frame);
+  return from;
+}
+
+void
+Report(uint64_t frame_count, uint64_t tsc)
+{
+  const uint64_t usec = MAX(tsc / median_tsc_per_usec, 1);
+  printf(
+      "Play "
+      "[ frames %lu ] "
+      "[ usec %lu ] "
+      "[ frames/sec %lu ] "
+      "[ realtime x%lu ] "
+      "\n",
+      frame_count, usec, frame_count * 1000 * 1000 / usec,
+      frame_count * 1000 * 1000 / usec / 60);
+}
+
+int
+main(int argc, char** argv)
+{
+  ReplayerState* s = &kReplayerState;
+  while (1) {
+    int opt = platform_getopt(argc, argv, "l:k:");
+    if (opt == -1) break;
+
+    switch (opt) {
+      case 'l':
+        s->limit_frame = strtol(platform_optarg, NULL, 10);
+        break;
+      case 'k':
+        s->seek_frame = strtol(platform_optarg, NULL, 10);
+        break;
+      default:
+        puts("Usage: space_replay -l <frames> -k <seek_frame> <replay_file>");
+        return 1;
+    }
+  }
+  if (platform_optind == argc) {
+    puts("Usage: space_replay -l <frames> -k <seek_frame> <replay_file>");
+    return 1;
+  }
+
+  const char* path = argv[platform_optind];
+  if (!ReplayLoad(path, &kReplay)) {
+    printf("Failed to load %s\n", path);
+    return 1;
+  }
+  const ReplayHeader* header = kReplay.header;
+  printf(
+      "Replay %s "
+      "[ bytes %lu ] "
+      "[ frames %lu ] "
+      "[ seed %lu ] "
+      "[ scenario %lu ] "
+      "[ players %lu ] "
+      "\n",
+      path, kReplay.bytes, kReplay.frame_count, header->seed,
+      header->scenario, header->player_count);
+
+  if (platform::thread_affinity_count() > 1) {
+    platform::thread_affinity_usecore(0);
+  }
+  __init_tsc_per_usec();
+
+  const uint64_t end = MIN(s->limit_frame, kReplay.frame_count);
+  Start();
+  uint64_t begin = rdtsc();
+  Play(end);
+  Report(s->frame, rdtsc() - begin);
+  for (int i = 0; i < simulation::kPhaseCount; ++i) {
+    printf("  %-20s [ mean %8lu tsc ]\n", kPhaseNames[i],
+           s->phase_tsc[i] / MAX(s->frame, 1));
+  }
+
+  if (s->seek_frame < end) {
+    begin = rdtsc();
+    const uint64_t from = Seek(s->seek_frame);
+    printf(
+        "Seek "
+        "[ frame %lu ] "
+        "[ from %lu ] "
+        "[ usec %lu ] "
+        "\n",
+        s->seek_frame, from, (rdtsc() - begin) / median_tsc_per_usec);
+    Play(end);
+  }
+
+  printf(
+      "Verified "
+      "[ checkpoints %lu ] "
+      "[ hash 0x%016lx ] "
+      "\n",
+      s->checkpoint_count, simulation::kSimulationHash);
+  ReplayUnload(&kReplay);
+
+  if (s->mismatch_frame != UINT64_MAX) {
+    printf("Replay diverged [ frame %lu ]\n", s->mismatch_frame);
+    return 2;
+  }
+
+  return 0;
+}